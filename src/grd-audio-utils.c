@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "grd-audio-utils.h"
+
+/*
+ * The kernels in this file are written, so that the compiler can vectorize
+ * them: The loops have no data dependent branches and only use integer
+ * arithmetic, which fits into 32 bits.
+ */
+
+#define GAIN_FRACTION_BITS 14
+#define GAIN_ONE (1 << GAIN_FRACTION_BITS)
+
+#define SILENCE_BLOCK_SIZE 256
+
+#define G711_QUANT_MASK 0xF
+#define G711_SEG_MASK 0x70
+#define G711_SEG_SHIFT 4
+
+static int32_t
+volume_to_gain (float volume)
+{
+  volume = CLAMP (volume, 0.0f, GRD_AUDIO_MAX_VOLUME);
+
+  return (int32_t) (volume * GAIN_ONE + 0.5f);
+}
+
+static inline int16_t
+scale_sample (int16_t sample,
+              int32_t gain)
+{
+  /*
+   * With a gain of at most 4 << GAIN_FRACTION_BITS, the product (including
+   * the rounding term) always fits into 32 bits
+   */
+  int32_t value = (sample * gain + (GAIN_ONE >> 1)) >> GAIN_FRACTION_BITS;
+
+  return CLAMP (value, INT16_MIN, INT16_MAX);
+}
+
+void
+grd_audio_apply_volume_s16 (int16_t     *data,
+                            uint32_t     n_frames,
+                            uint32_t     n_channels,
+                            const float *volumes)
+{
+  uint32_t i, j;
+
+  g_assert (n_channels > 0);
+
+  if (n_channels == 2)
+    {
+      int32_t gain_left = volume_to_gain (volumes[0]);
+      int32_t gain_right = volume_to_gain (volumes[1]);
+
+      if (gain_left == GAIN_ONE && gain_right == GAIN_ONE)
+        return;
+
+      for (i = 0; i < n_frames; ++i)
+        {
+          data[2 * i] = scale_sample (data[2 * i], gain_left);
+          data[2 * i + 1] = scale_sample (data[2 * i + 1], gain_right);
+        }
+      return;
+    }
+
+  for (j = 0; j < n_channels; ++j)
+    {
+      int32_t gain = volume_to_gain (volumes[j]);
+
+      if (gain == GAIN_ONE)
+        continue;
+
+      for (i = 0; i < n_frames; ++i)
+        data[i * n_channels + j] = scale_sample (data[i * n_channels + j], gain);
+    }
+}
+
+gboolean
+grd_audio_is_silent_s16 (const int16_t *data,
+                         uint32_t       n_samples)
+{
+  uint32_t i = 0;
+
+  /*
+   * OR-reduce the samples block wise, which vectorizes well, while still
+   * returning early for non-silent data
+   */
+  while (i < n_samples)
+    {
+      uint32_t block_end = MIN (i + SILENCE_BLOCK_SIZE, n_samples);
+      uint16_t accumulator = 0;
+
+      for (; i < block_end; ++i)
+        accumulator |= (uint16_t) data[i];
+
+      if (accumulator != 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static int16_t
+alaw_to_s16 (uint8_t alaw_value)
+{
+  int16_t segment;
+  int16_t temp;
+
+  alaw_value ^= 0x55;
+
+  temp = (alaw_value & G711_QUANT_MASK) << 4;
+  temp += 8;
+
+  segment = (alaw_value & G711_SEG_MASK) >> G711_SEG_SHIFT;
+
+  if (segment > 0)
+    temp += 0x100;
+  if (segment > 1)
+    temp <<= segment - 1;
+
+  return alaw_value > 127 ? temp : -temp;
+}
+
+static const int16_t *
+get_alaw_table (void)
+{
+  static int16_t alaw_table[256];
+  static gsize table_initialized = 0;
+
+  if (g_once_init_enter (&table_initialized))
+    {
+      uint32_t i;
+
+      for (i = 0; i < G_N_ELEMENTS (alaw_table); ++i)
+        alaw_table[i] = alaw_to_s16 (i);
+
+      g_once_init_leave (&table_initialized, 1);
+    }
+
+  return alaw_table;
+}
+
+void
+grd_audio_alaw_to_s16 (const uint8_t *src,
+                       int16_t       *dst,
+                       uint32_t       n_samples)
+{
+  const int16_t *alaw_table = get_alaw_table ();
+  uint32_t i;
+
+  for (i = 0; i < n_samples; ++i)
+    dst[i] = alaw_table[src[i]];
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+/*
+ * Volumes are applied with a fixed point gain and are therefore clamped to
+ * this maximum
+ */
+#define GRD_AUDIO_MAX_VOLUME 4.0f
+
+void grd_audio_apply_volume_s16 (int16_t     *data,
+                                 uint32_t     n_frames,
+                                 uint32_t     n_channels,
+                                 const float *volumes);
+
+gboolean grd_audio_is_silent_s16 (const int16_t *data,
+                                  uint32_t       n_samples);
+
+void grd_audio_alaw_to_s16 (const uint8_t *src,
+                            int16_t       *dst,
+                            uint32_t       n_samples);
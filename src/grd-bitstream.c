@@ -43,6 +43,17 @@ grd_bitstream_get_data_size (GrdBitstream *bitstream)
   return bitstream->data_size;
 }
 
+void
+grd_bitstream_set_data (GrdBitstream *bitstream,
+                        uint8_t      *data,
+                        uint32_t      data_size)
+{
+  g_assert (!bitstream->avc_frame_info);
+
+  bitstream->data = data;
+  bitstream->data_size = data_size;
+}
+
 GrdAVCFrameInfo *
 grd_bitstream_get_avc_frame_info (GrdBitstream *bitstream)
 {
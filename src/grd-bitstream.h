@@ -32,6 +32,10 @@ uint8_t *grd_bitstream_get_data (GrdBitstream *bitstream);
 
 uint32_t grd_bitstream_get_data_size (GrdBitstream *bitstream);
 
+void grd_bitstream_set_data (GrdBitstream *bitstream,
+                             uint8_t      *data,
+                             uint32_t      data_size);
+
 GrdAVCFrameInfo *grd_bitstream_get_avc_frame_info (GrdBitstream *bitstream);
 
 void grd_bitstream_set_avc_frame_info (GrdBitstream    *bitstream,
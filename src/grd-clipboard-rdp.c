@@ -25,6 +25,7 @@
 #include <winpr/clipboard.h>
 
 #include "grd-rdp-fuse-clipboard.h"
+#include "grd-rdp-memory-budget.h"
 #include "grd-session-rdp.h"
 
 #define CLIPRDR_FILEDESCRIPTOR_SIZE (4 + 32 + 4 + 16 + 8 + 4 + 4 + 520)
@@ -53,12 +54,24 @@ typedef struct _ServerFormatDataRequestContext
 {
   GrdClipboardRdp *clipboard_rdp;
   GrdMimeType mime_type;
+  uint32_t requested_format_id;
   uint32_t src_format_id;
   uint32_t dst_format_id;
   gboolean needs_null_terminator;
   gboolean needs_conversion;
 } ServerFormatDataRequestContext;
 
+typedef struct _ServerContentConversionContext
+{
+  ServerFormatDataRequestContext *request_context;
+  uint64_t serial;
+
+  char *src_format_name;
+  char *dst_format_name;
+  uint8_t *src_data;
+  uint32_t src_size;
+} ServerContentConversionContext;
+
 typedef struct _ClientFormatDataRequestContext
 {
   GrdMimeTypeTable mime_type_table;
@@ -125,6 +138,11 @@ struct _GrdClipboardRdp
 
   GrdMimeType which_unicode_format;
   ServerFormatDataRequestContext *format_data_request_context;
+  GCancellable *conversion_cancellable;
+  GHashTable *server_format_data_cache;
+  uint64_t server_format_data_cache_size;
+
+  GrdRdpMemoryBudget *memory_budget;
 
   GHashTable *pending_client_requests;
   GQueue *ordered_client_requests;
@@ -212,6 +230,15 @@ update_allowed_server_formats (GrdClipboardRdp *clipboard_rdp,
   g_clear_pointer (&clipboard_rdp->pending_server_formats, g_list_free);
 }
 
+static void
+format_data_free (gpointer data)
+{
+  FormatData *format_data = data;
+
+  g_free (format_data->data);
+  g_free (format_data);
+}
+
 static void
 remove_clipboard_format_data_for_mime_type (GrdClipboardRdp *clipboard_rdp,
                                             GrdMimeType      mime_type)
@@ -260,6 +287,17 @@ remove_duplicated_clipboard_mime_types (GrdClipboardRdp  *clipboard_rdp,
     }
 }
 
+static void
+clear_server_format_data_cache (GrdClipboardRdp *clipboard_rdp)
+{
+  g_hash_table_remove_all (clipboard_rdp->server_format_data_cache);
+
+  grd_rdp_memory_budget_account (clipboard_rdp->memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_CLIPBOARD,
+                                 -(int64_t) clipboard_rdp->server_format_data_cache_size);
+  clipboard_rdp->server_format_data_cache_size = 0;
+}
+
 static void
 update_clipboard_serial (GrdClipboardRdp *clipboard_rdp)
 {
@@ -268,6 +306,8 @@ update_clipboard_serial (GrdClipboardRdp *clipboard_rdp)
                                 GUINT_TO_POINTER (clipboard_rdp->serial)))
     ++clipboard_rdp->serial;
 
+  clear_server_format_data_cache (clipboard_rdp);
+
   g_debug ("[RDP.CLIPRDR] Updated clipboard serial to %lu", clipboard_rdp->serial);
 }
 
@@ -803,15 +843,204 @@ serialize_file_list (FILEDESCRIPTORW  *files,
   Stream_Free (s, FALSE);
 }
 
+static void
+send_server_format_data_response (GrdClipboardRdp                *clipboard_rdp,
+                                  ServerFormatDataRequestContext *request_context,
+                                  uint8_t                        *dst_data,
+                                  uint32_t                        dst_size)
+{
+  CliprdrServerContext *cliprdr_context = clipboard_rdp->cliprdr_context;
+  CLIPRDR_FORMAT_DATA_RESPONSE format_data_response = {0};
+
+  format_data_response.common.msgType = CB_FORMAT_DATA_RESPONSE;
+  format_data_response.common.msgFlags = dst_data ? CB_RESPONSE_OK
+                                                  : CB_RESPONSE_FAIL;
+  format_data_response.common.dataLen = dst_size;
+  format_data_response.requestedFormatData = dst_data;
+
+  cliprdr_context->ServerFormatDataResponse (cliprdr_context,
+                                             &format_data_response);
+
+  g_free (request_context);
+
+  g_mutex_lock (&clipboard_rdp->completion_mutex);
+  clipboard_rdp->completed_format_data_request = TRUE;
+  g_cond_signal (&clipboard_rdp->completion_cond);
+  g_mutex_unlock (&clipboard_rdp->completion_mutex);
+}
+
+static void
+cache_server_format_data (GrdClipboardRdp *clipboard_rdp,
+                          uint32_t         requested_format_id,
+                          uint8_t         *data,
+                          uint32_t         size)
+{
+  FormatData *format_data;
+  FormatData *old_format_data;
+  int64_t size_delta = size;
+
+  if (g_hash_table_lookup_extended (clipboard_rdp->server_format_data_cache,
+                                    GUINT_TO_POINTER (requested_format_id),
+                                    NULL, (gpointer *) &old_format_data))
+    size_delta -= old_format_data->size;
+
+  format_data = g_malloc0 (sizeof (FormatData));
+  format_data->size = size;
+  format_data->data = data;
+
+  g_hash_table_insert (clipboard_rdp->server_format_data_cache,
+                       GUINT_TO_POINTER (requested_format_id),
+                       format_data);
+
+  grd_rdp_memory_budget_account (clipboard_rdp->memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_CLIPBOARD,
+                                 size_delta);
+  clipboard_rdp->server_format_data_cache_size += size_delta;
+}
+
+static void
+server_content_conversion_context_free (gpointer data)
+{
+  ServerContentConversionContext *conversion_context = data;
+
+  g_free (conversion_context->request_context);
+  g_free (conversion_context->src_format_name);
+  g_free (conversion_context->dst_format_name);
+  g_free (conversion_context->src_data);
+  g_free (conversion_context);
+}
+
+static void
+convert_server_content_in_thread (GTask        *task,
+                                  gpointer      source_object,
+                                  gpointer      task_data,
+                                  GCancellable *cancellable)
+{
+  ServerContentConversionContext *conversion_context = task_data;
+  wClipboard *system;
+  uint32_t src_format_id;
+  uint32_t dst_format_id;
+  FormatData *format_data;
+  uint8_t *dst_data = NULL;
+  uint32_t dst_size = 0;
+
+  /*
+   * The WinPR clipboard of the session is not thread-safe and may be replaced
+   * at any time. Content without file list does not depend on its state, so
+   * use a private instance for the conversion.
+   */
+  system = ClipboardCreate ();
+  src_format_id = ClipboardGetFormatId (system,
+                                        conversion_context->src_format_name);
+  dst_format_id = ClipboardGetFormatId (system,
+                                        conversion_context->dst_format_name);
+
+  if (ClipboardSetData (system, src_format_id,
+                        conversion_context->src_data,
+                        conversion_context->src_size))
+    dst_data = ClipboardGetData (system, dst_format_id, &dst_size);
+  ClipboardDestroy (system);
+
+  if (!dst_data)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Failed to convert clipboard content");
+      return;
+    }
+
+  format_data = g_malloc0 (sizeof (FormatData));
+  format_data->size = dst_size;
+  format_data->data = dst_data;
+
+  g_task_return_pointer (task, format_data, format_data_free);
+}
+
+static void
+on_server_content_converted (GObject      *source_object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  GrdClipboardRdp *clipboard_rdp = GRD_CLIPBOARD_RDP (source_object);
+  GTask *task = G_TASK (result);
+  ServerContentConversionContext *conversion_context =
+    g_task_get_task_data (task);
+  ServerFormatDataRequestContext *request_context;
+  g_autoptr (GError) error = NULL;
+  FormatData *format_data;
+
+  request_context = g_steal_pointer (&conversion_context->request_context);
+
+  format_data = g_task_propagate_pointer (task, &error);
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+      clipboard_rdp->protocol_stopped)
+    {
+      g_clear_pointer (&format_data, format_data_free);
+      g_free (request_context);
+      return;
+    }
+
+  if (!format_data)
+    {
+      g_warning ("[RDP.CLIPRDR] Converting clipboard content for client "
+                 "failed: %s", error->message);
+      send_server_format_data_response (clipboard_rdp, request_context,
+                                        NULL, 0);
+      return;
+    }
+
+  if (conversion_context->serial == clipboard_rdp->serial)
+    {
+      cache_server_format_data (clipboard_rdp,
+                                request_context->requested_format_id,
+                                format_data->data, format_data->size);
+      send_server_format_data_response (clipboard_rdp, request_context,
+                                        format_data->data, format_data->size);
+      g_free (format_data);
+    }
+  else
+    {
+      send_server_format_data_response (clipboard_rdp, request_context,
+                                        format_data->data, format_data->size);
+      format_data_free (format_data);
+    }
+}
+
+static void
+convert_server_content_async (GrdClipboardRdp                *clipboard_rdp,
+                              ServerFormatDataRequestContext *request_context,
+                              uint8_t                        *src_data,
+                              uint32_t                        src_size)
+{
+  ServerContentConversionContext *conversion_context;
+  GTask *task;
+
+  conversion_context = g_malloc0 (sizeof (ServerContentConversionContext));
+  conversion_context->request_context = request_context;
+  conversion_context->serial = clipboard_rdp->serial;
+  conversion_context->src_format_name =
+    g_strdup (ClipboardGetFormatName (clipboard_rdp->system,
+                                      request_context->src_format_id));
+  conversion_context->dst_format_name =
+    g_strdup (ClipboardGetFormatName (clipboard_rdp->system,
+                                      request_context->dst_format_id));
+  conversion_context->src_data = src_data;
+  conversion_context->src_size = src_size;
+
+  task = g_task_new (clipboard_rdp, clipboard_rdp->conversion_cancellable,
+                     on_server_content_converted, NULL);
+  g_task_set_task_data (task, conversion_context,
+                        server_content_conversion_context_free);
+  g_task_run_in_thread (task, convert_server_content_in_thread);
+  g_object_unref (task);
+}
+
 static void
 grd_clipboard_rdp_submit_requested_server_content (GrdClipboard *clipboard,
                                                    uint8_t      *src_data,
                                                    uint32_t      src_size)
 {
   GrdClipboardRdp *clipboard_rdp = GRD_CLIPBOARD_RDP (clipboard);
-  CliprdrServerContext *cliprdr_context = clipboard_rdp->cliprdr_context;
   ServerFormatDataRequestContext *request_context;
-  CLIPRDR_FORMAT_DATA_RESPONSE format_data_response = {0};
   GrdMimeType mime_type;
   uint32_t src_format_id;
   uint32_t dst_format_id;
@@ -838,6 +1067,13 @@ grd_clipboard_rdp_submit_requested_server_content (GrdClipboard *clipboard,
               ++src_size;
             }
 
+          if (mime_type != GRD_MIME_TYPE_TEXT_URILIST)
+            {
+              convert_server_content_async (clipboard_rdp, request_context,
+                                            src_data, src_size);
+              return;
+            }
+
           success = ClipboardSetData (clipboard_rdp->system,
                                       src_format_id, src_data, src_size);
           if (!success)
@@ -850,7 +1086,7 @@ grd_clipboard_rdp_submit_requested_server_content (GrdClipboard *clipboard,
               dst_data = ClipboardGetData (clipboard_rdp->system,
                                            dst_format_id, &dst_size);
 
-              if (dst_data && mime_type == GRD_MIME_TYPE_TEXT_URILIST)
+              if (dst_data)
                 {
                   uint64_t serial = clipboard_rdp->serial;
                   ClipDataEntry *entry;
@@ -886,23 +1122,17 @@ grd_clipboard_rdp_submit_requested_server_content (GrdClipboard *clipboard,
         }
     }
 
-  format_data_response.common.msgType = CB_FORMAT_DATA_RESPONSE;
-  format_data_response.common.msgFlags = dst_data ? CB_RESPONSE_OK
-                                                  : CB_RESPONSE_FAIL;
-  format_data_response.common.dataLen = dst_size;
-  format_data_response.requestedFormatData = dst_data;
-
-  cliprdr_context->ServerFormatDataResponse (cliprdr_context,
-                                             &format_data_response);
-
   g_free (src_data);
-  g_free (dst_data);
-  g_free (request_context);
 
-  g_mutex_lock (&clipboard_rdp->completion_mutex);
-  clipboard_rdp->completed_format_data_request = TRUE;
-  g_cond_signal (&clipboard_rdp->completion_cond);
-  g_mutex_unlock (&clipboard_rdp->completion_mutex);
+  if (dst_data)
+    {
+      cache_server_format_data (clipboard_rdp,
+                                request_context->requested_format_id,
+                                dst_data, dst_size);
+    }
+
+  send_server_format_data_response (clipboard_rdp, request_context,
+                                    dst_data, dst_size);
 }
 
 /**
@@ -1540,6 +1770,7 @@ request_server_format_data (gpointer user_data)
   GrdClipboard *clipboard = GRD_CLIPBOARD (clipboard_rdp);
   CliprdrServerContext *cliprdr_context = clipboard_rdp->cliprdr_context;
   ServerFormatDataRequestContext *request_context;
+  FormatData *format_data;
   GrdMimeType mime_type;
 
   request_context = clipboard_rdp->format_data_request_context;
@@ -1570,6 +1801,25 @@ request_server_format_data (gpointer user_data)
       return G_SOURCE_REMOVE;
     }
 
+  if (g_hash_table_lookup_extended (clipboard_rdp->server_format_data_cache,
+                                    GUINT_TO_POINTER (request_context->requested_format_id),
+                                    NULL, (gpointer *) &format_data))
+    {
+      g_debug ("[RDP.CLIPRDR] Serving format data request for format %u from "
+               "cache", request_context->requested_format_id);
+
+      g_mutex_lock (&clipboard_rdp->server_format_data_request_mutex);
+      clipboard_rdp->server_format_data_request_id = 0;
+      g_mutex_unlock (&clipboard_rdp->server_format_data_request_mutex);
+
+      request_context =
+        g_steal_pointer (&clipboard_rdp->format_data_request_context);
+      send_server_format_data_response (clipboard_rdp, request_context,
+                                        format_data->data, format_data->size);
+
+      return G_SOURCE_REMOVE;
+    }
+
   grd_clipboard_request_server_content_for_mime_type_async (clipboard,
                                                             mime_type);
 
@@ -1677,6 +1927,8 @@ cliprdr_client_format_data_request (CliprdrServerContext              *cliprdr_c
       request_context = g_malloc0 (sizeof (ServerFormatDataRequestContext));
       request_context->clipboard_rdp = clipboard_rdp;
       request_context->mime_type = mime_type;
+      request_context->requested_format_id =
+        format_data_request->requestedFormatId;
       request_context->src_format_id = src_format_id;
       request_context->dst_format_id = dst_format_id;
       request_context->needs_null_terminator = needs_null_terminator;
@@ -2414,6 +2666,17 @@ create_new_winpr_clipboard (GrdClipboardRdp *clipboard_rdp)
   clipboard_rdp->has_file_list = FALSE;
 }
 
+static void
+on_memory_trim (GrdRdpMemoryBudget *memory_budget,
+                GrdClipboardRdp    *clipboard_rdp)
+{
+  if (g_hash_table_size (clipboard_rdp->server_format_data_cache) == 0)
+    return;
+
+  g_debug ("[RDP.CLIPRDR] Dropping cached server format data");
+  clear_server_format_data_cache (clipboard_rdp);
+}
+
 GrdClipboardRdp *
 grd_clipboard_rdp_new (GrdSessionRdp *session_rdp,
                        HANDLE         vcm,
@@ -2437,6 +2700,12 @@ grd_clipboard_rdp_new (GrdSessionRdp *session_rdp,
   clipboard = GRD_CLIPBOARD (clipboard_rdp);
   grd_clipboard_initialize (clipboard, GRD_SESSION (session_rdp));
 
+  clipboard_rdp->memory_budget =
+    g_object_ref (grd_session_rdp_get_memory_budget (session_rdp));
+  g_signal_connect_object (clipboard_rdp->memory_budget, "trim",
+                           G_CALLBACK (on_memory_trim),
+                           clipboard_rdp, 0);
+
   cliprdr_context->useLongFormatNames = TRUE;
   cliprdr_context->streamFileClipEnabled = TRUE;
   cliprdr_context->fileClipNoFilePaths = TRUE;
@@ -2508,6 +2777,12 @@ grd_clipboard_rdp_dispose (GObject *object)
   g_cond_signal (&clipboard_rdp->completion_cond);
   g_mutex_unlock (&clipboard_rdp->completion_mutex);
 
+  if (clipboard_rdp->conversion_cancellable)
+    {
+      g_cancellable_cancel (clipboard_rdp->conversion_cancellable);
+      g_clear_object (&clipboard_rdp->conversion_cancellable);
+    }
+
   if (clipboard_rdp->cliprdr_context)
     {
       clipboard_rdp->cliprdr_context->Stop (clipboard_rdp->cliprdr_context);
@@ -2548,6 +2823,11 @@ grd_clipboard_rdp_dispose (GObject *object)
   g_assert (g_hash_table_size (clipboard_rdp->format_data_cache) == 0);
   g_clear_pointer (&clipboard_rdp->pending_client_requests, g_hash_table_unref);
   g_clear_pointer (&clipboard_rdp->format_data_cache, g_hash_table_unref);
+  if (clipboard_rdp->memory_budget && clipboard_rdp->server_format_data_cache)
+    clear_server_format_data_cache (clipboard_rdp);
+  g_clear_object (&clipboard_rdp->memory_budget);
+  g_clear_pointer (&clipboard_rdp->server_format_data_cache,
+                   g_hash_table_destroy);
   g_clear_pointer (&clipboard_rdp->clip_data_table, g_hash_table_destroy);
   g_clear_pointer (&clipboard_rdp->serial_entry_table, g_hash_table_destroy);
   g_clear_pointer (&clipboard_rdp->allowed_server_formats, g_hash_table_destroy);
@@ -2640,8 +2920,11 @@ grd_clipboard_rdp_init (GrdClipboardRdp *clipboard_rdp)
                                                              clip_data_entry_free);
   clipboard_rdp->clip_data_table = g_hash_table_new (NULL, NULL);
   clipboard_rdp->format_data_cache = g_hash_table_new (NULL, NULL);
+  clipboard_rdp->server_format_data_cache =
+    g_hash_table_new_full (NULL, NULL, NULL, format_data_free);
   clipboard_rdp->pending_client_requests = g_hash_table_new (NULL, NULL);
   clipboard_rdp->ordered_client_requests = g_queue_new ();
+  clipboard_rdp->conversion_cancellable = g_cancellable_new ();
 
   g_mutex_init (&clipboard_rdp->client_request_mutex);
   g_mutex_init (&clipboard_rdp->clip_data_entry_mutex);
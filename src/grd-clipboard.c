@@ -28,6 +28,19 @@
 
 #define MAX_READ_TIME_MS 4000
 
+/*
+ * The read size starts small to not waste memory for small contents and grows
+ * for large contents to keep the number of read calls low
+ */
+#define MIN_READ_CHUNK_SIZE (64 * 1024)
+#define MAX_READ_CHUNK_SIZE (4 * 1024 * 1024)
+/*
+ * The content size is passed on as a 32 bit value, which is also the size of
+ * the length fields of the RDP Format Data Response PDU and of the VNC cut text
+ * message. The RDP backend may append a NUL terminator to the content.
+ */
+#define MAX_CONTENT_SIZE (G_MAXUINT32 - 1)
+
 typedef struct _ReadMimeTypeContentContext
 {
   GrdClipboard *clipboard;
@@ -206,20 +219,28 @@ read_mime_type_content_in_thread (GTask        *task,
   GrdClipboardPrivate *priv = grd_clipboard_get_instance_private (clipboard);
   ReadMimeTypeContentResult *read_result;
   GInputStream *input_stream;
-  GArray *data;
+  GByteArray *data;
+  uint32_t chunk_size = MIN_READ_CHUNK_SIZE;
   gboolean success = FALSE;
   g_autoptr (GError) error = NULL;
 
   input_stream = g_unix_input_stream_new (read_context->fd, TRUE);
-  data = g_array_new (FALSE, TRUE, sizeof (uint8_t));
+  data = g_byte_array_sized_new (chunk_size);
 
   while (TRUE)
     {
-      int len;
-      uint8_t buffer[1024];
+      uint32_t size = data->len;
+      gssize len;
 
-      len = g_input_stream_read (input_stream, buffer, G_N_ELEMENTS (buffer),
+      if ((uint64_t) size + chunk_size > MAX_CONTENT_SIZE)
+        chunk_size = MAX_CONTENT_SIZE - size + 1;
+
+      /* Read directly into the result buffer to avoid an additional copy */
+      g_byte_array_set_size (data, size + chunk_size);
+      len = g_input_stream_read (input_stream, data->data + size, chunk_size,
                                  read_context->cancellable, &error);
+      g_byte_array_set_size (data, size + MAX (len, 0));
+
       if (len < 0)
         {
           g_warning ("Clipboard[SelectionRead]: Failed to read mime type "
@@ -231,21 +252,26 @@ read_mime_type_content_in_thread (GTask        *task,
           success = TRUE;
           break;
         }
-      else
+      else if (data->len > MAX_CONTENT_SIZE)
         {
-          g_array_append_vals (data, buffer, len);
+          g_warning ("Clipboard[SelectionRead]: Mime type content exceeds "
+                     "maximum size of %u bytes", MAX_CONTENT_SIZE);
+          break;
         }
+
+      if ((gsize) len == chunk_size)
+        chunk_size = MIN (chunk_size * 2, MAX_READ_CHUNK_SIZE);
     }
 
   read_result = g_malloc0 (sizeof (ReadMimeTypeContentResult));
   if (success && data->len > 0)
     {
       read_result->size = data->len;
-      read_result->data = (uint8_t *) g_array_free (data, FALSE);
+      read_result->data = g_byte_array_free (data, FALSE);
     }
   else
     {
-      g_array_free (data, TRUE);
+      g_byte_array_free (data, TRUE);
     }
 
   g_object_unref (input_stream);
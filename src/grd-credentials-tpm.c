@@ -22,19 +22,109 @@
 
 #include "grd-credentials-tpm.h"
 
+#include <errno.h>
 #include <gio/gio.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "grd-tpm.h"
 
+#define N_CREDENTIALS_TYPES (GRD_CREDENTIALS_TYPE_VNC + 1)
+
+typedef struct _CachedSecret
+{
+  /* Content of the secret file, the cached credentials were unsealed from */
+  char *sealed_secret;
+
+  /* Serialized credentials, kept in locked memory */
+  char *credentials;
+  size_t credentials_size;
+} CachedSecret;
+
 struct _GrdCredentialsTpm
 {
   GrdCredentials parent;
+
+  GrdTpm *tpm;
+
+  CachedSecret *cached_secrets[N_CREDENTIALS_TYPES];
 };
 
 G_DEFINE_TYPE (GrdCredentialsTpm, grd_credentials_tpm, GRD_TYPE_CREDENTIALS)
 
+static void
+cached_secret_free (CachedSecret *cached_secret)
+{
+  explicit_bzero (cached_secret->credentials, cached_secret->credentials_size);
+  munlock (cached_secret->credentials, cached_secret->credentials_size);
+  munmap (cached_secret->credentials, cached_secret->credentials_size);
+
+  g_free (cached_secret->sealed_secret);
+  g_free (cached_secret);
+}
+
+static CachedSecret *
+cached_secret_new (const char *sealed_secret,
+                   const char *credentials)
+{
+  CachedSecret *cached_secret;
+  size_t page_size = sysconf (_SC_PAGESIZE);
+  size_t length = strlen (credentials) + 1;
+  size_t size;
+  char *buffer;
+
+  size = (length + page_size - 1) / page_size * page_size;
+  buffer = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED)
+    return NULL;
+
+  if (mlock (buffer, size) != 0)
+    {
+      g_debug ("[TPM] Not caching credentials: Failed to lock memory: %s",
+               g_strerror (errno));
+      munmap (buffer, size);
+      return NULL;
+    }
+  madvise (buffer, size, MADV_DONTDUMP);
+
+  memcpy (buffer, credentials, length);
+
+  cached_secret = g_new0 (CachedSecret, 1);
+  cached_secret->sealed_secret = g_strdup (sealed_secret);
+  cached_secret->credentials = buffer;
+  cached_secret->credentials_size = size;
+
+  return cached_secret;
+}
+
+static void
+invalidate_cached_secret (GrdCredentialsTpm  *credentials_tpm,
+                          GrdCredentialsType  type)
+{
+  g_clear_pointer (&credentials_tpm->cached_secrets[type], cached_secret_free);
+}
+
+static void
+cache_secret (GrdCredentialsTpm  *credentials_tpm,
+              GrdCredentialsType  type,
+              const char         *sealed_secret,
+              const char         *credentials)
+{
+  invalidate_cached_secret (credentials_tpm, type);
+  credentials_tpm->cached_secrets[type] = cached_secret_new (sealed_secret,
+                                                             credentials);
+}
+
+static void
+free_secret_string (char *string)
+{
+  explicit_bzero (string, strlen (string));
+  g_free (string);
+}
+
 static const char *
 secret_file_name_from_type (GrdCredentialsType type)
 {
@@ -55,6 +145,7 @@ grd_credentials_tpm_store (GrdCredentials      *credentials,
                            GVariant            *variant,
                            GError             **error)
 {
+  GrdCredentialsTpm *credentials_tpm = GRD_CREDENTIALS_TPM (credentials);
   g_autoptr (GrdTpm) tpm = NULL;
   g_autofree const char *serialized = NULL;
   ESYS_TR primary_handle = 0;
@@ -112,13 +203,20 @@ grd_credentials_tpm_store (GrdCredentials      *credentials,
 
   secret_serialized = g_variant_print (secret_variant, TRUE);
 
-  return g_file_replace_contents (secret_file,
-                                  secret_serialized,
-                                  strlen (secret_serialized) + 1,
-                                  NULL, FALSE,
-                                  G_FILE_CREATE_PRIVATE |
-                                  G_FILE_CREATE_REPLACE_DESTINATION,
-                                  NULL, NULL, error);
+  invalidate_cached_secret (credentials_tpm, type);
+
+  if (!g_file_replace_contents (secret_file,
+                                secret_serialized,
+                                strlen (secret_serialized) + 1,
+                                NULL, FALSE,
+                                G_FILE_CREATE_PRIVATE |
+                                G_FILE_CREATE_REPLACE_DESTINATION,
+                                NULL, NULL, error))
+    return FALSE;
+
+  cache_secret (credentials_tpm, type, secret_serialized, serialized);
+
+  return TRUE;
 }
 
 static GVariant *
@@ -126,7 +224,7 @@ grd_credentials_tpm_lookup (GrdCredentials      *credentials,
                             GrdCredentialsType   type,
                             GError             **error)
 {
-  g_autoptr (GrdTpm) tpm = NULL;
+  GrdCredentialsTpm *credentials_tpm = GRD_CREDENTIALS_TPM (credentials);
   const char *secret_file_name;
   g_autofree char *secret_path = NULL;
   g_autofree char *serialized = NULL;
@@ -134,7 +232,9 @@ grd_credentials_tpm_lookup (GrdCredentials      *credentials,
   g_autofree TPML_DIGEST *pcr_digest = NULL;
   g_autoptr (GVariant) secret_variant = NULL;
   g_autoptr (GError) local_error = NULL;
-  g_autofree char *credentials_string = NULL;
+  CachedSecret *cached_secret;
+  char *credentials_string;
+  GVariant *credentials_variant;
 
   secret_file_name = secret_file_name_from_type (type);
   secret_path = g_build_path ("/",
@@ -148,6 +248,8 @@ grd_credentials_tpm_lookup (GrdCredentials      *credentials,
                             NULL,
                             &local_error))
     {
+      invalidate_cached_secret (credentials_tpm, type);
+
       if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
         return NULL;
 
@@ -155,27 +257,55 @@ grd_credentials_tpm_lookup (GrdCredentials      *credentials,
       return NULL;
     }
 
+  /*
+   * The secret file may have been replaced by another process, so only use
+   * the cached credentials, if they were unsealed from the same file content
+   */
+  cached_secret = credentials_tpm->cached_secrets[type];
+  if (cached_secret && strcmp (cached_secret->sealed_secret, serialized) == 0)
+    return g_variant_parse (NULL, cached_secret->credentials, NULL, NULL, error);
+
+  invalidate_cached_secret (credentials_tpm, type);
+
   secret_variant = g_variant_parse (G_VARIANT_TYPE ("(uutqs)"), serialized,
                                     NULL, NULL, error);
   if (!secret_variant)
     return NULL;
 
-  tpm = grd_tpm_new (GRD_TPM_MODE_READ, error);
-  if (!tpm)
-    return FALSE;
+  /* Keep the TPM context and its sessions around for subsequent lookups */
+  if (!credentials_tpm->tpm)
+    {
+      credentials_tpm->tpm = grd_tpm_new (GRD_TPM_MODE_READ, error);
+      if (!credentials_tpm->tpm)
+        return NULL;
+    }
 
-  if (!grd_tpm_read_pcr (tpm, &pcr_selection, &pcr_digest, error))
-    return NULL;
+  if (!grd_tpm_read_pcr (credentials_tpm->tpm, &pcr_selection, &pcr_digest,
+                         error))
+    {
+      g_clear_object (&credentials_tpm->tpm);
+      return NULL;
+    }
 
-  credentials_string = grd_tpm_restore_secret (tpm,
+  credentials_string = grd_tpm_restore_secret (credentials_tpm->tpm,
                                                secret_variant,
                                                pcr_selection,
                                                pcr_digest,
                                                error);
   if (!credentials_string)
-    return NULL;
+    {
+      g_clear_object (&credentials_tpm->tpm);
+      return NULL;
+    }
+
+  credentials_variant = g_variant_parse (NULL, credentials_string,
+                                         NULL, NULL, error);
+  if (credentials_variant)
+    cache_secret (credentials_tpm, type, serialized, credentials_string);
 
-  return g_variant_parse (NULL, credentials_string, NULL, NULL, error);
+  free_secret_string (credentials_string);
+
+  return credentials_variant;
 }
 
 static gboolean
@@ -188,6 +318,8 @@ grd_credentials_tpm_clear (GrdCredentials      *credentials,
   g_autoptr (GFile) secret_file = NULL;
   g_autoptr (GError) local_error = NULL;
 
+  invalidate_cached_secret (GRD_CREDENTIALS_TPM (credentials), type);
+
   secret_file_name = secret_file_name_from_type (type);
   secret_path = g_build_path ("/",
                               g_get_user_data_dir (),
@@ -227,6 +359,20 @@ grd_credentials_tpm_new (GError **error)
   return g_object_new (GRD_TYPE_CREDENTIALS_TPM, NULL);
 }
 
+static void
+grd_credentials_tpm_finalize (GObject *object)
+{
+  GrdCredentialsTpm *credentials_tpm = GRD_CREDENTIALS_TPM (object);
+  GrdCredentialsType type;
+
+  for (type = 0; type < N_CREDENTIALS_TYPES; ++type)
+    invalidate_cached_secret (credentials_tpm, type);
+
+  g_clear_object (&credentials_tpm->tpm);
+
+  G_OBJECT_CLASS (grd_credentials_tpm_parent_class)->finalize (object);
+}
+
 static void
 grd_credentials_tpm_init (GrdCredentialsTpm *credentials_tpm)
 {
@@ -235,8 +381,11 @@ grd_credentials_tpm_init (GrdCredentialsTpm *credentials_tpm)
 static void
 grd_credentials_tpm_class_init (GrdCredentialsTpmClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
   GrdCredentialsClass *credentials_class = GRD_CREDENTIALS_CLASS (klass);
 
+  object_class->finalize = grd_credentials_tpm_finalize;
+
   credentials_class->store = grd_credentials_tpm_store;
   credentials_class->lookup = grd_credentials_tpm_lookup;
   credentials_class->clear = grd_credentials_tpm_clear;
@@ -51,6 +51,10 @@ struct _GrdDaemonHandover
   GrdSession *session;
 
   gboolean use_system_credentials;
+  gboolean awaiting_system_credentials;
+  gboolean failed_to_get_system_credentials;
+  GSocketConnection *pending_socket_connection;
+
   GrdPrompt *prompt;
   GCancellable *prompt_cancellable;
 
@@ -79,6 +83,18 @@ grd_daemon_handover_is_ready (GrdDaemon *daemon)
   return TRUE;
 }
 
+static void
+notify_incoming_client (GrdDaemonHandover *daemon_handover,
+                        GSocketConnection *socket_connection)
+{
+  GrdRdpServer *rdp_server;
+
+  rdp_server = grd_daemon_get_rdp_server (GRD_DAEMON (daemon_handover));
+
+  grd_rdp_server_notify_incoming (G_SOCKET_SERVICE (rdp_server),
+                                  socket_connection);
+}
+
 static void
 on_take_client_finished (GObject      *object,
                          GAsyncResult *result,
@@ -92,7 +108,6 @@ on_take_client_finished (GObject      *object,
   g_autoptr (GUnixFDList) fd_list = NULL;
   GrdDBusRemoteDesktopRdpHandover *proxy;
   GrdDaemonHandover *daemon_handover;
-  GrdRdpServer *rdp_server;
   GSocketConnection *socket_connection;
 
   proxy = GRD_DBUS_REMOTE_DESKTOP_RDP_HANDOVER (object);
@@ -133,11 +148,32 @@ on_take_client_finished (GObject      *object,
     }
 
   daemon_handover = GRD_DAEMON_HANDOVER (user_data);
-  rdp_server = grd_daemon_get_rdp_server (GRD_DAEMON (daemon_handover));
   socket_connection = g_socket_connection_factory_create_connection (socket);
 
-  grd_rdp_server_notify_incoming (G_SOCKET_SERVICE (rdp_server),
-                                  socket_connection);
+  if (daemon_handover->failed_to_get_system_credentials)
+    {
+      g_warning ("[DaemonHandover] Dropping client: System credentials are "
+                 "unavailable");
+      g_object_unref (socket_connection);
+      return;
+    }
+
+  /*
+   * The credentials are requested in parallel to the client. The client may
+   * only be handled, once they are set, as they are needed for the NLA
+   * authentication.
+   */
+  if (daemon_handover->awaiting_system_credentials)
+    {
+      g_debug ("[DaemonHandover] Deferring client until the system "
+               "credentials are set");
+
+      g_clear_object (&daemon_handover->pending_socket_connection);
+      daemon_handover->pending_socket_connection = socket_connection;
+      return;
+    }
+
+  notify_incoming_client (daemon_handover, socket_connection);
 }
 
 static void
@@ -152,8 +188,7 @@ on_get_system_credentials_finished (GObject      *object,
   GrdDaemonHandover *daemon_handover;
   GrdContext *context;
   GrdSettings *settings;
-  GCancellable *cancellable;
-  const char* object_path;
+  GSocketConnection *socket_connection;
 
   remote_desktop_handover = GRD_DBUS_REMOTE_DESKTOP_RDP_HANDOVER (object);
   if (!grd_dbus_remote_desktop_rdp_handover_call_get_system_credentials_finish (
@@ -168,6 +203,11 @@ on_get_system_credentials_finished (GObject      *object,
 
       g_warning ("[DaemonHandover] Failed to get system credentials: %s",
                  error->message);
+
+      daemon_handover = GRD_DAEMON_HANDOVER (user_data);
+      daemon_handover->awaiting_system_credentials = FALSE;
+      daemon_handover->failed_to_get_system_credentials = TRUE;
+      g_clear_object (&daemon_handover->pending_socket_connection);
       return;
     }
 
@@ -175,25 +215,22 @@ on_get_system_credentials_finished (GObject      *object,
   context = grd_daemon_get_context (GRD_DAEMON (daemon_handover));
   settings = grd_context_get_settings (context);
 
+  daemon_handover->awaiting_system_credentials = FALSE;
+
   if (!grd_settings_set_rdp_credentials (settings, username, password, &error))
     {
       g_warning ("[DaemonHanodver] Failed to overwrite credentials: %s",
                  error->message);
+
+      daemon_handover->failed_to_get_system_credentials = TRUE;
+      g_clear_object (&daemon_handover->pending_socket_connection);
       return;
     }
 
-  object_path =
-    g_dbus_proxy_get_object_path (G_DBUS_PROXY (remote_desktop_handover));
-
-  g_debug ("[DaemonHandover] At: %s, calling TakeClient", object_path);
-
-  cancellable = grd_daemon_get_cancellable (GRD_DAEMON (daemon_handover));
-  grd_dbus_remote_desktop_rdp_handover_call_take_client (
-    remote_desktop_handover,
-    NULL,
-    cancellable,
-    on_take_client_finished,
-    daemon_handover);
+  socket_connection =
+    g_steal_pointer (&daemon_handover->pending_socket_connection);
+  if (socket_connection)
+    notify_incoming_client (daemon_handover, socket_connection);
 }
 
 static void
@@ -211,6 +248,9 @@ on_take_client_ready (GrdDBusRemoteDesktopRdpHandover *interface,
            object_path);
 
   daemon_handover->use_system_credentials = use_system_credentials;
+  daemon_handover->awaiting_system_credentials = use_system_credentials;
+  daemon_handover->failed_to_get_system_credentials = FALSE;
+  g_clear_object (&daemon_handover->pending_socket_connection);
 
   if (use_system_credentials)
     {
@@ -222,8 +262,6 @@ on_take_client_ready (GrdDBusRemoteDesktopRdpHandover *interface,
         cancellable,
         on_get_system_credentials_finished,
         daemon_handover);
-
-      return;
     }
 
   g_debug ("[DaemonHandover] At: %s, calling TakeClient", object_path);
@@ -815,6 +853,7 @@ on_gnome_remote_desktop_name_vanished (GDBusConnection *connection,
 
   g_clear_object (&daemon_handover->remote_desktop_handover);
   g_clear_object (&daemon_handover->remote_desktop_dispatcher);
+  g_clear_object (&daemon_handover->pending_socket_connection);
 
   stop_watching_handover_objects (daemon_handover);
 
@@ -880,6 +919,7 @@ grd_daemon_handover_shutdown (GApplication *app)
 
   g_clear_object (&daemon_handover->remote_desktop_handover);
   g_clear_object (&daemon_handover->remote_desktop_dispatcher);
+  g_clear_object (&daemon_handover->pending_socket_connection);
 
   stop_watching_handover_objects (daemon_handover);
 
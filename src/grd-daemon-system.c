@@ -38,6 +38,7 @@
 #include "grd-utils.h"
 
 #define MAX_HANDOVER_WAIT_TIME_S 30
+#define WARM_DISPLAY_POOL_REFILL_DELAY_S 5
 
 typedef struct
 {
@@ -66,6 +67,12 @@ typedef struct
   gboolean use_system_credentials;
   gboolean needs_handover;
 
+  /* Display started ahead of time, which is not claimed by a client yet */
+  gboolean is_warm_display;
+  gboolean is_warm_display_starting;
+  gboolean claimed_warm_display;
+  int64_t connection_time_us;
+
   GrdDBusGdmRemoteDisplay *remote_display;
 } GrdRemoteClient;
 
@@ -83,6 +90,12 @@ struct _GrdDaemonSystem
   unsigned int gdm_watch_name_id;
 
   GHashTable *remote_clients;
+
+  GQueue *warm_remote_clients;
+  unsigned int n_starting_warm_displays;
+  unsigned int warm_display_pool_refill_id;
+  unsigned int n_warm_display_claims;
+  unsigned int n_displays_created_on_demand;
 };
 
 G_DEFINE_TYPE (GrdDaemonSystem, grd_daemon_system, GRD_TYPE_DAEMON)
@@ -95,6 +108,10 @@ grd_remote_client_free (GrdRemoteClient *remote_client);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (GrdRemoteClient, grd_remote_client_free)
 
+static void
+schedule_warm_display_pool_refill (GrdDaemonSystem *daemon_system,
+                                   unsigned int     delay_s);
+
 static void
 on_remote_display_remote_id_changed (GrdDBusGdmRemoteDisplay *remote_display,
                                      GParamSpec              *pspec,
@@ -414,6 +431,36 @@ on_handle_start_handover (GrdDBusRemoteDesktopRdpHandover *interface,
                                      NULL);
     }
 
+  if (remote_client->session && remote_client->connection_time_us)
+    {
+      GrdDaemonSystem *daemon_system = remote_client->daemon_system;
+      int64_t claim_latency_us;
+
+      claim_latency_us = g_get_monotonic_time () -
+                         remote_client->connection_time_us;
+      remote_client->connection_time_us = 0;
+
+      g_debug ("[DaemonSystem] At: %s, handover started %" G_GINT64_FORMAT
+               " ms after the connection arrived (%s display). Claimed warm "
+               "displays: %u, displays created on demand: %u",
+               remote_client->handover_dst->object_path,
+               claim_latency_us / 1000,
+               remote_client->claimed_warm_display ? "warm" : "new",
+               daemon_system->n_warm_display_claims,
+               daemon_system->n_displays_created_on_demand);
+
+      if (remote_client->claimed_warm_display)
+        {
+          grd_dbus_remote_desktop_rdp_dispatcher_set_warm_display_claim_latency (
+            daemon_system->dispatcher_skeleton, claim_latency_us);
+        }
+      else
+        {
+          grd_dbus_remote_desktop_rdp_dispatcher_set_on_demand_display_latency (
+            daemon_system->dispatcher_skeleton, claim_latency_us);
+        }
+    }
+
   sender = g_dbus_method_invocation_get_sender (invocation);
   remote_client->handover_dst->sender_name = g_strdup (sender);
 
@@ -545,6 +592,16 @@ register_handover_iface (GrdRemoteClient *remote_client,
   g_clear_pointer (&remote_client->handover_src, handover_iface_free);
   remote_client->handover_src = remote_client->handover_dst;
   remote_client->handover_dst = handover;
+
+  if (remote_client->is_warm_display_starting)
+    {
+      g_debug ("[DaemonSystem] Warm display with remote id %s is ready",
+               remote_client->id);
+
+      remote_client->is_warm_display_starting = FALSE;
+      --daemon_system->n_starting_warm_displays;
+      schedule_warm_display_pool_refill (daemon_system, 0);
+    }
 }
 
 static void
@@ -570,6 +627,21 @@ unregister_handover_iface (GrdRemoteClient   *remote_client,
 static void
 grd_remote_client_free (GrdRemoteClient *remote_client)
 {
+  GrdDaemonSystem *daemon_system = remote_client->daemon_system;
+
+  if (remote_client->is_warm_display_starting)
+    --daemon_system->n_starting_warm_displays;
+  if (remote_client->is_warm_display)
+    {
+      g_queue_remove (daemon_system->warm_remote_clients, remote_client);
+
+      if (daemon_system->remote_clients)
+        {
+          schedule_warm_display_pool_refill (daemon_system,
+                                             WARM_DISPLAY_POOL_REFILL_DELAY_S);
+        }
+    }
+
   disconnect_from_remote_display (remote_client);
 
   g_clear_pointer (&remote_client->id, g_free);
@@ -631,19 +703,12 @@ try_get_hostname (GrdSessionRdp *session_rdp)
   return g_inet_address_to_string (inet_address);
 }
 
-static GrdRemoteClient *
-remote_client_new (GrdDaemonSystem *daemon_system,
-                   GrdSession      *session)
+static void
+attach_session (GrdRemoteClient *remote_client,
+                GrdSession      *session)
 {
-  GrdRemoteClient *remote_client;
-
-  remote_client = g_new0 (GrdRemoteClient, 1);
-  remote_client->id = get_next_available_id (daemon_system);
-  remote_client->daemon_system = daemon_system;
-  remote_client->needs_handover = session != NULL;
-
-  if (!session)
-    return remote_client;
+  remote_client->needs_handover = TRUE;
+  remote_client->connection_time_us = g_get_monotonic_time ();
 
   remote_client->hostname = try_get_hostname (GRD_SESSION_RDP (session));
   remote_client->is_client_mstsc = grd_session_rdp_is_client_mstsc (GRD_SESSION_RDP (session));
@@ -656,6 +721,20 @@ remote_client_new (GrdDaemonSystem *daemon_system,
     g_timeout_add_seconds_once (MAX_HANDOVER_WAIT_TIME_S,
                                 abort_handover,
                                 remote_client);
+}
+
+static GrdRemoteClient *
+remote_client_new (GrdDaemonSystem *daemon_system,
+                   GrdSession      *session)
+{
+  GrdRemoteClient *remote_client;
+
+  remote_client = g_new0 (GrdRemoteClient, 1);
+  remote_client->id = get_next_available_id (daemon_system);
+  remote_client->daemon_system = daemon_system;
+
+  if (session)
+    attach_session (remote_client, session);
 
   return remote_client;
 }
@@ -750,19 +829,24 @@ serialize_remote_display_properties (GrdRemoteClient *remote_client)
 }
 
 static void
-on_incoming_new_connection (GrdRdpServer    *rdp_server,
-                            GrdSession      *session,
-                            GrdDaemonSystem *daemon_system)
+update_display_statistics (GrdDaemonSystem *daemon_system)
+{
+  grd_dbus_remote_desktop_rdp_dispatcher_set_warm_display_claims (
+    daemon_system->dispatcher_skeleton,
+    daemon_system->n_warm_display_claims);
+  grd_dbus_remote_desktop_rdp_dispatcher_set_displays_created_on_demand (
+    daemon_system->dispatcher_skeleton,
+    daemon_system->n_displays_created_on_demand);
+}
+
+static void
+create_remote_display (GrdDaemonSystem *daemon_system,
+                       GrdRemoteClient *remote_client)
 {
   GCancellable *cancellable =
     grd_daemon_get_cancellable (GRD_DAEMON (daemon_system));
-  GrdRemoteClient *remote_client;
   GVariant *properties_variant;
 
-  g_debug ("[DaemonSystem] Incoming connection without routing token");
-
-  remote_client = remote_client_new (daemon_system, session);
-
   g_hash_table_insert (daemon_system->remote_clients,
                        remote_client->id,
                        remote_client);
@@ -779,6 +863,164 @@ on_incoming_new_connection (GrdRdpServer    *rdp_server,
     remote_client);
 }
 
+static void
+maybe_create_warm_display (GrdDaemonSystem *daemon_system)
+{
+  GrdDaemon *daemon = GRD_DAEMON (daemon_system);
+  GrdSettings *settings = grd_context_get_settings (grd_daemon_get_context (daemon));
+  int warm_display_pool_size;
+  int max_parallel_connections;
+  GrdRemoteClient *remote_client;
+
+  if (!daemon_system->remote_display_factory_proxy ||
+      !grd_daemon_get_rdp_server (daemon))
+    return;
+
+  warm_display_pool_size = grd_settings_get_warm_display_pool_size (settings);
+  if (g_queue_get_length (daemon_system->warm_remote_clients) >=
+      (unsigned int) warm_display_pool_size)
+    return;
+
+  /* Start one display at a time to not overload GDM during bursts */
+  if (daemon_system->n_starting_warm_displays > 0)
+    return;
+
+  /* Warm displays count towards the connection limit */
+  max_parallel_connections = grd_settings_get_max_parallel_connections (settings);
+  if (g_hash_table_size (daemon_system->remote_clients) >=
+      (unsigned int) max_parallel_connections)
+    {
+      g_debug ("[DaemonSystem] Not starting warm display: Maximum number of "
+               "parallel connections reached");
+      return;
+    }
+
+  remote_client = remote_client_new (daemon_system, NULL);
+  remote_client->is_warm_display = TRUE;
+  remote_client->is_warm_display_starting = TRUE;
+  ++daemon_system->n_starting_warm_displays;
+
+  g_queue_push_tail (daemon_system->warm_remote_clients, remote_client);
+
+  g_debug ("[DaemonSystem] Starting warm display");
+
+  create_remote_display (daemon_system, remote_client);
+}
+
+static gboolean
+refill_warm_display_pool (gpointer user_data)
+{
+  GrdDaemonSystem *daemon_system = user_data;
+
+  daemon_system->warm_display_pool_refill_id = 0;
+
+  maybe_create_warm_display (daemon_system);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_warm_display_pool_refill (GrdDaemonSystem *daemon_system,
+                                   unsigned int     delay_s)
+{
+  GrdDaemon *daemon = GRD_DAEMON (daemon_system);
+  GrdSettings *settings = grd_context_get_settings (grd_daemon_get_context (daemon));
+
+  if (grd_settings_get_warm_display_pool_size (settings) == 0)
+    return;
+
+  if (daemon_system->warm_display_pool_refill_id && delay_s > 0)
+    return;
+
+  g_clear_handle_id (&daemon_system->warm_display_pool_refill_id,
+                     g_source_remove);
+  if (delay_s == 0)
+    {
+      daemon_system->warm_display_pool_refill_id =
+        g_idle_add (refill_warm_display_pool, daemon_system);
+    }
+  else
+    {
+      daemon_system->warm_display_pool_refill_id =
+        g_timeout_add_seconds (delay_s, refill_warm_display_pool,
+                               daemon_system);
+    }
+}
+
+static GrdRemoteClient *
+claim_warm_remote_client (GrdDaemonSystem *daemon_system,
+                          GrdSession      *session)
+{
+  GrdRemoteClient *remote_client = NULL;
+  g_autofree char *hostname = NULL;
+  GList *l;
+
+  /*
+   * GDM only learns the hostname of a client, when its display is created, so
+   * a display started ahead of time can only be used for clients without one
+   */
+  hostname = try_get_hostname (GRD_SESSION_RDP (session));
+  if (hostname)
+    return NULL;
+
+  /* Prefer a display, whose handover daemon is already waiting */
+  for (l = daemon_system->warm_remote_clients->head; l; l = l->next)
+    {
+      GrdRemoteClient *warm_remote_client = l->data;
+
+      if (warm_remote_client->handover_dst)
+        {
+          remote_client = warm_remote_client;
+          break;
+        }
+    }
+  if (!remote_client)
+    remote_client = g_queue_peek_head (daemon_system->warm_remote_clients);
+  if (!remote_client)
+    return NULL;
+
+  g_queue_remove (daemon_system->warm_remote_clients, remote_client);
+  remote_client->is_warm_display = FALSE;
+  remote_client->claimed_warm_display = TRUE;
+
+  attach_session (remote_client, session);
+
+  g_debug ("[DaemonSystem] Claimed warm display with remote id: %s",
+           remote_client->id);
+
+  if (remote_client->handover_dst)
+    {
+      grd_dbus_remote_desktop_rdp_handover_set_handover_is_waiting (
+        remote_client->handover_dst->interface, TRUE);
+    }
+
+  return remote_client;
+}
+
+static void
+on_incoming_new_connection (GrdRdpServer    *rdp_server,
+                            GrdSession      *session,
+                            GrdDaemonSystem *daemon_system)
+{
+  GrdRemoteClient *remote_client;
+
+  g_debug ("[DaemonSystem] Incoming connection without routing token");
+
+  if (claim_warm_remote_client (daemon_system, session))
+    {
+      ++daemon_system->n_warm_display_claims;
+      update_display_statistics (daemon_system);
+      schedule_warm_display_pool_refill (daemon_system, 0);
+      return;
+    }
+
+  ++daemon_system->n_displays_created_on_demand;
+  update_display_statistics (daemon_system);
+
+  remote_client = remote_client_new (daemon_system, session);
+  create_remote_display (daemon_system, remote_client);
+}
+
 static void
 inform_configuration_service (void)
 {
@@ -807,6 +1049,8 @@ on_rdp_server_started (GrdDaemonSystem *daemon_system)
                     G_CALLBACK (on_incoming_redirected_connection),
                     daemon_system);
 
+  schedule_warm_display_pool_refill (daemon_system, 0);
+
   inform_configuration_service ();
 }
 
@@ -1442,6 +1686,7 @@ grd_daemon_system_init (GrdDaemonSystem *daemon_system)
   daemon_system->remote_clients =
     g_hash_table_new_full (g_str_hash, g_str_equal,
                            NULL, (GDestroyNotify) grd_remote_client_free);
+  daemon_system->warm_remote_clients = g_queue_new ();
 }
 
 static void
@@ -1491,7 +1736,10 @@ grd_daemon_system_shutdown (GApplication *app)
 {
   GrdDaemonSystem *daemon_system = GRD_DAEMON_SYSTEM (app);
 
+  g_clear_handle_id (&daemon_system->warm_display_pool_refill_id,
+                     g_source_remove);
   g_clear_pointer (&daemon_system->remote_clients, g_hash_table_unref);
+  g_clear_pointer (&daemon_system->warm_remote_clients, g_queue_free);
 
   g_clear_handle_id (&daemon_system->gdm_watch_name_id, g_bus_unwatch_name);
   destroy_gdm_proxies (daemon_system);
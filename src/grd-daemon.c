@@ -51,6 +51,11 @@
 #define RDP_SERVER_RESTART_DELAY_MS 3000
 
 #define DEFAULT_MAX_PARALLEL_CONNECTIONS 10
+#define DEFAULT_MAX_CONNECTIONS_PER_PEER 5
+#define DEFAULT_MAX_PENDING_CONNECTIONS_PER_PEER 5
+#define DEFAULT_MAX_CONNECTION_ATTEMPTS_PER_SECOND 10
+#define DEFAULT_MAX_GLOBAL_PENDING_CONNECTIONS 256
+#define DEFAULT_MAX_GLOBAL_CONNECTION_ATTEMPTS_PER_SECOND 100
 
 enum
 {
@@ -1133,8 +1138,20 @@ main (int argc, char **argv)
   gboolean system = FALSE;
   gboolean handover = FALSE;
   int rdp_port = -1;
+  int rdp_listen_backlog = -1;
   int vnc_port = -1;
   int max_parallel_connections = DEFAULT_MAX_PARALLEL_CONNECTIONS;
+  int max_connections_per_peer = DEFAULT_MAX_CONNECTIONS_PER_PEER;
+  int max_pending_connections_per_peer =
+    DEFAULT_MAX_PENDING_CONNECTIONS_PER_PEER;
+  int max_connection_attempts_per_second =
+    DEFAULT_MAX_CONNECTION_ATTEMPTS_PER_SECOND;
+  int max_global_pending_connections = DEFAULT_MAX_GLOBAL_PENDING_CONNECTIONS;
+  int max_global_connection_attempts_per_second =
+    DEFAULT_MAX_GLOBAL_CONNECTION_ATTEMPTS_PER_SECOND;
+  int warm_display_pool_size = 0;
+  int rdp_session_memory_budget = 0;
+  int rdp_reconnect_grace_period = 0;
 
   GOptionEntry entries[] = {
     { "version", 0, 0, G_OPTION_ARG_NONE, &print_version,
@@ -1146,15 +1163,50 @@ main (int argc, char **argv)
       "Run in headless mode as a system g-r-d service", NULL },
     { "handover", 0, 0, G_OPTION_ARG_NONE, &handover,
       "Run in headless mode taking a connection from system g-r-d service", NULL },
+    { "warm-display-pool-size", 0, 0,
+      G_OPTION_ARG_INT, &warm_display_pool_size,
+      "Number of remote login displays to start ahead of time "
+      "(system mode only, default: 0)", NULL },
 #endif /* HAVE_RDP && HAVE_LIBSYSTEMD */
     { "rdp-port", 0, 0, G_OPTION_ARG_INT, &rdp_port,
       "RDP port", NULL },
+    { "rdp-listen-backlog", 0, 0, G_OPTION_ARG_INT, &rdp_listen_backlog,
+      "Max number of not yet accepted RDP connections", NULL },
+    { "rdp-session-memory-budget", 0, 0,
+      G_OPTION_ARG_INT, &rdp_session_memory_budget,
+      "Memory budget per RDP session in MiB, after which caches and pools "
+      "are trimmed (0 for unlimited, default: 0)", NULL },
+    { "rdp-reconnect-grace-period", 0, 0,
+      G_OPTION_ARG_INT, &rdp_reconnect_grace_period,
+      "Seconds to keep a disconnected RDP session for the client to "
+      "reconnect to it (0 to disable, default: 0)", NULL },
     { "vnc-port", 0, 0, G_OPTION_ARG_INT, &vnc_port,
       "VNC port", NULL },
     { "max-parallel-connections", 0, 0,
       G_OPTION_ARG_INT, &max_parallel_connections,
       "Max number of parallel connections (0 for unlimited, "
       "default: " QUOTE(DEFAULT_MAX_PARALLEL_CONNECTIONS) ")", NULL },
+    { "max-connections-per-peer", 0, 0,
+      G_OPTION_ARG_INT, &max_connections_per_peer,
+      "Max number of parallel connections from the same address (0 for "
+      "unlimited, default: " QUOTE(DEFAULT_MAX_CONNECTIONS_PER_PEER) ")", NULL },
+    { "max-pending-connections-per-peer", 0, 0,
+      G_OPTION_ARG_INT, &max_pending_connections_per_peer,
+      "Max number of delayed connections from the same address (default: "
+      QUOTE(DEFAULT_MAX_PENDING_CONNECTIONS_PER_PEER) ")", NULL },
+    { "max-connection-attempts-per-second", 0, 0,
+      G_OPTION_ARG_INT, &max_connection_attempts_per_second,
+      "Max number of connection attempts per second from the same address "
+      "(default: " QUOTE(DEFAULT_MAX_CONNECTION_ATTEMPTS_PER_SECOND) ")", NULL },
+    { "max-global-pending-connections", 0, 0,
+      G_OPTION_ARG_INT, &max_global_pending_connections,
+      "Max number of delayed connections from all addresses (default: "
+      QUOTE(DEFAULT_MAX_GLOBAL_PENDING_CONNECTIONS) ")", NULL },
+    { "max-global-connection-attempts-per-second", 0, 0,
+      G_OPTION_ARG_INT, &max_global_connection_attempts_per_second,
+      "Max number of connection attempts per second from all addresses "
+      "(default: " QUOTE(DEFAULT_MAX_GLOBAL_CONNECTION_ATTEMPTS_PER_SECOND) ")",
+      NULL },
     { NULL }
   };
   g_autoptr (GOptionContext) option_context = NULL;
@@ -1195,6 +1247,72 @@ main (int argc, char **argv)
       return EXIT_FAILURE;
     }
 
+  if (max_connections_per_peer == 0)
+    {
+      max_connections_per_peer = INT_MAX;
+    }
+  else if (max_connections_per_peer < 0)
+    {
+      g_printerr ("Invalid number of max connections per peer: %d\n",
+                  max_connections_per_peer);
+      return EXIT_FAILURE;
+    }
+
+  if (max_pending_connections_per_peer < 0)
+    {
+      g_printerr ("Invalid number of max pending connections per peer: %d\n",
+                  max_pending_connections_per_peer);
+      return EXIT_FAILURE;
+    }
+
+  if (max_connection_attempts_per_second <= 0)
+    {
+      g_printerr ("Invalid number of max connection attempts per second: %d\n",
+                  max_connection_attempts_per_second);
+      return EXIT_FAILURE;
+    }
+
+  if (max_global_pending_connections < 0)
+    {
+      g_printerr ("Invalid number of max global pending connections: %d\n",
+                  max_global_pending_connections);
+      return EXIT_FAILURE;
+    }
+
+  if (max_global_connection_attempts_per_second <= 0)
+    {
+      g_printerr ("Invalid number of max global connection attempts per "
+                  "second: %d\n", max_global_connection_attempts_per_second);
+      return EXIT_FAILURE;
+    }
+
+  if (rdp_listen_backlog != -1 && rdp_listen_backlog <= 0)
+    {
+      g_printerr ("Invalid RDP listen backlog: %d\n", rdp_listen_backlog);
+      return EXIT_FAILURE;
+    }
+
+  if (warm_display_pool_size < 0)
+    {
+      g_printerr ("Invalid warm display pool size: %d\n",
+                  warm_display_pool_size);
+      return EXIT_FAILURE;
+    }
+
+  if (rdp_session_memory_budget < 0)
+    {
+      g_printerr ("Invalid RDP session memory budget: %d\n",
+                  rdp_session_memory_budget);
+      return EXIT_FAILURE;
+    }
+
+  if (rdp_reconnect_grace_period < 0)
+    {
+      g_printerr ("Invalid RDP reconnect grace period: %d\n",
+                  rdp_reconnect_grace_period);
+      return EXIT_FAILURE;
+    }
+
   if (headless)
     runtime_mode = GRD_RUNTIME_MODE_HEADLESS;
   else if (system)
@@ -1238,11 +1356,29 @@ main (int argc, char **argv)
   settings = grd_context_get_settings (context);
   if (rdp_port != -1)
     grd_settings_override_rdp_port (settings, rdp_port);
+  if (rdp_listen_backlog != -1)
+    grd_settings_override_rdp_listen_backlog (settings, rdp_listen_backlog);
   if (vnc_port != -1)
     grd_settings_override_vnc_port (settings, vnc_port);
 
   grd_settings_override_max_parallel_connections (settings,
                                                   max_parallel_connections);
+  grd_settings_override_max_connections_per_peer (settings,
+                                                  max_connections_per_peer);
+  grd_settings_override_max_pending_connections_per_peer (
+    settings, max_pending_connections_per_peer);
+  grd_settings_override_max_connection_attempts_per_second (
+    settings, max_connection_attempts_per_second);
+  grd_settings_override_max_global_pending_connections (
+    settings, max_global_pending_connections);
+  grd_settings_override_max_global_connection_attempts_per_second (
+    settings, max_global_connection_attempts_per_second);
+  grd_settings_override_warm_display_pool_size (settings,
+                                                warm_display_pool_size);
+  grd_settings_override_rdp_session_memory_budget (settings,
+                                                   rdp_session_memory_budget);
+  grd_settings_override_rdp_reconnect_grace_period (settings,
+                                                    rdp_reconnect_grace_period);
 
   return g_application_run (G_APPLICATION (daemon), argc, argv);
 }
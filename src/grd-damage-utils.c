@@ -90,3 +90,37 @@ grd_get_damage_region (uint8_t  *current_data,
 
   return damage_region;
 }
+
+uint32_t
+grd_get_bitmap_hash (uint8_t  *data,
+                     uint32_t  width,
+                     uint32_t  height,
+                     uint32_t  stride,
+                     uint32_t  bytes_per_pixel)
+{
+  uint32_t row_length = width * bytes_per_pixel;
+  uint32_t hash = 2166136261u;
+  uint32_t x, y;
+
+  /* FNV-1a over 32-bit words, with the trailing bytes of a row hashed bytewise */
+  for (y = 0; y < height; ++y)
+    {
+      uint8_t *row = data + y * stride;
+
+      for (x = 0; x + 4 <= row_length; x += 4)
+        {
+          uint32_t word;
+
+          memcpy (&word, row + x, sizeof (word));
+          hash ^= word;
+          hash *= 16777619u;
+        }
+      for (; x < row_length; ++x)
+        {
+          hash ^= row[x];
+          hash *= 16777619u;
+        }
+    }
+
+  return hash;
+}
@@ -37,3 +37,9 @@ bool grd_is_tile_dirty (cairo_rectangle_int_t *tile,
                         uint8_t               *prev_data,
                         uint32_t               stride,
                         uint32_t               bytes_per_pixel);
+
+uint32_t grd_get_bitmap_hash (uint8_t  *data,
+                              uint32_t  width,
+                              uint32_t  height,
+                              uint32_t  stride,
+                              uint32_t  bytes_per_pixel);
@@ -38,9 +38,17 @@ void
 grd_encode_context_set_damage_region (GrdEncodeContext *encode_context,
                                       cairo_region_t   *damage_region)
 {
+  g_assert (!encode_context->damage_region);
+
   encode_context->damage_region = cairo_region_reference (damage_region);
 }
 
+void
+grd_encode_context_reset (GrdEncodeContext *encode_context)
+{
+  g_clear_pointer (&encode_context->damage_region, cairo_region_destroy);
+}
+
 GrdEncodeContext *
 grd_encode_context_new (void)
 {
@@ -27,6 +27,8 @@ GrdEncodeContext *grd_encode_context_new (void);
 
 void grd_encode_context_free (GrdEncodeContext *encode_context);
 
+void grd_encode_context_reset (GrdEncodeContext *encode_context);
+
 cairo_region_t *grd_encode_context_get_damage_region (GrdEncodeContext *encode_context);
 
 void grd_encode_context_set_damage_region (GrdEncodeContext *encode_context,
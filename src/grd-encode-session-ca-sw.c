@@ -27,6 +27,7 @@
 #include "grd-encode-context.h"
 #include "grd-image-view-rgb.h"
 #include "grd-local-buffer.h"
+#include "grd-rdp-memory-budget.h"
 #include "grd-rdp-sw-encoder-ca.h"
 
 /*
@@ -53,6 +54,12 @@
 typedef struct
 {
   GrdImageView *image_view;
+
+  /*
+   * Set by the graphics thread when the frame is submitted and cleared by the
+   * encode thread once the bitstream has been created
+   */
+  GrdEncodeContext *pending_encode_context;
 } RGBSurface;
 
 struct _GrdEncodeSessionCaSw
@@ -60,21 +67,24 @@ struct _GrdEncodeSessionCaSw
   GrdEncodeSession parent;
 
   GrdRdpSwEncoderCa *encoder_ca;
+  GrdRdpMemoryBudget *memory_budget;
 
   uint32_t surface_width;
   uint32_t surface_height;
 
-  GHashTable *surfaces;
-
-  GMutex pending_encodes_mutex;
-  GHashTable *pending_encodes;
+  RGBSurface *surfaces[N_SRC_SURFACES];
 
-  GMutex acquired_encode_streams_mutex;
   wStream *encode_streams[N_ENCODE_STREAMS];
-  GHashTable *acquired_encode_streams;
+  /* Capacity of encode_streams[i] as accounted in the memory budget */
+  size_t accounted_stream_capacities[N_ENCODE_STREAMS];
+  /* Bit i is set, while encode_streams[i] is acquired */
+  guint acquired_encode_stream_mask;
 
-  GMutex bitstreams_mutex;
-  GHashTable *bitstreams;
+  /*
+   * Each encode stream has its own bitstream object, which is reused for
+   * every frame encoded into that stream
+   */
+  GrdBitstream *stream_bitstreams[N_ENCODE_STREAMS];
 
   gboolean pending_header;
 };
@@ -104,6 +114,22 @@ rgb_surface_free (RGBSurface *rgb_surface)
   g_free (rgb_surface);
 }
 
+static RGBSurface *
+get_rgb_surface (GrdEncodeSessionCaSw *encode_session_ca,
+                 GrdImageView         *image_view)
+{
+  uint32_t i;
+
+  for (i = 0; i < N_SRC_SURFACES; ++i)
+    {
+      if (encode_session_ca->surfaces[i]->image_view == image_view)
+        return encode_session_ca->surfaces[i];
+    }
+
+  g_assert_not_reached ();
+  return NULL;
+}
+
 static void
 grd_encode_session_ca_sw_get_surface_size (GrdEncodeSession *encode_session,
                                            uint32_t         *surface_width,
@@ -118,7 +144,16 @@ grd_encode_session_ca_sw_get_image_views (GrdEncodeSession *encode_session)
   GrdEncodeSessionCaSw *encode_session_ca =
     GRD_ENCODE_SESSION_CA_SW (encode_session);
 
-  return g_hash_table_get_keys (encode_session_ca->surfaces);
+  GList *image_views = NULL;
+  uint32_t i;
+
+  for (i = 0; i < N_SRC_SURFACES; ++i)
+    {
+      image_views = g_list_prepend (image_views,
+                                    encode_session_ca->surfaces[i]->image_view);
+    }
+
+  return image_views;
 }
 
 static gboolean
@@ -127,9 +162,14 @@ grd_encode_session_ca_sw_has_pending_frames (GrdEncodeSession *encode_session)
   GrdEncodeSessionCaSw *encode_session_ca =
     GRD_ENCODE_SESSION_CA_SW (encode_session);
 
-  g_mutex_lock (&encode_session_ca->pending_encodes_mutex);
-  g_assert (g_hash_table_size (encode_session_ca->pending_encodes) == 0);
-  g_mutex_unlock (&encode_session_ca->pending_encodes_mutex);
+  uint32_t i;
+
+  for (i = 0; i < N_SRC_SURFACES; ++i)
+    {
+      RGBSurface *surface = encode_session_ca->surfaces[i];
+
+      g_assert (!g_atomic_pointer_get (&surface->pending_encode_context));
+    }
 
   return FALSE;
 }
@@ -142,36 +182,75 @@ grd_encode_session_ca_sw_encode_frame (GrdEncodeSession  *encode_session,
 {
   GrdEncodeSessionCaSw *encode_session_ca =
     GRD_ENCODE_SESSION_CA_SW (encode_session);
-  g_autoptr (GMutexLocker) locker = NULL;
+  RGBSurface *surface = get_rgb_surface (encode_session_ca, image_view);
 
-  locker = g_mutex_locker_new (&encode_session_ca->pending_encodes_mutex);
-  g_assert (!g_hash_table_contains (encode_session_ca->pending_encodes,
-                                    image_view));
-
-  g_hash_table_insert (encode_session_ca->pending_encodes,
-                       image_view, encode_context);
+  if (!g_atomic_pointer_compare_and_exchange (&surface->pending_encode_context,
+                                              NULL, encode_context))
+    g_assert_not_reached ();
 
   return TRUE;
 }
 
+static void
+account_stream_capacity (GrdEncodeSessionCaSw *encode_session_ca,
+                         uint32_t              stream_idx)
+{
+  wStream *encode_stream = encode_session_ca->encode_streams[stream_idx];
+  size_t *accounted_capacity =
+    &encode_session_ca->accounted_stream_capacities[stream_idx];
+  size_t capacity = encode_stream ? Stream_Capacity (encode_stream) : 0;
+
+  grd_rdp_memory_budget_account (encode_session_ca->memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_ENCODE_STREAMS,
+                                 (int64_t) capacity -
+                                 (int64_t) *accounted_capacity);
+  *accounted_capacity = capacity;
+}
+
+/*
+ * Encode streams grow with the largest encoded frame and are kept at that
+ * size. Under memory pressure, shrink them back, once they are not in use
+ */
+static void
+maybe_shrink_encode_stream (GrdEncodeSessionCaSw *encode_session_ca,
+                            uint32_t              stream_idx)
+{
+  wStream *encode_stream = encode_session_ca->encode_streams[stream_idx];
+  wStream *new_encode_stream;
+
+  if (Stream_Capacity (encode_stream) <= INITIAL_STREAM_SIZE ||
+      !grd_rdp_memory_budget_is_under_pressure (encode_session_ca->memory_budget))
+    return;
+
+  new_encode_stream = Stream_New (NULL, INITIAL_STREAM_SIZE);
+  if (!new_encode_stream)
+    return;
+
+  Stream_Free (encode_stream, TRUE);
+  encode_session_ca->encode_streams[stream_idx] = new_encode_stream;
+
+  account_stream_capacity (encode_session_ca, stream_idx);
+}
+
 static wStream *
-acquire_encode_stream (GrdEncodeSessionCaSw *encode_session_ca)
+acquire_encode_stream (GrdEncodeSessionCaSw  *encode_session_ca,
+                       GrdBitstream         **bitstream,
+                       uint32_t              *stream_idx)
 {
-  g_autoptr (GMutexLocker) locker = NULL;
   uint32_t i;
 
-  locker = g_mutex_locker_new (&encode_session_ca->acquired_encode_streams_mutex);
   for (i = 0; i < N_ENCODE_STREAMS; ++i)
     {
-      wStream *encode_stream = encode_session_ca->encode_streams[i];
+      guint stream_bit = 1u << i;
 
-      if (g_hash_table_contains (encode_session_ca->acquired_encode_streams,
-                                 encode_stream))
+      if (g_atomic_int_or (&encode_session_ca->acquired_encode_stream_mask,
+                           stream_bit) & stream_bit)
         continue;
 
-      g_hash_table_add (encode_session_ca->acquired_encode_streams,
-                        encode_stream);
-      return encode_stream;
+      *bitstream = encode_session_ca->stream_bitstreams[i];
+      *stream_idx = i;
+
+      return encode_session_ca->encode_streams[i];
     }
 
   g_assert_not_reached ();
@@ -180,14 +259,27 @@ acquire_encode_stream (GrdEncodeSessionCaSw *encode_session_ca)
 
 static void
 release_encode_stream (GrdEncodeSessionCaSw *encode_session_ca,
-                       wStream              *encode_stream)
+                       GrdBitstream         *bitstream)
 {
-  g_autoptr (GMutexLocker) locker = NULL;
+  uint32_t i;
 
-  locker = g_mutex_locker_new (&encode_session_ca->acquired_encode_streams_mutex);
-  if (!g_hash_table_remove (encode_session_ca->acquired_encode_streams,
-                            encode_stream))
-    g_assert_not_reached ();
+  for (i = 0; i < N_ENCODE_STREAMS; ++i)
+    {
+      guint stream_bit = 1u << i;
+
+      if (encode_session_ca->stream_bitstreams[i] != bitstream)
+        continue;
+
+      maybe_shrink_encode_stream (encode_session_ca, i);
+
+      if (!(g_atomic_int_and (&encode_session_ca->acquired_encode_stream_mask,
+                              ~stream_bit) & stream_bit))
+        g_assert_not_reached ();
+
+      return;
+    }
+
+  g_assert_not_reached ();
 }
 
 static GrdBitstream *
@@ -198,29 +290,25 @@ grd_encode_session_ca_sw_lock_bitstream (GrdEncodeSession  *encode_session,
   GrdEncodeSessionCaSw *encode_session_ca =
     GRD_ENCODE_SESSION_CA_SW (encode_session);
   GrdImageViewRGB *image_view_rgb = GRD_IMAGE_VIEW_RGB (image_view);
-  GrdEncodeContext *encode_context = NULL;
-  g_autoptr (GMutexLocker) locker = NULL;
+  RGBSurface *surface = get_rgb_surface (encode_session_ca, image_view);
+  GrdEncodeContext *encode_context;
   GrdLocalBuffer *local_buffer;
   uint8_t *buffer;
   uint32_t buffer_stride;
   cairo_region_t *damage_region;
   wStream *encode_stream;
   GrdBitstream *bitstream;
+  uint32_t stream_idx;
 
-  locker = g_mutex_locker_new (&encode_session_ca->pending_encodes_mutex);
-  if (!g_hash_table_lookup_extended (encode_session_ca->pending_encodes,
-                                     image_view,
-                                     NULL, (gpointer *) &encode_context))
-    g_assert_not_reached ();
-
-  g_clear_pointer (&locker, g_mutex_locker_free);
+  encode_context = g_atomic_pointer_get (&surface->pending_encode_context);
   g_assert (encode_context);
 
   local_buffer = grd_image_view_rgb_get_local_buffer (image_view_rgb);
   buffer = grd_local_buffer_get_buffer (local_buffer);
   buffer_stride = grd_local_buffer_get_buffer_stride (local_buffer);
   damage_region = grd_encode_context_get_damage_region (encode_context);
-  encode_stream = acquire_encode_stream (encode_session_ca);
+  encode_stream = acquire_encode_stream (encode_session_ca, &bitstream,
+                                         &stream_idx);
 
   grd_rdp_sw_encoder_ca_encode_progressive_frame (encode_session_ca->encoder_ca,
                                                   encode_session_ca->surface_width,
@@ -233,16 +321,12 @@ grd_encode_session_ca_sw_lock_bitstream (GrdEncodeSession  *encode_session,
 
   encode_session_ca->pending_header = FALSE;
 
-  bitstream = grd_bitstream_new (Stream_Buffer (encode_stream),
-                                 Stream_Length (encode_stream));
+  account_stream_capacity (encode_session_ca, stream_idx);
 
-  g_mutex_lock (&encode_session_ca->bitstreams_mutex);
-  g_hash_table_insert (encode_session_ca->bitstreams, bitstream, encode_stream);
-  g_mutex_unlock (&encode_session_ca->bitstreams_mutex);
+  grd_bitstream_set_data (bitstream, Stream_Buffer (encode_stream),
+                          Stream_Length (encode_stream));
 
-  locker = g_mutex_locker_new (&encode_session_ca->pending_encodes_mutex);
-  if (!g_hash_table_remove (encode_session_ca->pending_encodes, image_view))
-    g_assert_not_reached ();
+  g_atomic_pointer_set (&surface->pending_encode_context, NULL);
 
   return bitstream;
 }
@@ -254,20 +338,8 @@ grd_encode_session_ca_sw_unlock_bitstream (GrdEncodeSession  *encode_session,
 {
   GrdEncodeSessionCaSw *encode_session_ca =
     GRD_ENCODE_SESSION_CA_SW (encode_session);
-  wStream *encode_stream = NULL;
-  g_autoptr (GMutexLocker) locker = NULL;
-
-  locker = g_mutex_locker_new (&encode_session_ca->bitstreams_mutex);
-  if (!g_hash_table_steal_extended (encode_session_ca->bitstreams,
-                                    bitstream,
-                                    NULL, (gpointer *) &encode_stream))
-    g_assert_not_reached ();
-
-  g_clear_pointer (&locker, g_mutex_locker_free);
-  g_assert (encode_stream);
 
-  grd_bitstream_free (bitstream);
-  release_encode_stream (encode_session_ca, encode_stream);
+  release_encode_stream (encode_session_ca, bitstream);
 
   return TRUE;
 }
@@ -279,14 +351,7 @@ init_surfaces_and_streams (GrdEncodeSessionCaSw  *encode_session_ca,
   uint32_t i;
 
   for (i = 0; i < N_SRC_SURFACES; ++i)
-    {
-      RGBSurface *surface;
-
-      surface = rgb_surface_new ();
-
-      g_hash_table_insert (encode_session_ca->surfaces,
-                           surface->image_view, surface);
-    }
+    encode_session_ca->surfaces[i] = rgb_surface_new ();
 
   for (i = 0; i < N_ENCODE_STREAMS; ++i)
     {
@@ -300,21 +365,26 @@ init_surfaces_and_streams (GrdEncodeSessionCaSw  *encode_session_ca,
           return FALSE;
         }
       encode_session_ca->encode_streams[i] = encode_stream;
+      encode_session_ca->stream_bitstreams[i] = grd_bitstream_new (NULL, 0);
+
+      account_stream_capacity (encode_session_ca, i);
     }
 
   return TRUE;
 }
 
 GrdEncodeSessionCaSw *
-grd_encode_session_ca_sw_new (GrdRdpSwEncoderCa  *encoder_ca,
-                              uint32_t            source_width,
-                              uint32_t            source_height,
-                              GError            **error)
+grd_encode_session_ca_sw_new (GrdRdpSwEncoderCa   *encoder_ca,
+                              GrdRdpMemoryBudget  *memory_budget,
+                              uint32_t             source_width,
+                              uint32_t             source_height,
+                              GError             **error)
 {
   g_autoptr (GrdEncodeSessionCaSw) encode_session_ca = NULL;
 
   encode_session_ca = g_object_new (GRD_TYPE_ENCODE_SESSION_CA_SW, NULL);
   encode_session_ca->encoder_ca = encoder_ca;
+  encode_session_ca->memory_budget = g_object_ref (memory_budget);
   encode_session_ca->surface_width = source_width;
   encode_session_ca->surface_height = source_height;
 
@@ -336,49 +406,35 @@ grd_encode_session_ca_sw_dispose (GObject *object)
   GrdEncodeSessionCaSw *encode_session_ca = GRD_ENCODE_SESSION_CA_SW (object);
   uint32_t i;
 
-  g_assert (g_hash_table_size (encode_session_ca->pending_encodes) == 0);
-  g_assert (g_hash_table_size (encode_session_ca->acquired_encode_streams) == 0);
-  g_assert (g_hash_table_size (encode_session_ca->bitstreams) == 0);
+  g_assert (encode_session_ca->acquired_encode_stream_mask == 0);
 
   for (i = 0; i < N_ENCODE_STREAMS; ++i)
-    g_clear_pointer (&encode_session_ca->encode_streams[i], encode_stream_free);
-
-  g_clear_pointer (&encode_session_ca->surfaces, g_hash_table_unref);
-
-  G_OBJECT_CLASS (grd_encode_session_ca_sw_parent_class)->dispose (object);
-}
+    {
+      g_clear_pointer (&encode_session_ca->stream_bitstreams[i],
+                       grd_bitstream_free);
+      g_clear_pointer (&encode_session_ca->encode_streams[i],
+                       encode_stream_free);
+      if (encode_session_ca->memory_budget)
+        account_stream_capacity (encode_session_ca, i);
+    }
 
-static void
-grd_encode_session_ca_sw_finalize (GObject *object)
-{
-  GrdEncodeSessionCaSw *encode_session_ca = GRD_ENCODE_SESSION_CA_SW (object);
+  for (i = 0; i < N_SRC_SURFACES; ++i)
+    {
+      RGBSurface *surface = encode_session_ca->surfaces[i];
 
-  g_mutex_clear (&encode_session_ca->bitstreams_mutex);
-  g_mutex_clear (&encode_session_ca->acquired_encode_streams_mutex);
-  g_mutex_clear (&encode_session_ca->pending_encodes_mutex);
+      g_assert (!surface || !surface->pending_encode_context);
+      g_clear_pointer (&encode_session_ca->surfaces[i], rgb_surface_free);
+    }
 
-  g_clear_pointer (&encode_session_ca->bitstreams, g_hash_table_unref);
-  g_clear_pointer (&encode_session_ca->acquired_encode_streams, g_hash_table_unref);
-  g_clear_pointer (&encode_session_ca->pending_encodes, g_hash_table_unref);
+  g_clear_object (&encode_session_ca->memory_budget);
 
-  G_OBJECT_CLASS (grd_encode_session_ca_sw_parent_class)->finalize (object);
+  G_OBJECT_CLASS (grd_encode_session_ca_sw_parent_class)->dispose (object);
 }
 
 static void
 grd_encode_session_ca_sw_init (GrdEncodeSessionCaSw *encode_session_ca)
 {
   encode_session_ca->pending_header = TRUE;
-
-  encode_session_ca->surfaces =
-    g_hash_table_new_full (NULL, NULL,
-                           NULL, (GDestroyNotify) rgb_surface_free);
-  encode_session_ca->pending_encodes = g_hash_table_new (NULL, NULL);
-  encode_session_ca->acquired_encode_streams = g_hash_table_new (NULL, NULL);
-  encode_session_ca->bitstreams = g_hash_table_new (NULL, NULL);
-
-  g_mutex_init (&encode_session_ca->pending_encodes_mutex);
-  g_mutex_init (&encode_session_ca->acquired_encode_streams_mutex);
-  g_mutex_init (&encode_session_ca->bitstreams_mutex);
 }
 
 static void
@@ -389,7 +445,6 @@ grd_encode_session_ca_sw_class_init (GrdEncodeSessionCaSwClass *klass)
     GRD_ENCODE_SESSION_CLASS (klass);
 
   object_class->dispose = grd_encode_session_ca_sw_dispose;
-  object_class->finalize = grd_encode_session_ca_sw_finalize;
 
   encode_session_class->get_surface_size =
     grd_encode_session_ca_sw_get_surface_size;
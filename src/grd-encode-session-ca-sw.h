@@ -26,7 +26,8 @@
 G_DECLARE_FINAL_TYPE (GrdEncodeSessionCaSw, grd_encode_session_ca_sw,
                       GRD, ENCODE_SESSION_CA_SW, GrdEncodeSession)
 
-GrdEncodeSessionCaSw *grd_encode_session_ca_sw_new (GrdRdpSwEncoderCa  *encoder_ca,
-                                                    uint32_t            source_width,
-                                                    uint32_t            source_height,
-                                                    GError            **error);
+GrdEncodeSessionCaSw *grd_encode_session_ca_sw_new (GrdRdpSwEncoderCa   *encoder_ca,
+                                                    GrdRdpMemoryBudget  *memory_budget,
+                                                    uint32_t             source_width,
+                                                    uint32_t             source_height,
+                                                    GError             **error);
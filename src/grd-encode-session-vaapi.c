@@ -1788,6 +1788,23 @@ create_avc420_encode_session (GrdEncodeSessionVaapi  *encode_session_vaapi,
   return TRUE;
 }
 
+/*
+ * The driver owned allocations are not queryable, so the estimate assumes
+ * tightly packed NV12 surfaces for the source surfaces, the reference
+ * picture and the reconstructed picture of the frame in flight
+ */
+uint64_t
+grd_encode_session_vaapi_estimate_memory_usage (GrdEncodeSessionVaapi *encode_session_vaapi)
+{
+  uint64_t nv12_surface_size;
+
+  nv12_surface_size = (uint64_t) encode_session_vaapi->surface_width *
+                      encode_session_vaapi->surface_height * 3 / 2;
+
+  return (N_SRC_SURFACES + 2) * nv12_surface_size +
+         N_BITSTREAM_BUFFERS * (uint64_t) encode_session_vaapi->dedicated_buffer_size;
+}
+
 GrdEncodeSessionVaapi *
 grd_encode_session_vaapi_new (GrdVkDevice   *vk_device,
                               VADisplay      va_display,
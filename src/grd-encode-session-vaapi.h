@@ -35,3 +35,5 @@ GrdEncodeSessionVaapi *grd_encode_session_vaapi_new (GrdVkDevice   *vk_device,
                                                      uint32_t       source_height,
                                                      uint32_t       refresh_rate,
                                                      GError       **error);
+
+uint64_t grd_encode_session_vaapi_estimate_memory_usage (GrdEncodeSessionVaapi *encode_session_vaapi);
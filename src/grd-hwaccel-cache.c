@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "grd-hwaccel-cache.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <sys/utsname.h>
+
+#define DRM_CLASS_DIR "/sys/class/drm"
+#define NVIDIA_DRIVER_VERSION_FILE "/proc/driver/nvidia/version"
+
+/*
+ * A failed probe may be caused by something outside of the fingerprint, e.g. a
+ * missing package, so it is retried after some time
+ */
+#define UNSUPPORTED_RESULT_LIFETIME_S (24 * 60 * 60)
+
+static const char *vulkan_icd_dirs[] =
+{
+  "/etc/vulkan/icd.d",
+  "/usr/local/share/vulkan/icd.d",
+  "/usr/share/vulkan/icd.d",
+};
+
+struct _GrdHwAccelCache
+{
+  char *filename;
+  GKeyFile *key_file;
+
+  /* Identifies the device, driver and kernel setup the results belong to */
+  char *fingerprint;
+};
+
+static const char *
+backend_to_key (GrdHwAccelBackend backend)
+{
+  switch (backend)
+    {
+    case GRD_HWACCEL_BACKEND_CUDA:
+      return "cuda";
+    case GRD_HWACCEL_BACKEND_VULKAN:
+      return "vulkan";
+    }
+
+  g_assert_not_reached ();
+}
+
+static const char *
+backend_to_probe_time_key (GrdHwAccelBackend backend)
+{
+  switch (backend)
+    {
+    case GRD_HWACCEL_BACKEND_CUDA:
+      return "cuda-probe-time";
+    case GRD_HWACCEL_BACKEND_VULKAN:
+      return "vulkan-probe-time";
+    }
+
+  g_assert_not_reached ();
+}
+
+static char *
+read_sysfs_value (const char *path)
+{
+  g_autofree char *contents = NULL;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return NULL;
+
+  return g_strdup (g_strstrip (contents));
+}
+
+static int
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return g_strcmp0 (*(const char **) a, *(const char **) b);
+}
+
+static void
+append_render_nodes (GString *fingerprint)
+{
+  g_autoptr (GDir) dir = NULL;
+  g_autoptr (GPtrArray) render_nodes = NULL;
+  const char *name;
+  uint32_t i;
+
+  dir = g_dir_open (DRM_CLASS_DIR, 0, NULL);
+  if (!dir)
+    return;
+
+  render_nodes = g_ptr_array_new_with_free_func (g_free);
+  while ((name = g_dir_read_name (dir)))
+    {
+      if (g_str_has_prefix (name, "renderD"))
+        g_ptr_array_add (render_nodes, g_strdup (name));
+    }
+  g_ptr_array_sort (render_nodes, compare_strings);
+
+  for (i = 0; i < render_nodes->len; ++i)
+    {
+      const char *render_node = g_ptr_array_index (render_nodes, i);
+      g_autofree char *device_dir = NULL;
+      g_autofree char *driver_path = NULL;
+      g_autofree char *driver_link = NULL;
+      g_autofree char *driver = NULL;
+      g_autofree char *vendor_path = NULL;
+      g_autofree char *vendor = NULL;
+      g_autofree char *device_path = NULL;
+      g_autofree char *device = NULL;
+
+      device_dir = g_build_filename (DRM_CLASS_DIR, render_node, "device", NULL);
+
+      driver_path = g_build_filename (device_dir, "driver", NULL);
+      driver_link = g_file_read_link (driver_path, NULL);
+      if (driver_link)
+        driver = g_path_get_basename (driver_link);
+
+      vendor_path = g_build_filename (device_dir, "vendor", NULL);
+      vendor = read_sysfs_value (vendor_path);
+      device_path = g_build_filename (device_dir, "device", NULL);
+      device = read_sysfs_value (device_path);
+
+      g_string_append_printf (fingerprint, "%s:%s:%s:%s\n",
+                              render_node,
+                              driver ? driver : "",
+                              vendor ? vendor : "",
+                              device ? device : "");
+    }
+}
+
+/*
+ * Vulkan drivers (e.g. Mesa) register themselves with an ICD manifest, which
+ * is replaced, when the driver is updated
+ */
+static void
+append_vulkan_icds (GString *fingerprint)
+{
+  uint32_t i;
+
+  for (i = 0; i < G_N_ELEMENTS (vulkan_icd_dirs); ++i)
+    {
+      g_autoptr (GDir) dir = NULL;
+      g_autoptr (GPtrArray) icds = NULL;
+      const char *name;
+      uint32_t j;
+
+      dir = g_dir_open (vulkan_icd_dirs[i], 0, NULL);
+      if (!dir)
+        continue;
+
+      icds = g_ptr_array_new_with_free_func (g_free);
+      while ((name = g_dir_read_name (dir)))
+        g_ptr_array_add (icds, g_strdup (name));
+      g_ptr_array_sort (icds, compare_strings);
+
+      for (j = 0; j < icds->len; ++j)
+        {
+          const char *icd = g_ptr_array_index (icds, j);
+          g_autofree char *icd_path = NULL;
+          GStatBuf stat_buf;
+
+          icd_path = g_build_filename (vulkan_icd_dirs[i], icd, NULL);
+          if (g_stat (icd_path, &stat_buf) != 0)
+            continue;
+
+          g_string_append_printf (fingerprint, "%s:%" G_GINT64_FORMAT "\n",
+                                  icd_path, (int64_t) stat_buf.st_mtime);
+        }
+    }
+}
+
+static char *
+compute_fingerprint (void)
+{
+  g_autoptr (GString) fingerprint = NULL;
+  g_autofree char *nvidia_driver_version = NULL;
+  struct utsname uts = {};
+
+  fingerprint = g_string_new (VERSION "\n");
+
+  if (uname (&uts) == 0)
+    g_string_append_printf (fingerprint, "%s\n", uts.release);
+
+  append_render_nodes (fingerprint);
+  append_vulkan_icds (fingerprint);
+
+  /*
+   * The CUDA and NVENC user space libraries have to match the version of the
+   * kernel driver
+   */
+  if (g_file_get_contents (NVIDIA_DRIVER_VERSION_FILE,
+                           &nvidia_driver_version, NULL, NULL))
+    {
+      char *line_end = strchr (nvidia_driver_version, '\n');
+
+      if (line_end)
+        *line_end = '\0';
+      g_string_append_printf (fingerprint, "%s\n", nvidia_driver_version);
+    }
+
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA256,
+                                        fingerprint->str, fingerprint->len);
+}
+
+GrdHwAccelCache *
+grd_hwaccel_cache_new (void)
+{
+  g_autoptr (GrdHwAccelCache) hwaccel_cache = NULL;
+  g_autoptr (GError) error = NULL;
+
+  hwaccel_cache = g_new0 (GrdHwAccelCache, 1);
+  hwaccel_cache->key_file = g_key_file_new ();
+  hwaccel_cache->fingerprint = compute_fingerprint ();
+  hwaccel_cache->filename = g_build_path ("/",
+                                          g_get_user_cache_dir (),
+                                          "gnome-remote-desktop",
+                                          "hwaccel.ini",
+                                          NULL);
+
+  if (!g_key_file_load_from_file (hwaccel_cache->key_file,
+                                  hwaccel_cache->filename,
+                                  G_KEY_FILE_NONE, &error) &&
+      !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+    g_debug ("[HWAccel] Ignoring capability cache: %s", error->message);
+
+  return g_steal_pointer (&hwaccel_cache);
+}
+
+void
+grd_hwaccel_cache_free (GrdHwAccelCache *hwaccel_cache)
+{
+  g_clear_pointer (&hwaccel_cache->key_file, g_key_file_unref);
+  g_clear_pointer (&hwaccel_cache->fingerprint, g_free);
+  g_clear_pointer (&hwaccel_cache->filename, g_free);
+
+  g_free (hwaccel_cache);
+}
+
+GrdHwAccelSupport
+grd_hwaccel_cache_get_support (GrdHwAccelCache   *hwaccel_cache,
+                               GrdHwAccelBackend  backend)
+{
+  const char *key = backend_to_key (backend);
+  const char *probe_time_key = backend_to_probe_time_key (backend);
+  g_autoptr (GError) error = NULL;
+  gboolean supported;
+  int64_t probe_time_s;
+  int64_t now_s;
+
+  supported = g_key_file_get_boolean (hwaccel_cache->key_file,
+                                      hwaccel_cache->fingerprint, key,
+                                      &error);
+  if (error)
+    return GRD_HWACCEL_SUPPORT_UNKNOWN;
+
+  if (supported)
+    return GRD_HWACCEL_SUPPORT_SUPPORTED;
+
+  probe_time_s = g_key_file_get_int64 (hwaccel_cache->key_file,
+                                       hwaccel_cache->fingerprint,
+                                       probe_time_key, &error);
+  if (error)
+    return GRD_HWACCEL_SUPPORT_UNKNOWN;
+
+  now_s = g_get_real_time () / G_USEC_PER_SEC;
+  if (probe_time_s > now_s ||
+      now_s - probe_time_s >= UNSUPPORTED_RESULT_LIFETIME_S)
+    return GRD_HWACCEL_SUPPORT_UNKNOWN;
+
+  return GRD_HWACCEL_SUPPORT_UNSUPPORTED;
+}
+
+void
+grd_hwaccel_cache_set_support (GrdHwAccelCache   *hwaccel_cache,
+                               GrdHwAccelBackend  backend,
+                               GrdHwAccelSupport  support)
+{
+  const char *key = backend_to_key (backend);
+  const char *probe_time_key = backend_to_probe_time_key (backend);
+
+  g_key_file_remove_key (hwaccel_cache->key_file,
+                         hwaccel_cache->fingerprint, probe_time_key, NULL);
+
+  switch (support)
+    {
+    case GRD_HWACCEL_SUPPORT_UNKNOWN:
+      g_key_file_remove_key (hwaccel_cache->key_file,
+                             hwaccel_cache->fingerprint, key, NULL);
+      break;
+    case GRD_HWACCEL_SUPPORT_UNSUPPORTED:
+      g_key_file_set_boolean (hwaccel_cache->key_file,
+                              hwaccel_cache->fingerprint, key, FALSE);
+      g_key_file_set_int64 (hwaccel_cache->key_file,
+                            hwaccel_cache->fingerprint, probe_time_key,
+                            g_get_real_time () / G_USEC_PER_SEC);
+      break;
+    case GRD_HWACCEL_SUPPORT_SUPPORTED:
+      g_key_file_set_boolean (hwaccel_cache->key_file,
+                              hwaccel_cache->fingerprint, key, TRUE);
+      break;
+    }
+}
+
+gboolean
+grd_hwaccel_cache_save (GrdHwAccelCache  *hwaccel_cache,
+                        GError          **error)
+{
+  g_auto (GStrv) groups = NULL;
+  g_autofree char *dir_path = NULL;
+  char **group;
+
+  /* Results for other setups are stale, once the setup changed */
+  groups = g_key_file_get_groups (hwaccel_cache->key_file, NULL);
+  for (group = groups; *group; ++group)
+    {
+      if (strcmp (*group, hwaccel_cache->fingerprint) != 0)
+        g_key_file_remove_group (hwaccel_cache->key_file, *group, NULL);
+    }
+
+  dir_path = g_path_get_dirname (hwaccel_cache->filename);
+  if (g_mkdir_with_parents (dir_path, 0700) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to create cache directory: %s", g_strerror (errsv));
+      return FALSE;
+    }
+
+  return g_key_file_save_to_file (hwaccel_cache->key_file,
+                                  hwaccel_cache->filename, error);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+typedef struct _GrdHwAccelCache GrdHwAccelCache;
+
+typedef enum _GrdHwAccelBackend
+{
+  GRD_HWACCEL_BACKEND_CUDA,
+  GRD_HWACCEL_BACKEND_VULKAN,
+} GrdHwAccelBackend;
+
+typedef enum _GrdHwAccelSupport
+{
+  GRD_HWACCEL_SUPPORT_UNKNOWN,
+  GRD_HWACCEL_SUPPORT_UNSUPPORTED,
+  GRD_HWACCEL_SUPPORT_SUPPORTED,
+} GrdHwAccelSupport;
+
+GrdHwAccelCache *grd_hwaccel_cache_new (void);
+
+void grd_hwaccel_cache_free (GrdHwAccelCache *hwaccel_cache);
+
+GrdHwAccelSupport grd_hwaccel_cache_get_support (GrdHwAccelCache   *hwaccel_cache,
+                                                 GrdHwAccelBackend  backend);
+
+void grd_hwaccel_cache_set_support (GrdHwAccelCache   *hwaccel_cache,
+                                    GrdHwAccelBackend  backend,
+                                    GrdHwAccelSupport  support);
+
+gboolean grd_hwaccel_cache_save (GrdHwAccelCache  *hwaccel_cache,
+                                 GError          **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GrdHwAccelCache, grd_hwaccel_cache_free)
@@ -811,6 +811,52 @@ load_cuda_function (GrdHwAccelNvidia *hwaccel_nvidia,
   return TRUE;
 }
 
+/*
+ * Checks, whether the CUDA and NVENC libraries are available and whether
+ * there is any CUDA device, without creating any CUDA context.
+ * Can be called from any thread.
+ */
+gboolean
+grd_hwaccel_nvidia_probe (void)
+{
+  CudaFunctions *cuda_funcs = NULL;
+  NvencFunctions *nvenc_funcs = NULL;
+  int cu_device_count = 0;
+  gboolean available = FALSE;
+  CUresult cu_result;
+
+  cuda_load_functions (&cuda_funcs, NULL);
+  nvenc_load_functions (&nvenc_funcs, NULL);
+
+  if (!cuda_funcs || !nvenc_funcs)
+    {
+      g_debug ("[HWAccel.CUDA] Failed to load CUDA or NVENC library");
+      goto out;
+    }
+
+  cu_result = cuda_funcs->cuInit (0);
+  if (cu_result != CUDA_SUCCESS)
+    {
+      g_debug ("[HWAccel.CUDA] Failed to initialize CUDA: %i", cu_result);
+      goto out;
+    }
+
+  cu_result = cuda_funcs->cuDeviceGetCount (&cu_device_count);
+  if (cu_result != CUDA_SUCCESS)
+    {
+      g_debug ("[HWAccel.CUDA] Failed to get CUDA device count: %i", cu_result);
+      goto out;
+    }
+
+  available = cu_device_count > 0;
+
+out:
+  nvenc_free_functions (&nvenc_funcs);
+  cuda_free_functions (&cuda_funcs);
+
+  return available;
+}
+
 GrdHwAccelNvidia *
 grd_hwaccel_nvidia_new (GrdEglThread *egl_thread)
 {
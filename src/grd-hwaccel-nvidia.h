@@ -29,6 +29,8 @@
 G_DECLARE_FINAL_TYPE (GrdHwAccelNvidia, grd_hwaccel_nvidia,
                       GRD, HWACCEL_NVIDIA, GObject)
 
+gboolean grd_hwaccel_nvidia_probe (void);
+
 GrdHwAccelNvidia *grd_hwaccel_nvidia_new (GrdEglThread *egl_thread);
 
 void grd_hwaccel_nvidia_get_cuda_functions (GrdHwAccelNvidia *hwaccel_nvidia,
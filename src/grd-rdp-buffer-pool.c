@@ -24,6 +24,7 @@
 #include "grd-context.h"
 #include "grd-egl-thread.h"
 #include "grd-rdp-legacy-buffer.h"
+#include "grd-rdp-memory-budget.h"
 #include "grd-rdp-renderer.h"
 #include "grd-rdp-server.h"
 #include "grd-rdp-surface.h"
@@ -41,6 +42,9 @@ struct _GrdRdpBufferPool
 
   GrdRdpSurface *rdp_surface;
 
+  GrdRdpMemoryBudget *memory_budget;
+  uint64_t accounted_size;
+
   uint32_t buffer_height;
   uint32_t buffer_stride;
 
@@ -62,6 +66,21 @@ grd_rdp_buffer_pool_get_surface (GrdRdpBufferPool *buffer_pool)
   return buffer_pool->rdp_surface;
 }
 
+static void
+update_accounted_size (GrdRdpBufferPool *buffer_pool)
+{
+  uint64_t pool_size;
+
+  pool_size = (uint64_t) g_hash_table_size (buffer_pool->buffer_table) *
+              buffer_pool->buffer_height * buffer_pool->buffer_stride;
+
+  grd_rdp_memory_budget_account (buffer_pool->memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_BUFFER_POOLS,
+                                 (int64_t) pool_size -
+                                 (int64_t) buffer_pool->accounted_size);
+  buffer_pool->accounted_size = pool_size;
+}
+
 static gboolean
 add_buffer_to_pool (GrdRdpBufferPool *buffer_pool,
                     gboolean          preallocate_on_gpu)
@@ -103,6 +122,7 @@ grd_rdp_buffer_pool_resize_buffers (GrdRdpBufferPool *buffer_pool,
                                     uint32_t          buffer_stride)
 {
   g_autoptr (GMutexLocker) locker = NULL;
+  gboolean success;
 
   locker = g_mutex_locker_new (&buffer_pool->pool_mutex);
   g_assert (buffer_pool->buffers_taken == 0);
@@ -111,10 +131,10 @@ grd_rdp_buffer_pool_resize_buffers (GrdRdpBufferPool *buffer_pool,
   buffer_pool->buffer_stride = buffer_stride;
 
   g_hash_table_remove_all (buffer_pool->buffer_table);
-  if (!fill_buffer_pool (buffer_pool))
-    return FALSE;
+  success = fill_buffer_pool (buffer_pool);
+  update_accounted_size (buffer_pool);
 
-  return TRUE;
+  return success;
 }
 
 static gboolean
@@ -142,6 +162,7 @@ grd_rdp_buffer_pool_acquire (GrdRdpBufferPool *buffer_pool)
   if (g_hash_table_size (buffer_pool->buffer_table) <= buffer_pool->buffers_taken &&
       !add_buffer_to_pool (buffer_pool, FALSE))
     return NULL;
+  update_accounted_size (buffer_pool);
 
   g_hash_table_iter_init (&iter, buffer_pool->buffer_table);
   while (g_hash_table_iter_next (&iter, (gpointer *) &buffer,
@@ -179,6 +200,10 @@ should_resize_buffer_pool (GrdRdpBufferPool *buffer_pool)
   uint32_t minimum_size = buffer_pool->minimum_pool_size;
   uint32_t current_pool_size;
 
+  /* Under memory pressure, also drop the preallocated buffers */
+  if (grd_rdp_memory_budget_is_under_pressure (buffer_pool->memory_budget))
+    minimum_size = 0;
+
   current_pool_size = g_hash_table_size (buffer_pool->buffer_table);
 
   if (current_pool_size > minimum_size &&
@@ -231,6 +256,7 @@ resize_buffer_pool (gpointer user_data)
       if (!buffer_info->buffer_taken)
         g_hash_table_iter_remove (&iter);
     }
+  update_accounted_size (buffer_pool);
   g_mutex_unlock (&buffer_pool->pool_mutex);
 
   return G_SOURCE_CONTINUE;
@@ -272,15 +298,26 @@ static GSourceFuncs buffer_pool_source_funcs =
   .dispatch = buffer_pool_source_dispatch,
 };
 
+static void
+on_memory_trim (GrdRdpMemoryBudget *memory_budget,
+                GrdRdpBufferPool   *buffer_pool)
+{
+  g_source_set_ready_time (buffer_pool->resize_pool_source, 0);
+}
+
 GrdRdpBufferPool *
 grd_rdp_buffer_pool_new (GrdRdpSurface *rdp_surface,
                          uint32_t       minimum_size)
 {
+  GrdSessionRdp *session_rdp =
+    grd_rdp_renderer_get_session (rdp_surface->renderer);
   g_autoptr (GrdRdpBufferPool) buffer_pool = NULL;
 
   buffer_pool = g_object_new (GRD_TYPE_RDP_BUFFER_POOL, NULL);
   buffer_pool->rdp_surface = rdp_surface;
   buffer_pool->minimum_pool_size = minimum_size;
+  buffer_pool->memory_budget =
+    g_object_ref (grd_session_rdp_get_memory_budget (session_rdp));
 
   buffer_pool->resize_pool_source = g_source_new (&buffer_pool_source_funcs,
                                                   sizeof (GSource));
@@ -297,6 +334,10 @@ grd_rdp_buffer_pool_new (GrdRdpSurface *rdp_surface,
   g_source_set_ready_time (buffer_pool->unmap_source, -1);
   g_source_attach (buffer_pool->unmap_source, NULL);
 
+  g_signal_connect_object (buffer_pool->memory_budget, "trim",
+                           G_CALLBACK (on_memory_trim),
+                           buffer_pool, 0);
+
   return g_steal_pointer (&buffer_pool);
 }
 
@@ -362,6 +403,14 @@ grd_rdp_buffer_pool_finalize (GObject *object)
 
   g_clear_pointer (&buffer_pool->buffer_table, g_hash_table_unref);
 
+  if (buffer_pool->memory_budget)
+    {
+      grd_rdp_memory_budget_account (buffer_pool->memory_budget,
+                                     GRD_RDP_MEMORY_CATEGORY_BUFFER_POOLS,
+                                     -(int64_t) buffer_pool->accounted_size);
+    }
+  g_clear_object (&buffer_pool->memory_budget);
+
   /*
    * All buffers need to be destroyed, before the pool is freed to avoid use
    * after free by the EGL thread, when the RDP server is shut down and with it
@@ -27,8 +27,10 @@
 typedef struct
 {
   GrdRdpCursorUpdate *cursor_update;
+  uint32_t hash;
 
-  int64_t last_used;
+  uint16_t cache_index;
+  GList lru_link;
 } GrdRdpCursor;
 
 struct _GrdRdpCursorRenderer
@@ -49,6 +51,12 @@ struct _GrdRdpCursorRenderer
 
   uint32_t pointer_cache_size;
   GrdRdpCursor *pointer_cache;
+  uint32_t n_used_cache_slots;
+
+  /* Maps the content hash of a cached cursor to its cache slot */
+  GHashTable *cursor_table;
+  /* Used cache slots, most recently used cursor first */
+  GQueue cursor_lru_queue;
 
   GMutex update_mutex;
   GrdRdpCursorUpdate *pending_cursor_update;
@@ -183,6 +191,22 @@ is_cursor_hidden (GrdRdpCursorUpdate *cursor_update)
   return TRUE;
 }
 
+static uint32_t
+get_cursor_hash (GrdRdpCursorUpdate *cursor_update)
+{
+  uint32_t hash;
+
+  hash = grd_get_bitmap_hash (cursor_update->bitmap,
+                              cursor_update->width, cursor_update->height,
+                              cursor_update->width * 4u, 4u);
+  hash ^= ((uint32_t) cursor_update->width << 16) | cursor_update->height;
+  hash *= 16777619u;
+  hash ^= ((uint32_t) cursor_update->hotspot_x << 16) | cursor_update->hotspot_y;
+  hash *= 16777619u;
+
+  return hash;
+}
+
 static gboolean
 are_cursor_bitmaps_equal (GrdRdpCursorUpdate *first,
                           GrdRdpCursorUpdate *second)
@@ -228,27 +252,42 @@ use_cached_cursor (GrdRdpCursorRenderer *cursor_renderer,
   use_cached_cursor_fastpath (cursor_renderer, cache_index);
 }
 
-GrdRdpCursor *
-get_cursor_to_replace (GrdRdpCursorRenderer *cursor_renderer,
-                       uint32_t             *cache_index)
+static void
+mark_cached_cursor_as_used (GrdRdpCursorRenderer *cursor_renderer,
+                            GrdRdpCursor         *cached_cursor)
 {
-  GrdRdpCursor *lru_cursor = NULL;
-  uint32_t i;
+  g_queue_unlink (&cursor_renderer->cursor_lru_queue, &cached_cursor->lru_link);
+  g_queue_push_head_link (&cursor_renderer->cursor_lru_queue,
+                          &cached_cursor->lru_link);
+}
 
-  g_assert (cache_index);
+static GrdRdpCursor *
+get_cursor_to_replace (GrdRdpCursorRenderer *cursor_renderer)
+{
+  GrdRdpCursor *lru_cursor;
+  GList *lru_link;
 
-  for (i = 0; i < cursor_renderer->pointer_cache_size; ++i)
+  if (cursor_renderer->n_used_cache_slots < cursor_renderer->pointer_cache_size)
     {
-      GrdRdpCursor *cached_cursor = &cursor_renderer->pointer_cache[i];
+      uint32_t cache_index = cursor_renderer->n_used_cache_slots++;
 
-      /* Least recently used cursor */
-      if (!lru_cursor || lru_cursor->last_used > cached_cursor->last_used)
-        {
-          lru_cursor = cached_cursor;
-          *cache_index = i;
-        }
+      return &cursor_renderer->pointer_cache[cache_index];
     }
-  g_assert (lru_cursor);
+
+  /* Least recently used cursor */
+  lru_link = g_queue_pop_tail_link (&cursor_renderer->cursor_lru_queue);
+  g_assert (lru_link);
+
+  lru_cursor = lru_link->data;
+  g_assert (lru_cursor->cursor_update);
+
+  if (g_hash_table_lookup (cursor_renderer->cursor_table,
+                           GUINT_TO_POINTER (lru_cursor->hash)) == lru_cursor)
+    {
+      g_hash_table_remove (cursor_renderer->cursor_table,
+                           GUINT_TO_POINTER (lru_cursor->hash));
+    }
+  g_clear_pointer (&lru_cursor->cursor_update, grd_rdp_cursor_update_free);
 
   return lru_cursor;
 }
@@ -347,9 +386,9 @@ maybe_update_cursor (GrdRdpCursorRenderer *cursor_renderer,
 {
   GrdRdpCursor *current_cursor = cursor_renderer->current_cursor;
   GrdRdpCursorUpdate *current_cursor_update = NULL;
-  GrdRdpCursor *cursor_slot = NULL;
-  uint32_t cursor_slot_index = 0;
-  uint32_t i;
+  GrdRdpCursor *cached_cursor;
+  GrdRdpCursor *cursor_slot;
+  uint32_t hash;
 
   g_assert (cursor_update->update_type == GRD_RDP_CURSOR_UPDATE_TYPE_NORMAL);
   g_assert (cursor_update->bitmap);
@@ -374,59 +413,47 @@ maybe_update_cursor (GrdRdpCursorRenderer *cursor_renderer,
       return maybe_reset_cursor_shape (cursor_renderer, cursor_update);
     }
 
+  hash = get_cursor_hash (cursor_update);
+
   if (current_cursor_update &&
       current_cursor_update->update_type == GRD_RDP_CURSOR_UPDATE_TYPE_NORMAL &&
+      current_cursor->hash == hash &&
       are_cursor_bitmaps_equal (cursor_update, current_cursor_update))
     {
-      current_cursor->last_used = g_get_monotonic_time ();
+      if (current_cursor == cursor_renderer->current_cached_cursor)
+        mark_cached_cursor_as_used (cursor_renderer, current_cursor);
       return FALSE;
     }
 
-  for (i = 0; i < cursor_renderer->pointer_cache_size; ++i)
+  cached_cursor = g_hash_table_lookup (cursor_renderer->cursor_table,
+                                       GUINT_TO_POINTER (hash));
+  if (cached_cursor && cached_cursor != current_cursor &&
+      are_cursor_bitmaps_equal (cursor_update, cached_cursor->cursor_update))
     {
-      GrdRdpCursor *cached_cursor = &cursor_renderer->pointer_cache[i];
-      GrdRdpCursorUpdate *cached_cursor_update = cached_cursor->cursor_update;
-      GrdRdpCursorUpdateType update_type;
-
-      if (!cached_cursor_update)
-        {
-          g_assert (!cursor_slot);
-          cursor_slot = cached_cursor;
-          cursor_slot_index = i;
-          break;
-        }
-
-      update_type = cached_cursor_update->update_type;
-      g_assert (update_type == GRD_RDP_CURSOR_UPDATE_TYPE_NORMAL);
-
-      g_assert (cached_cursor);
-      if (current_cursor == cached_cursor)
-        continue;
-
-      if (!are_cursor_bitmaps_equal (cursor_update, cached_cursor_update))
-        continue;
-
       cursor_renderer->current_cached_cursor = cached_cursor;
       cursor_renderer->current_cursor = cursor_renderer->current_cached_cursor;
 
-      cached_cursor->last_used = g_get_monotonic_time ();
-      use_cached_cursor (cursor_renderer, i);
+      mark_cached_cursor_as_used (cursor_renderer, cached_cursor);
+      use_cached_cursor (cursor_renderer, cached_cursor->cache_index);
 
       return FALSE;
     }
 
-  if (!cursor_slot)
-    cursor_slot = get_cursor_to_replace (cursor_renderer, &cursor_slot_index);
+  cursor_slot = get_cursor_to_replace (cursor_renderer);
+  g_assert (!cursor_slot->cursor_update);
 
-  g_clear_pointer (&cursor_slot->cursor_update, grd_rdp_cursor_update_free);
   cursor_slot->cursor_update = cursor_update;
+  cursor_slot->hash = hash;
+  g_hash_table_insert (cursor_renderer->cursor_table,
+                       GUINT_TO_POINTER (hash), cursor_slot);
 
   cursor_renderer->current_cached_cursor = cursor_slot;
   cursor_renderer->current_cursor = cursor_renderer->current_cached_cursor;
 
-  cursor_slot->last_used = g_get_monotonic_time ();
-  submit_cursor (cursor_renderer, cursor_update, cursor_slot_index);
-  use_cached_cursor (cursor_renderer, cursor_slot_index);
+  g_queue_push_head_link (&cursor_renderer->cursor_lru_queue,
+                          &cursor_slot->lru_link);
+  submit_cursor (cursor_renderer, cursor_update, cursor_slot->cache_index);
+  use_cached_cursor (cursor_renderer, cursor_slot->cache_index);
 
   return TRUE;
 }
@@ -482,17 +509,11 @@ static GSourceFuncs render_source_funcs =
   .dispatch = render_source_dispatch,
 };
 
-GrdRdpCursorRenderer *
-grd_rdp_cursor_renderer_new (GrdRdpRenderer *renderer,
-                             rdpContext     *rdp_context)
+static void
+init_pointer_cache (GrdRdpCursorRenderer *cursor_renderer)
 {
-  GMainContext *render_context = grd_rdp_renderer_get_graphics_context (renderer);
-  rdpSettings *rdp_settings = rdp_context->settings;
-  GrdRdpCursorRenderer *cursor_renderer;
-  GSource *render_source;
-
-  cursor_renderer = g_object_new (GRD_TYPE_RDP_CURSOR_RENDERER, NULL);
-  cursor_renderer->rdp_context = rdp_context;
+  rdpSettings *rdp_settings = cursor_renderer->rdp_context->settings;
+  uint32_t i;
 
   cursor_renderer->pointer_cache_size =
     freerdp_settings_get_uint32 (rdp_settings, FreeRDP_PointerCacheSize);
@@ -504,6 +525,96 @@ grd_rdp_cursor_renderer_new (GrdRdpRenderer *renderer,
 
   cursor_renderer->pointer_cache = g_new0 (GrdRdpCursor,
                                            cursor_renderer->pointer_cache_size);
+  for (i = 0; i < cursor_renderer->pointer_cache_size; ++i)
+    {
+      GrdRdpCursor *cached_cursor = &cursor_renderer->pointer_cache[i];
+
+      cached_cursor->cache_index = i;
+      cached_cursor->lru_link.data = cached_cursor;
+    }
+}
+
+static void
+clear_pointer_cache (GrdRdpCursorRenderer *cursor_renderer)
+{
+  uint32_t i;
+
+  if (!cursor_renderer->pointer_cache)
+    return;
+
+  for (i = 0; i < cursor_renderer->pointer_cache_size; ++i)
+    {
+      g_clear_pointer (&cursor_renderer->pointer_cache[i].cursor_update,
+                       grd_rdp_cursor_update_free);
+    }
+  g_clear_pointer (&cursor_renderer->pointer_cache, g_free);
+}
+
+static GrdRdpCursorUpdate *
+copy_cursor_update (GrdRdpCursorUpdate *cursor_update)
+{
+  GrdRdpCursorUpdate *copy;
+
+  copy = g_memdup2 (cursor_update, sizeof (GrdRdpCursorUpdate));
+  if (cursor_update->bitmap)
+    {
+      copy->bitmap = g_memdup2 (cursor_update->bitmap,
+                                cursor_update->height * cursor_update->width * 4u);
+    }
+
+  return copy;
+}
+
+/*
+ * Must only be called, while the graphics thread is not running.
+ * A reconnected client starts with an empty pointer cache, so the cache is
+ * reset and the current cursor is submitted again.
+ */
+void
+grd_rdp_cursor_renderer_notify_peer_reattached (GrdRdpCursorRenderer *cursor_renderer,
+                                                rdpContext           *rdp_context)
+{
+  GrdRdpCursor *current_cursor = cursor_renderer->current_cursor;
+  GrdRdpCursorUpdate *cursor_update = NULL;
+
+  if (current_cursor && current_cursor->cursor_update)
+    cursor_update = copy_cursor_update (current_cursor->cursor_update);
+
+  cursor_renderer->current_cursor = NULL;
+  cursor_renderer->current_cached_cursor = NULL;
+  g_clear_pointer (&cursor_renderer->current_system_cursor.cursor_update,
+                   grd_rdp_cursor_update_free);
+
+  g_hash_table_remove_all (cursor_renderer->cursor_table);
+  g_queue_init (&cursor_renderer->cursor_lru_queue);
+  cursor_renderer->n_used_cache_slots = 0;
+  clear_pointer_cache (cursor_renderer);
+
+  cursor_renderer->rdp_context = rdp_context;
+  init_pointer_cache (cursor_renderer);
+
+  g_mutex_lock (&cursor_renderer->update_mutex);
+  if (!cursor_renderer->pending_cursor_update)
+    cursor_renderer->pending_cursor_update = g_steal_pointer (&cursor_update);
+  g_mutex_unlock (&cursor_renderer->update_mutex);
+
+  g_clear_pointer (&cursor_update, grd_rdp_cursor_update_free);
+
+  g_source_set_ready_time (cursor_renderer->render_source, 0);
+}
+
+GrdRdpCursorRenderer *
+grd_rdp_cursor_renderer_new (GrdRdpRenderer *renderer,
+                             rdpContext     *rdp_context)
+{
+  GMainContext *render_context = grd_rdp_renderer_get_graphics_context (renderer);
+  GrdRdpCursorRenderer *cursor_renderer;
+  GSource *render_source;
+
+  cursor_renderer = g_object_new (GRD_TYPE_RDP_CURSOR_RENDERER, NULL);
+  cursor_renderer->rdp_context = rdp_context;
+
+  init_pointer_cache (cursor_renderer);
 
   render_source = g_source_new (&render_source_funcs, sizeof (GSource));
   g_source_set_callback (render_source, maybe_render_cursor,
@@ -526,17 +637,8 @@ grd_rdp_cursor_renderer_dispose (GObject *object)
       g_clear_pointer (&cursor_renderer->render_source, g_source_unref);
     }
 
-  if (cursor_renderer->pointer_cache)
-    {
-      uint32_t i;
-
-      for (i = 0; i < cursor_renderer->pointer_cache_size; ++i)
-        {
-          g_clear_pointer (&cursor_renderer->pointer_cache[i].cursor_update,
-                           grd_rdp_cursor_update_free);
-        }
-      g_clear_pointer (&cursor_renderer->pointer_cache, g_free);
-    }
+  clear_pointer_cache (cursor_renderer);
+  g_clear_pointer (&cursor_renderer->cursor_table, g_hash_table_destroy);
 
   g_clear_pointer (&cursor_renderer->current_system_cursor.cursor_update,
                    grd_rdp_cursor_update_free);
@@ -559,6 +661,9 @@ grd_rdp_cursor_renderer_finalize (GObject *object)
 static void
 grd_rdp_cursor_renderer_init (GrdRdpCursorRenderer *cursor_renderer)
 {
+  cursor_renderer->cursor_table = g_hash_table_new (NULL, NULL);
+  g_queue_init (&cursor_renderer->cursor_lru_queue);
+
   g_mutex_init (&cursor_renderer->update_mutex);
 }
 
@@ -51,5 +51,8 @@ GrdRdpCursorRenderer *grd_rdp_cursor_renderer_new (GrdRdpRenderer *renderer,
 
 void grd_rdp_cursor_renderer_notify_session_ready (GrdRdpCursorRenderer *cursor_renderer);
 
+void grd_rdp_cursor_renderer_notify_peer_reattached (GrdRdpCursorRenderer *cursor_renderer,
+                                                     rdpContext           *rdp_context);
+
 void grd_rdp_cursor_renderer_submit_cursor_update (GrdRdpCursorRenderer *cursor_renderer,
                                                    GrdRdpCursorUpdate   *cursor_update);
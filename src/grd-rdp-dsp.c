@@ -25,9 +25,18 @@
 #include <gio/gio.h>
 #include <opus/opus.h>
 
-#define G711_QUANT_MASK 0xF
-#define G711_SEG_MASK 0x70
-#define G711_SEG_SHIFT 4
+#include "grd-audio-utils.h"
+
+#define OPUS_DEFAULT_FRAME_DURATION_MS 20
+
+/*
+ * Below this bitrate, spend more CPU time per frame to retain as much quality
+ * as possible, above it, the quality gain of the highest complexity settings
+ * is negligible
+ */
+#define OPUS_LOW_BITRATE 32000
+#define OPUS_COMPLEXITY_LOW_BITRATE 10
+#define OPUS_COMPLEXITY_DEFAULT 8
 
 struct _GrdRdpDsp
 {
@@ -38,9 +47,13 @@ struct _GrdRdpDsp
 
   HANDLE_AACENCODER aac_encoder;
   uint32_t aac_frame_length;
+  uint32_t aac_bitrate;
 
   OpusEncoder *opus_encoder;
   uint32_t opus_frame_length;
+  uint32_t opus_bitrate;
+
+  OpusDecoder *opus_decoder;
 };
 
 G_DEFINE_TYPE (GrdRdpDsp, grd_rdp_dsp, G_TYPE_OBJECT)
@@ -84,6 +97,103 @@ grd_rdp_dsp_get_frames_per_packet (GrdRdpDsp      *rdp_dsp,
   g_assert_not_reached ();
 }
 
+static gboolean
+set_aac_bitrate (GrdRdpDsp *rdp_dsp,
+                 uint32_t   bitrate)
+{
+  AACENC_ERROR aac_error;
+
+  /*
+   * Changing the bitrate of an initialized encoder makes it reinitialize
+   * itself with the next encode call
+   */
+  aac_error = aacEncoder_SetParam (rdp_dsp->aac_encoder, AACENC_BITRATE,
+                                   bitrate);
+  if (aac_error != AACENC_OK)
+    {
+      g_warning ("[RDP.DSP] Failed to set AAC encoder bitrate to %u. "
+                 "AAC error %i", bitrate, aac_error);
+      return FALSE;
+    }
+
+  rdp_dsp->aac_bitrate = bitrate;
+
+  return TRUE;
+}
+
+static int
+get_opus_complexity (uint32_t bitrate)
+{
+  if (bitrate < OPUS_LOW_BITRATE)
+    return OPUS_COMPLEXITY_LOW_BITRATE;
+
+  return OPUS_COMPLEXITY_DEFAULT;
+}
+
+static gboolean
+set_opus_bitrate (GrdRdpDsp *rdp_dsp,
+                  uint32_t   bitrate)
+{
+  int complexity = get_opus_complexity (bitrate);
+  int opus_error;
+
+  opus_error = opus_encoder_ctl (rdp_dsp->opus_encoder,
+                                 OPUS_SET_BITRATE(bitrate));
+  if (opus_error != OPUS_OK)
+    {
+      g_warning ("[RDP.DSP] Failed to set Opus encoder bitrate to %u: %s",
+                 bitrate, opus_strerror (opus_error));
+      return FALSE;
+    }
+
+  opus_error = opus_encoder_ctl (rdp_dsp->opus_encoder,
+                                 OPUS_SET_COMPLEXITY(complexity));
+  if (opus_error != OPUS_OK)
+    {
+      g_warning ("[RDP.DSP] Failed to set Opus encoder complexity to %i: %s",
+                 complexity, opus_strerror (opus_error));
+      return FALSE;
+    }
+
+  rdp_dsp->opus_bitrate = bitrate;
+
+  return TRUE;
+}
+
+gboolean
+grd_rdp_dsp_set_bitrate (GrdRdpDsp      *rdp_dsp,
+                         GrdRdpDspCodec  codec,
+                         uint32_t        bitrate)
+{
+  g_assert (rdp_dsp->create_flags & GRD_RDP_DSP_CREATE_FLAG_ENCODER);
+
+  switch (codec)
+    {
+    case GRD_RDP_DSP_CODEC_NONE:
+    case GRD_RDP_DSP_CODEC_ALAW:
+      g_assert_not_reached ();
+      return FALSE;
+    case GRD_RDP_DSP_CODEC_AAC:
+      if (rdp_dsp->aac_bitrate == bitrate)
+        return TRUE;
+
+      g_debug ("[RDP.DSP] Changing AAC encoder bitrate from %u to %u",
+               rdp_dsp->aac_bitrate, bitrate);
+      return set_aac_bitrate (rdp_dsp, bitrate);
+    case GRD_RDP_DSP_CODEC_OPUS:
+      if (rdp_dsp->opus_bitrate == bitrate)
+        return TRUE;
+
+      g_debug ("[RDP.DSP] Changing Opus encoder bitrate from %u to %u",
+               rdp_dsp->opus_bitrate, bitrate);
+      return set_opus_bitrate (rdp_dsp, bitrate);
+    }
+
+  g_assert_not_reached ();
+
+  return FALSE;
+}
+
 static gboolean
 encode_aac (GrdRdpDsp  *rdp_dsp,
             int16_t    *input_data,
@@ -204,35 +314,36 @@ grd_rdp_dsp_encode (GrdRdpDsp       *rdp_dsp,
   return FALSE;
 }
 
-static int16_t
-alaw_to_s16 (uint8_t alaw_value)
+static gboolean
+decode_alaw (GrdRdpDsp  *rdp_dsp,
+             uint8_t    *input_data,
+             uint32_t    input_size,
+             int16_t   **output_data,
+             uint32_t   *output_size)
 {
-  int16_t segment;
-  int16_t temp;
-
-  alaw_value ^= 0x55;
+  g_assert (output_data);
+  g_assert (output_size);
 
-  temp = (alaw_value & G711_QUANT_MASK) << 4;
-  temp += 8;
+  g_assert (input_data);
+  g_assert (input_size > 0);
 
-  segment = (alaw_value & G711_SEG_MASK) >> G711_SEG_SHIFT;
+  *output_size = input_size / sizeof (uint8_t) * sizeof (int16_t);
+  *output_data = g_malloc0 (*output_size);
 
-  if (segment > 0)
-    temp += 0x100;
-  if (segment > 1)
-    temp <<= segment - 1;
+  grd_audio_alaw_to_s16 (input_data, *output_data, input_size);
 
-  return alaw_value > 127 ? temp : -temp;
+  return TRUE;
 }
 
 static gboolean
-decode_alaw (GrdRdpDsp  *rdp_dsp,
+decode_opus (GrdRdpDsp  *rdp_dsp,
              uint8_t    *input_data,
              uint32_t    input_size,
              int16_t   **output_data,
              uint32_t   *output_size)
 {
-  uint32_t i;
+  int n_frames;
+  int length;
 
   g_assert (output_data);
   g_assert (output_size);
@@ -240,11 +351,31 @@ decode_alaw (GrdRdpDsp  *rdp_dsp,
   g_assert (input_data);
   g_assert (input_size > 0);
 
-  *output_size = input_size / sizeof (uint8_t) * sizeof (int16_t);
-  *output_data = g_malloc0 (*output_size);
+  *output_size = 0;
+
+  n_frames = opus_decoder_get_nb_samples (rdp_dsp->opus_decoder,
+                                          input_data, input_size);
+  if (n_frames < 0)
+    {
+      g_warning ("[RDP.DSP] Failed to retrieve number of samples of Opus "
+                 "packet: %s", opus_strerror (n_frames));
+      return FALSE;
+    }
+  if (n_frames == 0)
+    return FALSE;
+
+  *output_data = g_new0 (int16_t, n_frames * rdp_dsp->n_channels);
 
-  for (i = 0; i < input_size; ++i)
-    (*output_data)[i] = alaw_to_s16 (input_data[i]);
+  length = opus_decode (rdp_dsp->opus_decoder, input_data, input_size,
+                        *output_data, n_frames, 0);
+  if (length < 0)
+    {
+      g_warning ("[RDP.DSP] Failed to Opus decode samples: %s",
+                 opus_strerror (length));
+      g_clear_pointer (output_data, g_free);
+      return FALSE;
+    }
+  *output_size = length * rdp_dsp->n_channels * sizeof (int16_t);
 
   return TRUE;
 }
@@ -269,8 +400,8 @@ grd_rdp_dsp_decode (GrdRdpDsp       *rdp_dsp,
       return decode_alaw (rdp_dsp, input_data, input_size,
                           output_data, output_size);
     case GRD_RDP_DSP_CODEC_OPUS:
-      g_assert_not_reached ();
-      return FALSE;
+      return decode_opus (rdp_dsp, input_data, input_size,
+                          output_data, output_size);
     }
 
   g_assert_not_reached ();
@@ -321,6 +452,7 @@ create_aac_encoder (GrdRdpDsp  *rdp_dsp,
                    "AAC error %i", aac_error);
       return FALSE;
     }
+  rdp_dsp->aac_bitrate = bitrate;
 
   aac_error = aacEncoder_SetParam (rdp_dsp->aac_encoder, AACENC_SAMPLERATE,
                                    n_samples_per_sec);
@@ -403,10 +535,24 @@ create_opus_encoder (GrdRdpDsp  *rdp_dsp,
                      uint32_t    n_samples_per_sec,
                      uint32_t    n_channels,
                      uint32_t    bitrate,
+                     uint32_t    frame_duration_ms,
                      GError    **error)
 {
   int opus_error = OPUS_OK;
 
+  if (frame_duration_ms == 0)
+    frame_duration_ms = OPUS_DEFAULT_FRAME_DURATION_MS;
+
+  /* Frame durations (in ms), which are supported by Opus, except for 2.5 ms */
+  if (frame_duration_ms != 5 && frame_duration_ms != 10 &&
+      frame_duration_ms != 20 && frame_duration_ms != 40 &&
+      frame_duration_ms != 60)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid Opus frame duration: %u ms", frame_duration_ms);
+      return FALSE;
+    }
+
   rdp_dsp->opus_encoder = opus_encoder_create (n_samples_per_sec, n_channels,
                                                OPUS_APPLICATION_AUDIO,
                                                &opus_error);
@@ -428,8 +574,35 @@ create_opus_encoder (GrdRdpDsp  *rdp_dsp,
                    opus_strerror (opus_error));
       return FALSE;
     }
+  rdp_dsp->opus_bitrate = bitrate;
 
-  rdp_dsp->opus_frame_length = n_samples_per_sec / 50;
+  opus_error = opus_encoder_ctl (rdp_dsp->opus_encoder,
+                                 OPUS_SET_COMPLEXITY(get_opus_complexity (bitrate)));
+  if (opus_error != OPUS_OK)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to set Opus encoder complexity: %s",
+                   opus_strerror (opus_error));
+      return FALSE;
+    }
+
+  /*
+   * Let the encoder reduce the packet rate during periods of silence or
+   * background noise
+   */
+  opus_error = opus_encoder_ctl (rdp_dsp->opus_encoder, OPUS_SET_DTX(1));
+  if (opus_error != OPUS_OK)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to enable Opus encoder DTX: %s",
+                   opus_strerror (opus_error));
+      return FALSE;
+    }
+
+  rdp_dsp->opus_frame_length = n_samples_per_sec * frame_duration_ms / 1000;
+
+  g_debug ("[RDP.DSP] Opus encoder: Using frame duration of %u ms "
+           "(frame length: %u)", frame_duration_ms, rdp_dsp->opus_frame_length);
 
   return TRUE;
 }
@@ -439,8 +612,6 @@ create_encoders (GrdRdpDsp                  *rdp_dsp,
                  const GrdRdpDspDescriptor  *dsp_descriptor,
                  GError                    **error)
 {
-  rdp_dsp->n_channels = dsp_descriptor->n_channels;
-
   if (!create_aac_encoder (rdp_dsp,
                            dsp_descriptor->n_samples_per_sec_aac,
                            dsp_descriptor->n_channels,
@@ -451,6 +622,43 @@ create_encoders (GrdRdpDsp                  *rdp_dsp,
                             dsp_descriptor->n_samples_per_sec_opus,
                             dsp_descriptor->n_channels,
                             dsp_descriptor->bitrate_opus,
+                            dsp_descriptor->frame_duration_ms_opus,
+                            error))
+    return FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+create_opus_decoder (GrdRdpDsp  *rdp_dsp,
+                     uint32_t    n_samples_per_sec,
+                     uint32_t    n_channels,
+                     GError    **error)
+{
+  int opus_error = OPUS_OK;
+
+  rdp_dsp->opus_decoder = opus_decoder_create (n_samples_per_sec, n_channels,
+                                               &opus_error);
+  if (opus_error != OPUS_OK)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to create Opus decoder: %s",
+                   opus_strerror (opus_error));
+      return FALSE;
+    }
+  g_assert (rdp_dsp->opus_decoder);
+
+  return TRUE;
+}
+
+static gboolean
+create_decoders (GrdRdpDsp                  *rdp_dsp,
+                 const GrdRdpDspDescriptor  *dsp_descriptor,
+                 GError                    **error)
+{
+  if (!create_opus_decoder (rdp_dsp,
+                            dsp_descriptor->n_samples_per_sec_opus,
+                            dsp_descriptor->n_channels,
                             error))
     return FALSE;
 
@@ -465,10 +673,14 @@ grd_rdp_dsp_new (const GrdRdpDspDescriptor  *dsp_descriptor,
 
   rdp_dsp = g_object_new (GRD_TYPE_RDP_DSP, NULL);
   rdp_dsp->create_flags = dsp_descriptor->create_flags;
+  rdp_dsp->n_channels = dsp_descriptor->n_channels;
 
   if (dsp_descriptor->create_flags & GRD_RDP_DSP_CREATE_FLAG_ENCODER &&
       !create_encoders (rdp_dsp, dsp_descriptor, error))
     return NULL;
+  if (dsp_descriptor->create_flags & GRD_RDP_DSP_CREATE_FLAG_DECODER &&
+      !create_decoders (rdp_dsp, dsp_descriptor, error))
+    return NULL;
 
   return g_steal_pointer (&rdp_dsp);
 }
@@ -478,6 +690,7 @@ grd_rdp_dsp_dispose (GObject *object)
 {
   GrdRdpDsp *rdp_dsp = GRD_RDP_DSP (object);
 
+  g_clear_pointer (&rdp_dsp->opus_decoder, opus_decoder_destroy);
   g_clear_pointer (&rdp_dsp->opus_encoder, opus_encoder_destroy);
 
   aacEncClose (&rdp_dsp->aac_encoder);
@@ -45,12 +45,16 @@ typedef struct
 {
   GrdRdpDspCreateFlag create_flags;
 
-  /* Encoder */
-  uint32_t n_samples_per_sec_aac;
+  /* Encoder and decoder */
   uint32_t n_samples_per_sec_opus;
   uint32_t n_channels;
+
+  /* Encoder */
+  uint32_t n_samples_per_sec_aac;
   uint32_t bitrate_aac;
   uint32_t bitrate_opus;
+  /* Opus frame duration in ms, 20 ms if 0 */
+  uint32_t frame_duration_ms_opus;
 } GrdRdpDspDescriptor;
 
 GrdRdpDsp *grd_rdp_dsp_new (const GrdRdpDspDescriptor  *dsp_descriptor,
@@ -61,6 +65,10 @@ const char *grd_rdp_dsp_codec_to_string (GrdRdpDspCodec dsp_codec);
 uint32_t grd_rdp_dsp_get_frames_per_packet (GrdRdpDsp      *rdp_dsp,
                                             GrdRdpDspCodec  codec);
 
+gboolean grd_rdp_dsp_set_bitrate (GrdRdpDsp      *rdp_dsp,
+                                  GrdRdpDspCodec  codec,
+                                  uint32_t        bitrate);
+
 gboolean grd_rdp_dsp_encode (GrdRdpDsp       *rdp_dsp,
                              GrdRdpDspCodec   codec,
                              int16_t         *input_data,
@@ -31,8 +31,24 @@
 
 #define MAX_LOCAL_FRAMES_LIFETIME_US (200 * 1000)
 
+/*
+ * Amount of audio, which is buffered, before the PipeWire source starts (or,
+ * after an underrun, resumes) to output frames, to compensate for the
+ * irregular arrival of packets
+ */
+#define JITTER_BUFFER_DURATION_MS 30
+
+#define PACKET_DURATION_MS 10
+/* Larger Opus frames compress better and reduce the packet overhead */
+#define PACKET_DURATION_MS_OPUS 20
+
 #define N_CHANNELS 2
-#define N_SAMPLES_PER_SEC 44100
+/*
+ * The PipeWire source is created before the format negotiation with the
+ * default rate and switched to the rate of the negotiated format afterwards
+ */
+#define N_SAMPLES_PER_SEC_DEFAULT 44100
+#define N_SAMPLES_PER_SEC_OPUS 48000
 #define N_BYTES_PER_SAMPLE_PCM sizeof (int16_t)
 #define N_BYTES_PER_SAMPLE_ALAW sizeof (uint8_t)
 #define N_BLOCK_ALIGN_PCM (N_CHANNELS * N_BYTES_PER_SAMPLE_PCM)
@@ -81,10 +97,17 @@ struct _GrdRdpDvcAudioInput
   int64_t incoming_data_time_us;
 
   int64_t requested_format_idx;
+  int64_t opus_client_format_idx;
   int64_t alaw_client_format_idx;
   int64_t pcm_client_format_idx;
   GrdRdpDspCodec codec;
 
+  /* Sample rate of the negotiated format */
+  uint32_t n_samples_per_sec;
+  /* Sample rate, the PipeWire source currently announces */
+  uint32_t source_samples_per_sec;
+  GSource *source_rate_update_source;
+
   GrdRdpDsp *rdp_dsp;
 
   GSource *pipewire_source;
@@ -98,6 +121,8 @@ struct _GrdRdpDvcAudioInput
 
   GMutex pending_frames_mutex;
   GQueue *pending_frames;
+  uint32_t n_pending_frames;
+  gboolean awaiting_prefill;
 };
 
 G_DEFINE_TYPE (GrdRdpDvcAudioInput, grd_rdp_dvc_audio_input,
@@ -221,12 +246,23 @@ negotiation_state_to_string (NegotiationState state)
   g_assert_not_reached ();
 }
 
+static const AUDIO_FORMAT audio_format_opus =
+{
+  .wFormatTag = WAVE_FORMAT_OPUS,
+  .nChannels = N_CHANNELS,
+  .nSamplesPerSec = N_SAMPLES_PER_SEC_OPUS,
+  .nAvgBytesPerSec = 8000,
+  .nBlockAlign = 4,
+  .wBitsPerSample = 16,
+  .cbSize = 0,
+};
+
 static const AUDIO_FORMAT audio_format_alaw =
 {
   .wFormatTag = WAVE_FORMAT_ALAW,
   .nChannels = N_CHANNELS,
-  .nSamplesPerSec = N_SAMPLES_PER_SEC,
-  .nAvgBytesPerSec = N_SAMPLES_PER_SEC * N_BLOCK_ALIGN_ALAW,
+  .nSamplesPerSec = N_SAMPLES_PER_SEC_DEFAULT,
+  .nAvgBytesPerSec = N_SAMPLES_PER_SEC_DEFAULT * N_BLOCK_ALIGN_ALAW,
   .nBlockAlign = N_BLOCK_ALIGN_ALAW,
   .wBitsPerSample = N_BYTES_PER_SAMPLE_ALAW * 8,
   .cbSize = 0,
@@ -236,8 +272,8 @@ static const AUDIO_FORMAT audio_format_pcm =
 {
   .wFormatTag = WAVE_FORMAT_PCM,
   .nChannels = N_CHANNELS,
-  .nSamplesPerSec = N_SAMPLES_PER_SEC,
-  .nAvgBytesPerSec = N_SAMPLES_PER_SEC * N_BLOCK_ALIGN_PCM,
+  .nSamplesPerSec = N_SAMPLES_PER_SEC_DEFAULT,
+  .nAvgBytesPerSec = N_SAMPLES_PER_SEC_DEFAULT * N_BLOCK_ALIGN_PCM,
   .nBlockAlign = N_BLOCK_ALIGN_PCM,
   .wBitsPerSample = N_BYTES_PER_SAMPLE_PCM * 8,
   .cbSize = 0,
@@ -245,6 +281,7 @@ static const AUDIO_FORMAT audio_format_pcm =
 
 static AUDIO_FORMAT server_formats[] =
 {
+  audio_format_opus,
   audio_format_alaw,
   audio_format_pcm,
 };
@@ -345,6 +382,8 @@ audin_receive_formats (audin_server_context *audin_context,
   size_t byte_count;
   SNDIN_OPEN open = {};
   WAVEFORMAT_EXTENSIBLE waveformat_extensible = {};
+  uint32_t packet_duration_ms;
+  uint32_t n_samples_per_sec;
   uint32_t i;
 
   current_time_us = g_get_monotonic_time ();
@@ -363,6 +402,9 @@ audin_receive_formats (audin_server_context *audin_context,
     {
       AUDIO_FORMAT *audio_format = &formats->SoundFormats[i];
 
+      if (audio_input->opus_client_format_idx < 0 &&
+          are_audio_formats_equal (audio_format, &audio_format_opus))
+        audio_input->opus_client_format_idx = i;
       if (audio_input->alaw_client_format_idx < 0 &&
           are_audio_formats_equal (audio_format, &audio_format_alaw))
         audio_input->alaw_client_format_idx = i;
@@ -371,7 +413,8 @@ audin_receive_formats (audin_server_context *audin_context,
         audio_input->pcm_client_format_idx = i;
     }
 
-  if (audio_input->alaw_client_format_idx < 0 &&
+  if (audio_input->opus_client_format_idx < 0 &&
+      audio_input->alaw_client_format_idx < 0 &&
       audio_input->pcm_client_format_idx < 0)
     {
       g_warning ("[RDP.AUDIO_INPUT] Audio Format negotiation with client "
@@ -381,17 +424,25 @@ audin_receive_formats (audin_server_context *audin_context,
       return CHANNEL_RC_INITIALIZATION_ERROR;
     }
 
-  g_debug ("[RDP.AUDIO_INPUT] Client Formats: [A-law: %s, PCM: %s]",
+  g_debug ("[RDP.AUDIO_INPUT] Client Formats: [Opus: %s, A-law: %s, PCM: %s]",
+           audio_input->opus_client_format_idx >= 0 ? "true" : "false",
            audio_input->alaw_client_format_idx >= 0 ? "true" : "false",
            audio_input->pcm_client_format_idx >= 0 ? "true" : "false");
 
-  if (audio_input->alaw_client_format_idx >= 0)
+  if (audio_input->opus_client_format_idx >= 0)
+    audio_input->requested_format_idx = audio_input->opus_client_format_idx;
+  else if (audio_input->alaw_client_format_idx >= 0)
     audio_input->requested_format_idx = audio_input->alaw_client_format_idx;
   else if (audio_input->pcm_client_format_idx >= 0)
     audio_input->requested_format_idx = audio_input->pcm_client_format_idx;
   else
     g_assert_not_reached ();
 
+  n_samples_per_sec =
+    formats->SoundFormats[audio_input->requested_format_idx].nSamplesPerSec;
+  g_atomic_int_set (&audio_input->n_samples_per_sec, n_samples_per_sec);
+  g_source_set_ready_time (audio_input->source_rate_update_source, 0);
+
   time_delta_us = current_time_us - audio_input->incoming_data_time_us;
   byte_count = formats->cbSizeFormatsPacket + formats->ExtraDataSize;
   g_debug ("[RDP.AUDIO_INPUT] Measured clients uplink: >= %zuKB/s "
@@ -406,12 +457,17 @@ audin_receive_formats (audin_server_context *audin_context,
                                         SPEAKER_FRONT_RIGHT;
   waveformat_extensible.SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
 
-  open.FramesPerPacket = N_SAMPLES_PER_SEC / 100;
+  if (audio_input->requested_format_idx == audio_input->opus_client_format_idx)
+    packet_duration_ms = PACKET_DURATION_MS_OPUS;
+  else
+    packet_duration_ms = PACKET_DURATION_MS;
+
+  open.FramesPerPacket = n_samples_per_sec * packet_duration_ms / 1000;
   open.initialFormat = audio_input->requested_format_idx;
   open.captureFormat.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
   open.captureFormat.nChannels = N_CHANNELS;
-  open.captureFormat.nSamplesPerSec = N_SAMPLES_PER_SEC;
-  open.captureFormat.nAvgBytesPerSec = N_SAMPLES_PER_SEC * N_BLOCK_ALIGN_PCM;
+  open.captureFormat.nSamplesPerSec = n_samples_per_sec;
+  open.captureFormat.nAvgBytesPerSec = n_samples_per_sec * N_BLOCK_ALIGN_PCM;
   open.captureFormat.nBlockAlign = N_BLOCK_ALIGN_PCM;
   open.captureFormat.wBitsPerSample = N_BYTES_PER_SAMPLE_PCM * 8;
   open.ExtraFormatData = &waveformat_extensible;
@@ -566,6 +622,7 @@ audin_data (audin_server_context *audin_context,
     return CHANNEL_RC_OK;
 
   g_mutex_lock (&audio_input->pending_frames_mutex);
+  audio_input->n_pending_frames += audio_data->n_frames;
   g_queue_push_tail (audio_input->pending_frames, g_steal_pointer (&audio_data));
   g_mutex_unlock (&audio_input->pending_frames_mutex);
 
@@ -610,7 +667,9 @@ audin_receive_format_change (audin_server_context     *audin_context,
       return CHANNEL_RC_INITIALIZATION_ERROR;
     }
 
-  if (audio_input->requested_format_idx == audio_input->alaw_client_format_idx)
+  if (audio_input->requested_format_idx == audio_input->opus_client_format_idx)
+    audio_input->codec = GRD_RDP_DSP_CODEC_OPUS;
+  else if (audio_input->requested_format_idx == audio_input->alaw_client_format_idx)
     audio_input->codec = GRD_RDP_DSP_CODEC_ALAW;
   else if (audio_input->requested_format_idx == audio_input->pcm_client_format_idx)
     audio_input->codec = GRD_RDP_DSP_CODEC_NONE;
@@ -714,12 +773,15 @@ ensure_dvc_is_closed (GrdRdpDvcAudioInput *audio_input)
 
   g_mutex_lock (&audio_input->pending_frames_mutex);
   g_queue_clear_full (audio_input->pending_frames, audio_data_free);
+  audio_input->n_pending_frames = 0;
+  audio_input->awaiting_prefill = TRUE;
   g_mutex_unlock (&audio_input->pending_frames_mutex);
 
   audio_input->negotiation_state = NEGOTIATION_STATE_AWAIT_VERSION;
   audio_input->runtime_state = RT_STATE_AWAIT_INCOMING_DATA;
 
   audio_input->requested_format_idx = -1;
+  audio_input->opus_client_format_idx = -1;
   audio_input->alaw_client_format_idx = -1;
   audio_input->pcm_client_format_idx = -1;
   audio_input->codec = GRD_RDP_DSP_CODEC_NONE;
@@ -732,6 +794,8 @@ ensure_dvc_can_be_opened (GrdRdpDvcAudioInput *audio_input)
 
   /* No need to lock prevent_dvc_init_mutex */
   audio_input->prevent_dvc_initialization = FALSE;
+
+  grd_rdp_dvc_queue_initialization (GRD_RDP_DVC (audio_input));
 }
 
 static void
@@ -807,6 +871,26 @@ clear_old_frames (GrdRdpDvcAudioInput *audio_input)
 
   g_queue_clear_full (audio_input->pending_frames, audio_data_free);
   g_queue_push_tail (audio_input->pending_frames, audio_data);
+
+  audio_input->n_pending_frames = audio_data->n_frames;
+}
+
+static gboolean
+is_jitter_buffer_filled (GrdRdpDvcAudioInput *audio_input)
+{
+  uint32_t n_prefill_frames;
+
+  if (!audio_input->awaiting_prefill)
+    return TRUE;
+
+  n_prefill_frames = g_atomic_int_get (&audio_input->n_samples_per_sec) *
+                     JITTER_BUFFER_DURATION_MS / 1000;
+  if (audio_input->n_pending_frames < n_prefill_frames)
+    return FALSE;
+
+  audio_input->awaiting_prefill = FALSE;
+
+  return TRUE;
 }
 
 static void
@@ -822,7 +906,8 @@ pipewire_stream_process (void *user_data)
   locker = g_mutex_locker_new (&audio_input->pending_frames_mutex);
   clear_old_frames (audio_input);
 
-  if (g_queue_get_length (audio_input->pending_frames) == 0)
+  if (g_queue_get_length (audio_input->pending_frames) == 0 ||
+      !is_jitter_buffer_filled (audio_input))
     return;
 
   buffer = pw_stream_dequeue_buffer (audio_input->pipewire_stream);
@@ -861,11 +946,14 @@ pipewire_stream_process (void *user_data)
 
       audio_data->n_frames -= frames_taken;
       audio_data->sample_offset += frames_taken * N_CHANNELS;
+      audio_input->n_pending_frames -= frames_taken;
       if (audio_data->n_frames == 0)
         audio_data_free (audio_data);
       else
         g_queue_push_head (audio_input->pending_frames, audio_data);
     }
+  if (audio_input->n_pending_frames == 0)
+    audio_input->awaiting_prefill = TRUE;
   g_clear_pointer (&locker, g_mutex_locker_free);
 
   pw_stream_queue_buffer (audio_input->pipewire_stream, buffer);
@@ -879,33 +967,71 @@ static const struct pw_stream_events pipewire_stream_events =
   .process = pipewire_stream_process,
 };
 
-static gboolean
-set_up_audio_source (GrdRdpDvcAudioInput  *audio_input,
-                     GError              **error)
+static const struct spa_pod *
+build_source_format_param (struct spa_pod_builder *pod_builder,
+                           uint32_t                n_samples_per_sec)
 {
-  struct spa_pod_builder pod_builder;
-  const struct spa_pod *params[1];
-  uint8_t params_buffer[1024];
   uint32_t position[N_CHANNELS] = {};
-  int result;
-
-  g_message ("[RDP.AUDIO_INPUT] Setting up Audio Source");
 
   position[0] = SPA_AUDIO_CHANNEL_FL;
   position[1] = SPA_AUDIO_CHANNEL_FR;
 
-  pod_builder = SPA_POD_BUILDER_INIT (params_buffer, sizeof (params_buffer));
-  params[0] = spa_pod_builder_add_object (
-    &pod_builder,
+  return spa_pod_builder_add_object (
+    pod_builder,
     SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
     SPA_FORMAT_mediaType, SPA_POD_Id (SPA_MEDIA_TYPE_audio),
     SPA_FORMAT_mediaSubtype, SPA_POD_Id (SPA_MEDIA_SUBTYPE_raw),
     SPA_FORMAT_AUDIO_format, SPA_POD_Id (SPA_AUDIO_FORMAT_S16),
-    SPA_FORMAT_AUDIO_rate, SPA_POD_Int (N_SAMPLES_PER_SEC),
+    SPA_FORMAT_AUDIO_rate, SPA_POD_Int (n_samples_per_sec),
     SPA_FORMAT_AUDIO_channels, SPA_POD_Int (N_CHANNELS),
     SPA_FORMAT_AUDIO_position, SPA_POD_Array (sizeof (uint32_t), SPA_TYPE_Id,
                                               N_CHANNELS, position),
     0);
+}
+
+static gboolean
+update_source_rate (gpointer user_data)
+{
+  GrdRdpDvcAudioInput *audio_input = user_data;
+  struct spa_pod_builder pod_builder;
+  const struct spa_pod *params[1];
+  uint8_t params_buffer[1024];
+  uint32_t n_samples_per_sec;
+
+  n_samples_per_sec = g_atomic_int_get (&audio_input->n_samples_per_sec);
+  if (!audio_input->pipewire_stream ||
+      audio_input->source_samples_per_sec == n_samples_per_sec)
+    return G_SOURCE_CONTINUE;
+
+  g_debug ("[RDP.AUDIO_INPUT] Switching audio source rate from %uHz to %uHz",
+           audio_input->source_samples_per_sec, n_samples_per_sec);
+
+  pod_builder = SPA_POD_BUILDER_INIT (params_buffer, sizeof (params_buffer));
+  params[0] = build_source_format_param (&pod_builder, n_samples_per_sec);
+
+  pw_stream_update_params (audio_input->pipewire_stream, params, 1);
+  audio_input->source_samples_per_sec = n_samples_per_sec;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+set_up_audio_source (GrdRdpDvcAudioInput  *audio_input,
+                     GError              **error)
+{
+  struct spa_pod_builder pod_builder;
+  const struct spa_pod *params[1];
+  uint8_t params_buffer[1024];
+  int result;
+
+  g_message ("[RDP.AUDIO_INPUT] Setting up Audio Source");
+
+  audio_input->source_samples_per_sec =
+    g_atomic_int_get (&audio_input->n_samples_per_sec);
+
+  pod_builder = SPA_POD_BUILDER_INIT (params_buffer, sizeof (params_buffer));
+  params[0] = build_source_format_param (&pod_builder,
+                                         audio_input->source_samples_per_sec);
 
   audio_input->pipewire_stream =
     pw_stream_new (audio_input->pipewire_core,
@@ -983,6 +1109,8 @@ grd_rdp_dvc_audio_input_new (GrdSessionRdp    *session_rdp,
   audin_context->userdata = audio_input;
 
   dsp_descriptor.create_flags = GRD_RDP_DSP_CREATE_FLAG_DECODER;
+  dsp_descriptor.n_samples_per_sec_opus = N_SAMPLES_PER_SEC_OPUS;
+  dsp_descriptor.n_channels = N_CHANNELS;
 
   audio_input->rdp_dsp = grd_rdp_dsp_new (&dsp_descriptor, &error);
   if (!audio_input->rdp_dsp)
@@ -1016,6 +1144,12 @@ grd_rdp_dvc_audio_input_dispose (GObject *object)
   ensure_dvc_is_closed (audio_input);
   g_assert (!audio_input->protocol_timeout_source);
 
+  if (audio_input->source_rate_update_source)
+    {
+      g_source_destroy (audio_input->source_rate_update_source);
+      g_clear_pointer (&audio_input->source_rate_update_source, g_source_unref);
+    }
+
   if (audio_input->pipewire_stream)
     {
       spa_hook_remove (&audio_input->pipewire_stream_listener);
@@ -1062,24 +1196,51 @@ grd_rdp_dvc_audio_input_finalize (GObject *object)
   G_OBJECT_CLASS (grd_rdp_dvc_audio_input_parent_class)->finalize (object);
 }
 
+static gboolean
+source_dispatch (GSource     *source,
+                 GSourceFunc  callback,
+                 gpointer     user_data)
+{
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs source_funcs =
+{
+  .dispatch = source_dispatch,
+};
+
 static void
 grd_rdp_dvc_audio_input_init (GrdRdpDvcAudioInput *audio_input)
 {
+  GSource *source_rate_update_source;
+
   audio_input->prevent_dvc_initialization = TRUE;
   audio_input->negotiation_state = NEGOTIATION_STATE_AWAIT_VERSION;
   audio_input->runtime_state = RT_STATE_AWAIT_INCOMING_DATA;
 
   audio_input->requested_format_idx = -1;
+  audio_input->opus_client_format_idx = -1;
   audio_input->alaw_client_format_idx = -1;
   audio_input->pcm_client_format_idx = -1;
   audio_input->codec = GRD_RDP_DSP_CODEC_NONE;
+  audio_input->n_samples_per_sec = N_SAMPLES_PER_SEC_DEFAULT;
 
   audio_input->pending_frames = g_queue_new ();
+  audio_input->awaiting_prefill = TRUE;
 
   g_mutex_init (&audio_input->prevent_dvc_init_mutex);
   g_mutex_init (&audio_input->protocol_timeout_mutex);
   g_mutex_init (&audio_input->pending_frames_mutex);
 
+  source_rate_update_source = g_source_new (&source_funcs, sizeof (GSource));
+  g_source_set_callback (source_rate_update_source, update_source_rate,
+                         audio_input, NULL);
+  g_source_set_ready_time (source_rate_update_source, -1);
+  g_source_attach (source_rate_update_source, NULL);
+  audio_input->source_rate_update_source = source_rate_update_source;
+
   pw_init (NULL, NULL);
 }
 
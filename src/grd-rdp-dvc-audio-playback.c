@@ -23,9 +23,13 @@
 
 #include <freerdp/server/rdpsnd.h>
 
+#include "grd-audio-utils.h"
 #include "grd-pipewire-utils.h"
 #include "grd-rdp-audio-output-stream.h"
 #include "grd-rdp-dsp.h"
+#include "grd-rdp-memory-budget.h"
+#include "grd-rdp-network-autodetection.h"
+#include "grd-session-rdp.h"
 
 #define PROTOCOL_TIMEOUT_MS (10 * 1000)
 
@@ -35,6 +39,25 @@
 #define MAX_LOCAL_FRAMES_LIFETIME_US (50 * 1000)
 #define MAX_RENDER_LATENCY_MS 300
 
+/*
+ * Opus clients are served in low latency mode: Small Opus frames are used and
+ * the render latency target adapts to the network conditions, instead of
+ * accepting up to MAX_RENDER_LATENCY_MS
+ */
+#define LOW_LATENCY_OPUS_FRAME_DURATION_MS 10
+#define LOW_LATENCY_MIN_RENDER_LATENCY_MS 50
+
+/*
+ * The encoder bitrate follows the measured bandwidth, of which audio playback
+ * may use a tenth. Bitrate changes smaller than an eighth of the current
+ * bitrate are ignored to avoid constant encoder reconfigurations
+ */
+#define BITRATE_UPDATE_INTERVAL_US (2 * G_USEC_PER_SEC)
+#define BANDWIDTH_SHARE_DIVISOR 10
+#define BITRATE_HYSTERESIS_DIVISOR 8
+#define MIN_BITRATE_AAC 32000
+#define MIN_BITRATE_OPUS 16000
+
 #define N_CHANNELS 2
 #define N_SAMPLES_PER_SEC_DEFAULT 44100
 #define N_SAMPLES_PER_SEC_OPUS 48000
@@ -44,12 +67,37 @@
 #define TRAINING_PACKSIZE 1024
 #define TRAINING_TIMESTAMP 0
 
-typedef struct _AudioData
+/*
+ * Must be a power of two, so that the ring buffer positions can wrap around
+ * at 2^32 without breaking the offset calculation
+ */
+#define RING_BUFFER_SIZE (1 << 17)
+
+/*
+ * Captured PCM data is passed from the PipeWire side (producer) to the encode
+ * thread (consumer) via a single-producer/single-consumer ring buffer.
+ * Producer side operations are serialized via the stream lock mutex.
+ *
+ * All positions are byte positions, that only ever increase and only the
+ * respective side advances its positions:
+ * The producer advances write_pos and discard_pos, the consumer read_pos.
+ * To drop all pending data, the producer sets discard_pos to its current
+ * write_pos, which makes the consumer skip all data before that position.
+ * Discards are only applied by the consumer, once it does not use any data
+ * before read_pos any more. Until then, the producer does not reuse that
+ * space, as it only considers read_pos for the free space.
+ */
+typedef struct _AudioRingBuffer
 {
-  int16_t *data;
-  uint32_t size;
-  int64_t timestamp_us;
-} AudioData;
+  uint8_t *data;
+
+  uint32_t write_pos;
+  uint32_t discard_pos;
+  /* Lower 32 bits of the monotonic time of the last write */
+  uint32_t last_write_time_us;
+
+  uint32_t read_pos;
+} AudioRingBuffer;
 
 typedef struct _BlockInfo
 {
@@ -88,6 +136,13 @@ struct _GrdRdpDvcAudioPlayback
   GrdRdpDsp *rdp_dsp;
   uint32_t sample_buffer_size;
 
+  GrdRdpNetworkAutodetection *network_autodetection;
+  gboolean low_latency_mode;
+  gboolean has_rtt_consumer;
+
+  uint32_t bitrate;
+  int64_t last_bitrate_update_us;
+
   GMutex block_mutex;
   BlockInfo block_infos[256];
 
@@ -111,8 +166,13 @@ struct _GrdRdpDvcAudioPlayback
   int64_t first_empty_audio_data_us;
   gboolean has_empty_audio_timestamp;
 
-  GMutex pending_frames_mutex;
-  GQueue *pending_frames;
+  AudioRingBuffer ring_buffer;
+
+  /* Used for packets, which wrap around the end of the ring buffer */
+  uint8_t *packet_buffer;
+  uint32_t packet_buffer_size;
+
+  GrdRdpMemoryBudget *memory_budget;
 };
 
 G_DEFINE_TYPE (GrdRdpDvcAudioPlayback, grd_rdp_dvc_audio_playback,
@@ -210,21 +270,6 @@ does_volume_mute_audio (const GrdRdpAudioVolumeData *volume_data)
   return TRUE;
 }
 
-static gboolean
-is_audio_data_empty (int16_t  *data,
-                     uint32_t  size)
-{
-  uint32_t i;
-
-  for (i = 0; i < size / sizeof (int16_t); ++i)
-    {
-      if (data[i] != 0)
-        return FALSE;
-    }
-
-  return TRUE;
-}
-
 static void
 set_other_streams_inactive (GrdRdpDvcAudioPlayback *audio_playback)
 {
@@ -250,6 +295,29 @@ set_other_streams_inactive (GrdRdpDvcAudioPlayback *audio_playback)
   g_mutex_lock (&audio_playback->stream_lock_mutex);
 }
 
+/*
+ * Up to date round trip times are only needed, while audio is played back.
+ * Must be called with the stream lock mutex held
+ */
+static void
+update_rtt_necessity (GrdRdpDvcAudioPlayback *audio_playback)
+{
+  GrdRdpNwAutodetectRTTNecessity rtt_necessity;
+
+  if (!audio_playback->has_rtt_consumer)
+    return;
+
+  if (audio_playback->has_stream_lock)
+    rtt_necessity = GRD_RDP_NW_AUTODETECT_RTT_NEC_HIGH;
+  else
+    rtt_necessity = GRD_RDP_NW_AUTODETECT_RTT_NEC_LOW;
+
+  grd_rdp_network_autodetection_set_rtt_consumer_necessity (
+    audio_playback->network_autodetection,
+    GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_AUDIO,
+    rtt_necessity);
+}
+
 static void
 acquire_stream_lock (GrdRdpDvcAudioPlayback *audio_playback,
                      uint32_t                node_id)
@@ -261,16 +329,136 @@ acquire_stream_lock (GrdRdpDvcAudioPlayback *audio_playback,
   audio_playback->locked_node_id = node_id;
   audio_playback->has_stream_lock = TRUE;
 
+  update_rtt_necessity (audio_playback);
+
   set_other_streams_inactive (audio_playback);
 }
 
+static uint32_t
+ring_buffer_get_pending_size (AudioRingBuffer *ring_buffer)
+{
+  uint32_t read_pos = g_atomic_int_get (&ring_buffer->read_pos);
+  uint32_t discard_pos = g_atomic_int_get (&ring_buffer->discard_pos);
+
+  if ((int32_t) (discard_pos - read_pos) > 0)
+    read_pos = discard_pos;
+
+  return g_atomic_int_get (&ring_buffer->write_pos) - read_pos;
+}
+
+/* Producer side */
+static uint32_t
+ring_buffer_get_free_size (AudioRingBuffer *ring_buffer)
+{
+  uint32_t read_pos = g_atomic_int_get (&ring_buffer->read_pos);
+
+  return RING_BUFFER_SIZE - (ring_buffer->write_pos - read_pos);
+}
+
+static gboolean
+ring_buffer_write (AudioRingBuffer *ring_buffer,
+                   const uint8_t   *data,
+                   uint32_t         size)
+{
+  uint32_t write_pos = ring_buffer->write_pos;
+  uint32_t offset = write_pos & (RING_BUFFER_SIZE - 1);
+  uint32_t first_part_size;
+
+  if (size > ring_buffer_get_free_size (ring_buffer))
+    return FALSE;
+
+  first_part_size = MIN (size, RING_BUFFER_SIZE - offset);
+  memcpy (ring_buffer->data + offset, data, first_part_size);
+  memcpy (ring_buffer->data, data + first_part_size, size - first_part_size);
+
+  g_atomic_int_set (&ring_buffer->last_write_time_us,
+                    (uint32_t) g_get_monotonic_time ());
+  g_atomic_int_set (&ring_buffer->write_pos, write_pos + size);
+
+  return TRUE;
+}
+
+/* Producer side */
+static void
+ring_buffer_discard (AudioRingBuffer *ring_buffer)
+{
+  g_atomic_int_set (&ring_buffer->discard_pos, ring_buffer->write_pos);
+}
+
+/* Consumer side */
+static uint32_t
+ring_buffer_apply_discard (AudioRingBuffer *ring_buffer)
+{
+  uint32_t read_pos = ring_buffer->read_pos;
+  uint32_t discard_pos = g_atomic_int_get (&ring_buffer->discard_pos);
+
+  if ((int32_t) (discard_pos - read_pos) > 0)
+    {
+      read_pos = discard_pos;
+      g_atomic_int_set (&ring_buffer->read_pos, read_pos);
+    }
+
+  return read_pos;
+}
+
+/* Consumer side */
 static void
-audio_data_free (gpointer data)
+ring_buffer_drop (AudioRingBuffer *ring_buffer,
+                  uint32_t         max_remaining_size)
 {
-  AudioData *audio_data = data;
+  uint32_t read_pos = ring_buffer_apply_discard (ring_buffer);
+  uint32_t write_pos = g_atomic_int_get (&ring_buffer->write_pos);
+
+  if (write_pos - read_pos > max_remaining_size)
+    read_pos = write_pos - max_remaining_size;
 
-  g_free (audio_data->data);
-  g_free (audio_data);
+  g_atomic_int_set (&ring_buffer->read_pos, read_pos);
+}
+
+/*
+ * Returns the next size bytes of the ring buffer or NULL, if not enough data
+ * is pending. If they wrap around the end of the ring buffer, they are copied
+ * into the given buffer.
+ * The returned data is owned by the consumer until ring_buffer_consume() is
+ * called with the returned read position and may therefore be modified in
+ * place.
+ */
+static uint8_t *
+ring_buffer_peek (AudioRingBuffer *ring_buffer,
+                  uint32_t         size,
+                  uint8_t         *wrap_buffer,
+                  uint32_t        *out_read_pos)
+{
+  uint32_t read_pos = ring_buffer_apply_discard (ring_buffer);
+  uint32_t offset = read_pos & (RING_BUFFER_SIZE - 1);
+  uint32_t first_part_size;
+
+  if (g_atomic_int_get (&ring_buffer->write_pos) - read_pos < size)
+    return NULL;
+
+  *out_read_pos = read_pos;
+
+  if (offset + size <= RING_BUFFER_SIZE)
+    return ring_buffer->data + offset;
+
+  first_part_size = RING_BUFFER_SIZE - offset;
+  memcpy (wrap_buffer, ring_buffer->data + offset, first_part_size);
+  memcpy (wrap_buffer + first_part_size, ring_buffer->data,
+          size - first_part_size);
+
+  return wrap_buffer;
+}
+
+/*
+ * Advances from the position returned by ring_buffer_peek(). Discards, that
+ * happened in the meantime, are applied with the next peek or drop
+ */
+static void
+ring_buffer_consume (AudioRingBuffer *ring_buffer,
+                     uint32_t         read_pos,
+                     uint32_t         size)
+{
+  g_atomic_int_set (&ring_buffer->read_pos, read_pos + size);
 }
 
 static void
@@ -298,9 +486,7 @@ release_stream_lock (GrdRdpDvcAudioPlayback *audio_playback)
   g_debug ("[RDP.AUDIO_PLAYBACK] Unlocking audio stream (was locked to "
            "node id %u)", audio_playback->locked_node_id);
 
-  g_mutex_lock (&audio_playback->pending_frames_mutex);
-  g_queue_clear_full (audio_playback->pending_frames, audio_data_free);
-  g_mutex_unlock (&audio_playback->pending_frames_mutex);
+  ring_buffer_discard (&audio_playback->ring_buffer);
 
   g_mutex_lock (&audio_playback->block_mutex);
   for (i = 0; i < 256; ++i)
@@ -313,6 +499,8 @@ release_stream_lock (GrdRdpDvcAudioPlayback *audio_playback)
 
   audio_playback->has_stream_lock = FALSE;
 
+  update_rtt_necessity (audio_playback);
+
   set_all_streams_active (audio_playback);
 }
 
@@ -338,22 +526,6 @@ is_locked_stream_idling_too_long (GrdRdpDvcAudioPlayback *audio_playback)
   return FALSE;
 }
 
-static uint32_t
-get_pending_audio_data_size (GrdRdpDvcAudioPlayback *audio_playback)
-{
-  AudioData *audio_data;
-  uint32_t pending_size = 0;
-  GQueue *tmp;
-
-  tmp = g_queue_copy (audio_playback->pending_frames);
-  while ((audio_data = g_queue_pop_head (tmp)))
-    pending_size += audio_data->size;
-
-  g_queue_free (tmp);
-
-  return pending_size;
-}
-
 void
 grd_rdp_dvc_audio_playback_maybe_submit_samples (GrdRdpDvcAudioPlayback *audio_playback,
                                                  uint32_t                node_id,
@@ -372,7 +544,8 @@ grd_rdp_dvc_audio_playback_maybe_submit_samples (GrdRdpDvcAudioPlayback *audio_p
   prepare_volume_data (volume_data);
   audio_muted = does_volume_mute_audio (volume_data);
 
-  data_is_empty = audio_muted || is_audio_data_empty (data, size);
+  data_is_empty = audio_muted ||
+                  grd_audio_is_silent_s16 (data, size / sizeof (int16_t));
 
   locker = g_mutex_locker_new (&audio_playback->stream_lock_mutex);
   if (audio_playback->has_stream_lock &&
@@ -406,25 +579,22 @@ grd_rdp_dvc_audio_playback_maybe_submit_samples (GrdRdpDvcAudioPlayback *audio_p
   if (!data_is_empty)
     audio_playback->has_empty_audio_timestamp = FALSE;
 
-  g_mutex_lock (&audio_playback->pending_frames_mutex);
-  pending_size = get_pending_audio_data_size (audio_playback);
+  pending_size = ring_buffer_get_pending_size (&audio_playback->ring_buffer);
 
   if (!data_is_empty ||
       (pending_size > 0 && pending_size < audio_playback->sample_buffer_size))
     {
-      AudioData *audio_data;
-
-      audio_data = g_new0 (AudioData, 1);
-      audio_data->data = g_memdup2 (data, size);
-      audio_data->size = size;
-      audio_data->timestamp_us = g_get_monotonic_time ();
-
-      g_queue_push_tail (audio_playback->pending_frames, audio_data);
+      if (!ring_buffer_write (&audio_playback->ring_buffer,
+                              (uint8_t *) data, size))
+        {
+          g_debug ("[RDP.AUDIO_PLAYBACK] Ring buffer full, dropping %u bytes",
+                   size);
+          return;
+        }
 
       if (pending_size + size >= audio_playback->sample_buffer_size)
         pending_encode = TRUE;
     }
-  g_mutex_unlock (&audio_playback->pending_frames_mutex);
 
   if (pending_encode)
     g_source_set_ready_time (audio_playback->encode_source, 0);
@@ -577,6 +747,22 @@ prepare_client_format (GrdRdpDvcAudioPlayback *audio_playback)
     }
 
   audio_playback->n_samples_per_sec = get_sample_rate (audio_playback);
+  audio_playback->low_latency_mode =
+    audio_playback->codec == GRD_RDP_DSP_CODEC_OPUS;
+
+  if (audio_playback->low_latency_mode &&
+      audio_playback->network_autodetection &&
+      !audio_playback->has_rtt_consumer)
+    {
+      g_mutex_lock (&audio_playback->stream_lock_mutex);
+      grd_rdp_network_autodetection_ensure_rtt_consumer (
+        audio_playback->network_autodetection,
+        GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_AUDIO);
+      audio_playback->has_rtt_consumer = TRUE;
+
+      update_rtt_necessity (audio_playback);
+      g_mutex_unlock (&audio_playback->stream_lock_mutex);
+    }
 
   switch (audio_playback->codec)
     {
@@ -740,10 +926,11 @@ encode_thread_func (gpointer data)
 }
 
 GrdRdpDvcAudioPlayback *
-grd_rdp_dvc_audio_playback_new (GrdSessionRdp    *session_rdp,
-                                GrdRdpDvcHandler *dvc_handler,
-                                HANDLE            vcm,
-                                rdpContext       *rdp_context)
+grd_rdp_dvc_audio_playback_new (GrdSessionRdp              *session_rdp,
+                                GrdRdpDvcHandler           *dvc_handler,
+                                HANDLE                      vcm,
+                                rdpContext                 *rdp_context,
+                                GrdRdpNetworkAutodetection *network_autodetection)
 {
   g_autoptr (GrdRdpDvcAudioPlayback) audio_playback = NULL;
   RdpsndServerContext *rdpsnd_context;
@@ -756,11 +943,18 @@ grd_rdp_dvc_audio_playback_new (GrdSessionRdp    *session_rdp,
     g_error ("[RDP.AUDIO_PLAYBACK] Failed to create server context");
 
   audio_playback->rdpsnd_context = rdpsnd_context;
+  audio_playback->network_autodetection = network_autodetection;
 
   grd_rdp_dvc_initialize_base (GRD_RDP_DVC (audio_playback),
                                dvc_handler, session_rdp,
                                GRD_RDP_CHANNEL_AUDIO_PLAYBACK);
 
+  audio_playback->memory_budget =
+    g_object_ref (grd_session_rdp_get_memory_budget (session_rdp));
+  grd_rdp_memory_budget_account (audio_playback->memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_AUDIO,
+                                 RING_BUFFER_SIZE);
+
   rdpsnd_context->use_dynamic_virtual_channel = TRUE;
   rdpsnd_context->server_formats = server_formats;
   rdpsnd_context->num_server_formats = G_N_ELEMENTS (server_formats);
@@ -780,6 +974,7 @@ grd_rdp_dvc_audio_playback_new (GrdSessionRdp    *session_rdp,
   dsp_descriptor.n_channels = N_CHANNELS;
   dsp_descriptor.bitrate_aac = audio_format_aac.nAvgBytesPerSec * 8;
   dsp_descriptor.bitrate_opus = audio_format_opus.nAvgBytesPerSec * 8;
+  dsp_descriptor.frame_duration_ms_opus = LOW_LATENCY_OPUS_FRAME_DURATION_MS;
 
   audio_playback->rdp_dsp = grd_rdp_dsp_new (&dsp_descriptor, &error);
   if (!audio_playback->rdp_dsp)
@@ -816,6 +1011,20 @@ grd_rdp_dvc_audio_playback_dispose (GObject *object)
     }
   grd_rdp_dvc_maybe_unsubscribe_creation_status (dvc);
 
+  g_mutex_lock (&audio_playback->stream_lock_mutex);
+  if (audio_playback->has_rtt_consumer)
+    {
+      grd_rdp_network_autodetection_set_rtt_consumer_necessity (
+        audio_playback->network_autodetection,
+        GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_AUDIO,
+        GRD_RDP_NW_AUTODETECT_RTT_NEC_LOW);
+      grd_rdp_network_autodetection_remove_rtt_consumer (
+        audio_playback->network_autodetection,
+        GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_AUDIO);
+      audio_playback->has_rtt_consumer = FALSE;
+    }
+  g_mutex_unlock (&audio_playback->stream_lock_mutex);
+
   if (audio_playback->rdpsnd_context)
     audio_playback->rdpsnd_context->server_formats = NULL;
 
@@ -867,11 +1076,18 @@ grd_rdp_dvc_audio_playback_dispose (GObject *object)
 
   g_clear_pointer (&audio_playback->encode_context, g_main_context_unref);
 
-  if (audio_playback->pending_frames)
+  if (audio_playback->memory_budget)
     {
-      g_queue_free_full (audio_playback->pending_frames, audio_data_free);
-      audio_playback->pending_frames = NULL;
+      grd_rdp_memory_budget_account (audio_playback->memory_budget,
+                                     GRD_RDP_MEMORY_CATEGORY_AUDIO,
+                                     -(int64_t) (RING_BUFFER_SIZE +
+                                                 audio_playback->packet_buffer_size));
+      audio_playback->packet_buffer_size = 0;
     }
+  g_clear_object (&audio_playback->memory_budget);
+
+  g_clear_pointer (&audio_playback->ring_buffer.data, g_free);
+  g_clear_pointer (&audio_playback->packet_buffer, g_free);
 
   g_clear_pointer (&audio_playback->rdpsnd_context, rdpsnd_server_context_free);
 
@@ -883,7 +1099,6 @@ grd_rdp_dvc_audio_playback_finalize (GObject *object)
 {
   GrdRdpDvcAudioPlayback *audio_playback = GRD_RDP_DVC_AUDIO_PLAYBACK (object);
 
-  g_mutex_clear (&audio_playback->pending_frames_mutex);
   g_mutex_clear (&audio_playback->stream_lock_mutex);
   g_mutex_clear (&audio_playback->streams_mutex);
   g_mutex_clear (&audio_playback->block_mutex);
@@ -931,22 +1146,28 @@ set_up_static_virtual_channel (gpointer user_data)
 static void
 clear_old_frames (GrdRdpDvcAudioPlayback *audio_playback)
 {
-  int64_t current_time_us;
-  AudioData *audio_data;
-  GQueue *tmp;
-
-  current_time_us = g_get_monotonic_time ();
-  tmp = g_queue_copy (audio_playback->pending_frames);
-
-  while ((audio_data = g_queue_pop_head (tmp)))
+  AudioRingBuffer *ring_buffer = &audio_playback->ring_buffer;
+  uint32_t last_write_time_us;
+  uint32_t time_since_last_write_us;
+  uint64_t max_remaining_frames = 0;
+
+  last_write_time_us = g_atomic_int_get (&ring_buffer->last_write_time_us);
+  time_since_last_write_us = (uint32_t) g_get_monotonic_time () -
+                             last_write_time_us;
+
+  /*
+   * The last written frame was captured at the time of the last write, and
+   * every frame before it one sample period earlier. This allows to determine
+   * the age of every pending frame
+   */
+  if (time_since_last_write_us < MAX_LOCAL_FRAMES_LIFETIME_US)
     {
-      if (current_time_us - audio_data->timestamp_us > MAX_LOCAL_FRAMES_LIFETIME_US)
-        audio_data_free (g_queue_pop_head (audio_playback->pending_frames));
-      else
-        break;
+      max_remaining_frames =
+        (uint64_t) (MAX_LOCAL_FRAMES_LIFETIME_US - time_since_last_write_us) *
+        audio_playback->n_samples_per_sec / G_USEC_PER_SEC;
     }
 
-  g_queue_free (tmp);
+  ring_buffer_drop (ring_buffer, max_remaining_frames * N_BLOCK_ALIGN_PCM);
 }
 
 static uint32_t
@@ -979,17 +1200,66 @@ get_current_render_latency (GrdRdpDvcAudioPlayback *audio_playback)
   return accumulated_render_latency_ms / n_latencies;
 }
 
+static uint32_t
+get_render_latency_target (GrdRdpDvcAudioPlayback *audio_playback)
+{
+  int64_t base_round_trip_time_us = 0;
+  int64_t avg_round_trip_time_us = 0;
+  int64_t jitter_us;
+  int64_t target_ms;
+
+  if (!audio_playback->low_latency_mode)
+    return MAX_RENDER_LATENCY_MS;
+
+  if (audio_playback->network_autodetection)
+    {
+      grd_rdp_network_autodetection_get_round_trip_times (
+        audio_playback->network_autodetection,
+        &base_round_trip_time_us, &avg_round_trip_time_us);
+    }
+
+  /*
+   * Use the deviation of the average round trip time from the base round
+   * trip time as jitter estimation and leave room for twice the jitter and
+   * the one-way delay
+   */
+  jitter_us = avg_round_trip_time_us - base_round_trip_time_us;
+  target_ms = LOW_LATENCY_MIN_RENDER_LATENCY_MS +
+              (avg_round_trip_time_us / 2 + 2 * jitter_us) / 1000;
+
+  return MIN (target_ms, MAX_RENDER_LATENCY_MS);
+}
+
 static void
 maybe_drop_pending_frames (GrdRdpDvcAudioPlayback *audio_playback)
 {
+  AudioRingBuffer *ring_buffer = &audio_playback->ring_buffer;
   uint32_t render_latency_ms;
+  uint32_t render_latency_target_ms;
+  uint64_t excess_frames;
+  uint32_t pending_size;
+  uint32_t drop_size;
   uint16_t i;
 
   render_latency_ms = get_current_render_latency (audio_playback);
-  if (render_latency_ms <= MAX_RENDER_LATENCY_MS)
+  render_latency_target_ms = get_render_latency_target (audio_playback);
+  if (render_latency_ms <= render_latency_target_ms)
     return;
 
-  g_queue_clear_full (audio_playback->pending_frames, audio_data_free);
+  /*
+   * Only drop as many pending frames as needed to get back to the latency
+   * target, instead of dropping all of them
+   */
+  excess_frames = (uint64_t) (render_latency_ms - render_latency_target_ms) *
+                  audio_playback->n_samples_per_sec / 1000;
+  pending_size = ring_buffer_get_pending_size (ring_buffer);
+  drop_size = MIN (excess_frames * N_BLOCK_ALIGN_PCM, pending_size);
+
+  g_debug ("[RDP.AUDIO_PLAYBACK] Render latency %ums exceeds target %ums, "
+           "dropping %u bytes", render_latency_ms, render_latency_target_ms,
+           drop_size);
+
+  ring_buffer_drop (ring_buffer, pending_size - drop_size);
 
   g_mutex_lock (&audio_playback->block_mutex);
   for (i = 0; i < 256; ++i)
@@ -1001,134 +1271,142 @@ maybe_drop_pending_frames (GrdRdpDvcAudioPlayback *audio_playback)
   g_mutex_unlock (&audio_playback->block_mutex);
 }
 
-static void
-apply_volume_to_audio_data (GrdRdpDvcAudioPlayback      *audio_playback,
-                            const GrdRdpAudioVolumeData *volume_data,
-                            int16_t                     *data,
-                            uint32_t                     frames)
-{
-  uint32_t i, j;
-
-  g_assert (N_CHANNELS <= SPA_AUDIO_MAX_CHANNELS);
-
-  for (i = 0; i < frames; ++i)
-    {
-      for (j = 0; j < N_CHANNELS; ++j)
-        {
-          float pcm;
-
-          pcm = volume_data->volumes[j] * data[i * N_CHANNELS + j];
-          data[i * N_CHANNELS + j] = pcm;
-        }
-    }
-}
-
 static void
 maybe_send_frames (GrdRdpDvcAudioPlayback      *audio_playback,
                    const GrdRdpAudioVolumeData *volume_data)
 {
   RdpsndServerContext *rdpsnd_context = audio_playback->rdpsnd_context;
+  AudioRingBuffer *ring_buffer = &audio_playback->ring_buffer;
   int32_t client_format_idx = audio_playback->client_format_idx;
+  uint32_t sample_buffer_size = audio_playback->sample_buffer_size;
   GrdRdpDspCodec codec = audio_playback->codec;
-  g_autofree uint8_t *raw_data = NULL;
-  uint32_t raw_data_size = 0;
-  uint32_t copied_data = 0;
-  g_autofree uint8_t *out_data = NULL;
+  uint8_t *raw_data;
+  g_autofree uint8_t *encoded_data = NULL;
+  const uint8_t *out_data = NULL;
   uint32_t out_size = 0;
   gboolean success = FALSE;
   BlockInfo *block_info;
+  uint32_t read_pos;
 
   g_assert (N_BLOCK_ALIGN_PCM > 0);
-  g_assert (audio_playback->sample_buffer_size > 0);
-  g_assert (audio_playback->sample_buffer_size % N_BLOCK_ALIGN_PCM == 0);
+  g_assert (sample_buffer_size > 0);
+  g_assert (sample_buffer_size % N_BLOCK_ALIGN_PCM == 0);
   g_assert (!audio_playback->pending_training_confirm);
 
-  raw_data_size = get_pending_audio_data_size (audio_playback);
-  if (raw_data_size < audio_playback->sample_buffer_size)
+  if (ring_buffer_get_pending_size (ring_buffer) < sample_buffer_size)
     return;
 
-  g_assert (raw_data_size > 0);
-  raw_data = g_malloc0 (audio_playback->sample_buffer_size);
-
-  while (copied_data < audio_playback->sample_buffer_size)
+  if (audio_playback->packet_buffer_size != sample_buffer_size)
     {
-      AudioData *audio_data;
-      uint32_t sample_size;
-      uint32_t frames_taken;
+      grd_rdp_memory_budget_account (audio_playback->memory_budget,
+                                     GRD_RDP_MEMORY_CATEGORY_AUDIO,
+                                     (int64_t) sample_buffer_size -
+                                     (int64_t) audio_playback->packet_buffer_size);
+
+      g_free (audio_playback->packet_buffer);
+      audio_playback->packet_buffer = g_malloc0 (sample_buffer_size);
+      audio_playback->packet_buffer_size = sample_buffer_size;
+    }
 
-      audio_data = g_queue_pop_head (audio_playback->pending_frames);
+  raw_data = ring_buffer_peek (ring_buffer, sample_buffer_size,
+                               audio_playback->packet_buffer, &read_pos);
+  if (!raw_data)
+    return;
 
-      g_assert (audio_data);
-      g_assert (audio_data->size % N_BLOCK_ALIGN_PCM == 0);
+  g_assert (N_CHANNELS <= SPA_AUDIO_MAX_CHANNELS);
+  grd_audio_apply_volume_s16 ((int16_t *) raw_data,
+                              sample_buffer_size / N_BLOCK_ALIGN_PCM,
+                              N_CHANNELS, volume_data->volumes);
 
-      sample_size = N_BLOCK_ALIGN_PCM;
-      frames_taken = audio_data->size / sample_size;
+  switch (codec)
+    {
+    case GRD_RDP_DSP_CODEC_NONE:
+      out_data = raw_data;
+      out_size = sample_buffer_size;
+      success = TRUE;
+      break;
+    case GRD_RDP_DSP_CODEC_AAC:
+    case GRD_RDP_DSP_CODEC_ALAW:
+    case GRD_RDP_DSP_CODEC_OPUS:
+      success = grd_rdp_dsp_encode (audio_playback->rdp_dsp, codec,
+                                    (int16_t *) raw_data, sample_buffer_size,
+                                    sizeof (int16_t), &encoded_data, &out_size);
+      out_data = encoded_data;
+      break;
+    }
 
-      g_assert (audio_data->size >= N_BLOCK_ALIGN_PCM);
+  if (success)
+    {
+      g_mutex_lock (&audio_playback->block_mutex);
+      block_info = &audio_playback->block_infos[rdpsnd_context->block_no];
 
-      if (copied_data + audio_data->size > audio_playback->sample_buffer_size)
-        {
-          AudioData *remaining_audio_data;
-          uint32_t processed_size;
-          uint32_t remaining_size;
-
-          processed_size = audio_playback->sample_buffer_size - copied_data;
-          g_assert (processed_size % N_BLOCK_ALIGN_PCM == 0);
-
-          frames_taken = processed_size / sample_size;
-
-          remaining_size = audio_data->size - processed_size;
-          if (remaining_size >= N_BLOCK_ALIGN_PCM)
-            {
-              remaining_audio_data = g_new0 (AudioData, 1);
-              remaining_audio_data->data =
-                g_memdup2 (((uint8_t *) audio_data->data) + processed_size,
-                           remaining_size);
-              remaining_audio_data->size = remaining_size;
-              remaining_audio_data->timestamp_us = audio_data->timestamp_us;
-
-              g_queue_push_head (audio_playback->pending_frames, remaining_audio_data);
-            }
-        }
+      block_info->render_latency_ms = 0;
+      g_mutex_unlock (&audio_playback->block_mutex);
+
+      rdpsnd_context->SendSamples2 (rdpsnd_context, client_format_idx,
+                                    out_data, out_size, 0, 0);
+    }
 
-      apply_volume_to_audio_data (audio_playback, volume_data,
-                                  (int16_t *) audio_data->data,
-                                  frames_taken);
+  ring_buffer_consume (ring_buffer, read_pos, sample_buffer_size);
+}
 
-      memcpy (raw_data + copied_data, audio_data->data,
-              frames_taken * sample_size);
-      copied_data += frames_taken * sample_size;
+static void
+maybe_update_bitrate (GrdRdpDvcAudioPlayback *audio_playback)
+{
+  GrdRdpDspCodec codec = audio_playback->codec;
+  uint32_t min_bitrate;
+  uint32_t max_bitrate;
+  uint32_t bandwidth_kbits;
+  uint32_t bitrate;
+  uint32_t bitrate_delta;
+  int64_t current_time_us;
 
-      audio_data_free (audio_data);
-    }
+  if (!audio_playback->network_autodetection)
+    return;
 
   switch (codec)
     {
     case GRD_RDP_DSP_CODEC_NONE:
-      out_data = g_steal_pointer (&raw_data);
-      out_size = copied_data;
-      success = TRUE;
-      break;
-    case GRD_RDP_DSP_CODEC_AAC:
     case GRD_RDP_DSP_CODEC_ALAW:
+      return;
+    case GRD_RDP_DSP_CODEC_AAC:
+      min_bitrate = MIN_BITRATE_AAC;
+      max_bitrate = audio_format_aac.nAvgBytesPerSec * 8;
+      break;
     case GRD_RDP_DSP_CODEC_OPUS:
-      success = grd_rdp_dsp_encode (audio_playback->rdp_dsp, codec,
-                                    (int16_t *) raw_data, copied_data,
-                                    sizeof (int16_t), &out_data, &out_size);
+      min_bitrate = MIN_BITRATE_OPUS;
+      max_bitrate = audio_format_opus.nAvgBytesPerSec * 8;
       break;
     }
 
-  if (!success)
+  current_time_us = g_get_monotonic_time ();
+  if (current_time_us - audio_playback->last_bitrate_update_us <
+      BITRATE_UPDATE_INTERVAL_US)
     return;
 
-  g_mutex_lock (&audio_playback->block_mutex);
-  block_info = &audio_playback->block_infos[rdpsnd_context->block_no];
+  audio_playback->last_bitrate_update_us = current_time_us;
 
-  block_info->render_latency_ms = 0;
-  g_mutex_unlock (&audio_playback->block_mutex);
+  bandwidth_kbits = grd_rdp_network_autodetection_get_bandwidth_kbits (
+    audio_playback->network_autodetection);
+  if (bandwidth_kbits == 0)
+    return;
+
+  bitrate = CLAMP ((uint64_t) bandwidth_kbits * 1000 / BANDWIDTH_SHARE_DIVISOR,
+                   min_bitrate, max_bitrate);
+  if (audio_playback->bitrate == 0)
+    audio_playback->bitrate = max_bitrate;
+
+  if (bitrate > audio_playback->bitrate)
+    bitrate_delta = bitrate - audio_playback->bitrate;
+  else
+    bitrate_delta = audio_playback->bitrate - bitrate;
+
+  if (bitrate != max_bitrate && bitrate != min_bitrate &&
+      bitrate_delta < audio_playback->bitrate / BITRATE_HYSTERESIS_DIVISOR)
+    return;
 
-  rdpsnd_context->SendSamples2 (rdpsnd_context, client_format_idx,
-                                out_data, out_size, 0, 0);
+  if (grd_rdp_dsp_set_bitrate (audio_playback->rdp_dsp, codec, bitrate))
+    audio_playback->bitrate = bitrate;
 }
 
 static gboolean
@@ -1166,13 +1444,11 @@ maybe_encode_frames (gpointer user_data)
 
   prepare_volume_data (&volume_data);
 
-  g_mutex_lock (&audio_playback->pending_frames_mutex);
   clear_old_frames (audio_playback);
   maybe_drop_pending_frames (audio_playback);
+  maybe_update_bitrate (audio_playback);
 
-  if (g_queue_get_length (audio_playback->pending_frames) > 0)
-    maybe_send_frames (audio_playback, &volume_data);
-  g_mutex_unlock (&audio_playback->pending_frames_mutex);
+  maybe_send_frames (audio_playback, &volume_data);
 
   return G_SOURCE_CONTINUE;
 }
@@ -1397,13 +1673,12 @@ grd_rdp_dvc_audio_playback_init (GrdRdpDvcAudioPlayback *audio_playback)
 
   audio_playback->audio_streams = g_hash_table_new_full (NULL, NULL,
                                                          NULL, g_object_unref);
-  audio_playback->pending_frames = g_queue_new ();
+  audio_playback->ring_buffer.data = g_malloc0 (RING_BUFFER_SIZE);
 
   g_mutex_init (&audio_playback->protocol_timeout_mutex);
   g_mutex_init (&audio_playback->block_mutex);
   g_mutex_init (&audio_playback->streams_mutex);
   g_mutex_init (&audio_playback->stream_lock_mutex);
-  g_mutex_init (&audio_playback->pending_frames_mutex);
 
   audio_playback->encode_context = g_main_context_new ();
 
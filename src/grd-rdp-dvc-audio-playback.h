@@ -25,10 +25,11 @@
 G_DECLARE_FINAL_TYPE (GrdRdpDvcAudioPlayback, grd_rdp_dvc_audio_playback,
                       GRD, RDP_DVC_AUDIO_PLAYBACK, GrdRdpDvc)
 
-GrdRdpDvcAudioPlayback *grd_rdp_dvc_audio_playback_new (GrdSessionRdp    *session_rdp,
-                                                        GrdRdpDvcHandler *dvc_handler,
-                                                        HANDLE            vcm,
-                                                        rdpContext       *rdp_context);
+GrdRdpDvcAudioPlayback *grd_rdp_dvc_audio_playback_new (GrdSessionRdp              *session_rdp,
+                                                        GrdRdpDvcHandler           *dvc_handler,
+                                                        HANDLE                      vcm,
+                                                        rdpContext                 *rdp_context,
+                                                        GrdRdpNetworkAutodetection *network_autodetection);
 
 void grd_rdp_dvc_audio_playback_maybe_submit_samples (GrdRdpDvcAudioPlayback *audio_playback,
                                                       uint32_t                node_id,
@@ -89,6 +89,11 @@ struct _GrdRdpDvcGraphicsPipeline
   GrdRdpNetworkAutodetection *network_autodetection;
   wStream *encode_stream;
   RFX_CONTEXT *rfx_context;
+  uint16_t rfx_context_width;
+  uint16_t rfx_context_height;
+
+  RFX_RECT *rfx_rects;
+  int n_max_rfx_rects;
 
   GSource *protocol_timeout_source;
 
@@ -1343,6 +1348,28 @@ rfx_progressive_write_message (RFX_MESSAGE *rfx_message,
   Stream_Write_UINT32 (s, block_len); /* blockLen */
 }
 
+static void
+maybe_reset_rfx_context (GrdRdpDvcGraphicsPipeline *graphics_pipeline,
+                         uint16_t                   surface_width,
+                         uint16_t                   surface_height)
+{
+  /*
+   * Resetting the RFX context discards its state, so only do that, when the
+   * surface size actually changes. See maybe_reset_rfx_context () in
+   * grd-rdp-sw-encoder-ca.c for the effect on the frameIndex
+   */
+  if (graphics_pipeline->rfx_context_width == surface_width &&
+      graphics_pipeline->rfx_context_height == surface_height)
+    return;
+
+  rfx_context_set_mode (graphics_pipeline->rfx_context, RLGR1);
+  rfx_context_reset (graphics_pipeline->rfx_context,
+                     surface_width, surface_height);
+
+  graphics_pipeline->rfx_context_width = surface_width;
+  graphics_pipeline->rfx_context_height = surface_height;
+}
+
 static gboolean
 refresh_gfx_surface_rfx_progressive (GrdRdpDvcGraphicsPipeline *graphics_pipeline,
                                      GrdRdpSurface             *rdp_surface,
@@ -1378,9 +1405,7 @@ refresh_gfx_surface_rfx_progressive (GrdRdpDvcGraphicsPipeline *graphics_pipelin
   if (!region)
     return FALSE;
 
-  rfx_context_set_mode (graphics_pipeline->rfx_context, RLGR1);
-  rfx_context_reset (graphics_pipeline->rfx_context,
-                     surface_width, surface_height);
+  maybe_reset_rfx_context (graphics_pipeline, surface_width, surface_height);
 
   codec_context_id = grd_rdp_gfx_surface_get_codec_context_id (gfx_surface);
   g_mutex_lock (&graphics_pipeline->gfx_mutex);
@@ -1390,7 +1415,15 @@ refresh_gfx_surface_rfx_progressive (GrdRdpDvcGraphicsPipeline *graphics_pipelin
   g_mutex_unlock (&graphics_pipeline->gfx_mutex);
 
   n_rects = cairo_region_num_rectangles (region);
-  rfx_rects = g_malloc0 (n_rects * sizeof (RFX_RECT));
+  if (n_rects > graphics_pipeline->n_max_rfx_rects)
+    {
+      graphics_pipeline->rfx_rects = g_renew (RFX_RECT,
+                                              graphics_pipeline->rfx_rects,
+                                              n_rects);
+      graphics_pipeline->n_max_rfx_rects = n_rects;
+    }
+  rfx_rects = graphics_pipeline->rfx_rects;
+
   for (i = 0; i < n_rects; ++i)
     {
       cairo_region_get_rectangle (region, i, &cairo_rect);
@@ -1409,7 +1442,6 @@ refresh_gfx_surface_rfx_progressive (GrdRdpDvcGraphicsPipeline *graphics_pipelin
                                     surface_width,
                                     surface_height,
                                     src_stride);
-  g_free (rfx_rects);
 
   GetSystemTime (&system_time);
   cmd_start.timestamp = system_time.wHour << 22 |
@@ -2234,6 +2266,7 @@ grd_rdp_dvc_graphics_pipeline_dispose (GObject *object)
   g_clear_pointer (&graphics_pipeline->surface_hwaccel_table, g_hash_table_destroy);
 
   g_clear_pointer (&graphics_pipeline->cap_sets, g_free);
+  g_clear_pointer (&graphics_pipeline->rfx_rects, g_free);
 
   g_assert (g_hash_table_size (graphics_pipeline->serial_surface_table) == 0);
   g_clear_pointer (&graphics_pipeline->serial_surface_table, g_hash_table_destroy);
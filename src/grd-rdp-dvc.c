@@ -64,6 +64,14 @@ grd_rdp_dvc_maybe_init (GrdRdpDvc *dvc)
   klass->maybe_init (dvc);
 }
 
+void
+grd_rdp_dvc_queue_initialization (GrdRdpDvc *dvc)
+{
+  GrdRdpDvcPrivate *priv = grd_rdp_dvc_get_instance_private (dvc);
+
+  grd_session_rdp_queue_dvc_initialization (priv->session_rdp);
+}
+
 void
 grd_rdp_dvc_queue_channel_tear_down (GrdRdpDvc *dvc)
 {
@@ -42,6 +42,8 @@ void grd_rdp_dvc_initialize_base (GrdRdpDvc        *dvc,
 
 void grd_rdp_dvc_maybe_init (GrdRdpDvc *dvc);
 
+void grd_rdp_dvc_queue_initialization (GrdRdpDvc *dvc);
+
 void grd_rdp_dvc_queue_channel_tear_down (GrdRdpDvc *dvc);
 
 void grd_rdp_dvc_subscribe_creation_status (GrdRdpDvc                       *dvc,
@@ -24,6 +24,8 @@
 #include <gio/gio.h>
 #include <xkbcommon/xkbcommon-keysyms.h>
 
+#include "grd-debug.h"
+
 typedef enum _RdpEventType
 {
   RDP_EVENT_TYPE_NONE,
@@ -40,6 +42,8 @@ typedef struct _RdpEvent
 {
   RdpEventType type;
 
+  int64_t queued_us;
+
   /* RDP_EVENT_TYPE_INPUT_KBD_KEYCODE */
   struct
   {
@@ -102,6 +106,12 @@ struct _GrdRdpEventQueue
   GMutex event_mutex;
   GQueue *queue;
 
+  gboolean debug_input_times;
+  uint64_t n_dispatched_events;
+  uint64_t n_coalesced_events;
+  int64_t total_dispatch_latency_us;
+  int64_t max_dispatch_latency_us;
+
   GCancellable *pending_sync_cancellable;
   gboolean expected_caps_lock_state;
   gboolean expected_num_lock_state;
@@ -197,13 +207,35 @@ grd_rdp_event_queue_flush_synchronization (GrdRdpEventQueue *rdp_event_queue)
 }
 
 static void
-process_rdp_events (GrdRdpEventQueue *rdp_event_queue)
+update_dispatch_latency (GrdRdpEventQueue *rdp_event_queue,
+                         RdpEvent         *rdp_event,
+                         int64_t           dispatch_us)
+{
+  int64_t latency_us = dispatch_us - rdp_event->queued_us;
+
+  ++rdp_event_queue->n_dispatched_events;
+  rdp_event_queue->total_dispatch_latency_us += latency_us;
+  rdp_event_queue->max_dispatch_latency_us =
+    MAX (rdp_event_queue->max_dispatch_latency_us, latency_us);
+}
+
+static void
+process_rdp_events (GrdRdpEventQueue *rdp_event_queue,
+                    GQueue           *queue)
 {
   GrdSession *session = GRD_SESSION (rdp_event_queue->session_rdp);
+  int64_t dispatch_us = g_get_monotonic_time ();
+  int64_t max_batch_latency_us = 0;
+  uint32_t n_events = 0;
   RdpEvent *rdp_event;
 
-  while ((rdp_event = g_queue_pop_head (rdp_event_queue->queue)))
+  while ((rdp_event = g_queue_pop_head (queue)))
     {
+      max_batch_latency_us = MAX (max_batch_latency_us,
+                                  dispatch_us - rdp_event->queued_us);
+      update_dispatch_latency (rdp_event_queue, rdp_event, dispatch_us);
+      ++n_events;
+
       switch (rdp_event->type)
         {
         case RDP_EVENT_TYPE_NONE:
@@ -246,21 +278,88 @@ process_rdp_events (GrdRdpEventQueue *rdp_event_queue)
 
       free_rdp_event (rdp_event);
     }
+
+  if (rdp_event_queue->debug_input_times && n_events > 0)
+    {
+      g_debug ("[RDP] InputDispatch[Times]: events: %u, max latency: %liµs",
+               n_events, max_batch_latency_us);
+    }
 }
 
-void
-grd_rdp_event_queue_flush (GrdRdpEventQueue *rdp_event_queue)
+static void
+flush_rdp_event_queue (GrdRdpEventQueue *rdp_event_queue)
 {
+  GQueue queue = G_QUEUE_INIT;
+
+  /*
+   * Only take over the pending events under the lock. Dispatching them to
+   * the compositor can take a while and the socket thread must not be
+   * blocked by that, when queueing new input events.
+   */
   g_mutex_lock (&rdp_event_queue->event_mutex);
-  process_rdp_events (rdp_event_queue);
+  queue = *rdp_event_queue->queue;
+  g_queue_init (rdp_event_queue->queue);
   g_mutex_unlock (&rdp_event_queue->event_mutex);
+
+  process_rdp_events (rdp_event_queue, &queue);
+}
+
+void
+grd_rdp_event_queue_flush (GrdRdpEventQueue *rdp_event_queue)
+{
+  flush_rdp_event_queue (rdp_event_queue);
+}
+
+static gboolean
+maybe_coalesce_rdp_event (GrdRdpEventQueue *rdp_event_queue,
+                          RdpEvent         *rdp_event)
+{
+  RdpEvent *last_rdp_event;
+
+  last_rdp_event = g_queue_peek_tail (rdp_event_queue->queue);
+  if (!last_rdp_event || last_rdp_event->type != rdp_event->type)
+    return FALSE;
+
+  /*
+   * Only pointer motion is coalesced and only when there is no other event in
+   * between, so that the event order for e.g. buttons is kept intact.
+   * The queueing time of the older event is kept, so that the dispatch latency
+   * accounts for the whole time the pointer motion was pending.
+   */
+  switch (rdp_event->type)
+    {
+    case RDP_EVENT_TYPE_INPUT_PTR_MOTION:
+      last_rdp_event->input_ptr_motion.dx += rdp_event->input_ptr_motion.dx;
+      last_rdp_event->input_ptr_motion.dy += rdp_event->input_ptr_motion.dy;
+      return TRUE;
+    case RDP_EVENT_TYPE_INPUT_PTR_MOTION_ABS:
+      if (last_rdp_event->input_ptr_motion_abs.stream !=
+          rdp_event->input_ptr_motion_abs.stream)
+        return FALSE;
+
+      last_rdp_event->input_ptr_motion_abs.motion_abs =
+        rdp_event->input_ptr_motion_abs.motion_abs;
+      return TRUE;
+    default:
+      return FALSE;
+    }
 }
 
 static void
 queue_rdp_event (GrdRdpEventQueue *rdp_event_queue,
                  RdpEvent         *rdp_event)
 {
+  rdp_event->queued_us = g_get_monotonic_time ();
+
   g_mutex_lock (&rdp_event_queue->event_mutex);
+  if (maybe_coalesce_rdp_event (rdp_event_queue, rdp_event))
+    {
+      ++rdp_event_queue->n_coalesced_events;
+      g_mutex_unlock (&rdp_event_queue->event_mutex);
+
+      g_clear_pointer (&rdp_event, free_rdp_event);
+      return;
+    }
   g_queue_push_tail (rdp_event_queue->queue, rdp_event);
   g_mutex_unlock (&rdp_event_queue->event_mutex);
 
@@ -398,9 +497,7 @@ flush_rdp_events (gpointer user_data)
 {
   GrdRdpEventQueue *rdp_event_queue = user_data;
 
-  g_mutex_lock (&rdp_event_queue->event_mutex);
-  process_rdp_events (rdp_event_queue);
-  g_mutex_unlock (&rdp_event_queue->event_mutex);
+  flush_rdp_event_queue (rdp_event_queue);
 
   return G_SOURCE_CONTINUE;
 }
@@ -432,6 +529,11 @@ grd_rdp_event_queue_new (GrdSessionRdp *session_rdp)
   flush_source = g_source_new (&flush_source_funcs, sizeof (GSource));
   g_source_set_callback (flush_source, flush_rdp_events, rdp_event_queue, NULL);
   g_source_set_ready_time (flush_source, -1);
+  /*
+   * Input is latency sensitive. Don't let it queue up behind e.g. clipboard
+   * transfers or layout changes, which are handled on the main context too.
+   */
+  g_source_set_priority (flush_source, G_PRIORITY_HIGH);
   g_source_attach (flush_source, NULL);
   rdp_event_queue->flush_source = flush_source;
 
@@ -449,6 +551,18 @@ grd_rdp_event_queue_dispose (GObject *object)
       g_clear_pointer (&rdp_event_queue->flush_source, g_source_unref);
     }
 
+  if (rdp_event_queue->debug_input_times &&
+      rdp_event_queue->n_dispatched_events > 0)
+    {
+      g_debug ("[RDP] InputDispatch[Summary]: dispatched events: %lu, "
+               "coalesced events: %lu, avg latency: %liµs, max latency: %liµs",
+               rdp_event_queue->n_dispatched_events,
+               rdp_event_queue->n_coalesced_events,
+               rdp_event_queue->total_dispatch_latency_us /
+               (int64_t) rdp_event_queue->n_dispatched_events,
+               rdp_event_queue->max_dispatch_latency_us);
+    }
+
   G_OBJECT_CLASS (grd_rdp_event_queue_parent_class)->dispose (object);
 }
 
@@ -472,6 +586,9 @@ grd_rdp_event_queue_init (GrdRdpEventQueue *rdp_event_queue)
 {
   rdp_event_queue->queue = g_queue_new ();
 
+  if (grd_get_debug_flags () & GRD_DEBUG_INPUT_TIMES)
+    rdp_event_queue->debug_input_times = TRUE;
+
   g_mutex_init (&rdp_event_queue->event_mutex);
 }
 
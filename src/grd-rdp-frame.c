@@ -25,8 +25,27 @@
 #include "grd-rdp-render-context.h"
 #include "grd-rdp-renderer.h"
 
+/*
+ * A frame either holds one image view (RFX Progressive), two image views
+ * (AVC420, AVC444v2 dual frame), or one image view (AVC444v2 frame upgrade)
+ */
+#define MAX_IMAGE_VIEWS 2
+
+struct _GrdRdpFramePool
+{
+  GMutex pool_mutex;
+  GrdRdpFrame *free_frames;
+
+  uint32_t n_allocated_frames;
+  uint32_t n_free_frames;
+  uint64_t n_recycled_frames;
+};
+
 struct _GrdRdpFrame
 {
+  GrdRdpFramePool *frame_pool;
+  GrdRdpFrame *next_free_frame;
+
   GrdRdpRenderer *renderer;
   GrdRdpRenderContext *render_context;
 
@@ -41,8 +60,17 @@ struct _GrdRdpFrame
 
   GrdEncodeContext *encode_context;
 
+  /*
+   * The list links are embedded in the frame, so that acquiring image views
+   * does not require any heap allocation
+   */
+  GList acquired_image_view_links[MAX_IMAGE_VIEWS];
+  uint32_t n_acquired_image_views;
   GList *acquired_image_views;
-  GQueue *unused_image_views;
+
+  GList unused_image_view_links[MAX_IMAGE_VIEWS];
+  uint32_t n_unused_image_view_links;
+  GQueue unused_image_views;
 
   GrdRdpBuffer *src_buffer_new;
   GrdRdpBuffer *src_buffer_old;
@@ -137,12 +165,12 @@ grd_rdp_frame_set_avc_view_type (GrdRdpFrame         *rdp_frame,
   switch (rdp_frame->view_type)
     {
     case GRD_RDP_FRAME_VIEW_TYPE_DUAL:
-      g_assert (g_queue_get_length (rdp_frame->unused_image_views) == 2);
-      g_queue_pop_tail (rdp_frame->unused_image_views);
+      g_assert (g_queue_get_length (&rdp_frame->unused_image_views) == 2);
+      g_queue_pop_tail_link (&rdp_frame->unused_image_views);
       break;
     case GRD_RDP_FRAME_VIEW_TYPE_MAIN:
     case GRD_RDP_FRAME_VIEW_TYPE_AUX:
-      g_assert (g_queue_get_length (rdp_frame->unused_image_views) == 1);
+      g_assert (g_queue_get_length (&rdp_frame->unused_image_views) == 1);
       break;
     }
 
@@ -196,7 +224,13 @@ grd_rdp_frame_notify_frame_submission (GrdRdpFrame *rdp_frame)
 GrdImageView *
 grd_rdp_frame_pop_image_view (GrdRdpFrame *rdp_frame)
 {
-  return g_queue_pop_head (rdp_frame->unused_image_views);
+  GList *link;
+
+  link = g_queue_pop_head_link (&rdp_frame->unused_image_views);
+  if (!link)
+    return NULL;
+
+  return link->data;
 }
 
 static void
@@ -253,6 +287,30 @@ get_n_image_views_to_be_encoded (GrdRdpFrame *rdp_frame)
   g_assert_not_reached ();
 }
 
+static void
+add_acquired_image_view (GrdRdpFrame  *rdp_frame,
+                         GrdImageView *image_view,
+                         gboolean      to_be_encoded)
+{
+  GList *link;
+
+  g_assert (rdp_frame->n_acquired_image_views < MAX_IMAGE_VIEWS);
+
+  link = &rdp_frame->acquired_image_view_links[rdp_frame->n_acquired_image_views++];
+  *link = (GList) { .data = image_view };
+  rdp_frame->acquired_image_views =
+    g_list_concat (rdp_frame->acquired_image_views, link);
+
+  if (!to_be_encoded)
+    return;
+
+  g_assert (rdp_frame->n_unused_image_view_links < MAX_IMAGE_VIEWS);
+
+  link = &rdp_frame->unused_image_view_links[rdp_frame->n_unused_image_view_links++];
+  *link = (GList) { .data = image_view };
+  g_queue_push_tail_link (&rdp_frame->unused_image_views, link);
+}
+
 static void
 acquire_image_views (GrdRdpFrame *rdp_frame)
 {
@@ -269,11 +327,8 @@ acquire_image_views (GrdRdpFrame *rdp_frame)
       GrdImageView *image_view;
 
       image_view = grd_rdp_render_context_acquire_image_view (render_context);
-      rdp_frame->acquired_image_views =
-        g_list_append (rdp_frame->acquired_image_views, image_view);
-
-      if (i < n_image_views_to_be_encoded)
-        g_queue_push_tail (rdp_frame->unused_image_views, image_view);
+      add_acquired_image_view (rdp_frame, image_view,
+                               i < n_image_views_to_be_encoded);
     }
 }
 
@@ -301,13 +356,71 @@ prepare_frame_upgrade (GrdRdpFrame *rdp_frame)
   g_assert (image_view);
   g_assert (damage_region);
 
-  rdp_frame->acquired_image_views =
-    g_list_append (rdp_frame->acquired_image_views, image_view);
-  g_queue_push_tail (rdp_frame->unused_image_views, image_view);
+  add_acquired_image_view (rdp_frame, image_view, TRUE);
 
   rdp_frame->damage_region = damage_region;
 }
 
+static GrdRdpFrame *
+acquire_frame (GrdRdpFramePool *frame_pool)
+{
+  GrdRdpFrame *rdp_frame;
+
+  g_mutex_lock (&frame_pool->pool_mutex);
+  rdp_frame = frame_pool->free_frames;
+  if (rdp_frame)
+    {
+      frame_pool->free_frames = rdp_frame->next_free_frame;
+      --frame_pool->n_free_frames;
+      ++frame_pool->n_recycled_frames;
+    }
+  else
+    {
+      ++frame_pool->n_allocated_frames;
+    }
+  g_mutex_unlock (&frame_pool->pool_mutex);
+
+  if (rdp_frame)
+    {
+      rdp_frame->next_free_frame = NULL;
+      return rdp_frame;
+    }
+
+  /*
+   * Once the pipeline is filled, frames are only recycled. Any further
+   * allocation in the steady state shows up here.
+   */
+  g_debug ("[RDP] Frame pool: Allocating new frame (%u frames allocated)",
+           frame_pool->n_allocated_frames);
+
+  rdp_frame = g_new0 (GrdRdpFrame, 1);
+  rdp_frame->frame_pool = frame_pool;
+  rdp_frame->encode_context = grd_encode_context_new ();
+  g_queue_init (&rdp_frame->unused_image_views);
+
+  return rdp_frame;
+}
+
+static void
+recycle_frame (GrdRdpFrame *rdp_frame)
+{
+  GrdRdpFramePool *frame_pool = rdp_frame->frame_pool;
+  GrdEncodeContext *encode_context = rdp_frame->encode_context;
+
+  grd_encode_context_reset (encode_context);
+
+  *rdp_frame = (GrdRdpFrame) {};
+  rdp_frame->frame_pool = frame_pool;
+  rdp_frame->encode_context = encode_context;
+  g_queue_init (&rdp_frame->unused_image_views);
+
+  g_mutex_lock (&frame_pool->pool_mutex);
+  rdp_frame->next_free_frame = frame_pool->free_frames;
+  frame_pool->free_frames = rdp_frame;
+  ++frame_pool->n_free_frames;
+  g_mutex_unlock (&frame_pool->pool_mutex);
+}
+
 GrdRdpFrame *
 grd_rdp_frame_new (GrdRdpRenderContext *render_context,
                    GrdRdpBuffer        *src_buffer_new,
@@ -319,9 +432,11 @@ grd_rdp_frame_new (GrdRdpRenderContext *render_context,
                    gpointer             callback_user_data,
                    GDestroyNotify       user_data_destroy)
 {
+  GrdRdpFramePool *frame_pool =
+    grd_rdp_render_context_get_frame_pool (render_context);
   GrdRdpFrame *rdp_frame;
 
-  rdp_frame = g_new0 (GrdRdpFrame, 1);
+  rdp_frame = acquire_frame (frame_pool);
   rdp_frame->render_context = render_context;
   rdp_frame->src_buffer_new = src_buffer_new;
   rdp_frame->src_buffer_old = src_buffer_old;
@@ -333,9 +448,6 @@ grd_rdp_frame_new (GrdRdpRenderContext *render_context,
   rdp_frame->callback_user_data = callback_user_data;
   rdp_frame->user_data_destroy = user_data_destroy;
 
-  rdp_frame->encode_context = grd_encode_context_new ();
-  rdp_frame->unused_image_views = g_queue_new ();
-
   if (src_buffer_new)
     prepare_new_frame (rdp_frame);
   else
@@ -356,7 +468,7 @@ release_image_views (GrdRdpFrame *rdp_frame)
       grd_rdp_render_context_release_image_view (rdp_frame->render_context,
                                                  image_view);
     }
-  g_clear_pointer (&rdp_frame->acquired_image_views, g_list_free);
+  rdp_frame->acquired_image_views = NULL;
 }
 
 void
@@ -368,15 +480,47 @@ grd_rdp_frame_free (GrdRdpFrame *rdp_frame)
   if (rdp_frame->pending_view_finalization)
     finalize_view (rdp_frame);
 
-  g_clear_pointer (&rdp_frame->encode_context, grd_encode_context_free);
   g_clear_pointer (&rdp_frame->damage_region, cairo_region_destroy);
 
-  g_clear_pointer (&rdp_frame->unused_image_views, g_queue_free);
   release_image_views (rdp_frame);
 
   rdp_frame->frame_finalized (rdp_frame, rdp_frame->callback_user_data);
   g_clear_pointer (&rdp_frame->callback_user_data,
                    rdp_frame->user_data_destroy);
 
-  g_free (rdp_frame);
+  recycle_frame (rdp_frame);
+}
+
+GrdRdpFramePool *
+grd_rdp_frame_pool_new (void)
+{
+  GrdRdpFramePool *frame_pool;
+
+  frame_pool = g_new0 (GrdRdpFramePool, 1);
+  g_mutex_init (&frame_pool->pool_mutex);
+
+  return frame_pool;
+}
+
+void
+grd_rdp_frame_pool_free (GrdRdpFramePool *frame_pool)
+{
+  GrdRdpFrame *rdp_frame;
+
+  g_assert (frame_pool->n_free_frames == frame_pool->n_allocated_frames);
+
+  g_debug ("[RDP] Frame pool: Allocated frames: %u, recycled frames: %lu",
+           frame_pool->n_allocated_frames, frame_pool->n_recycled_frames);
+
+  while ((rdp_frame = frame_pool->free_frames))
+    {
+      frame_pool->free_frames = rdp_frame->next_free_frame;
+
+      g_clear_pointer (&rdp_frame->encode_context, grd_encode_context_free);
+      g_free (rdp_frame);
+    }
+
+  g_mutex_clear (&frame_pool->pool_mutex);
+
+  g_free (frame_pool);
 }
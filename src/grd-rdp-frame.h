@@ -21,6 +21,7 @@
 
 #include <cairo/cairo.h>
 #include <glib.h>
+#include <stdint.h>
 
 #include "grd-types.h"
 
@@ -34,6 +35,10 @@ typedef enum
 typedef void (* GrdRdpFrameCallback) (GrdRdpFrame *rdp_frame,
                                       gpointer     user_data);
 
+GrdRdpFramePool *grd_rdp_frame_pool_new (void);
+
+void grd_rdp_frame_pool_free (GrdRdpFramePool *frame_pool);
+
 GrdRdpFrame *grd_rdp_frame_new (GrdRdpRenderContext *render_context,
                                 GrdRdpBuffer        *src_buffer_new,
                                 GrdRdpBuffer        *src_buffer_old,
@@ -33,6 +33,21 @@
 #define CLIP_DATA_ENTRY_DROP_TIMEOUT_DELTA_US (10 * G_USEC_PER_SEC)
 #define WIN32_FILETIME_TO_UNIX_EPOCH UINT64_C (11644473600)
 
+/*
+ * File contents are requested from the client in chunks of this size. For
+ * sequential reads, several chunks are requested ahead of time, so that the
+ * transfer is not limited by the round trip time for each read() call
+ */
+#define FILE_CHUNK_SIZE (1024 * 1024)
+#define MAX_READ_AHEAD_CHUNKS 4
+#define MAX_CACHED_CHUNKS 16
+
+/*
+ * File managers issue many lookup() and getattr() calls in parallel, when
+ * a directory tree is pasted
+ */
+#define MAX_IDLE_FUSE_THREADS 8
+
 typedef enum _FuseLowlevelOperationType
 {
   FUSE_LL_OPERATION_NONE,
@@ -61,10 +76,34 @@ typedef struct _ClearRdpFuseRequestContext
 typedef struct _FuseFile FuseFile;
 typedef struct _ClipDataEntry ClipDataEntry;
 
+typedef struct _FileChunk
+{
+  FuseFile *fuse_file;
+  uint64_t chunk_idx;
+
+  GBytes *data;
+  uint32_t size;
+} FileChunk;
+
+typedef struct _PendingFileRead
+{
+  FuseFile *fuse_file;
+  fuse_req_t fuse_req;
+
+  uint64_t offset;
+  uint32_t size;
+
+  int error;
+  GPtrArray *reply_chunks;
+  struct iovec *iov;
+  int n_iov;
+} PendingFileRead;
+
 struct _FuseFile
 {
   FuseFile *parent;
-  GList *children;
+  GPtrArray *children;
+  GHashTable *children_by_name;
 
   char *filename;
   char *filename_with_root;
@@ -84,6 +123,8 @@ struct _FuseFile
   uint32_t clip_data_id;
 
   ClipDataEntry *entry;
+
+  uint64_t next_read_offset;
 };
 
 struct _ClipDataEntry
@@ -113,6 +154,9 @@ typedef struct _RdpFuseFileContentsRequest
   FuseLowlevelOperationType operation_type;
 
   uint32_t stream_id;
+
+  /* Only used for FUSE_LL_OPERATION_READ */
+  uint64_t chunk_idx;
 } RdpFuseFileContentsRequest;
 
 struct _GrdRdpFuseClipboard
@@ -135,6 +179,9 @@ struct _GrdRdpFuseClipboard
   GHashTable *inode_table;
   GHashTable *clip_data_table;
   GHashTable *request_table;
+  GQueue *cached_chunks;
+  GList *pending_reads;
+  GList *finished_reads;
   FuseFile *root_dir;
 
   ClipDataEntry *no_cdi_entry;
@@ -201,13 +248,126 @@ maybe_clear_rdp_fuse_request (gpointer key,
                                 clear_context->clip_data_id))
     return FALSE;
 
-  if (rdp_fuse_clipboard->fuse_handle)
+  if (rdp_fuse_clipboard->fuse_handle && rdp_fuse_request->fuse_req)
     fuse_reply_err (rdp_fuse_request->fuse_req, EIO);
   g_free (rdp_fuse_request);
 
   return TRUE;
 }
 
+static void
+file_chunk_free (gpointer data)
+{
+  FileChunk *chunk = data;
+
+  g_bytes_unref (chunk->data);
+  g_free (chunk);
+}
+
+static void
+pending_file_read_free (gpointer data)
+{
+  PendingFileRead *pending_read = data;
+
+  g_clear_pointer (&pending_read->reply_chunks, g_ptr_array_unref);
+  g_free (pending_read->iov);
+  g_free (pending_read);
+}
+
+static void
+finish_pending_read (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                     PendingFileRead     *pending_read,
+                     int                  error)
+{
+  if (!rdp_fuse_clipboard->fuse_handle)
+    {
+      pending_file_read_free (pending_read);
+      return;
+    }
+
+  pending_read->error = error;
+  rdp_fuse_clipboard->finished_reads =
+    g_list_append (rdp_fuse_clipboard->finished_reads, pending_read);
+}
+
+/**
+ * Finished reads are only replied to after filesystem_mutex is unlocked.
+ * The reply data is kept alive by the chunk references of each read, so
+ * evicting its chunks in the meantime is fine.
+ */
+static void
+unlock_filesystem_and_reply_reads (GrdRdpFuseClipboard *rdp_fuse_clipboard)
+{
+  GList *finished_reads;
+  GList *l;
+
+  finished_reads = g_steal_pointer (&rdp_fuse_clipboard->finished_reads);
+  g_mutex_unlock (&rdp_fuse_clipboard->filesystem_mutex);
+
+  for (l = finished_reads; l; l = l->next)
+    {
+      PendingFileRead *pending_read = l->data;
+
+      if (pending_read->error)
+        fuse_reply_err (pending_read->fuse_req, pending_read->error);
+      else
+        fuse_reply_iov (pending_read->fuse_req, pending_read->iov, pending_read->n_iov);
+    }
+  g_list_free_full (finished_reads, pending_file_read_free);
+}
+
+static void
+clear_pending_reads (ClearRdpFuseRequestContext *clear_context)
+{
+  GrdRdpFuseClipboard *rdp_fuse_clipboard = clear_context->rdp_fuse_clipboard;
+  GList *l;
+
+  l = rdp_fuse_clipboard->pending_reads;
+  while (l)
+    {
+      PendingFileRead *pending_read = l->data;
+      GList *l_next = l->next;
+
+      if (should_remove_fuse_file (pending_read->fuse_file,
+                                   clear_context->all_files,
+                                   clear_context->has_clip_data_id,
+                                   clear_context->clip_data_id))
+        {
+          finish_pending_read (rdp_fuse_clipboard, pending_read, EIO);
+
+          rdp_fuse_clipboard->pending_reads =
+            g_list_delete_link (rdp_fuse_clipboard->pending_reads, l);
+        }
+
+      l = l_next;
+    }
+}
+
+static void
+clear_cached_chunks (ClearRdpFuseRequestContext *clear_context)
+{
+  GrdRdpFuseClipboard *rdp_fuse_clipboard = clear_context->rdp_fuse_clipboard;
+  GList *l;
+
+  l = rdp_fuse_clipboard->cached_chunks->head;
+  while (l)
+    {
+      FileChunk *chunk = l->data;
+      GList *l_next = l->next;
+
+      if (should_remove_fuse_file (chunk->fuse_file,
+                                   clear_context->all_files,
+                                   clear_context->has_clip_data_id,
+                                   clear_context->clip_data_id))
+        {
+          file_chunk_free (chunk);
+          g_queue_delete_link (rdp_fuse_clipboard->cached_chunks, l);
+        }
+
+      l = l_next;
+    }
+}
+
 void
 grd_rdp_fuse_clipboard_dismiss_all_no_cdi_requests (GrdRdpFuseClipboard *rdp_fuse_clipboard)
 {
@@ -218,7 +378,8 @@ grd_rdp_fuse_clipboard_dismiss_all_no_cdi_requests (GrdRdpFuseClipboard *rdp_fus
   g_mutex_lock (&rdp_fuse_clipboard->filesystem_mutex);
   g_hash_table_foreach_remove (rdp_fuse_clipboard->request_table,
                                maybe_clear_rdp_fuse_request, &clear_context);
-  g_mutex_unlock (&rdp_fuse_clipboard->filesystem_mutex);
+  clear_pending_reads (&clear_context);
+  unlock_filesystem_and_reply_reads (rdp_fuse_clipboard);
 }
 
 static void
@@ -228,11 +389,11 @@ invalidate_inode (gpointer data,
   GrdRdpFuseClipboard *rdp_fuse_clipboard = user_data;
   FuseFile *fuse_file = data;
   FuseFile *child;
-  GList *l;
+  uint32_t i;
 
-  for (l = fuse_file->children; l; l = l->next)
+  for (i = 0; fuse_file->children && i < fuse_file->children->len; ++i)
     {
-      child = l->data;
+      child = g_ptr_array_index (fuse_file->children, i);
 
       fuse_lowlevel_notify_delete (rdp_fuse_clipboard->fuse_handle,
                                    fuse_file->ino, child->ino,
@@ -250,11 +411,39 @@ fuse_file_free (gpointer data)
 {
   FuseFile *fuse_file = data;
 
-  g_list_free (fuse_file->children);
+  g_clear_pointer (&fuse_file->children_by_name, g_hash_table_unref);
+  g_clear_pointer (&fuse_file->children, g_ptr_array_unref);
   g_free (fuse_file->filename_with_root);
   g_free (fuse_file);
 }
 
+static void
+fuse_file_add_child (FuseFile *parent,
+                     FuseFile *child)
+{
+  if (!parent->children)
+    {
+      parent->children = g_ptr_array_new ();
+      parent->children_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+
+  g_ptr_array_add (parent->children, child);
+  g_hash_table_insert (parent->children_by_name, child->filename, child);
+  child->parent = parent;
+}
+
+static void
+fuse_file_remove_child (FuseFile *parent,
+                        FuseFile *child)
+{
+  if (!parent->children)
+    return;
+
+  g_ptr_array_remove (parent->children, child);
+  if (g_hash_table_lookup (parent->children_by_name, child->filename) == child)
+    g_hash_table_remove (parent->children_by_name, child->filename);
+}
+
 static void
 clear_selection (GrdRdpFuseClipboard *rdp_fuse_clipboard,
                  gboolean             all_selections,
@@ -272,7 +461,7 @@ clear_selection (GrdRdpFuseClipboard *rdp_fuse_clipboard,
       FuseFile *root_dir = rdp_fuse_clipboard->root_dir;
 
       clip_data_dir = g_steal_pointer (&entry->clip_data_dir);
-      root_dir->children = g_list_remove (root_dir->children, clip_data_dir);
+      fuse_file_remove_child (root_dir, clip_data_dir);
 
       steal_context.has_clip_data_id = clear_context.has_clip_data_id =
         entry->has_clip_data_id;
@@ -288,10 +477,12 @@ clear_selection (GrdRdpFuseClipboard *rdp_fuse_clipboard,
     g_debug ("[FUSE Clipboard] Clearing selection%s", all_selections ? "s" : "");
   g_hash_table_foreach_remove (rdp_fuse_clipboard->request_table,
                                maybe_clear_rdp_fuse_request, &clear_context);
+  clear_pending_reads (&clear_context);
+  clear_cached_chunks (&clear_context);
 
   g_hash_table_foreach_steal (rdp_fuse_clipboard->inode_table,
                               collect_fuse_file_to_steal, &steal_context);
-  g_mutex_unlock (&rdp_fuse_clipboard->filesystem_mutex);
+  unlock_filesystem_and_reply_reads (rdp_fuse_clipboard);
 
   /**
    * fuse_lowlevel_notify_inval_inode() is a blocking operation. If we receive
@@ -562,8 +753,7 @@ clip_data_dir_new (GrdRdpFuseClipboard *rdp_fuse_clipboard,
   clip_data_dir->has_clip_data_id = has_clip_data_id;
   clip_data_dir->clip_data_id = clip_data_id;
 
-  root_dir->children = g_list_append (root_dir->children, clip_data_dir);
-  clip_data_dir->parent = root_dir;
+  fuse_file_add_child (root_dir, clip_data_dir);
 
   g_hash_table_insert (rdp_fuse_clipboard->inode_table,
                        GUINT_TO_POINTER (clip_data_dir->ino), clip_data_dir);
@@ -571,33 +761,15 @@ clip_data_dir_new (GrdRdpFuseClipboard *rdp_fuse_clipboard,
   return clip_data_dir;
 }
 
-static gboolean
-is_fuse_file_parent (gpointer key,
-                     gpointer value,
-                     gpointer user_data)
-{
-  FuseFile *fuse_file = value;
-  const char *parent_path = user_data;
-
-  if (!fuse_file->is_directory)
-    return FALSE;
-
-  if (strcmp (parent_path, fuse_file->filename_with_root) == 0)
-    return TRUE;
-
-  return FALSE;
-}
-
 static FuseFile *
-get_parent_directory (GrdRdpFuseClipboard *rdp_fuse_clipboard,
-                      const char          *path)
+get_parent_directory (GHashTable *directories,
+                      const char *path)
 {
   FuseFile *parent;
   char *parent_path;
 
   parent_path = g_path_get_dirname (path);
-  parent = g_hash_table_find (rdp_fuse_clipboard->inode_table,
-                              is_fuse_file_parent, parent_path);
+  parent = g_hash_table_lookup (directories, parent_path);
 
   g_free (parent_path);
 
@@ -612,8 +784,13 @@ set_selection_for_clip_data_entry (GrdRdpFuseClipboard *rdp_fuse_clipboard,
 {
   FuseFile *clip_data_dir = entry->clip_data_dir;
   uint32_t clip_data_id = clip_data_dir->clip_data_id;
+  g_autoptr (GHashTable) directories = NULL;
   uint32_t i;
 
+  directories = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (directories, clip_data_dir->filename_with_root,
+                       clip_data_dir);
+
   if (entry->has_clip_data_id)
     g_debug ("[FUSE Clipboard] Setting selection for clipDataId %u", clip_data_id);
   else
@@ -653,7 +830,7 @@ set_selection_for_clip_data_entry (GrdRdpFuseClipboard *rdp_fuse_clipboard,
       fuse_file->filename = strrchr (fuse_file->filename_with_root, '/') + 1;
       g_free (filename);
 
-      parent = get_parent_directory (rdp_fuse_clipboard,
+      parent = get_parent_directory (directories,
                                      fuse_file->filename_with_root);
       if (!parent)
         {
@@ -665,8 +842,7 @@ set_selection_for_clip_data_entry (GrdRdpFuseClipboard *rdp_fuse_clipboard,
           return FALSE;
         }
 
-      parent->children = g_list_append (parent->children, fuse_file);
-      fuse_file->parent = parent;
+      fuse_file_add_child (parent, fuse_file);
 
       fuse_file->list_idx = i;
       fuse_file->ino = get_next_free_inode (rdp_fuse_clipboard);
@@ -674,7 +850,11 @@ set_selection_for_clip_data_entry (GrdRdpFuseClipboard *rdp_fuse_clipboard,
       fuse_file->clip_data_id = clip_data_id;
       fuse_file->entry = entry;
       if (file->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-        fuse_file->is_directory = TRUE;
+        {
+          fuse_file->is_directory = TRUE;
+          g_hash_table_insert (directories, fuse_file->filename_with_root,
+                               fuse_file);
+        }
       if (file->dwFileAttributes & FILE_ATTRIBUTE_READONLY)
         fuse_file->is_readonly = TRUE;
       if (file->dwFlags & FD_FILESIZE)
@@ -811,6 +991,237 @@ maybe_queue_clip_data_entry_timeout_reset (GrdRdpFuseClipboard *rdp_fuse_clipboa
   g_source_set_ready_time (rdp_fuse_clipboard->timeout_reset_source, 0);
 }
 
+static FileChunk *
+get_cached_chunk (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                  FuseFile            *fuse_file,
+                  uint64_t             chunk_idx)
+{
+  GList *l;
+
+  for (l = rdp_fuse_clipboard->cached_chunks->head; l; l = l->next)
+    {
+      FileChunk *chunk = l->data;
+
+      if (chunk->fuse_file == fuse_file && chunk->chunk_idx == chunk_idx)
+        return chunk;
+    }
+
+  return NULL;
+}
+
+static void
+get_chunk_range_of_read (PendingFileRead *pending_read,
+                         uint64_t        *first_chunk_idx,
+                         uint64_t        *last_chunk_idx)
+{
+  FuseFile *fuse_file = pending_read->fuse_file;
+  uint64_t end;
+
+  end = MIN (pending_read->offset + pending_read->size, fuse_file->size);
+  end = MAX (end, pending_read->offset + 1);
+
+  *first_chunk_idx = pending_read->offset / FILE_CHUNK_SIZE;
+  *last_chunk_idx = (end - 1) / FILE_CHUNK_SIZE;
+}
+
+static gboolean
+is_chunk_needed_by_pending_read (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                                 FileChunk           *chunk)
+{
+  GList *l;
+
+  for (l = rdp_fuse_clipboard->pending_reads; l; l = l->next)
+    {
+      PendingFileRead *pending_read = l->data;
+      uint64_t first_chunk_idx;
+      uint64_t last_chunk_idx;
+
+      if (pending_read->fuse_file != chunk->fuse_file)
+        continue;
+
+      get_chunk_range_of_read (pending_read, &first_chunk_idx, &last_chunk_idx);
+      if (chunk->chunk_idx >= first_chunk_idx &&
+          chunk->chunk_idx <= last_chunk_idx)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+maybe_evict_cached_chunks (GrdRdpFuseClipboard *rdp_fuse_clipboard)
+{
+  GQueue *cached_chunks = rdp_fuse_clipboard->cached_chunks;
+  GList *l;
+
+  l = cached_chunks->head;
+  while (l && g_queue_get_length (cached_chunks) > MAX_CACHED_CHUNKS)
+    {
+      FileChunk *chunk = l->data;
+      GList *l_next = l->next;
+
+      if (!is_chunk_needed_by_pending_read (rdp_fuse_clipboard, chunk))
+        {
+          file_chunk_free (chunk);
+          g_queue_delete_link (cached_chunks, l);
+        }
+
+      l = l_next;
+    }
+}
+
+static void
+drop_consumed_chunks (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                      FuseFile            *fuse_file,
+                      uint64_t             chunk_idx)
+{
+  GQueue *cached_chunks = rdp_fuse_clipboard->cached_chunks;
+  GList *l;
+
+  l = cached_chunks->head;
+  while (l)
+    {
+      FileChunk *chunk = l->data;
+      GList *l_next = l->next;
+
+      if (chunk->fuse_file == fuse_file && chunk->chunk_idx < chunk_idx &&
+          !is_chunk_needed_by_pending_read (rdp_fuse_clipboard, chunk))
+        {
+          file_chunk_free (chunk);
+          g_queue_delete_link (cached_chunks, l);
+        }
+
+      l = l_next;
+    }
+}
+
+static gboolean
+try_finish_file_read (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                      PendingFileRead     *pending_read)
+{
+  FuseFile *fuse_file = pending_read->fuse_file;
+  uint64_t first_chunk_idx;
+  uint64_t last_chunk_idx;
+  uint64_t chunk_idx;
+  uint64_t end;
+
+  end = MIN (pending_read->offset + pending_read->size, fuse_file->size);
+  if (pending_read->offset >= end)
+    {
+      finish_pending_read (rdp_fuse_clipboard, pending_read, 0);
+      return TRUE;
+    }
+
+  get_chunk_range_of_read (pending_read, &first_chunk_idx, &last_chunk_idx);
+  for (chunk_idx = first_chunk_idx; chunk_idx <= last_chunk_idx; ++chunk_idx)
+    {
+      if (!get_cached_chunk (rdp_fuse_clipboard, fuse_file, chunk_idx))
+        return FALSE;
+    }
+
+  pending_read->iov = g_new0 (struct iovec,
+                              last_chunk_idx - first_chunk_idx + 1);
+  pending_read->reply_chunks =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+  for (chunk_idx = first_chunk_idx; chunk_idx <= last_chunk_idx; ++chunk_idx)
+    {
+      FileChunk *chunk;
+      uint64_t chunk_offset = chunk_idx * FILE_CHUNK_SIZE;
+      uint64_t start_in_chunk;
+      uint64_t end_in_chunk;
+
+      chunk = get_cached_chunk (rdp_fuse_clipboard, fuse_file, chunk_idx);
+
+      start_in_chunk = MAX (pending_read->offset, chunk_offset) - chunk_offset;
+      end_in_chunk = MIN (end - chunk_offset, chunk->size);
+      if (end_in_chunk <= start_in_chunk)
+        break;
+
+      pending_read->iov[pending_read->n_iov].iov_base =
+        (uint8_t *) g_bytes_get_data (chunk->data, NULL) + start_in_chunk;
+      pending_read->iov[pending_read->n_iov].iov_len =
+        end_in_chunk - start_in_chunk;
+      ++pending_read->n_iov;
+
+      g_ptr_array_add (pending_read->reply_chunks, g_bytes_ref (chunk->data));
+
+      /* The client returned less data than requested */
+      if (chunk->size < FILE_CHUNK_SIZE)
+        break;
+    }
+
+  finish_pending_read (rdp_fuse_clipboard, pending_read, 0);
+
+  return TRUE;
+}
+
+static void
+finish_pending_reads (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                     FuseFile            *fuse_file,
+                     gboolean             chunk_failed,
+                     uint64_t             failed_chunk_idx)
+{
+  GList *l;
+
+  l = rdp_fuse_clipboard->pending_reads;
+  while (l)
+    {
+      PendingFileRead *pending_read = l->data;
+      GList *l_next = l->next;
+      uint64_t first_chunk_idx;
+      uint64_t last_chunk_idx;
+      gboolean finished;
+
+      if (pending_read->fuse_file != fuse_file)
+        {
+          l = l_next;
+          continue;
+        }
+
+      get_chunk_range_of_read (pending_read, &first_chunk_idx, &last_chunk_idx);
+      if (chunk_failed &&
+          failed_chunk_idx >= first_chunk_idx &&
+          failed_chunk_idx <= last_chunk_idx)
+        {
+          finish_pending_read (rdp_fuse_clipboard, pending_read, EIO);
+          finished = TRUE;
+        }
+      else
+        {
+          finished = try_finish_file_read (rdp_fuse_clipboard, pending_read);
+        }
+
+      if (finished)
+        {
+          rdp_fuse_clipboard->pending_reads =
+            g_list_delete_link (rdp_fuse_clipboard->pending_reads, l);
+        }
+
+      l = l_next;
+    }
+}
+
+static void
+store_file_chunk (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                  FuseFile            *fuse_file,
+                  uint64_t             chunk_idx,
+                  const uint8_t       *data,
+                  uint32_t             size)
+{
+  FileChunk *chunk;
+
+  chunk = g_new0 (FileChunk, 1);
+  chunk->fuse_file = fuse_file;
+  chunk->chunk_idx = chunk_idx;
+  chunk->data = g_bytes_new (data, size);
+  chunk->size = size;
+
+  g_queue_push_tail (rdp_fuse_clipboard->cached_chunks, chunk);
+
+  finish_pending_reads (rdp_fuse_clipboard, fuse_file, FALSE, 0);
+  maybe_evict_cached_chunks (rdp_fuse_clipboard);
+}
+
 void
 grd_rdp_fuse_clipboard_submit_file_contents_response (GrdRdpFuseClipboard *rdp_fuse_clipboard,
                                                       uint32_t             stream_id,
@@ -834,6 +1245,16 @@ grd_rdp_fuse_clipboard_submit_file_contents_response (GrdRdpFuseClipboard *rdp_f
     {
       g_warning ("[RDP.CLIPRDR] Failed to retrieve file data for file \"%s\" "
                  "from the client", rdp_fuse_request->fuse_file->filename);
+
+      if (rdp_fuse_request->operation_type == FUSE_LL_OPERATION_READ)
+        {
+          finish_pending_reads (rdp_fuse_clipboard, rdp_fuse_request->fuse_file,
+                                TRUE, rdp_fuse_request->chunk_idx);
+          unlock_filesystem_and_reply_reads (rdp_fuse_clipboard);
+
+          g_free (rdp_fuse_request);
+          return;
+        }
       g_mutex_unlock (&rdp_fuse_clipboard->filesystem_mutex);
 
       fuse_reply_err (rdp_fuse_request->fuse_req, EIO);
@@ -875,12 +1296,15 @@ grd_rdp_fuse_clipboard_submit_file_contents_response (GrdRdpFuseClipboard *rdp_f
     {
       g_debug ("[FUSE Clipboard] Received file range for file \"%s\" with stream "
                "id %u", rdp_fuse_request->fuse_file->filename, stream_id);
+
+      store_file_chunk (rdp_fuse_clipboard, rdp_fuse_request->fuse_file,
+                        rdp_fuse_request->chunk_idx, data, size);
     }
   else
     {
       g_assert_not_reached ();
     }
-  g_mutex_unlock (&rdp_fuse_clipboard->filesystem_mutex);
+  unlock_filesystem_and_reply_reads (rdp_fuse_clipboard);
 
   switch (rdp_fuse_request->operation_type)
     {
@@ -893,7 +1317,6 @@ grd_rdp_fuse_clipboard_submit_file_contents_response (GrdRdpFuseClipboard *rdp_f
       fuse_reply_attr (rdp_fuse_request->fuse_req, &entry.attr, entry.attr_timeout);
       break;
     case FUSE_LL_OPERATION_READ:
-      fuse_reply_buf (rdp_fuse_request->fuse_req, (const char *) data, size);
       break;
     }
 
@@ -954,19 +1377,23 @@ request_file_size_async (GrdRdpFuseClipboard       *rdp_fuse_clipboard,
 }
 
 static void
-request_file_range_async (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+request_file_chunk_async (GrdRdpFuseClipboard *rdp_fuse_clipboard,
                           FuseFile            *fuse_file,
-                          fuse_req_t           fuse_req,
-                          uint64_t             offset,
-                          uint32_t             requested_size)
+                          uint64_t             chunk_idx)
 {
   GrdClipboardRdp *clipboard_rdp = rdp_fuse_clipboard->clipboard_rdp;
   RdpFuseFileContentsRequest *rdp_fuse_request;
+  uint64_t offset = chunk_idx * FILE_CHUNK_SIZE;
+  uint32_t requested_size;
+
+  g_assert (offset < fuse_file->size);
+  requested_size = MIN (fuse_file->size - offset, FILE_CHUNK_SIZE);
 
   rdp_fuse_request = rdp_fuse_file_contents_request_new (rdp_fuse_clipboard,
                                                          fuse_file,
-                                                         fuse_req);
+                                                         NULL);
   rdp_fuse_request->operation_type = FUSE_LL_OPERATION_READ;
+  rdp_fuse_request->chunk_idx = chunk_idx;
 
   g_hash_table_insert (rdp_fuse_clipboard->request_table,
                        GUINT_TO_POINTER (rdp_fuse_request->stream_id),
@@ -983,6 +1410,38 @@ request_file_range_async (GrdRdpFuseClipboard *rdp_fuse_clipboard,
                                                      fuse_file->clip_data_id);
 }
 
+static gboolean
+is_chunk_requested (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                    FuseFile            *fuse_file,
+                    uint64_t             chunk_idx)
+{
+  GHashTableIter iter;
+  RdpFuseFileContentsRequest *rdp_fuse_request;
+
+  g_hash_table_iter_init (&iter, rdp_fuse_clipboard->request_table);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &rdp_fuse_request))
+    {
+      if (rdp_fuse_request->fuse_file == fuse_file &&
+          rdp_fuse_request->operation_type == FUSE_LL_OPERATION_READ &&
+          rdp_fuse_request->chunk_idx == chunk_idx)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+ensure_file_chunk (GrdRdpFuseClipboard *rdp_fuse_clipboard,
+                   FuseFile            *fuse_file,
+                   uint64_t             chunk_idx)
+{
+  if (get_cached_chunk (rdp_fuse_clipboard, fuse_file, chunk_idx) ||
+      is_chunk_requested (rdp_fuse_clipboard, fuse_file, chunk_idx))
+    return;
+
+  request_file_chunk_async (rdp_fuse_clipboard, fuse_file, chunk_idx);
+}
+
 static FuseFile *
 get_fuse_file_by_ino (GrdRdpFuseClipboard *rdp_fuse_clipboard,
                       fuse_ino_t           fuse_ino)
@@ -1001,15 +1460,10 @@ get_fuse_file_by_name_from_parent (GrdRdpFuseClipboard *rdp_fuse_clipboard,
                                    const char          *name)
 {
   FuseFile *child;
-  GList *l;
-
-  for (l = parent->children; l; l = l->next)
-    {
-      child = l->data;
 
-      if (strcmp (name, child->filename) == 0)
-        return child;
-    }
+  if (parent->children_by_name &&
+      (child = g_hash_table_lookup (parent->children_by_name, name)))
+    return child;
 
   /**
    * This is not an error since several applications try to find specific files,
@@ -1149,6 +1603,12 @@ fuse_ll_read (fuse_req_t             fuse_req,
 {
   GrdRdpFuseClipboard *rdp_fuse_clipboard = fuse_req_userdata (fuse_req);
   FuseFile *fuse_file;
+  PendingFileRead *pending_read;
+  gboolean is_sequential_read;
+  uint64_t first_chunk_idx;
+  uint64_t last_chunk_idx;
+  uint64_t chunk_idx;
+  uint64_t n_chunks;
 
   g_mutex_lock (&rdp_fuse_clipboard->filesystem_mutex);
   if (!(fuse_file = get_fuse_file_by_ino (rdp_fuse_clipboard, fuse_ino)))
@@ -1173,9 +1633,39 @@ fuse_ll_read (fuse_req_t             fuse_req,
   size = MIN (size, 8 * 1024 * 1024);
   g_assert (size > 0);
 
-  request_file_range_async (rdp_fuse_clipboard, fuse_file, fuse_req,
-                            offset, size);
-  g_mutex_unlock (&rdp_fuse_clipboard->filesystem_mutex);
+  pending_read = g_new0 (PendingFileRead, 1);
+  pending_read->fuse_file = fuse_file;
+  pending_read->fuse_req = fuse_req;
+  pending_read->offset = offset;
+  pending_read->size = size;
+
+  is_sequential_read = offset == fuse_file->next_read_offset;
+  fuse_file->next_read_offset = offset + size;
+
+  get_chunk_range_of_read (pending_read, &first_chunk_idx, &last_chunk_idx);
+  if (is_sequential_read)
+    drop_consumed_chunks (rdp_fuse_clipboard, fuse_file, first_chunk_idx);
+
+  if (!try_finish_file_read (rdp_fuse_clipboard, pending_read))
+    {
+      for (chunk_idx = first_chunk_idx; chunk_idx <= last_chunk_idx; ++chunk_idx)
+        ensure_file_chunk (rdp_fuse_clipboard, fuse_file, chunk_idx);
+
+      rdp_fuse_clipboard->pending_reads =
+        g_list_append (rdp_fuse_clipboard->pending_reads, pending_read);
+    }
+
+  if (is_sequential_read)
+    {
+      n_chunks = (fuse_file->size + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE;
+
+      for (chunk_idx = last_chunk_idx + 1;
+           chunk_idx <= last_chunk_idx + MAX_READ_AHEAD_CHUNKS &&
+           chunk_idx < n_chunks;
+           ++chunk_idx)
+        ensure_file_chunk (rdp_fuse_clipboard, fuse_file, chunk_idx);
+    }
+  unlock_filesystem_and_reply_reads (rdp_fuse_clipboard);
 }
 
 static void
@@ -1227,8 +1717,8 @@ fuse_ll_readdir (fuse_req_t             fuse_req,
   size_t written_size, entry_size;
   char *filename;
   char *buf;
+  uint32_t n_children;
   off_t i;
-  GList *l;
 
   g_mutex_lock (&rdp_fuse_clipboard->filesystem_mutex);
   if (!(fuse_file = get_fuse_file_by_ino (rdp_fuse_clipboard, fuse_ino)))
@@ -1247,7 +1737,8 @@ fuse_ll_readdir (fuse_req_t             fuse_req,
   g_debug ("[FUSE Clipboard] Reading directory \"%s\" at offset %lu",
            fuse_file->filename_with_root, offset);
 
-  if (offset >= g_list_length (fuse_file->children) + 1)
+  n_children = fuse_file->children ? fuse_file->children->len : 0;
+  if (offset >= n_children + 1)
     {
       g_mutex_unlock (&rdp_fuse_clipboard->filesystem_mutex);
       fuse_reply_buf (fuse_req, NULL, 0);
@@ -1289,12 +1780,9 @@ fuse_ll_readdir (fuse_req_t             fuse_req,
       written_size += entry_size;
     }
 
-  for (l = fuse_file->children, i = 2; l; l = l->next, ++i)
+  for (i = MAX (offset + 1, 2); i < n_children + 2; ++i)
     {
-      if (i <= offset)
-        continue;
-
-      child = l->data;
+      child = g_ptr_array_index (fuse_file->children, i - 2);
 
       write_file_attributes (child, &attr);
       entry_size = fuse_add_direntry (fuse_req, buf + written_size,
@@ -1326,6 +1814,7 @@ fuse_thread_func (gpointer data)
 {
   GrdRdpFuseClipboard *rdp_fuse_clipboard = data;
   struct fuse_args args = {0};
+  struct fuse_loop_config loop_config = {0};
   char *argv[1];
   int result;
 
@@ -1350,7 +1839,10 @@ fuse_thread_func (gpointer data)
   grd_sync_point_complete (&rdp_fuse_clipboard->sync_point_start, TRUE);
 
   g_debug ("[FUSE Clipboard] Starting FUSE session");
-  result = fuse_session_loop (rdp_fuse_clipboard->fuse_handle);
+  loop_config.clone_fd = 0;
+  loop_config.max_idle_threads = MAX_IDLE_FUSE_THREADS;
+
+  result = fuse_session_loop_mt (rdp_fuse_clipboard->fuse_handle, &loop_config);
   if (result < 0)
     g_error ("fuse_loop() failed: %s", g_strerror (-result));
 
@@ -1395,7 +1887,8 @@ dismiss_all_requests (GrdRdpFuseClipboard *rdp_fuse_clipboard)
   g_mutex_lock (&rdp_fuse_clipboard->filesystem_mutex);
   g_hash_table_foreach_remove (rdp_fuse_clipboard->request_table,
                                maybe_clear_rdp_fuse_request, &clear_context);
-  g_mutex_unlock (&rdp_fuse_clipboard->filesystem_mutex);
+  clear_pending_reads (&clear_context);
+  unlock_filesystem_and_reply_reads (rdp_fuse_clipboard);
 }
 
 static void
@@ -1444,6 +1937,11 @@ grd_rdp_fuse_clipboard_dispose (GObject *object)
       dismiss_all_requests (rdp_fuse_clipboard);
       g_clear_pointer (&rdp_fuse_clipboard->request_table, g_hash_table_unref);
     }
+  if (rdp_fuse_clipboard->cached_chunks)
+    {
+      g_queue_free_full (rdp_fuse_clipboard->cached_chunks, file_chunk_free);
+      rdp_fuse_clipboard->cached_chunks = NULL;
+    }
   g_clear_pointer (&rdp_fuse_clipboard->no_cdi_entry, g_free);
   g_clear_pointer (&rdp_fuse_clipboard->clip_data_table, g_hash_table_destroy);
   g_clear_pointer (&rdp_fuse_clipboard->inode_table, g_hash_table_destroy);
@@ -1560,6 +2058,7 @@ grd_rdp_fuse_clipboard_init (GrdRdpFuseClipboard *rdp_fuse_clipboard)
   rdp_fuse_clipboard->clip_data_table = g_hash_table_new_full (NULL, NULL, NULL,
                                                                clip_data_entry_free);
   rdp_fuse_clipboard->request_table = g_hash_table_new (NULL, NULL);
+  rdp_fuse_clipboard->cached_chunks = g_queue_new ();
 
   rdp_fuse_clipboard->root_dir = fuse_file_new_root ();
   g_hash_table_insert (rdp_fuse_clipboard->inode_table,
@@ -554,6 +554,48 @@ grd_rdp_layout_manager_submit_new_monitor_config (GrdRdpLayoutManager *layout_ma
   g_source_set_ready_time (layout_manager->layout_update_source, 0);
 }
 
+gboolean
+grd_rdp_layout_manager_can_suspend (GrdRdpLayoutManager *layout_manager)
+{
+  gboolean can_suspend;
+
+  /*
+   * Only layouts of virtual monitors stay untouched without a client. The
+   * streams of physical monitors follow the monitor configuration of the
+   * compositor, which would require updating the monitor data of a peer.
+   */
+  g_mutex_lock (&layout_manager->state_mutex);
+  can_suspend = layout_manager->state == UPDATE_STATE_AWAIT_CONFIG;
+  g_mutex_unlock (&layout_manager->state_mutex);
+
+  g_mutex_lock (&layout_manager->monitor_config_mutex);
+  can_suspend = can_suspend &&
+                layout_manager->current_monitor_config &&
+                layout_manager->current_monitor_config->is_virtual &&
+                !layout_manager->pending_monitor_config;
+  g_mutex_unlock (&layout_manager->monitor_config_mutex);
+
+  return can_suspend;
+}
+
+void
+grd_rdp_layout_manager_notify_peer_reattached (GrdRdpLayoutManager *layout_manager)
+{
+  rdpContext *rdp_context =
+    grd_session_rdp_get_rdp_context (layout_manager->session_rdp);
+  rdpSettings *rdp_settings = rdp_context->settings;
+  GrdRdpMonitorConfig *monitor_config = layout_manager->current_monitor_config;
+
+  g_assert (layout_manager->state == UPDATE_STATE_AWAIT_CONFIG);
+  g_assert (monitor_config->is_virtual);
+
+  update_monitor_data (layout_manager);
+  freerdp_settings_set_uint32 (rdp_settings, FreeRDP_DesktopWidth,
+                               monitor_config->desktop_width);
+  freerdp_settings_set_uint32 (rdp_settings, FreeRDP_DesktopHeight,
+                               monitor_config->desktop_height);
+}
+
 gboolean
 grd_rdp_layout_manager_transform_position (GrdRdpLayoutManager  *layout_manager,
                                            uint32_t              x,
@@ -37,6 +37,10 @@ void grd_rdp_layout_manager_notify_session_started (GrdRdpLayoutManager *layout_
 void grd_rdp_layout_manager_submit_new_monitor_config (GrdRdpLayoutManager *layout_manager,
                                                        GrdRdpMonitorConfig *monitor_config);
 
+gboolean grd_rdp_layout_manager_can_suspend (GrdRdpLayoutManager *layout_manager);
+
+void grd_rdp_layout_manager_notify_peer_reattached (GrdRdpLayoutManager *layout_manager);
+
 gboolean grd_rdp_layout_manager_transform_position (GrdRdpLayoutManager  *layout_manager,
                                                     uint32_t              x,
                                                     uint32_t              y,
@@ -105,9 +105,8 @@ hwaccel_nvidia_from_buffer (GrdRdpLegacyBuffer *buffer)
     grd_rdp_buffer_pool_get_surface (buffer->buffer_pool);
   GrdSessionRdp *session_rdp =
     grd_rdp_renderer_get_session (rdp_surface->renderer);
-  GrdRdpServer *rdp_server = grd_session_rdp_get_server (session_rdp);
 
-  return grd_rdp_server_get_hwaccel_nvidia (rdp_server);
+  return grd_session_rdp_get_hwaccel_nvidia (session_rdp);
 }
 
 static GrdEglThread *
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "grd-rdp-memory-budget.h"
+
+/*
+ * After a system wide memory pressure event, sessions stay in the trimming
+ * state for this long, even when they are below their budget
+ */
+#define MEMORY_PRESSURE_DURATION_US (G_USEC_PER_SEC * 30)
+/*
+ * Usage changes on every encoded frame, so consumers of the usage are only
+ * notified about it at most once in this interval
+ */
+#define USAGE_CHANGED_INTERVAL_US (G_USEC_PER_SEC * 1)
+
+enum
+{
+  TRIM,
+  USAGE_CHANGED,
+
+  N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+struct _GrdRdpMemoryBudget
+{
+  GObject parent;
+
+  /* 0 means unlimited */
+  uint64_t budget;
+
+  GMutex usage_mutex;
+  uint64_t usage[GRD_RDP_MEMORY_CATEGORY_N];
+  uint64_t total_usage;
+  uint64_t peak_total_usage;
+  int64_t memory_pressure_end_us;
+
+  GSource *trim_source;
+  GSource *usage_changed_source;
+};
+
+G_DEFINE_TYPE (GrdRdpMemoryBudget, grd_rdp_memory_budget, G_TYPE_OBJECT)
+
+const char *
+grd_rdp_memory_category_to_string (GrdRdpMemoryCategory category)
+{
+  switch (category)
+    {
+    case GRD_RDP_MEMORY_CATEGORY_LOCAL_BUFFERS:
+      return "local-buffers";
+    case GRD_RDP_MEMORY_CATEGORY_BUFFER_POOLS:
+      return "buffer-pools";
+    case GRD_RDP_MEMORY_CATEGORY_ENCODE_STREAMS:
+      return "encode-streams";
+    case GRD_RDP_MEMORY_CATEGORY_VAAPI_SURFACES:
+      return "vaapi-surfaces";
+    case GRD_RDP_MEMORY_CATEGORY_AUDIO:
+      return "audio";
+    case GRD_RDP_MEMORY_CATEGORY_CLIPBOARD:
+      return "clipboard";
+    case GRD_RDP_MEMORY_CATEGORY_N:
+      break;
+    }
+
+  g_assert_not_reached ();
+}
+
+void
+grd_rdp_memory_budget_account (GrdRdpMemoryBudget   *memory_budget,
+                               GrdRdpMemoryCategory  category,
+                               int64_t               size_delta)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  uint64_t old_total_usage;
+
+  g_assert (category < GRD_RDP_MEMORY_CATEGORY_N);
+
+  if (size_delta == 0)
+    return;
+
+  locker = g_mutex_locker_new (&memory_budget->usage_mutex);
+  g_assert (size_delta > 0 ||
+            memory_budget->usage[category] >= (uint64_t) -size_delta);
+
+  old_total_usage = memory_budget->total_usage;
+
+  memory_budget->usage[category] += size_delta;
+  memory_budget->total_usage += size_delta;
+  memory_budget->peak_total_usage = MAX (memory_budget->peak_total_usage,
+                                         memory_budget->total_usage);
+
+  if (memory_budget->trim_source &&
+      memory_budget->budget > 0 &&
+      old_total_usage <= memory_budget->budget &&
+      memory_budget->total_usage > memory_budget->budget)
+    g_source_set_ready_time (memory_budget->trim_source, 0);
+
+  if (memory_budget->usage_changed_source &&
+      g_source_get_ready_time (memory_budget->usage_changed_source) == -1)
+    {
+      g_source_set_ready_time (memory_budget->usage_changed_source,
+                               g_get_monotonic_time () +
+                               USAGE_CHANGED_INTERVAL_US);
+    }
+}
+
+uint64_t
+grd_rdp_memory_budget_get_budget (GrdRdpMemoryBudget *memory_budget)
+{
+  return memory_budget->budget;
+}
+
+uint64_t
+grd_rdp_memory_budget_get_usage (GrdRdpMemoryBudget   *memory_budget,
+                                 GrdRdpMemoryCategory  category)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  g_assert (category < GRD_RDP_MEMORY_CATEGORY_N);
+
+  locker = g_mutex_locker_new (&memory_budget->usage_mutex);
+  return memory_budget->usage[category];
+}
+
+uint64_t
+grd_rdp_memory_budget_get_total_usage (GrdRdpMemoryBudget *memory_budget)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  locker = g_mutex_locker_new (&memory_budget->usage_mutex);
+  return memory_budget->total_usage;
+}
+
+uint64_t
+grd_rdp_memory_budget_get_peak_total_usage (GrdRdpMemoryBudget *memory_budget)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  locker = g_mutex_locker_new (&memory_budget->usage_mutex);
+  return memory_budget->peak_total_usage;
+}
+
+gboolean
+grd_rdp_memory_budget_is_under_pressure (GrdRdpMemoryBudget *memory_budget)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+
+  locker = g_mutex_locker_new (&memory_budget->usage_mutex);
+  if (memory_budget->budget > 0 &&
+      memory_budget->total_usage > memory_budget->budget)
+    return TRUE;
+
+  return g_get_monotonic_time () < memory_budget->memory_pressure_end_us;
+}
+
+void
+grd_rdp_memory_budget_notify_memory_pressure (GrdRdpMemoryBudget *memory_budget)
+{
+  g_mutex_lock (&memory_budget->usage_mutex);
+  memory_budget->memory_pressure_end_us = g_get_monotonic_time () +
+                                          MEMORY_PRESSURE_DURATION_US;
+  g_mutex_unlock (&memory_budget->usage_mutex);
+
+  g_source_set_ready_time (memory_budget->trim_source, 0);
+}
+
+void
+grd_rdp_memory_budget_log_usage (GrdRdpMemoryBudget *memory_budget)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  g_autoptr (GString) usage_string = NULL;
+  GrdRdpMemoryCategory category;
+
+  usage_string = g_string_new (NULL);
+
+  locker = g_mutex_locker_new (&memory_budget->usage_mutex);
+  for (category = 0; category < GRD_RDP_MEMORY_CATEGORY_N; ++category)
+    {
+      g_string_append_printf (usage_string, ", %s: %" G_GUINT64_FORMAT "KiB",
+                              grd_rdp_memory_category_to_string (category),
+                              memory_budget->usage[category] / 1024);
+    }
+
+  g_debug ("[RDP] Session memory usage: %" G_GUINT64_FORMAT "KiB (peak: "
+           "%" G_GUINT64_FORMAT "KiB, budget: %" G_GUINT64_FORMAT "KiB)%s",
+           memory_budget->total_usage / 1024,
+           memory_budget->peak_total_usage / 1024,
+           memory_budget->budget / 1024,
+           usage_string->str);
+}
+
+static gboolean
+trim (gpointer user_data)
+{
+  GrdRdpMemoryBudget *memory_budget = user_data;
+
+  g_debug ("[RDP] Session is under memory pressure, trimming caches and pools");
+  grd_rdp_memory_budget_log_usage (memory_budget);
+
+  g_signal_emit (memory_budget, signals[TRIM], 0);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+notify_usage_changed (gpointer user_data)
+{
+  GrdRdpMemoryBudget *memory_budget = user_data;
+
+  g_signal_emit (memory_budget, signals[USAGE_CHANGED], 0);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+source_dispatch (GSource     *source,
+                 GSourceFunc  callback,
+                 gpointer     user_data)
+{
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs source_funcs =
+{
+  .dispatch = source_dispatch,
+};
+
+GrdRdpMemoryBudget *
+grd_rdp_memory_budget_new (uint64_t budget)
+{
+  GrdRdpMemoryBudget *memory_budget;
+
+  memory_budget = g_object_new (GRD_TYPE_RDP_MEMORY_BUDGET, NULL);
+  memory_budget->budget = budget;
+
+  return memory_budget;
+}
+
+static void
+grd_rdp_memory_budget_dispose (GObject *object)
+{
+  GrdRdpMemoryBudget *memory_budget = GRD_RDP_MEMORY_BUDGET (object);
+
+  g_mutex_lock (&memory_budget->usage_mutex);
+  if (memory_budget->trim_source)
+    {
+      g_source_destroy (memory_budget->trim_source);
+      g_clear_pointer (&memory_budget->trim_source, g_source_unref);
+    }
+  if (memory_budget->usage_changed_source)
+    {
+      g_source_destroy (memory_budget->usage_changed_source);
+      g_clear_pointer (&memory_budget->usage_changed_source, g_source_unref);
+    }
+  g_mutex_unlock (&memory_budget->usage_mutex);
+
+  G_OBJECT_CLASS (grd_rdp_memory_budget_parent_class)->dispose (object);
+}
+
+static void
+grd_rdp_memory_budget_finalize (GObject *object)
+{
+  GrdRdpMemoryBudget *memory_budget = GRD_RDP_MEMORY_BUDGET (object);
+
+  g_mutex_clear (&memory_budget->usage_mutex);
+
+  G_OBJECT_CLASS (grd_rdp_memory_budget_parent_class)->finalize (object);
+}
+
+static void
+grd_rdp_memory_budget_init (GrdRdpMemoryBudget *memory_budget)
+{
+  GSource *trim_source;
+  GSource *usage_changed_source;
+
+  g_mutex_init (&memory_budget->usage_mutex);
+
+  trim_source = g_source_new (&source_funcs, sizeof (GSource));
+  g_source_set_callback (trim_source, trim, memory_budget, NULL);
+  g_source_set_ready_time (trim_source, -1);
+  g_source_attach (trim_source, NULL);
+  memory_budget->trim_source = trim_source;
+
+  usage_changed_source = g_source_new (&source_funcs, sizeof (GSource));
+  g_source_set_callback (usage_changed_source, notify_usage_changed,
+                         memory_budget, NULL);
+  g_source_set_ready_time (usage_changed_source, -1);
+  g_source_attach (usage_changed_source, NULL);
+  memory_budget->usage_changed_source = usage_changed_source;
+}
+
+static void
+grd_rdp_memory_budget_class_init (GrdRdpMemoryBudgetClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = grd_rdp_memory_budget_dispose;
+  object_class->finalize = grd_rdp_memory_budget_finalize;
+
+  signals[TRIM] = g_signal_new ("trim",
+                                G_TYPE_FROM_CLASS (klass),
+                                G_SIGNAL_RUN_LAST,
+                                0,
+                                NULL, NULL, NULL,
+                                G_TYPE_NONE, 0);
+  signals[USAGE_CHANGED] = g_signal_new ("usage-changed",
+                                         G_TYPE_FROM_CLASS (klass),
+                                         G_SIGNAL_RUN_LAST,
+                                         0,
+                                         NULL, NULL, NULL,
+                                         G_TYPE_NONE, 0);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include <stdint.h>
+
+#include "grd-types.h"
+
+#define GRD_TYPE_RDP_MEMORY_BUDGET (grd_rdp_memory_budget_get_type ())
+G_DECLARE_FINAL_TYPE (GrdRdpMemoryBudget, grd_rdp_memory_budget,
+                      GRD, RDP_MEMORY_BUDGET, GObject)
+
+typedef enum _GrdRdpMemoryCategory
+{
+  GRD_RDP_MEMORY_CATEGORY_LOCAL_BUFFERS,
+  GRD_RDP_MEMORY_CATEGORY_BUFFER_POOLS,
+  GRD_RDP_MEMORY_CATEGORY_ENCODE_STREAMS,
+  GRD_RDP_MEMORY_CATEGORY_VAAPI_SURFACES,
+  GRD_RDP_MEMORY_CATEGORY_AUDIO,
+  GRD_RDP_MEMORY_CATEGORY_CLIPBOARD,
+
+  GRD_RDP_MEMORY_CATEGORY_N
+} GrdRdpMemoryCategory;
+
+const char *grd_rdp_memory_category_to_string (GrdRdpMemoryCategory category);
+
+GrdRdpMemoryBudget *grd_rdp_memory_budget_new (uint64_t budget);
+
+uint64_t grd_rdp_memory_budget_get_budget (GrdRdpMemoryBudget *memory_budget);
+
+void grd_rdp_memory_budget_account (GrdRdpMemoryBudget   *memory_budget,
+                                    GrdRdpMemoryCategory  category,
+                                    int64_t               size_delta);
+
+uint64_t grd_rdp_memory_budget_get_usage (GrdRdpMemoryBudget   *memory_budget,
+                                          GrdRdpMemoryCategory  category);
+
+uint64_t grd_rdp_memory_budget_get_total_usage (GrdRdpMemoryBudget *memory_budget);
+
+uint64_t grd_rdp_memory_budget_get_peak_total_usage (GrdRdpMemoryBudget *memory_budget);
+
+gboolean grd_rdp_memory_budget_is_under_pressure (GrdRdpMemoryBudget *memory_budget);
+
+void grd_rdp_memory_budget_notify_memory_pressure (GrdRdpMemoryBudget *memory_budget);
+
+void grd_rdp_memory_budget_log_usage (GrdRdpMemoryBudget *memory_budget);
@@ -80,6 +80,10 @@ struct _GrdRdpNetworkAutodetection
   GQueue *round_trip_times;
   PingInterval ping_interval;
 
+  GMutex rtt_mutex;
+  int64_t base_round_trip_time_us;
+  int64_t avg_round_trip_time_us;
+
   GMutex bw_measure_mutex;
   uint32_t bandwidth_kbits;
   BwMeasureState bw_measure_state;
@@ -208,6 +212,9 @@ has_active_high_nec_rtt_consumers (GrdRdpNetworkAutodetection *network_autodetec
   if (is_active_high_nec_rtt_consumer (network_autodetection,
                                        GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_RDPGFX))
     return TRUE;
+  if (is_active_high_nec_rtt_consumer (network_autodetection,
+                                       GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_AUDIO))
+    return TRUE;
 
   return FALSE;
 }
@@ -450,6 +457,23 @@ update_round_trip_time_values (GrdRdpNetworkAutodetection *network_autodetection
   *avg_round_trip_time_us = sum_round_trip_times_us / total_round_trip_times;
 }
 
+void
+grd_rdp_network_autodetection_get_round_trip_times (GrdRdpNetworkAutodetection *network_autodetection,
+                                                    int64_t                    *base_round_trip_time_us,
+                                                    int64_t                    *avg_round_trip_time_us)
+{
+  g_mutex_lock (&network_autodetection->rtt_mutex);
+  *base_round_trip_time_us = network_autodetection->base_round_trip_time_us;
+  *avg_round_trip_time_us = network_autodetection->avg_round_trip_time_us;
+  g_mutex_unlock (&network_autodetection->rtt_mutex);
+}
+
+uint32_t
+grd_rdp_network_autodetection_get_bandwidth_kbits (GrdRdpNetworkAutodetection *network_autodetection)
+{
+  return g_atomic_int_get (&network_autodetection->bandwidth_kbits);
+}
+
 static void
 maybe_send_network_characteristics_results (GrdRdpNetworkAutodetection *network_autodetection,
                                             uint32_t                    base_round_trip_time_ms,
@@ -540,6 +564,11 @@ autodetect_rtt_measure_response (rdpAutoDetect      *rdp_autodetect,
                                  &base_round_trip_time_us,
                                  &avg_round_trip_time_us);
 
+  g_mutex_lock (&network_autodetection->rtt_mutex);
+  network_autodetection->base_round_trip_time_us = base_round_trip_time_us;
+  network_autodetection->avg_round_trip_time_us = avg_round_trip_time_us;
+  g_mutex_unlock (&network_autodetection->rtt_mutex);
+
   if (!grd_rdp_connect_time_autodetection_is_complete (ct_autodetection))
     {
       grd_rdp_connect_time_autodetection_notify_rtt_measure_response (ct_autodetection,
@@ -591,7 +620,7 @@ handle_bw_measure_results_connect_time (GrdRdpNetworkAutodetection *network_auto
   bit_count = ((uint64_t) byte_count) * UINT64_C (8);
   bandwidth_kbits = bit_count / MAX (time_delta_ms, 1);
 
-  network_autodetection->bandwidth_kbits = bandwidth_kbits;
+  g_atomic_int_set (&network_autodetection->bandwidth_kbits, bandwidth_kbits);
 
   return TRUE;
 }
@@ -614,7 +643,8 @@ handle_bw_measure_results_continuous (GrdRdpNetworkAutodetection *network_autode
   g_clear_pointer (&locker, g_mutex_locker_free);
 
   bit_count = ((uint64_t) byte_count) * UINT64_C (8);
-  network_autodetection->bandwidth_kbits = bit_count / MAX (time_delta_ms, 1);
+  g_atomic_int_set (&network_autodetection->bandwidth_kbits,
+                    bit_count / MAX (time_delta_ms, 1));
 
   update_round_trip_time_values (network_autodetection,
                                  &base_round_trip_time_us,
@@ -711,6 +741,7 @@ grd_rdp_network_autodetection_finalize (GObject *object)
     GRD_RDP_NETWORK_AUTODETECTION (object);
 
   g_mutex_clear (&network_autodetection->bw_measure_mutex);
+  g_mutex_clear (&network_autodetection->rtt_mutex);
   g_mutex_clear (&network_autodetection->sequence_mutex);
   g_mutex_clear (&network_autodetection->consumer_mutex);
   g_mutex_clear (&network_autodetection->shutdown_mutex);
@@ -734,6 +765,7 @@ grd_rdp_network_autodetection_init (GrdRdpNetworkAutodetection *network_autodete
   g_mutex_init (&network_autodetection->shutdown_mutex);
   g_mutex_init (&network_autodetection->consumer_mutex);
   g_mutex_init (&network_autodetection->sequence_mutex);
+  g_mutex_init (&network_autodetection->rtt_mutex);
   g_mutex_init (&network_autodetection->bw_measure_mutex);
 }
 
@@ -32,6 +32,7 @@ typedef enum _GrdRdpNwAutodetectRTTConsumer
 {
   GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_NONE   = 0,
   GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_RDPGFX = 1 << 0,
+  GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_AUDIO  = 1 << 1,
 } GrdRdpNwAutodetectRTTConsumer;
 
 typedef enum _GrdRdpNwAutodetectRTTNecessity
@@ -65,6 +66,12 @@ void grd_rdp_network_autodetection_set_rtt_consumer_necessity (GrdRdpNetworkAuto
                                                                GrdRdpNwAutodetectRTTConsumer   rtt_consumer,
                                                                GrdRdpNwAutodetectRTTNecessity  rtt_necessity);
 
+void grd_rdp_network_autodetection_get_round_trip_times (GrdRdpNetworkAutodetection *network_autodetection,
+                                                         int64_t                    *base_round_trip_time_us,
+                                                         int64_t                    *avg_round_trip_time_us);
+
+uint32_t grd_rdp_network_autodetection_get_bandwidth_kbits (GrdRdpNetworkAutodetection *network_autodetection);
+
 gboolean grd_rdp_network_autodetection_try_bw_measure_start (GrdRdpNetworkAutodetection *network_autodetection);
 
 void grd_rdp_network_autodetection_bw_measure_stop (GrdRdpNetworkAutodetection *network_autodetection);
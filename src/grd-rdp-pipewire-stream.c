@@ -40,10 +40,10 @@
 #include "grd-rdp-legacy-buffer.h"
 #include "grd-rdp-pw-buffer.h"
 #include "grd-rdp-renderer.h"
-#include "grd-rdp-server.h"
 #include "grd-rdp-session-metrics.h"
 #include "grd-rdp-surface.h"
 #include "grd-rdp-surface-renderer.h"
+#include "grd-session-rdp.h"
 #include "grd-utils.h"
 #include "grd-vk-device.h"
 
@@ -277,9 +277,8 @@ get_modifiers_for_format (GrdRdpPipeWireStream  *stream,
   vk_device = grd_rdp_renderer_get_vk_device (renderer);
   if (vk_device)
     {
-      GrdRdpServer *rdp_server = grd_session_rdp_get_server (session_rdp);
       GrdHwAccelVulkan *hwaccel_vulkan =
-        grd_rdp_server_get_hwaccel_vulkan (rdp_server);
+        grd_session_rdp_get_hwaccel_vulkan (session_rdp);
       GrdVkPhysicalDevice *vk_physical_device =
         grd_vk_device_get_physical_device (vk_device);
 
@@ -305,9 +304,8 @@ add_format_params (GrdRdpPipeWireStream        *stream,
 {
   GrdSession *session = GRD_SESSION (stream->session_rdp);
   GrdContext *context = grd_session_get_context (session);
-  GrdRdpServer *rdp_server = grd_session_rdp_get_server (stream->session_rdp);
   GrdHwAccelNvidia *hwaccel_nvidia =
-    grd_rdp_server_get_hwaccel_nvidia (rdp_server);
+    grd_session_rdp_get_hwaccel_nvidia (stream->session_rdp);
   GrdEglThread *egl_thread = grd_context_get_egl_thread (context);
   GrdRdpSurfaceRenderer *surface_renderer =
     grd_rdp_surface_get_surface_renderer (stream->rdp_surface);
@@ -487,9 +485,8 @@ on_stream_param_changed (void                 *user_data,
   GrdSession *session = GRD_SESSION (stream->session_rdp);
   GrdContext *context = grd_session_get_context (session);
   GrdEglThread *egl_thread = grd_context_get_egl_thread (context);
-  GrdRdpServer *rdp_server = grd_session_rdp_get_server (stream->session_rdp);
   GrdHwAccelNvidia *hwaccel_nvidia =
-    grd_rdp_server_get_hwaccel_nvidia (rdp_server);
+    grd_session_rdp_get_hwaccel_nvidia (stream->session_rdp);
   uint32_t width;
   uint32_t height;
   uint32_t stride;
@@ -857,9 +854,8 @@ process_frame_data (GrdRdpPipeWireStream *stream,
   GrdSession *session = GRD_SESSION (stream->session_rdp);
   GrdContext *context = grd_session_get_context (session);
   GrdEglThread *egl_thread = grd_context_get_egl_thread (context);
-  GrdRdpServer *rdp_server = grd_session_rdp_get_server (stream->session_rdp);
   GrdHwAccelNvidia *hwaccel_nvidia =
-    grd_rdp_server_get_hwaccel_nvidia (rdp_server);
+    grd_session_rdp_get_hwaccel_nvidia (stream->session_rdp);
   struct spa_buffer *buffer = pw_buffer->buffer;
   GrdRdpPwBuffer *rdp_pw_buffer = NULL;
   g_autoptr (GrdRdpFrame) frame = NULL;
@@ -991,9 +987,8 @@ static void
 on_stream_process (void *user_data)
 {
   GrdRdpPipeWireStream *stream = GRD_RDP_PIPEWIRE_STREAM (user_data);
-  GrdRdpServer *rdp_server = grd_session_rdp_get_server (stream->session_rdp);
   GrdHwAccelNvidia *hwaccel_nvidia =
-    grd_rdp_server_get_hwaccel_nvidia (rdp_server);
+    grd_session_rdp_get_hwaccel_nvidia (stream->session_rdp);
   g_autoptr (GMutexLocker) locker = NULL;
   struct pw_buffer *last_pointer_buffer = NULL;
   struct pw_buffer *last_frame_buffer = NULL;
@@ -1169,9 +1164,8 @@ grd_rdp_pipewire_stream_new (GrdSessionRdp               *session_rdp,
   GrdSession *session = GRD_SESSION (session_rdp);
   GrdContext *context = grd_session_get_context (session);
   GrdEglThread *egl_thread = grd_context_get_egl_thread (context);
-  GrdRdpServer *rdp_server = grd_session_rdp_get_server (session_rdp);
   GrdHwAccelNvidia *hwaccel_nvidia =
-    grd_rdp_server_get_hwaccel_nvidia (rdp_server);
+    grd_session_rdp_get_hwaccel_nvidia (session_rdp);
   g_autoptr (GrdRdpPipeWireStream) stream = NULL;
   GrdPipeWireSource *pipewire_source;
 
@@ -26,6 +26,7 @@
 #include "grd-context.h"
 #include "grd-encode-session.h"
 #include "grd-encode-session-ca-sw.h"
+#include "grd-encode-session-vaapi.h"
 #include "grd-hwaccel-vaapi.h"
 #include "grd-image-view.h"
 #include "grd-rdp-buffer-info.h"
@@ -35,6 +36,7 @@
 #include "grd-rdp-gfx-frame-controller.h"
 #include "grd-rdp-gfx-framerate-log.h"
 #include "grd-rdp-gfx-surface.h"
+#include "grd-rdp-memory-budget.h"
 #include "grd-rdp-render-state.h"
 #include "grd-rdp-renderer.h"
 #include "grd-rdp-server.h"
@@ -43,6 +45,7 @@
 #include "grd-rdp-view-creator-avc.h"
 #include "grd-rdp-view-creator-gen-gl.h"
 #include "grd-rdp-view-creator-gen-sw.h"
+#include "grd-session-rdp.h"
 #include "grd-utils.h"
 
 #define STATE_TILE_WIDTH 64
@@ -60,6 +63,8 @@ struct _GrdRdpRenderContext
   GrdRdpViewCreator *view_creator;
   GrdEncodeSession *encode_session;
 
+  GrdRdpFramePool *frame_pool;
+
   GHashTable *image_views;
   GHashTable *acquired_image_views;
 
@@ -69,6 +74,10 @@ struct _GrdRdpRenderContext
 
   uint32_t *chroma_state_buffer;
   uint32_t state_buffer_length;
+
+  GrdRdpMemoryBudget *memory_budget;
+  /* Estimated memory usage of the VAAPI encode session */
+  uint64_t vaapi_memory_usage;
 };
 
 G_DEFINE_TYPE (GrdRdpRenderContext, grd_rdp_render_context, G_TYPE_OBJECT)
@@ -103,6 +112,12 @@ grd_rdp_render_context_get_encode_session (GrdRdpRenderContext *render_context)
   return render_context->encode_session;
 }
 
+GrdRdpFramePool *
+grd_rdp_render_context_get_frame_pool (GrdRdpRenderContext *render_context)
+{
+  return render_context->frame_pool;
+}
+
 gboolean
 grd_rdp_render_context_must_delay_view_finalization (GrdRdpRenderContext *render_context)
 {
@@ -390,8 +405,6 @@ grd_rdp_render_context_update_frame_state (GrdRdpRenderContext *render_context,
 
   damage_region = create_damage_region (render_context, render_state);
   grd_rdp_frame_set_damage_region (rdp_frame, damage_region);
-
-  grd_rdp_render_state_free (render_state);
 }
 
 void
@@ -494,6 +507,13 @@ try_create_vaapi_session (GrdRdpRenderContext *render_context,
       g_hash_table_add (render_context->image_views, image_view);
     }
 
+  render_context->vaapi_memory_usage =
+    grd_encode_session_vaapi_estimate_memory_usage (
+      GRD_ENCODE_SESSION_VAAPI (encode_session));
+  grd_rdp_memory_budget_account (render_context->memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_VAAPI_SURFACES,
+                                 render_context->vaapi_memory_usage);
+
   render_context->view_creator = GRD_RDP_VIEW_CREATOR (view_creator_avc);
   render_context->encode_session = g_steal_pointer (&encode_session);
 
@@ -523,6 +543,7 @@ create_egl_based_rfx_progressive_encode_session (GrdRdpRenderContext  *render_co
 
   encode_session_ca =
     grd_encode_session_ca_sw_new (encoder_ca,
+                                  render_context->memory_budget,
                                   surface_width, surface_height,
                                   error);
   if (!encode_session_ca)
@@ -593,6 +614,7 @@ create_sw_based_rfx_progressive_encode_session (GrdRdpRenderContext  *render_con
 
   encode_session_ca =
     grd_encode_session_ca_sw_new (encoder_ca,
+                                  render_context->memory_budget,
                                   surface_width, surface_height,
                                   error);
   if (!encode_session_ca)
@@ -676,6 +698,8 @@ grd_rdp_render_context_new (GrdRdpRenderer *renderer,
 
   render_context = g_object_new (GRD_TYPE_RDP_RENDER_CONTEXT, NULL);
   render_context->renderer = renderer;
+  render_context->memory_budget =
+    g_object_ref (grd_session_rdp_get_memory_budget (session_rdp));
   render_context->gfx_surface =
     grd_rdp_dvc_graphics_pipeline_acquire_gfx_surface (graphics_pipeline,
                                                        rdp_surface);
@@ -704,6 +728,15 @@ grd_rdp_render_context_dispose (GObject *object)
   g_clear_object (&render_context->encode_session);
   g_clear_object (&render_context->gfx_surface);
 
+  if (render_context->memory_budget)
+    {
+      grd_rdp_memory_budget_account (render_context->memory_budget,
+                                     GRD_RDP_MEMORY_CATEGORY_VAAPI_SURFACES,
+                                     -(int64_t) render_context->vaapi_memory_usage);
+      render_context->vaapi_memory_usage = 0;
+    }
+  g_clear_object (&render_context->memory_budget);
+
   G_OBJECT_CLASS (grd_rdp_render_context_parent_class)->dispose (object);
 }
 
@@ -712,6 +745,8 @@ grd_rdp_render_context_finalize (GObject *object)
 {
   GrdRdpRenderContext *render_context = GRD_RDP_RENDER_CONTEXT (object);
 
+  g_clear_pointer (&render_context->frame_pool, grd_rdp_frame_pool_free);
+
   g_clear_pointer (&render_context->acquired_image_views, g_hash_table_unref);
   g_clear_pointer (&render_context->image_views, g_hash_table_unref);
 
@@ -721,6 +756,8 @@ grd_rdp_render_context_finalize (GObject *object)
 static void
 grd_rdp_render_context_init (GrdRdpRenderContext *render_context)
 {
+  render_context->frame_pool = grd_rdp_frame_pool_new ();
+
   render_context->image_views = g_hash_table_new (NULL, NULL);
   render_context->acquired_image_views = g_hash_table_new (NULL, NULL);
 }
@@ -48,6 +48,8 @@ GrdRdpViewCreator *grd_rdp_render_context_get_view_creator (GrdRdpRenderContext
 
 GrdEncodeSession *grd_rdp_render_context_get_encode_session (GrdRdpRenderContext *render_context);
 
+GrdRdpFramePool *grd_rdp_render_context_get_frame_pool (GrdRdpRenderContext *render_context);
+
 gboolean grd_rdp_render_context_must_delay_view_finalization (GrdRdpRenderContext *render_context);
 
 gboolean grd_rdp_render_context_should_avoid_dual_frame (GrdRdpRenderContext *render_context);
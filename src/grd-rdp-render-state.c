@@ -61,6 +61,17 @@ grd_rdp_render_state_new (uint32_t *damage_buffer,
   return render_state;
 }
 
+void
+grd_rdp_render_state_update (GrdRdpRenderState *render_state,
+                             uint32_t          *damage_buffer,
+                             uint32_t          *chroma_state_buffer,
+                             uint32_t           state_buffer_length)
+{
+  render_state->damage_buffer = damage_buffer;
+  render_state->chroma_state_buffer = chroma_state_buffer;
+  render_state->state_buffer_length = state_buffer_length;
+}
+
 void
 grd_rdp_render_state_free (GrdRdpRenderState *render_state)
 {
@@ -28,6 +28,11 @@ GrdRdpRenderState *grd_rdp_render_state_new (uint32_t *damage_buffer,
                                              uint32_t *chroma_state_buffer,
                                              uint32_t  state_buffer_length);
 
+void grd_rdp_render_state_update (GrdRdpRenderState *render_state,
+                                  uint32_t          *damage_buffer,
+                                  uint32_t          *chroma_state_buffer,
+                                  uint32_t           state_buffer_length);
+
 void grd_rdp_render_state_free (GrdRdpRenderState *render_state);
 
 uint32_t *grd_rdp_render_state_get_damage_buffer (GrdRdpRenderState *render_state);
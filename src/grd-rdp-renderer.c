@@ -30,7 +30,6 @@
 #include "grd-rdp-frame.h"
 #include "grd-rdp-private.h"
 #include "grd-rdp-render-context.h"
-#include "grd-rdp-server.h"
 #include "grd-rdp-surface.h"
 #include "grd-rdp-surface-renderer.h"
 #include "grd-rdp-sw-encoder-ca.h"
@@ -177,9 +176,8 @@ static gpointer
 graphics_thread_func (gpointer data)
 {
   GrdRdpRenderer *renderer = data;
-  GrdRdpServer *rdp_server = grd_session_rdp_get_server (renderer->session_rdp);
   GrdHwAccelNvidia *hwaccel_nvidia =
-    grd_rdp_server_get_hwaccel_nvidia (rdp_server);
+    grd_session_rdp_get_hwaccel_nvidia (renderer->session_rdp);
 
   if (hwaccel_nvidia)
     grd_hwaccel_nvidia_push_cuda_context (hwaccel_nvidia);
@@ -234,9 +232,8 @@ maybe_initialize_hardware_acceleration (GrdRdpRenderer   *renderer,
 gboolean
 grd_rdp_renderer_start (GrdRdpRenderer *renderer)
 {
-  GrdRdpServer *rdp_server = grd_session_rdp_get_server (renderer->session_rdp);
   GrdHwAccelVulkan *hwaccel_vulkan =
-    grd_rdp_server_get_hwaccel_vulkan (rdp_server);
+    grd_session_rdp_get_hwaccel_vulkan (renderer->session_rdp);
   g_autoptr (GError) error = NULL;
 
   if (hwaccel_vulkan &&
@@ -258,6 +255,25 @@ grd_rdp_renderer_start (GrdRdpRenderer *renderer)
   return TRUE;
 }
 
+void
+grd_rdp_renderer_resume (GrdRdpRenderer *renderer)
+{
+  g_assert (renderer->encoder_ca);
+  g_assert (!renderer->graphics_thread);
+
+  g_mutex_lock (&renderer->inhibition_mutex);
+  renderer->stop_rendering = FALSE;
+  g_mutex_unlock (&renderer->inhibition_mutex);
+
+  /* Output suppression state of the previous connection does not apply */
+  renderer->output_suppressed = FALSE;
+  renderer->in_shutdown = FALSE;
+
+  renderer->graphics_thread = g_thread_new ("RDP graphics thread",
+                                            graphics_thread_func,
+                                            renderer);
+}
+
 static GrdRdpDvcGraphicsPipeline *
 graphics_pipeline_from_renderer (GrdRdpRenderer *renderer)
 {
@@ -56,6 +56,8 @@ void grd_rdp_renderer_invoke_shutdown (GrdRdpRenderer *renderer);
 
 gboolean grd_rdp_renderer_start (GrdRdpRenderer *renderer);
 
+void grd_rdp_renderer_resume (GrdRdpRenderer *renderer);
+
 void grd_rdp_renderer_notify_new_desktop_layout (GrdRdpRenderer *renderer,
                                                  uint32_t        desktop_width,
                                                  uint32_t        desktop_height);
@@ -30,6 +30,14 @@
 #define MAX_PEEK_TIME_MS 2000
 #define PROTOCOL_RDSTLS 0x00000004
 
+#define TPKT_HEADER_LENGTH 4
+
+typedef enum _PeekState
+{
+  PEEK_STATE_TPKT_HEADER,
+  PEEK_STATE_X224_PDU,
+} PeekState;
+
 typedef struct _RoutingTokenContext
 {
   GrdRdpServer *rdp_server;
@@ -37,9 +45,14 @@ typedef struct _RoutingTokenContext
 
   GCancellable *cancellable;
   unsigned int abort_peek_source_id;
+  GSource *socket_source;
 
   GCancellable *server_cancellable;
 
+  PeekState state;
+  uint16_t tpkt_length;
+  int n_peeked_bytes;
+
   gboolean requested_rdstls;
 } RoutingTokenContext;
 
@@ -70,72 +83,74 @@ find_cr_lf (const char *buffer,
 }
 
 static gboolean
-peek_bytes (int            fd,
-            uint8_t       *buffer,
-            int            length,
-            GCancellable  *cancellable,
-            GError       **error)
+set_receive_low_watermark (int      fd,
+                           int      length,
+                           GError **error)
+{
+  if (setsockopt (fd, SOL_SOCKET, SO_RCVLOWAT, &length, sizeof (length)) != 0)
+    {
+      g_set_error (error, G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "On setsockopt command: %s", strerror (errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Peeks the requested amount of bytes without blocking. If not enough data is
+ * available yet, the receive low watermark is raised to the requested length,
+ * so that the socket only becomes readable again, when the missing data has
+ * arrived or when the peer closed the connection.
+ */
+static gboolean
+try_peek_bytes (int        fd,
+                uint8_t   *buffer,
+                int        length,
+                int       *n_peeked_bytes,
+                gboolean  *peeked,
+                GError   **error)
 {
-  GPollFD poll_fds[2] = {};
-  int n_fds = 0;
   int ret;
 
-  poll_fds[n_fds].fd = fd;
-  poll_fds[n_fds].events = G_IO_IN;
-  n_fds++;
+  *peeked = FALSE;
+
+  do
+    ret = recv (fd, (void *) buffer, (size_t) length, MSG_PEEK | MSG_DONTWAIT);
+  while (ret == -1 && errno == EINTR);
 
-  if (!g_cancellable_make_pollfd (cancellable, &poll_fds[n_fds]))
+  if (ret == -1)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Failure preparing the cancellable for pollfd");
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return TRUE;
+
+      g_set_error (error, G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "On recv command: %s", strerror (errno));
       return FALSE;
     }
 
-  n_fds++;
-
-  do
+  if (ret == 0)
     {
-      do
-        ret = g_poll (poll_fds, n_fds, MAX_PEEK_TIME_MS);
-      while (ret == -1 && errno == EINTR);
-
-      if (ret == -1)
-        {
-          g_set_error (error, G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       "On poll command: %s", strerror (errno));
-          g_cancellable_release_fd (cancellable);
-          return FALSE;
-        }
-
-      if (g_cancellable_is_cancelled (cancellable))
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
-                       "Cancelled");
-          g_cancellable_release_fd (cancellable);
-          return FALSE;
-        }
-
-      do
-        ret = recv (fd, (void *) buffer, (size_t) length, MSG_PEEK);
-      while (ret == -1 && errno == EINTR);
-
-      if (ret == -1)
-        {
-          if (errno == EAGAIN || errno == EWOULDBLOCK)
-            continue;
-
-          g_set_error (error, G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       "On recv command: %s", strerror (errno));
-          g_cancellable_release_fd (cancellable);
-          return FALSE;
-        }
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED,
+                   "Connection closed by peer");
+      return FALSE;
+    }
 
+  if (ret < length && ret == *n_peeked_bytes)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED,
+                   "Connection closed by peer before the PDU was complete");
+      return FALSE;
     }
-  while (ret < length);
 
-  g_cancellable_release_fd (cancellable);
+  *n_peeked_bytes = ret;
+
+  if (ret < length)
+    return set_receive_low_watermark (fd, length, error);
+
+  *peeked = TRUE;
 
   return TRUE;
 }
@@ -168,11 +183,11 @@ get_routing_token_without_prefix (char   *buffer,
 }
 
 static gboolean
-peek_routing_token (int            fd,
-                    char         **routing_token,
-                    gboolean      *requested_rdstls,
-                    GCancellable  *cancellable,
-                    GError       **error)
+peek_tpkt_header (int        fd,
+                  uint16_t  *tpkt_length_out,
+                  int       *n_peeked_bytes,
+                  gboolean  *peeked,
+                  GError   **error)
 {
   g_autoptr (wStream) s = NULL;
 
@@ -180,25 +195,14 @@ peek_routing_token (int            fd,
   uint8_t  version;
   uint16_t tpkt_length;
 
-  /* x224Crq values */
-  uint8_t  length_indicator;
-  uint8_t  cr_cdt;
-  uint16_t dst_ref;
-  uint8_t  class_opt;
-
-  size_t routing_token_length;
-
-  /* rdpNegReq values */
-  uint8_t rdp_neg_type;
-  uint16_t rdp_neg_length;
-  uint32_t requested_protocols;
-
-  /* Peek TPKT Header */
-  s = Stream_New (NULL, 4);
+  s = Stream_New (NULL, TPKT_HEADER_LENGTH);
   g_assert (s);
 
-  if (!peek_bytes (fd, Stream_Buffer (s), 4, cancellable, error))
+  if (!try_peek_bytes (fd, Stream_Buffer (s), TPKT_HEADER_LENGTH,
+                       n_peeked_bytes, peeked, error))
     return FALSE;
+  if (!(*peeked))
+    return TRUE;
 
   Stream_Read_UINT8 (s, version);
   Stream_Seek (s, 1);
@@ -217,15 +221,46 @@ peek_routing_token (int            fd,
       return FALSE;
     }
 
+  *tpkt_length_out = tpkt_length;
+
+  return TRUE;
+}
+
+static gboolean
+peek_routing_token (int         fd,
+                    uint16_t    tpkt_length,
+                    char      **routing_token,
+                    gboolean   *requested_rdstls,
+                    int        *n_peeked_bytes,
+                    gboolean   *peeked,
+                    GError    **error)
+{
+  g_autoptr (wStream) s = NULL;
+
+  /* x224Crq values */
+  uint8_t  length_indicator;
+  uint8_t  cr_cdt;
+  uint16_t dst_ref;
+  uint8_t  class_opt;
+
+  size_t routing_token_length;
+
+  /* rdpNegReq values */
+  uint8_t rdp_neg_type;
+  uint16_t rdp_neg_length;
+  uint32_t requested_protocols;
+
   /* Peek full PDU */
-  Stream_Free (s, TRUE);
   s = Stream_New (NULL, tpkt_length);
   g_assert (s);
 
-  if (!peek_bytes (fd, Stream_Buffer (s), tpkt_length, cancellable, error))
+  if (!try_peek_bytes (fd, Stream_Buffer (s), tpkt_length,
+                       n_peeked_bytes, peeked, error))
     return FALSE;
+  if (!(*peeked))
+    return TRUE;
 
-  Stream_Seek (s, 4);
+  Stream_Seek (s, TPKT_HEADER_LENGTH);
 
   /* Check x224Crq */
   Stream_Read_UINT8 (s, length_indicator);
@@ -272,29 +307,102 @@ peek_routing_token (int            fd,
   return TRUE;
 }
 
+static gboolean
+continue_peek (RoutingTokenContext  *routing_token_context,
+               int                   fd,
+               char                **routing_token,
+               gboolean             *finished,
+               GError              **error)
+{
+  gboolean peeked = FALSE;
+
+  *finished = FALSE;
+
+  switch (routing_token_context->state)
+    {
+    case PEEK_STATE_TPKT_HEADER:
+      if (!peek_tpkt_header (fd, &routing_token_context->tpkt_length,
+                             &routing_token_context->n_peeked_bytes,
+                             &peeked, error))
+        return FALSE;
+      if (!peeked)
+        return TRUE;
+
+      routing_token_context->state = PEEK_STATE_X224_PDU;
+      routing_token_context->n_peeked_bytes = 0;
+      G_GNUC_FALLTHROUGH;
+    case PEEK_STATE_X224_PDU:
+      if (!peek_routing_token (fd,
+                               routing_token_context->tpkt_length,
+                               routing_token,
+                               &routing_token_context->requested_rdstls,
+                               &routing_token_context->n_peeked_bytes,
+                               &peeked,
+                               error))
+        return FALSE;
+      if (!peeked)
+        return TRUE;
+
+      *finished = TRUE;
+      return TRUE;
+    }
+
+  g_assert_not_reached ();
+}
+
 static void
-peek_routing_token_in_thread (GTask        *task,
-                              gpointer      source_object,
-                              gpointer      task_data,
-                              GCancellable *cancellable)
+stop_peeking (RoutingTokenContext *routing_token_context)
 {
-  RoutingTokenContext *routing_token_context = task_data;
   GSocket *socket;
-  int fd;
+  g_autoptr (GError) error = NULL;
+
+  g_clear_handle_id (&routing_token_context->abort_peek_source_id,
+                     g_source_remove);
+
+  if (routing_token_context->socket_source)
+    {
+      g_source_destroy (routing_token_context->socket_source);
+      g_clear_pointer (&routing_token_context->socket_source, g_source_unref);
+    }
+
+  /* The connection is handed over to FreeRDP, which expects the default */
+  socket = g_socket_connection_get_socket (routing_token_context->connection);
+  if (!set_receive_low_watermark (g_socket_get_fd (socket), 1, &error))
+    g_debug ("RoutingToken: Failed to reset receive low watermark: %s",
+             error->message);
+}
+
+static gboolean
+on_socket_ready (GSocket      *socket,
+                 GIOCondition  condition,
+                 gpointer      user_data)
+{
+  GTask *task = G_TASK (user_data);
+  RoutingTokenContext *routing_token_context = g_task_get_task_data (task);
   char *routing_token = NULL;
+  gboolean finished = FALSE;
   GError *error = NULL;
 
-  socket = g_socket_connection_get_socket (routing_token_context->connection);
-  fd = g_socket_get_fd (socket);
-
-  if (!peek_routing_token (fd,
-                           &routing_token,
-                           &routing_token_context->requested_rdstls,
-                           routing_token_context->cancellable,
-                           &error))
-    g_task_return_error (task, error);
-  else
-    g_task_return_pointer (task, routing_token, g_free);
+  if (g_cancellable_set_error_if_cancelled (routing_token_context->cancellable,
+                                            &error) ||
+      !continue_peek (routing_token_context,
+                      g_socket_get_fd (socket),
+                      &routing_token,
+                      &finished,
+                      &error))
+    {
+      stop_peeking (routing_token_context);
+      g_task_return_error (task, error);
+      return G_SOURCE_REMOVE;
+    }
+
+  if (!finished)
+    return G_SOURCE_CONTINUE;
+
+  stop_peeking (routing_token_context);
+  g_task_return_pointer (task, routing_token, g_free);
+
+  return G_SOURCE_REMOVE;
 }
 
 static gboolean
@@ -319,6 +427,8 @@ clear_routing_token_context (gpointer data)
 {
   RoutingTokenContext *routing_token_context = data;
 
+  g_assert (!routing_token_context->socket_source);
+
   g_clear_object (&routing_token_context->connection);
   g_clear_object (&routing_token_context->server_cancellable);
   g_clear_object (&routing_token_context->cancellable);
@@ -335,6 +445,7 @@ grd_routing_token_peek_async (GrdRdpServer        *rdp_server,
                               GAsyncReadyCallback  on_finished_callback)
 {
   RoutingTokenContext *routing_token_context;
+  GSocket *socket;
   GTask *task;
 
   routing_token_context = g_new0 (RoutingTokenContext, 1);
@@ -342,11 +453,23 @@ grd_routing_token_peek_async (GrdRdpServer        *rdp_server,
   routing_token_context->connection = g_object_ref (connection);
   routing_token_context->cancellable = g_cancellable_new ();
   routing_token_context->server_cancellable = g_object_ref (cancellable);
+  routing_token_context->state = PEEK_STATE_TPKT_HEADER;
 
   task = g_task_new (NULL, NULL, on_finished_callback, NULL);
   g_task_set_task_data (task, routing_token_context, clear_routing_token_context);
-  g_task_run_in_thread (task, peek_routing_token_in_thread);
-  g_object_unref (task);
+
+  /*
+   * Peek on the main context, driven by the readiness of the socket, so that
+   * pending connections don't occupy a thread each. The source keeps the task
+   * alive, until the peek operation finished, failed or timed out.
+   */
+  socket = g_socket_connection_get_socket (connection);
+  routing_token_context->socket_source =
+    g_socket_create_source (socket, G_IO_IN, routing_token_context->cancellable);
+  g_source_set_callback (routing_token_context->socket_source,
+                         G_SOURCE_FUNC (on_socket_ready),
+                         task, g_object_unref);
+  g_source_attach (routing_token_context->socket_source, NULL);
 
   routing_token_context->abort_peek_source_id =
     g_timeout_add (MAX_PEEK_TIME_MS,
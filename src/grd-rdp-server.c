@@ -28,8 +28,10 @@
 #include <winpr/ssl.h>
 
 #include "grd-context.h"
+#include "grd-hwaccel-cache.h"
 #include "grd-hwaccel-nvidia.h"
 #include "grd-hwaccel-vulkan.h"
+#include "grd-rdp-memory-budget.h"
 #include "grd-rdp-routing-token.h"
 #include "grd-session-rdp.h"
 #include "grd-throttler.h"
@@ -57,6 +59,21 @@ enum
 
 static guint signals[N_SIGNALS];
 
+typedef struct _HwAccelProbe
+{
+  GrdEglThread *egl_thread;
+  GrdHwAccelCache *hwaccel_cache;
+
+  GThread *probe_thread;
+  GSource *probe_done_source;
+
+  int64_t probe_start_us;
+
+  /* Set by the probe thread */
+  gboolean cuda_available;
+  GrdHwAccelVulkan *hwaccel_vulkan;
+} HwAccelProbe;
+
 struct _GrdRdpServer
 {
   GSocketService parent;
@@ -68,14 +85,41 @@ struct _GrdRdpServer
   GList *stopped_sessions;
   guint cleanup_sessions_idle_id;
 
+  uint32_t next_logon_id;
+
+  /* Maps the logon id of a session, waiting for its client to reconnect */
+  GMutex suspended_sessions_mutex;
+  GHashTable *suspended_sessions;
+
   GCancellable *cancellable;
 
+  GMemoryMonitor *memory_monitor;
+  uint64_t peak_session_memory_usage;
+
   GrdContext *context;
   GrdHwAccelVulkan *hwaccel_vulkan;
   GrdHwAccelNvidia *hwaccel_nvidia;
 
+  /*
+   * Sessions take the hardware acceleration, which is available when they are
+   * created, so that existing sessions do not switch their backend midway,
+   * when the probe finishes
+   */
+  HwAccelProbe *hwaccel_probe;
+
   uint32_t pending_binding_attempts;
   unsigned int binding_timeout_source_id;
+
+  /*
+   * Parsed from the settings, whenever they change. Sessions get a copy of
+   * the certificate created from its DER encoding. FreeRDP exports no way to
+   * copy a private key, so the key of a session is created from the PEM data.
+   */
+  rdpCertificate *server_certificate;
+  BYTE *server_certificate_der;
+  size_t server_certificate_der_len;
+  rdpPrivateKey *server_private_key;
+  char *server_private_key_pem;
 };
 
 G_DEFINE_TYPE (GrdRdpServer, grd_rdp_server, G_TYPE_SOCKET_SERVICE)
@@ -98,12 +142,382 @@ grd_rdp_server_get_hwaccel_vulkan (GrdRdpServer *rdp_server)
   return rdp_server->hwaccel_vulkan;
 }
 
+uint32_t
+grd_rdp_server_acquire_logon_id (GrdRdpServer *rdp_server)
+{
+  return ++rdp_server->next_logon_id;
+}
+
+void
+grd_rdp_server_add_suspended_session (GrdRdpServer  *rdp_server,
+                                      GrdSessionRdp *session_rdp)
+{
+  uint32_t logon_id = grd_session_rdp_get_logon_id (session_rdp);
+
+  g_mutex_lock (&rdp_server->suspended_sessions_mutex);
+  g_assert (!g_hash_table_contains (rdp_server->suspended_sessions,
+                                    GUINT_TO_POINTER (logon_id)));
+  g_hash_table_insert (rdp_server->suspended_sessions,
+                       GUINT_TO_POINTER (logon_id), session_rdp);
+  g_mutex_unlock (&rdp_server->suspended_sessions_mutex);
+}
+
+void
+grd_rdp_server_remove_suspended_session (GrdRdpServer  *rdp_server,
+                                         GrdSessionRdp *session_rdp)
+{
+  uint32_t logon_id = grd_session_rdp_get_logon_id (session_rdp);
+
+  g_mutex_lock (&rdp_server->suspended_sessions_mutex);
+  if (g_hash_table_lookup (rdp_server->suspended_sessions,
+                           GUINT_TO_POINTER (logon_id)) == session_rdp)
+    {
+      g_hash_table_remove (rdp_server->suspended_sessions,
+                           GUINT_TO_POINTER (logon_id));
+    }
+  g_mutex_unlock (&rdp_server->suspended_sessions_mutex);
+}
+
+GrdSessionRdp *
+grd_rdp_server_claim_suspended_session (GrdRdpServer  *rdp_server,
+                                        uint32_t       logon_id,
+                                        const uint8_t *security_verifier)
+{
+  g_autoptr (GMutexLocker) locker = NULL;
+  GrdSessionRdp *session_rdp;
+
+  locker = g_mutex_locker_new (&rdp_server->suspended_sessions_mutex);
+  session_rdp = g_hash_table_lookup (rdp_server->suspended_sessions,
+                                     GUINT_TO_POINTER (logon_id));
+  if (!session_rdp)
+    return NULL;
+
+  if (!grd_session_rdp_verify_auto_reconnect_cookie (session_rdp,
+                                                     security_verifier))
+    {
+      g_warning ("[RDP] Client presented an invalid auto-reconnect cookie "
+                 "for logon id %u", logon_id);
+      return NULL;
+    }
+
+  g_hash_table_remove (rdp_server->suspended_sessions,
+                       GUINT_TO_POINTER (logon_id));
+
+  return g_object_ref (session_rdp);
+}
+
+static void
+clear_server_certificate (GrdRdpServer *rdp_server)
+{
+  g_clear_pointer (&rdp_server->server_certificate, freerdp_certificate_free);
+  g_clear_pointer (&rdp_server->server_certificate_der, g_free);
+  rdp_server->server_certificate_der_len = 0;
+  g_clear_pointer (&rdp_server->server_private_key, freerdp_key_free);
+  g_clear_pointer (&rdp_server->server_private_key_pem, g_free);
+}
+
+static gboolean
+load_server_certificate (GrdRdpServer  *rdp_server,
+                         GError       **error)
+{
+  GrdSettings *settings = grd_context_get_settings (rdp_server->context);
+  g_autofree char *server_cert = NULL;
+  g_autofree char *server_key = NULL;
+
+  g_object_get (G_OBJECT (settings),
+                "rdp-server-cert", &server_cert,
+                "rdp-server-key", &server_key,
+                NULL);
+
+  if (!server_cert || !server_key)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Server certificate or private key is not set");
+      return FALSE;
+    }
+
+  rdp_server->server_certificate = freerdp_certificate_new_from_pem (server_cert);
+  if (rdp_server->server_certificate)
+    {
+      rdp_server->server_certificate_der =
+        freerdp_certificate_get_der (rdp_server->server_certificate,
+                                     &rdp_server->server_certificate_der_len);
+    }
+  if (!rdp_server->server_certificate_der)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to create certificate from file");
+      clear_server_certificate (rdp_server);
+      return FALSE;
+    }
+
+  rdp_server->server_private_key = freerdp_key_new_from_pem (server_key);
+  if (!rdp_server->server_private_key)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to create private key from file");
+      clear_server_certificate (rdp_server);
+      return FALSE;
+    }
+  rdp_server->server_private_key_pem = g_steal_pointer (&server_key);
+
+  return TRUE;
+}
+
+gboolean
+grd_rdp_server_get_server_certificate (GrdRdpServer    *rdp_server,
+                                       rdpCertificate **certificate,
+                                       rdpPrivateKey  **private_key,
+                                       GError         **error)
+{
+  if (!rdp_server->server_certificate &&
+      !load_server_certificate (rdp_server, error))
+    return FALSE;
+
+  *certificate =
+    freerdp_certificate_new_from_der (rdp_server->server_certificate_der,
+                                      rdp_server->server_certificate_der_len);
+  if (!(*certificate))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to copy server certificate");
+      return FALSE;
+    }
+
+  *private_key = freerdp_key_new_from_pem (rdp_server->server_private_key_pem);
+  if (!(*private_key))
+    {
+      g_clear_pointer (certificate, freerdp_certificate_free);
+
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to copy server private key");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+on_server_certificate_changed (GrdSettings  *settings,
+                               GParamSpec   *pspec,
+                               GrdRdpServer *rdp_server)
+{
+  g_autoptr (GError) error = NULL;
+
+  g_debug ("[RDP] Server certificate changed, reloading it");
+
+  clear_server_certificate (rdp_server);
+
+  /* Retried, when the next session needs the certificate */
+  if (!load_server_certificate (rdp_server, &error))
+    g_debug ("[RDP] Failed to reload server certificate: %s", error->message);
+}
+
+static void
+hwaccel_probe_free (HwAccelProbe *hwaccel_probe)
+{
+  g_assert (!hwaccel_probe->probe_thread);
+
+  if (hwaccel_probe->probe_done_source)
+    {
+      g_source_destroy (hwaccel_probe->probe_done_source);
+      g_clear_pointer (&hwaccel_probe->probe_done_source, g_source_unref);
+    }
+
+  g_clear_object (&hwaccel_probe->hwaccel_vulkan);
+  g_clear_pointer (&hwaccel_probe->hwaccel_cache, grd_hwaccel_cache_free);
+
+  g_free (hwaccel_probe);
+}
+
+static gboolean
+on_hwaccel_probe_done (gpointer user_data)
+{
+  GrdRdpServer *rdp_server = user_data;
+  HwAccelProbe *hwaccel_probe = rdp_server->hwaccel_probe;
+  GrdHwAccelCache *hwaccel_cache = hwaccel_probe->hwaccel_cache;
+  g_autoptr (GrdHwAccelNvidia) hwaccel_nvidia = NULL;
+  g_autoptr (GrdHwAccelVulkan) hwaccel_vulkan = NULL;
+  g_autoptr (GError) error = NULL;
+
+  g_clear_pointer (&hwaccel_probe->probe_thread, g_thread_join);
+
+  hwaccel_vulkan = g_steal_pointer (&hwaccel_probe->hwaccel_vulkan);
+
+  /*
+   * CUDA makes its context current on the thread creating it, which has to
+   * be the main thread. The expensive part (loading the libraries and
+   * initializing CUDA) already happened in the probe thread.
+   */
+  if (hwaccel_probe->cuda_available)
+    {
+      hwaccel_nvidia = grd_hwaccel_nvidia_new (hwaccel_probe->egl_thread);
+      grd_hwaccel_cache_set_support (hwaccel_cache, GRD_HWACCEL_BACKEND_CUDA,
+                                     hwaccel_nvidia ?
+                                       GRD_HWACCEL_SUPPORT_SUPPORTED :
+                                       GRD_HWACCEL_SUPPORT_UNSUPPORTED);
+    }
+
+  /* The probe thread only tried Vulkan, when CUDA was not available at all */
+  if (!hwaccel_nvidia && !hwaccel_vulkan &&
+      hwaccel_probe->cuda_available &&
+      grd_hwaccel_cache_get_support (hwaccel_cache,
+                                     GRD_HWACCEL_BACKEND_VULKAN) !=
+      GRD_HWACCEL_SUPPORT_UNSUPPORTED)
+    {
+      hwaccel_vulkan = grd_hwaccel_vulkan_new (hwaccel_probe->egl_thread,
+                                               &error);
+      if (!hwaccel_vulkan)
+        {
+          g_debug ("[HWAccel.Vulkan] Could not initialize Vulkan: %s",
+                   error->message);
+          g_clear_error (&error);
+        }
+      grd_hwaccel_cache_set_support (hwaccel_cache, GRD_HWACCEL_BACKEND_VULKAN,
+                                     hwaccel_vulkan ?
+                                       GRD_HWACCEL_SUPPORT_SUPPORTED :
+                                       GRD_HWACCEL_SUPPORT_UNSUPPORTED);
+    }
+  if (hwaccel_nvidia)
+    g_clear_object (&hwaccel_vulkan);
+
+  if (!grd_hwaccel_cache_save (hwaccel_cache, &error))
+    g_debug ("[HWAccel] Failed to save capability cache: %s", error->message);
+
+  g_debug ("[HWAccel] Probing hardware acceleration took %" G_GINT64_FORMAT "ms",
+           (g_get_monotonic_time () - hwaccel_probe->probe_start_us) / 1000);
+
+  g_clear_pointer (&rdp_server->hwaccel_probe, hwaccel_probe_free);
+
+  g_assert (!rdp_server->hwaccel_nvidia);
+  g_assert (!rdp_server->hwaccel_vulkan);
+
+  rdp_server->hwaccel_nvidia = g_steal_pointer (&hwaccel_nvidia);
+  rdp_server->hwaccel_vulkan = g_steal_pointer (&hwaccel_vulkan);
+
+  if (rdp_server->hwaccel_nvidia)
+    g_message ("[HWAccel.CUDA] Initialization of CUDA was successful");
+  else if (rdp_server->hwaccel_vulkan)
+    g_message ("[HWAccel.Vulkan] Initialization of Vulkan was successful");
+
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer
+hwaccel_probe_thread_func (gpointer data)
+{
+  HwAccelProbe *hwaccel_probe = data;
+  GrdHwAccelCache *hwaccel_cache;
+  g_autoptr (GError) error = NULL;
+
+  hwaccel_probe->hwaccel_cache = grd_hwaccel_cache_new ();
+  hwaccel_cache = hwaccel_probe->hwaccel_cache;
+
+  if (grd_hwaccel_cache_get_support (hwaccel_cache, GRD_HWACCEL_BACKEND_CUDA) ==
+      GRD_HWACCEL_SUPPORT_UNSUPPORTED)
+    {
+      g_debug ("[HWAccel.CUDA] Skipping probe, CUDA is cached as unsupported");
+    }
+  else
+    {
+      hwaccel_probe->cuda_available = grd_hwaccel_nvidia_probe ();
+      if (!hwaccel_probe->cuda_available)
+        {
+          grd_hwaccel_cache_set_support (hwaccel_cache,
+                                         GRD_HWACCEL_BACKEND_CUDA,
+                                         GRD_HWACCEL_SUPPORT_UNSUPPORTED);
+        }
+    }
+
+  if (!hwaccel_probe->cuda_available)
+    {
+      if (grd_hwaccel_cache_get_support (hwaccel_cache,
+                                         GRD_HWACCEL_BACKEND_VULKAN) ==
+          GRD_HWACCEL_SUPPORT_UNSUPPORTED)
+        {
+          g_debug ("[HWAccel.Vulkan] Skipping probe, Vulkan is cached as "
+                   "unsupported");
+        }
+      else
+        {
+          hwaccel_probe->hwaccel_vulkan =
+            grd_hwaccel_vulkan_new (hwaccel_probe->egl_thread, &error);
+          if (!hwaccel_probe->hwaccel_vulkan)
+            {
+              g_debug ("[HWAccel.Vulkan] Could not initialize Vulkan: %s",
+                       error->message);
+            }
+          grd_hwaccel_cache_set_support (hwaccel_cache,
+                                         GRD_HWACCEL_BACKEND_VULKAN,
+                                         hwaccel_probe->hwaccel_vulkan ?
+                                           GRD_HWACCEL_SUPPORT_SUPPORTED :
+                                           GRD_HWACCEL_SUPPORT_UNSUPPORTED);
+        }
+    }
+
+  g_source_set_ready_time (hwaccel_probe->probe_done_source, 0);
+
+  return NULL;
+}
+
+static gboolean
+source_dispatch (GSource     *source,
+                 GSourceFunc  callback,
+                 gpointer     user_data)
+{
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs source_funcs =
+{
+  .dispatch = source_dispatch,
+};
+
+static void
+start_hwaccel_probe (GrdRdpServer *rdp_server,
+                     GrdEglThread *egl_thread)
+{
+  HwAccelProbe *hwaccel_probe;
+  GSource *probe_done_source;
+
+  hwaccel_probe = g_new0 (HwAccelProbe, 1);
+  hwaccel_probe->egl_thread = egl_thread;
+  hwaccel_probe->probe_start_us = g_get_monotonic_time ();
+
+  probe_done_source = g_source_new (&source_funcs, sizeof (GSource));
+  g_source_set_callback (probe_done_source, on_hwaccel_probe_done,
+                         rdp_server, NULL);
+  g_source_set_ready_time (probe_done_source, -1);
+  g_source_attach (probe_done_source, NULL);
+  hwaccel_probe->probe_done_source = probe_done_source;
+
+  rdp_server->hwaccel_probe = hwaccel_probe;
+
+  hwaccel_probe->probe_thread = g_thread_new ("HWAccel probe thread",
+                                              hwaccel_probe_thread_func,
+                                              hwaccel_probe);
+}
+
+static void
+stop_hwaccel_probe (GrdRdpServer *rdp_server)
+{
+  HwAccelProbe *hwaccel_probe = rdp_server->hwaccel_probe;
+
+  if (!hwaccel_probe)
+    return;
+
+  /* The probe thread uses the EGL thread, which must outlive it */
+  g_clear_pointer (&hwaccel_probe->probe_thread, g_thread_join);
+  g_clear_pointer (&rdp_server->hwaccel_probe, hwaccel_probe_free);
+}
+
 GrdRdpServer *
 grd_rdp_server_new (GrdContext *context)
 {
   GrdRdpServer *rdp_server;
   GrdEglThread *egl_thread;
-  g_autoptr (GError) error = NULL;
 
   rdp_server = g_object_new (GRD_TYPE_RDP_SERVER,
                              "context", context,
@@ -113,18 +527,12 @@ grd_rdp_server_new (GrdContext *context)
   if (!egl_thread)
     return rdp_server;
 
-  rdp_server->hwaccel_nvidia = grd_hwaccel_nvidia_new (egl_thread);
-  if (rdp_server->hwaccel_nvidia)
-    {
-      g_message ("[HWAccel.CUDA] Initialization of CUDA was successful");
-      return rdp_server;
-    }
-
-  rdp_server->hwaccel_vulkan = grd_hwaccel_vulkan_new (egl_thread, &error);
-  if (!rdp_server->hwaccel_vulkan)
-    g_debug ("[HWAccel.Vulkan] Could not initialize Vulkan: %s", error->message);
-  else
-    g_message ("[HWAccel.Vulkan] Initialization of Vulkan was successful");
+  /*
+   * Probing hardware acceleration can take a while (loading the CUDA and
+   * Vulkan libraries and initializing them). Don't block the daemon startup
+   * on it. Sessions created before the probe finished use software encoding.
+   */
+  start_hwaccel_probe (rdp_server, egl_thread);
 
   return rdp_server;
 }
@@ -145,15 +553,120 @@ cleanup_stopped_sessions_idle (GrdRdpServer *rdp_server)
   return G_SOURCE_REMOVE;
 }
 
+static char *
+get_session_peer_name (GrdSessionRdp *session_rdp)
+{
+  g_autoptr (GSocketAddress) socket_address = NULL;
+  GSocketConnection *connection;
+  GInetAddress *inet_address;
+  g_autofree char *address_string = NULL;
+
+  connection = grd_session_rdp_get_socket_connection (session_rdp);
+  if (!connection)
+    return g_strdup ("");
+
+  socket_address = g_socket_connection_get_remote_address (connection, NULL);
+  if (!socket_address || !G_IS_INET_SOCKET_ADDRESS (socket_address))
+    return g_strdup ("");
+
+  inet_address =
+    g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (socket_address));
+  address_string = g_inet_address_to_string (inet_address);
+
+  return g_strdup_printf ("%s:%u", address_string,
+                          g_inet_socket_address_get_port (
+                            G_INET_SOCKET_ADDRESS (socket_address)));
+}
+
+static GVariant *
+serialize_session_memory_usage (GrdSessionRdp      *session_rdp,
+                                GrdRdpMemoryBudget *memory_budget)
+{
+  g_autofree char *peer_name = NULL;
+  GVariantBuilder builder;
+  GrdRdpMemoryCategory category;
+
+  peer_name = get_session_peer_name (session_rdp);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&builder, "{sv}", "peer",
+                         g_variant_new_string (peer_name));
+  g_variant_builder_add (&builder, "{sv}", "budget",
+                         g_variant_new_uint64 (
+                           grd_rdp_memory_budget_get_budget (memory_budget)));
+  g_variant_builder_add (&builder, "{sv}", "total",
+                         g_variant_new_uint64 (
+                           grd_rdp_memory_budget_get_total_usage (memory_budget)));
+  g_variant_builder_add (&builder, "{sv}", "peak",
+                         g_variant_new_uint64 (
+                           grd_rdp_memory_budget_get_peak_total_usage (memory_budget)));
+
+  for (category = 0; category < GRD_RDP_MEMORY_CATEGORY_N; ++category)
+    {
+      uint64_t usage = grd_rdp_memory_budget_get_usage (memory_budget,
+                                                        category);
+
+      g_variant_builder_add (&builder, "{sv}",
+                             grd_rdp_memory_category_to_string (category),
+                             g_variant_new_uint64 (usage));
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+update_session_memory_usage (GrdRdpServer *rdp_server)
+{
+  GrdDBusRemoteDesktopRdpServer *rdp_server_iface =
+    grd_context_get_rdp_server_interface (rdp_server->context);
+  GVariantBuilder builder;
+  GList *l;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+  for (l = rdp_server->sessions; l; l = l->next)
+    {
+      GrdSessionRdp *session_rdp = l->data;
+      GrdRdpMemoryBudget *memory_budget =
+        grd_session_rdp_get_memory_budget (session_rdp);
+
+      g_variant_builder_add_value (&builder,
+                                   serialize_session_memory_usage (session_rdp,
+                                                                   memory_budget));
+      rdp_server->peak_session_memory_usage =
+        MAX (rdp_server->peak_session_memory_usage,
+             grd_rdp_memory_budget_get_peak_total_usage (memory_budget));
+    }
+
+  grd_dbus_remote_desktop_rdp_server_set_session_memory_usage (
+    rdp_server_iface, g_variant_builder_end (&builder));
+  grd_dbus_remote_desktop_rdp_server_set_peak_session_memory_usage (
+    rdp_server_iface, rdp_server->peak_session_memory_usage);
+}
+
+static void
+on_session_memory_usage_changed (GrdRdpMemoryBudget *memory_budget,
+                                 GrdRdpServer       *rdp_server)
+{
+  update_session_memory_usage (rdp_server);
+}
+
 static void
 on_session_stopped (GrdSession   *session,
                     GrdRdpServer *rdp_server)
 {
+  GrdSessionRdp *session_rdp = GRD_SESSION_RDP (session);
+
   g_debug ("RDP session stopped");
 
+  g_signal_handlers_disconnect_by_func (
+    grd_session_rdp_get_memory_budget (session_rdp),
+    G_CALLBACK (on_session_memory_usage_changed),
+    rdp_server);
+
   rdp_server->stopped_sessions = g_list_append (rdp_server->stopped_sessions,
                                                 session);
   rdp_server->sessions = g_list_remove (rdp_server->sessions, session);
+  update_session_memory_usage (rdp_server);
   if (!rdp_server->cleanup_sessions_idle_id)
     {
       rdp_server->cleanup_sessions_idle_id =
@@ -241,9 +754,37 @@ on_routing_token_peeked (GObject      *source_object,
       g_signal_connect (session_rdp, "post-connected",
                         G_CALLBACK (on_session_post_connect),
                         rdp_server);
+      g_signal_connect (grd_session_rdp_get_memory_budget (session_rdp),
+                        "usage-changed",
+                        G_CALLBACK (on_session_memory_usage_changed),
+                        rdp_server);
     }
 }
 
+static void
+on_throttler_stats_changed (GrdThrottler *throttler,
+                            GrdRdpServer *rdp_server)
+{
+  GrdDBusRemoteDesktopRdpServer *rdp_server_iface =
+    grd_context_get_rdp_server_interface (rdp_server->context);
+  GrdThrottlerStats stats;
+
+  grd_throttler_get_stats (throttler, &stats);
+
+  grd_dbus_remote_desktop_rdp_server_set_queued_connections (
+    rdp_server_iface, stats.queued_connections);
+  grd_dbus_remote_desktop_rdp_server_set_max_queued_connections (
+    rdp_server_iface, stats.max_queued_connections);
+  grd_dbus_remote_desktop_rdp_server_set_delayed_connections (
+    rdp_server_iface, stats.n_delayed_connections);
+  grd_dbus_remote_desktop_rdp_server_set_denied_connections (
+    rdp_server_iface, stats.n_denied_connections);
+  grd_dbus_remote_desktop_rdp_server_set_total_connection_wait_time (
+    rdp_server_iface, stats.total_wait_time_us);
+  grd_dbus_remote_desktop_rdp_server_set_max_connection_wait_time (
+    rdp_server_iface, stats.max_wait_time_us);
+}
+
 static void
 allow_connection_peek_cb (GrdThrottler      *throttler,
                           GSocketConnection *connection,
@@ -288,6 +829,10 @@ accept_connection (GrdRdpServer      *rdp_server,
   g_signal_connect (session_rdp, "post-connected",
                     G_CALLBACK (on_session_post_connect),
                     rdp_server);
+  g_signal_connect (grd_session_rdp_get_memory_budget (session_rdp),
+                    "usage-changed",
+                    G_CALLBACK (on_session_memory_usage_changed),
+                    rdp_server);
 }
 
 static void
@@ -388,9 +933,19 @@ bind_socket (GrdRdpServer  *rdp_server,
   int rdp_port = 0;
   uint16_t selected_rdp_port = 0;
   gboolean negotiate_port;
+  int backlog;
+
+  /*
+   * Connections, which did not get accepted yet, wait in the backlog. A
+   * larger backlog avoids dropped connection attempts, when many clients
+   * connect at the same time
+   */
+  backlog = grd_settings_get_rdp_listen_backlog (settings);
+  if (backlog <= 0)
+    backlog = RDP_SERVER_SOCKET_BACKLOG_COUNT;
 
-  g_socket_listener_set_backlog (G_SOCKET_LISTENER (rdp_server),
-                                 RDP_SERVER_SOCKET_BACKLOG_COUNT);
+  g_debug ("[RDP] Using listen backlog of %d", backlog);
+  g_socket_listener_set_backlog (G_SOCKET_LISTENER (rdp_server), backlog);
 
   g_object_get (G_OBJECT (settings),
                 "rdp-port", &rdp_port,
@@ -441,6 +996,25 @@ bind_socket (GrdRdpServer  *rdp_server,
   return TRUE;
 }
 
+static void
+on_low_memory_warning (GMemoryMonitor             *memory_monitor,
+                       GMemoryMonitorWarningLevel  level,
+                       GrdRdpServer               *rdp_server)
+{
+  GList *l;
+
+  g_debug ("[RDP] System is low on memory (warning level %i), asking "
+           "sessions to trim their memory usage", level);
+
+  for (l = rdp_server->sessions; l; l = l->next)
+    {
+      GrdSessionRdp *session_rdp = l->data;
+
+      grd_rdp_memory_budget_notify_memory_pressure (
+        grd_session_rdp_get_memory_budget (session_rdp));
+    }
+}
+
 gboolean
 grd_rdp_server_start (GrdRdpServer  *rdp_server,
                       GError       **error)
@@ -466,6 +1040,10 @@ grd_rdp_server_start (GrdRdpServer  *rdp_server,
       break;
     }
 
+  rdp_server->memory_monitor = g_memory_monitor_dup_default ();
+  g_signal_connect (rdp_server->memory_monitor, "low-memory-warning",
+                    G_CALLBACK (on_low_memory_warning), rdp_server);
+
   grd_dbus_remote_desktop_rdp_server_set_enabled (rdp_server_iface, TRUE);
 
   return TRUE;
@@ -503,6 +1081,16 @@ grd_rdp_server_stop (GrdRdpServer *rdp_server)
 
   g_clear_handle_id (&rdp_server->binding_timeout_source_id, g_source_remove);
 
+  if (rdp_server->memory_monitor)
+    {
+      g_signal_handlers_disconnect_by_func (rdp_server->memory_monitor,
+                                            G_CALLBACK (on_low_memory_warning),
+                                            rdp_server);
+      g_clear_object (&rdp_server->memory_monitor);
+    }
+
+  stop_hwaccel_probe (rdp_server);
+
   g_clear_object (&rdp_server->hwaccel_nvidia);
   g_clear_object (&rdp_server->hwaccel_vulkan);
 }
@@ -555,13 +1143,31 @@ grd_rdp_server_dispose (GObject *object)
   g_assert (!rdp_server->cleanup_sessions_idle_id);
   g_assert (!rdp_server->stopped_sessions);
   g_assert (!rdp_server->throttler);
+  g_assert (!rdp_server->memory_monitor);
 
+  g_assert (!rdp_server->hwaccel_probe);
   g_assert (!rdp_server->hwaccel_nvidia);
   g_assert (!rdp_server->hwaccel_vulkan);
 
+  clear_server_certificate (rdp_server);
+
+  if (rdp_server->suspended_sessions)
+    g_assert (g_hash_table_size (rdp_server->suspended_sessions) == 0);
+  g_clear_pointer (&rdp_server->suspended_sessions, g_hash_table_unref);
+
   G_OBJECT_CLASS (grd_rdp_server_parent_class)->dispose (object);
 }
 
+static void
+grd_rdp_server_finalize (GObject *object)
+{
+  GrdRdpServer *rdp_server = GRD_RDP_SERVER (object);
+
+  g_mutex_clear (&rdp_server->suspended_sessions_mutex);
+
+  G_OBJECT_CLASS (grd_rdp_server_parent_class)->finalize (object);
+}
+
 static void
 grd_rdp_server_constructed (GObject *object)
 {
@@ -589,10 +1195,22 @@ grd_rdp_server_constructed (GObject *object)
         grd_throttler_new (grd_throttler_limits_new (rdp_server->context),
                            allow_callback,
                            rdp_server);
+      g_signal_connect (rdp_server->throttler, "stats-changed",
+                        G_CALLBACK (on_throttler_stats_changed),
+                        rdp_server);
     }
 
   rdp_server->pending_binding_attempts = RDP_SERVER_N_BINDING_ATTEMPTS;
 
+  g_signal_connect_object (grd_context_get_settings (rdp_server->context),
+                           "notify::rdp-server-cert",
+                           G_CALLBACK (on_server_certificate_changed),
+                           rdp_server, 0);
+  g_signal_connect_object (grd_context_get_settings (rdp_server->context),
+                           "notify::rdp-server-key",
+                           G_CALLBACK (on_server_certificate_changed),
+                           rdp_server, 0);
+
   winpr_InitializeSSL (WINPR_SSL_INIT_DEFAULT);
   WTSRegisterWtsApiFunctionTable (FreeRDP_InitWtsApi ());
 
@@ -607,6 +1225,9 @@ grd_rdp_server_constructed (GObject *object)
 static void
 grd_rdp_server_init (GrdRdpServer *rdp_server)
 {
+  rdp_server->suspended_sessions = g_hash_table_new (NULL, NULL);
+
+  g_mutex_init (&rdp_server->suspended_sessions_mutex);
 }
 
 static void
@@ -617,6 +1238,7 @@ grd_rdp_server_class_init (GrdRdpServerClass *klass)
   object_class->set_property = grd_rdp_server_set_property;
   object_class->get_property = grd_rdp_server_get_property;
   object_class->dispose = grd_rdp_server_dispose;
+  object_class->finalize = grd_rdp_server_finalize;
   object_class->constructed = grd_rdp_server_constructed;
 
   g_object_class_install_property (object_class,
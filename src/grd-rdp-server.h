@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <freerdp/freerdp.h>
 #include <gio/gio.h>
 #include <glib-object.h>
 
@@ -36,6 +37,23 @@ GrdHwAccelNvidia *grd_rdp_server_get_hwaccel_nvidia (GrdRdpServer *rdp_server);
 
 GrdHwAccelVulkan *grd_rdp_server_get_hwaccel_vulkan (GrdRdpServer *rdp_server);
 
+gboolean grd_rdp_server_get_server_certificate (GrdRdpServer    *rdp_server,
+                                                rdpCertificate **certificate,
+                                                rdpPrivateKey  **private_key,
+                                                GError         **error);
+
+uint32_t grd_rdp_server_acquire_logon_id (GrdRdpServer *rdp_server);
+
+void grd_rdp_server_add_suspended_session (GrdRdpServer  *rdp_server,
+                                           GrdSessionRdp *session_rdp);
+
+void grd_rdp_server_remove_suspended_session (GrdRdpServer  *rdp_server,
+                                              GrdSessionRdp *session_rdp);
+
+GrdSessionRdp *grd_rdp_server_claim_suspended_session (GrdRdpServer  *rdp_server,
+                                                       uint32_t       logon_id,
+                                                       const uint8_t *security_verifier);
+
 gboolean grd_rdp_server_start (GrdRdpServer  *rdp_server,
                                GError       **error);
 
@@ -25,7 +25,6 @@
 #include "grd-rdp-damage-detector-cuda.h"
 #include "grd-rdp-damage-detector-memcmp.h"
 #include "grd-rdp-renderer.h"
-#include "grd-rdp-server.h"
 #include "grd-session-rdp.h"
 
 static GrdHwAccelNvidia *
@@ -33,10 +32,8 @@ hwaccel_nvidia_from_surface (GrdRdpSurface *rdp_surface)
 {
   GrdSessionRdp *session_rdp =
     grd_rdp_renderer_get_session (rdp_surface->renderer);
-  GrdRdpServer *rdp_server =
-    grd_session_rdp_get_server (session_rdp);
 
-  return grd_rdp_server_get_hwaccel_nvidia (rdp_server);
+  return grd_session_rdp_get_hwaccel_nvidia (session_rdp);
 }
 
 static void
@@ -29,6 +29,11 @@ struct _GrdRdpSwEncoderCa
 
   GMutex encode_mutex;
   RFX_CONTEXT *rfx_context;
+  uint32_t rfx_context_width;
+  uint32_t rfx_context_height;
+
+  RFX_RECT *rfx_rects;
+  int n_max_rfx_rects;
 };
 
 G_DEFINE_TYPE (GrdRdpSwEncoderCa, grd_rdp_sw_encoder_ca, G_TYPE_OBJECT)
@@ -174,6 +179,29 @@ rfx_progressive_write_message (RFX_MESSAGE *rfx_message,
   Stream_SealLength (s);
 }
 
+static void
+maybe_reset_rfx_context (GrdRdpSwEncoderCa *encoder_ca,
+                         uint32_t           surface_width,
+                         uint32_t           surface_height)
+{
+  /*
+   * Resetting the RFX context also restarts its frame index. Since the
+   * context is only reset on size changes, the frameIndex of
+   * RFX_PROGRESSIVE_FRAME_BEGIN increases with every encoded frame and only
+   * restarts at 0 after a resize, instead of being 0 for every frame
+   */
+  if (encoder_ca->rfx_context_width == surface_width &&
+      encoder_ca->rfx_context_height == surface_height)
+    return;
+
+  g_debug ("[RDP] SW encoder (CA): Resetting RFX context for size %ux%u",
+           surface_width, surface_height);
+
+  rfx_context_reset (encoder_ca->rfx_context, surface_width, surface_height);
+  encoder_ca->rfx_context_width = surface_width;
+  encoder_ca->rfx_context_height = surface_height;
+}
+
 void
 grd_rdp_sw_encoder_ca_encode_progressive_frame (GrdRdpSwEncoderCa *encoder_ca,
                                                 uint32_t           surface_width,
@@ -185,17 +213,25 @@ grd_rdp_sw_encoder_ca_encode_progressive_frame (GrdRdpSwEncoderCa *encoder_ca,
                                                 gboolean           write_header)
 {
   g_autoptr (GMutexLocker) locker = NULL;
-  g_autofree RFX_RECT *rfx_rects = NULL;
+  RFX_RECT *rfx_rects;
   int n_rects;
   RFX_MESSAGE *rfx_message;
   int i;
 
   locker = g_mutex_locker_new (&encoder_ca->encode_mutex);
-  rfx_context_set_mode (encoder_ca->rfx_context, RLGR1);
-  rfx_context_reset (encoder_ca->rfx_context, surface_width, surface_height);
+  maybe_reset_rfx_context (encoder_ca, surface_width, surface_height);
 
   n_rects = cairo_region_num_rectangles (damage_region);
-  rfx_rects = g_new0 (RFX_RECT, n_rects);
+  if (n_rects > encoder_ca->n_max_rfx_rects)
+    {
+      g_debug ("[RDP] SW encoder (CA): Growing rect array to %i rects",
+               n_rects);
+
+      encoder_ca->rfx_rects = g_renew (RFX_RECT, encoder_ca->rfx_rects,
+                                       n_rects);
+      encoder_ca->n_max_rfx_rects = n_rects;
+    }
+  rfx_rects = encoder_ca->rfx_rects;
 
   for (i = 0; i < n_rects; ++i)
     {
@@ -242,6 +278,7 @@ grd_rdp_sw_encoder_ca_new (GError **error)
   rfx_context_set_pixel_format (encoder_ca->rfx_context,
                                 PIXEL_FORMAT_XRGB32);
 #endif
+  rfx_context_set_mode (encoder_ca->rfx_context, RLGR1);
 
   return g_steal_pointer (&encoder_ca);
 }
@@ -252,6 +289,7 @@ grd_rdp_sw_encoder_ca_dispose (GObject *object)
   GrdRdpSwEncoderCa *encoder_ca = GRD_RDP_SW_ENCODER_CA (object);
 
   g_clear_pointer (&encoder_ca->rfx_context, rfx_context_free);
+  g_clear_pointer (&encoder_ca->rfx_rects, g_free);
 
   G_OBJECT_CLASS (grd_rdp_sw_encoder_ca_parent_class)->dispose (object);
 }
@@ -25,7 +25,6 @@
 #include "grd-image-view-nv12.h"
 #include "grd-rdp-buffer.h"
 #include "grd-rdp-pw-buffer.h"
-#include "grd-rdp-render-state.h"
 #include "grd-utils.h"
 #include "grd-vk-buffer.h"
 #include "grd-vk-device.h"
@@ -645,9 +644,10 @@ grd_rdp_view_creator_avc_finish_view (GrdRdpViewCreator  *view_creator,
   state_buffer_length = view_creator_avc->state_buffer_size /
                         sizeof (uint32_t);
 
-  return grd_rdp_render_state_new (view_creator_avc->mapped_dmg_buffer,
-                                   view_creator_avc->mapped_chroma_check_buffer,
-                                   state_buffer_length);
+  return grd_rdp_view_creator_update_render_state (view_creator,
+                                                   view_creator_avc->mapped_dmg_buffer,
+                                                   view_creator_avc->mapped_chroma_check_buffer,
+                                                   state_buffer_length);
 }
 
 static void
@@ -29,9 +29,9 @@
 #include "grd-image-view-rgb.h"
 #include "grd-local-buffer-copy.h"
 #include "grd-rdp-buffer.h"
+#include "grd-rdp-memory-budget.h"
 #include "grd-rdp-pw-buffer.h"
 #include "grd-rdp-render-context.h"
-#include "grd-rdp-render-state.h"
 #include "grd-rdp-renderer.h"
 #include "grd-rdp-server.h"
 #include "grd-session-rdp.h"
@@ -68,8 +68,11 @@ struct _GrdRdpViewCreatorGenGL
   uint32_t surface_width;
   uint32_t surface_height;
 
+  GrdRdpMemoryBudget *memory_budget;
+
   GrdLocalBuffer *local_buffers[N_LOCAL_BUFFERS];
-  GHashTable *acquired_buffers;
+  /* Bit i is set, while local_buffers[i] is acquired */
+  guint acquired_buffer_mask;
 
   GrdDamageDetectorSw *damage_detector;
 
@@ -95,14 +98,13 @@ acquire_local_buffer (GrdRdpViewCreatorGenGL *view_creator_gen_gl)
   for (i = 0; i < N_LOCAL_BUFFERS; ++i)
     {
       GrdLocalBuffer *local_buffer = view_creator_gen_gl->local_buffers[i];
+      guint buffer_bit = 1u << i;
 
-      if (g_hash_table_contains (view_creator_gen_gl->acquired_buffers,
-                                 local_buffer))
-        continue;
       if (local_buffer == view_creator_gen_gl->last_local_buffer)
         continue;
-
-      g_hash_table_add (view_creator_gen_gl->acquired_buffers, local_buffer);
+      if (g_atomic_int_or (&view_creator_gen_gl->acquired_buffer_mask,
+                           buffer_bit) & buffer_bit)
+        continue;
 
       return local_buffer;
     }
@@ -115,8 +117,23 @@ static void
 release_local_buffer (GrdRdpViewCreatorGenGL *view_creator_gen_gl,
                       GrdLocalBuffer         *local_buffer)
 {
-  if (!g_hash_table_remove (view_creator_gen_gl->acquired_buffers, local_buffer))
-    g_assert_not_reached ();
+  uint32_t i;
+
+  for (i = 0; i < N_LOCAL_BUFFERS; ++i)
+    {
+      guint buffer_bit = 1u << i;
+
+      if (view_creator_gen_gl->local_buffers[i] != local_buffer)
+        continue;
+
+      if (!(g_atomic_int_and (&view_creator_gen_gl->acquired_buffer_mask,
+                              ~buffer_bit) & buffer_bit))
+        g_assert_not_reached ();
+
+      return;
+    }
+
+  g_assert_not_reached ();
 }
 
 static ViewContext *
@@ -296,7 +313,16 @@ grd_rdp_view_creator_gen_gl_finish_view (GrdRdpViewCreator  *view_creator,
   damage_buffer_length =
     grd_damage_detector_sw_get_damage_buffer_length (damage_detector);
 
-  return grd_rdp_render_state_new (damage_buffer, NULL, damage_buffer_length);
+  return grd_rdp_view_creator_update_render_state (view_creator,
+                                                   damage_buffer, NULL,
+                                                   damage_buffer_length);
+}
+
+static uint64_t
+get_local_buffers_size (GrdRdpViewCreatorGenGL *view_creator_gen_gl)
+{
+  return (uint64_t) N_LOCAL_BUFFERS * view_creator_gen_gl->surface_width * 4 *
+         view_creator_gen_gl->surface_height;
 }
 
 GrdRdpViewCreatorGenGL *
@@ -304,6 +330,9 @@ grd_rdp_view_creator_gen_gl_new (GrdRdpRenderContext *render_context,
                                  uint32_t             surface_width,
                                  uint32_t             surface_height)
 {
+  GrdRdpRenderer *renderer =
+    grd_rdp_render_context_get_renderer (render_context);
+  GrdSessionRdp *session_rdp = grd_rdp_renderer_get_session (renderer);
   GrdRdpViewCreatorGenGL *view_creator_gen_gl;
   uint32_t i;
 
@@ -311,6 +340,8 @@ grd_rdp_view_creator_gen_gl_new (GrdRdpRenderContext *render_context,
   view_creator_gen_gl->render_context = render_context;
   view_creator_gen_gl->surface_width = surface_width;
   view_creator_gen_gl->surface_height = surface_height;
+  view_creator_gen_gl->memory_budget =
+    g_object_ref (grd_session_rdp_get_memory_budget (session_rdp));
 
   view_creator_gen_gl->damage_detector =
     grd_damage_detector_sw_new (surface_width, surface_height);
@@ -324,6 +355,9 @@ grd_rdp_view_creator_gen_gl_new (GrdRdpRenderContext *render_context,
       view_creator_gen_gl->local_buffers[i] =
         GRD_LOCAL_BUFFER (local_buffer_copy);
     }
+  grd_rdp_memory_budget_account (view_creator_gen_gl->memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_LOCAL_BUFFERS,
+                                 get_local_buffers_size (view_creator_gen_gl));
 
   return view_creator_gen_gl;
 }
@@ -335,25 +369,29 @@ grd_rdp_view_creator_gen_gl_dispose (GObject *object)
     GRD_RDP_VIEW_CREATOR_GEN_GL (object);
   uint32_t i;
 
-  if (view_creator_gen_gl->acquired_buffers)
-    g_assert (g_hash_table_size (view_creator_gen_gl->acquired_buffers) == 0);
+  g_assert (view_creator_gen_gl->acquired_buffer_mask == 0);
 
   g_assert (!view_creator_gen_gl->current_view_context);
 
   g_clear_object (&view_creator_gen_gl->damage_detector);
 
-  g_clear_pointer (&view_creator_gen_gl->acquired_buffers, g_hash_table_unref);
-
+  if (view_creator_gen_gl->local_buffers[0])
+    {
+      grd_rdp_memory_budget_account (view_creator_gen_gl->memory_budget,
+                                     GRD_RDP_MEMORY_CATEGORY_LOCAL_BUFFERS,
+                                     -(int64_t) get_local_buffers_size (view_creator_gen_gl));
+    }
   for (i = 0; i < N_LOCAL_BUFFERS; ++i)
     g_clear_object (&view_creator_gen_gl->local_buffers[i]);
 
+  g_clear_object (&view_creator_gen_gl->memory_budget);
+
   G_OBJECT_CLASS (grd_rdp_view_creator_gen_gl_parent_class)->dispose (object);
 }
 
 static void
 grd_rdp_view_creator_gen_gl_init (GrdRdpViewCreatorGenGL *view_creator_gen_gl)
 {
-  view_creator_gen_gl->acquired_buffers = g_hash_table_new (NULL, NULL);
 }
 
 static void
@@ -24,7 +24,6 @@
 #include "grd-damage-detector-sw.h"
 #include "grd-image-view-rgb.h"
 #include "grd-local-buffer-wrapper-rdp.h"
-#include "grd-rdp-render-state.h"
 
 /*
  * One buffer is needed, when encoding a frame,
@@ -52,7 +51,8 @@ struct _GrdRdpViewCreatorGenSW
   GrdRdpViewCreator parent;
 
   GrdLocalBuffer *local_buffers[N_LOCAL_BUFFERS];
-  GHashTable *acquired_buffers;
+  /* Bit i is set, while local_buffers[i] is acquired */
+  guint acquired_buffer_mask;
 
   GrdDamageDetectorSw *damage_detector;
 
@@ -78,14 +78,13 @@ acquire_local_buffer (GrdRdpViewCreatorGenSW *view_creator_gen_sw)
   for (i = 0; i < N_LOCAL_BUFFERS; ++i)
     {
       GrdLocalBuffer *local_buffer = view_creator_gen_sw->local_buffers[i];
+      guint buffer_bit = 1u << i;
 
-      if (g_hash_table_contains (view_creator_gen_sw->acquired_buffers,
-                                 local_buffer))
-        continue;
       if (local_buffer == view_creator_gen_sw->last_local_buffer)
         continue;
-
-      g_hash_table_add (view_creator_gen_sw->acquired_buffers, local_buffer);
+      if (g_atomic_int_or (&view_creator_gen_sw->acquired_buffer_mask,
+                           buffer_bit) & buffer_bit)
+        continue;
 
       return local_buffer;
     }
@@ -98,8 +97,23 @@ static void
 release_local_buffer (GrdRdpViewCreatorGenSW *view_creator_gen_sw,
                       GrdLocalBuffer         *local_buffer)
 {
-  if (!g_hash_table_remove (view_creator_gen_sw->acquired_buffers, local_buffer))
-    g_assert_not_reached ();
+  uint32_t i;
+
+  for (i = 0; i < N_LOCAL_BUFFERS; ++i)
+    {
+      guint buffer_bit = 1u << i;
+
+      if (view_creator_gen_sw->local_buffers[i] != local_buffer)
+        continue;
+
+      if (!(g_atomic_int_and (&view_creator_gen_sw->acquired_buffer_mask,
+                              ~buffer_bit) & buffer_bit))
+        g_assert_not_reached ();
+
+      return;
+    }
+
+  g_assert_not_reached ();
 }
 
 static ViewContext *
@@ -207,7 +221,9 @@ grd_rdp_view_creator_gen_sw_finish_view (GrdRdpViewCreator  *view_creator,
   damage_buffer_length =
     grd_damage_detector_sw_get_damage_buffer_length (damage_detector);
 
-  return grd_rdp_render_state_new (damage_buffer, NULL, damage_buffer_length);
+  return grd_rdp_view_creator_update_render_state (view_creator,
+                                                   damage_buffer, NULL,
+                                                   damage_buffer_length);
 }
 
 GrdRdpViewCreatorGenSW *
@@ -238,15 +254,12 @@ grd_rdp_view_creator_gen_sw_dispose (GObject *object)
     GRD_RDP_VIEW_CREATOR_GEN_SW (object);
   uint32_t i;
 
-  if (view_creator_gen_sw->acquired_buffers)
-    g_assert (g_hash_table_size (view_creator_gen_sw->acquired_buffers) == 0);
+  g_assert (view_creator_gen_sw->acquired_buffer_mask == 0);
 
   g_assert (!view_creator_gen_sw->current_view_context);
 
   g_clear_object (&view_creator_gen_sw->damage_detector);
 
-  g_clear_pointer (&view_creator_gen_sw->acquired_buffers, g_hash_table_unref);
-
   for (i = 0; i < N_LOCAL_BUFFERS; ++i)
     g_clear_object (&view_creator_gen_sw->local_buffers[i]);
 
@@ -256,7 +269,6 @@ grd_rdp_view_creator_gen_sw_dispose (GObject *object)
 static void
 grd_rdp_view_creator_gen_sw_init (GrdRdpViewCreatorGenSW *view_creator_gen_sw)
 {
-  view_creator_gen_sw->acquired_buffers = g_hash_table_new (NULL, NULL);
 }
 
 static void
@@ -23,6 +23,7 @@
 
 #include "grd-rdp-frame.h"
 #include "grd-rdp-render-context.h"
+#include "grd-rdp-render-state.h"
 
 typedef struct
 {
@@ -39,6 +40,8 @@ typedef struct
 
   GSource *view_creation_source;
   GAsyncQueue *task_queue;
+
+  GrdRdpRenderState *render_state;
 } GrdRdpViewCreatorPrivate;
 
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (GrdRdpViewCreator, grd_rdp_view_creator,
@@ -72,6 +75,31 @@ grd_rdp_view_creator_create_view (GrdRdpViewCreator                   *view_crea
   return TRUE;
 }
 
+GrdRdpRenderState *
+grd_rdp_view_creator_update_render_state (GrdRdpViewCreator *view_creator,
+                                          uint32_t          *damage_buffer,
+                                          uint32_t          *chroma_state_buffer,
+                                          uint32_t           state_buffer_length)
+{
+  GrdRdpViewCreatorPrivate *priv =
+    grd_rdp_view_creator_get_instance_private (view_creator);
+
+  if (!priv->render_state)
+    {
+      priv->render_state = grd_rdp_render_state_new (damage_buffer,
+                                                     chroma_state_buffer,
+                                                     state_buffer_length);
+      return priv->render_state;
+    }
+
+  grd_rdp_render_state_update (priv->render_state,
+                               damage_buffer,
+                               chroma_state_buffer,
+                               state_buffer_length);
+
+  return priv->render_state;
+}
+
 static void
 stop_view_creation_thread (GrdRdpViewCreator *view_creator)
 {
@@ -117,6 +145,7 @@ grd_rdp_view_creator_finalize (GObject *object)
   GrdRdpViewCreatorPrivate *priv =
     grd_rdp_view_creator_get_instance_private (view_creator);
 
+  g_clear_pointer (&priv->render_state, grd_rdp_render_state_free);
   g_clear_pointer (&priv->task_queue, g_async_queue_unref);
 
   G_OBJECT_CLASS (grd_rdp_view_creator_parent_class)->finalize (object);
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <glib-object.h>
+#include <stdint.h>
 
 #include "grd-types.h"
 
@@ -39,6 +40,7 @@ struct _GrdRdpViewCreatorClass
                             GrdRdpBuffer       *src_buffer_new,
                             GrdRdpBuffer       *src_buffer_old,
                             GError            **error);
+  /* The returned render state is owned by the view creator */
   GrdRdpRenderState *(* finish_view) (GrdRdpViewCreator  *view_creator,
                                       GError            **error);
 };
@@ -47,3 +49,8 @@ gboolean grd_rdp_view_creator_create_view (GrdRdpViewCreator                   *
                                            GrdRdpFrame                         *rdp_frame,
                                            GrdRdpViewCreatorOnViewCreatedFunc   on_view_created,
                                            GError                             **error);
+
+GrdRdpRenderState *grd_rdp_view_creator_update_render_state (GrdRdpViewCreator *view_creator,
+                                                             uint32_t          *damage_buffer,
+                                                             uint32_t          *chroma_state_buffer,
+                                                             uint32_t           state_buffer_length);
@@ -30,6 +30,8 @@
 #include <krb5.h>
 #include <linux/input-event-codes.h>
 #include <pwd.h>
+#include <sys/epoll.h>
+#include <winpr/crypto.h>
 #include <xkbcommon/xkbcommon.h>
 
 #include "grd-clipboard-rdp.h"
@@ -45,6 +47,7 @@
 #include "grd-rdp-dvc-telemetry.h"
 #include "grd-rdp-event-queue.h"
 #include "grd-rdp-layout-manager.h"
+#include "grd-rdp-memory-budget.h"
 #include "grd-rdp-network-autodetection.h"
 #include "grd-rdp-private.h"
 #include "grd-rdp-renderer.h"
@@ -58,6 +61,10 @@
 #define MAX_MONITOR_COUNT_SCREEN_SHARE 1
 #define DISCRETE_SCROLL_STEP 10.0
 #define ELEMENT_TYPE_CERTIFICATE 32
+#define MAX_TRANSPORT_HANDLES 32
+#define MAX_EPOLL_EVENTS 16
+#define ARC_RANDOM_BITS_SIZE 16
+#define ARC_CS_PRIVATE_PACKET_SIZE 28
 
 enum
 {
@@ -81,12 +88,36 @@ typedef enum _PauseKeyState
   PAUSE_KEY_STATE_CTRL_UP,
 } PauseKeyState;
 
+typedef enum _SocketEventSource
+{
+  SOCKET_EVENT_SOURCE_STOP,
+  SOCKET_EVENT_SOURCE_BW_MEASURE_STOP,
+  SOCKET_EVENT_SOURCE_CHANNEL,
+  SOCKET_EVENT_SOURCE_DVC_INIT,
+  SOCKET_EVENT_SOURCE_TRANSPORT,
+} SocketEventSource;
+
+typedef struct _SocketEventLoop
+{
+  int epoll_fd;
+
+  int transport_fds[MAX_TRANSPORT_HANDLES];
+  uint32_t n_transport_fds;
+} SocketEventLoop;
+
 struct _GrdSessionRdp
 {
   GrdSession parent;
 
   GrdRdpServer *server;
   GSocketConnection *connection;
+
+  /*
+   * Hardware acceleration of the server at the time the session was created.
+   * It stays the same for the lifetime of the session.
+   */
+  GrdHwAccelNvidia *hwaccel_nvidia;
+  GrdHwAccelVulkan *hwaccel_vulkan;
   freerdp_peer *peer;
   GrdRdpSAMFile *sam_file;
   uint32_t rdp_error_info;
@@ -95,12 +126,14 @@ struct _GrdSessionRdp
   gboolean session_should_stop;
 
   GrdRdpSessionMetrics *session_metrics;
+  GrdRdpMemoryBudget *memory_budget;
 
   GMutex rdp_flags_mutex;
   RdpPeerFlag rdp_flags;
 
   GThread *socket_thread;
   HANDLE stop_event;
+  HANDLE dvc_init_event;
 
   GrdRdpRenderer *renderer;
   GrdRdpCursorRenderer *cursor_renderer;
@@ -122,6 +155,18 @@ struct _GrdSessionRdp
   unsigned int notify_post_connected_source_id;
 
   uint32_t next_stream_id;
+
+  uint32_t logon_id;
+  uint8_t arc_random_bits[ARC_RANDOM_BITS_SIZE];
+  gboolean auto_reconnect_cookie_sent;
+
+  gboolean is_suspended;
+  unsigned int reconnect_grace_period_source_id;
+
+  /* Suspended session, claimed by the auto-reconnect cookie of the client */
+  GrdSessionRdp *reconnect_target;
+  gboolean peer_handover_pending;
+  unsigned int peer_handover_idle_id;
 };
 
 G_DEFINE_TYPE (GrdSessionRdp, grd_session_rdp, GRD_TYPE_SESSION)
@@ -132,12 +177,27 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC (rdpRedirection, redirection_free)
 static gboolean
 close_session_idle (gpointer user_data);
 
+static gboolean
+hand_over_peer_idle (gpointer user_data);
+
 GrdRdpServer *
 grd_session_rdp_get_server (GrdSessionRdp *session_rdp)
 {
   return session_rdp->server;
 }
 
+GrdHwAccelNvidia *
+grd_session_rdp_get_hwaccel_nvidia (GrdSessionRdp *session_rdp)
+{
+  return session_rdp->hwaccel_nvidia;
+}
+
+GrdHwAccelVulkan *
+grd_session_rdp_get_hwaccel_vulkan (GrdSessionRdp *session_rdp)
+{
+  return session_rdp->hwaccel_vulkan;
+}
+
 GrdRdpRenderer *
 grd_session_rdp_get_renderer (GrdSessionRdp *session_rdp)
 {
@@ -177,6 +237,34 @@ grd_session_rdp_get_socket_connection (GrdSessionRdp *session_rdp)
   return session_rdp->connection;
 }
 
+uint32_t
+grd_session_rdp_get_logon_id (GrdSessionRdp *session_rdp)
+{
+  return session_rdp->logon_id;
+}
+
+gboolean
+grd_session_rdp_verify_auto_reconnect_cookie (GrdSessionRdp *session_rdp,
+                                              const uint8_t *security_verifier)
+{
+  /* With enhanced RDP security, the client random only consists of zeroes */
+  uint8_t client_random[32] = {};
+  uint8_t expected_verifier[16] = {};
+  uint8_t difference = 0;
+  size_t i;
+
+  if (!winpr_HMAC (WINPR_MD_MD5,
+                   session_rdp->arc_random_bits, ARC_RANDOM_BITS_SIZE,
+                   client_random, sizeof (client_random),
+                   expected_verifier, sizeof (expected_verifier)))
+    return FALSE;
+
+  for (i = 0; i < sizeof (expected_verifier); ++i)
+    difference |= expected_verifier[i] ^ security_verifier[i];
+
+  return difference == 0;
+}
+
 static gboolean
 is_rdp_peer_flag_set (GrdSessionRdp *session_rdp,
                       RdpPeerFlag    flag)
@@ -214,6 +302,12 @@ grd_session_rdp_get_session_metrics (GrdSessionRdp *session_rdp)
   return session_rdp->session_metrics;
 }
 
+GrdRdpMemoryBudget *
+grd_session_rdp_get_memory_budget (GrdSessionRdp *session_rdp)
+{
+  return session_rdp->memory_budget;
+}
+
 static uint32_t
 get_next_free_stream_id (GrdSessionRdp *session_rdp)
 {
@@ -476,6 +570,12 @@ grd_session_rdp_notify_error (GrdSessionRdp      *session_rdp,
   maybe_queue_close_session_idle (session_rdp);
 }
 
+void
+grd_session_rdp_queue_dvc_initialization (GrdSessionRdp *session_rdp)
+{
+  SetEvent (session_rdp->dvc_init_event);
+}
+
 void
 grd_session_rdp_tear_down_channel (GrdSessionRdp *session_rdp,
                                    GrdRdpChannel  channel)
@@ -1149,6 +1249,35 @@ get_max_monitor_count (GrdSessionRdp *session_rdp)
   g_assert_not_reached ();
 }
 
+static gboolean
+maybe_claim_suspended_session (GrdSessionRdp *session_rdp)
+{
+  rdpSettings *rdp_settings = session_rdp->peer->context->settings;
+  const ARC_CS_PRIVATE_PACKET *auto_reconnect_cookie;
+  GrdSessionRdp *suspended_session;
+
+  auto_reconnect_cookie =
+    freerdp_settings_get_pointer (rdp_settings,
+                                  FreeRDP_ClientAutoReconnectCookie);
+  if (!auto_reconnect_cookie ||
+      auto_reconnect_cookie->cbLen != ARC_CS_PRIVATE_PACKET_SIZE)
+    return FALSE;
+
+  suspended_session =
+    grd_rdp_server_claim_suspended_session (session_rdp->server,
+                                            auto_reconnect_cookie->logonId,
+                                            auto_reconnect_cookie->securityVerifier);
+  if (!suspended_session)
+    return FALSE;
+
+  g_debug ("[RDP] Client reconnects to suspended session with logon id %u",
+           auto_reconnect_cookie->logonId);
+
+  session_rdp->reconnect_target = suspended_session;
+
+  return TRUE;
+}
+
 static BOOL
 rdp_peer_capabilities (freerdp_peer *peer)
 {
@@ -1203,6 +1332,13 @@ rdp_peer_capabilities (freerdp_peer *peer)
       return FALSE;
     }
 
+  /*
+   * The monitor layout of a suspended session is kept. The client learns
+   * about it, when the graphics pipeline is reset.
+   */
+  if (maybe_claim_suspended_session (session_rdp))
+    return TRUE;
+
   if (session_rdp->screen_share_mode == GRD_RDP_SCREEN_SHARE_MODE_EXTEND)
     {
       uint32_t max_monitor_count;
@@ -1329,6 +1465,15 @@ rdp_peer_post_connect (freerdp_peer *peer)
       freerdp_settings_set_bool (rdp_settings, FreeRDP_AudioPlayback, FALSE);
     }
 
+  if (session_rdp->reconnect_target)
+    {
+      g_clear_pointer (&session_rdp->sam_file, grd_rdp_sam_free_sam_file);
+
+      /* The socket thread hands the peer over to the suspended session */
+      session_rdp->peer_handover_pending = TRUE;
+      return TRUE;
+    }
+
   if (freerdp_settings_get_bool (rdp_settings, FreeRDP_SupportGraphicsPipeline))
     grd_rdp_renderer_notify_graphics_pipeline_reset (session_rdp->renderer);
 
@@ -1433,8 +1578,6 @@ init_rdp_session (GrdSessionRdp  *session_rdp,
   GrdSettings *settings = grd_context_get_settings (context);
   GSocket *socket = g_socket_connection_get_socket (session_rdp->connection);
   GrdRdpAuthMethods auth_methods = 0;
-  g_autofree char *server_cert = NULL;
-  g_autofree char *server_key = NULL;
   gboolean use_client_configs;
   freerdp_peer *peer;
   rdpInput *rdp_input;
@@ -1507,31 +1650,15 @@ init_rdp_session (GrdSessionRdp  *session_rdp,
                                    kerberos_keytab);
     }
 
-  g_object_get (G_OBJECT (settings),
-                "rdp-server-cert", &server_cert,
-                "rdp-server-key", &server_key,
-                NULL);
+  if (!grd_rdp_server_get_server_certificate (session_rdp->server,
+                                              &rdp_certificate,
+                                              &rdp_private_key,
+                                              error))
+    return FALSE;
 
-  if (server_cert)
-    rdp_certificate = freerdp_certificate_new_from_pem (server_cert);
-  if (!rdp_certificate)
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Failed to create certificate from file");
-      return FALSE;
-    }
   freerdp_settings_set_pointer_len (rdp_settings,
                                     FreeRDP_RdpServerCertificate,
                                     rdp_certificate, 1);
-
-  if (server_key)
-    rdp_private_key = freerdp_key_new_from_pem (server_key);
-  if (!rdp_private_key)
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Failed to create private key from file");
-      return FALSE;
-    }
   freerdp_settings_set_pointer_len (rdp_settings,
                                     FreeRDP_RdpServerRsaKey,
                                     rdp_private_key, 1);
@@ -1617,76 +1744,299 @@ init_rdp_session (GrdSessionRdp  *session_rdp,
   return TRUE;
 }
 
+static gboolean
+watch_fd (int                epoll_fd,
+          int                fd,
+          SocketEventSource  event_source,
+          GError           **error)
+{
+  struct epoll_event epoll_event = {};
+
+  epoll_event.events = EPOLLIN;
+  epoll_event.data.u32 = event_source;
+
+  if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &epoll_event) < 0 &&
+      errno != EEXIST)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Failed to watch fd %i: %s", fd, g_strerror (errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+watch_event_handle (int                epoll_fd,
+                    HANDLE             event_handle,
+                    SocketEventSource  event_source,
+                    GError           **error)
+{
+  int fd;
+
+  fd = GetEventFileDescriptor (event_handle);
+  if (fd < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to retrieve fd of event handle");
+      return FALSE;
+    }
+
+  return watch_fd (epoll_fd, fd, event_source, error);
+}
+
+static gboolean
+sync_transport_fds (SocketEventLoop  *event_loop,
+                    freerdp_peer     *peer,
+                    GError          **error)
+{
+  HANDLE transport_handles[MAX_TRANSPORT_HANDLES] = {};
+  int transport_fds[MAX_TRANSPORT_HANDLES] = {};
+  uint32_t n_transport_handles;
+  uint32_t i;
+
+  n_transport_handles = peer->GetEventHandles (peer, transport_handles,
+                                               MAX_TRANSPORT_HANDLES);
+  if (!n_transport_handles)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Failed to get FreeRDP transport event handles");
+      return FALSE;
+    }
+
+  for (i = 0; i < n_transport_handles; ++i)
+    {
+      transport_fds[i] = GetEventFileDescriptor (transport_handles[i]);
+      if (transport_fds[i] < 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Failed to retrieve fd of transport event handle");
+          return FALSE;
+        }
+    }
+
+  /*
+   * The transport handles only change, when the transport layer itself
+   * changes, so in the common case, there is nothing to do here.
+   */
+  if (n_transport_handles == event_loop->n_transport_fds &&
+      memcmp (transport_fds, event_loop->transport_fds,
+              n_transport_handles * sizeof (int)) == 0)
+    return TRUE;
+
+  for (i = 0; i < event_loop->n_transport_fds; ++i)
+    {
+      epoll_ctl (event_loop->epoll_fd, EPOLL_CTL_DEL,
+                 event_loop->transport_fds[i], NULL);
+    }
+  event_loop->n_transport_fds = 0;
+
+  for (i = 0; i < n_transport_handles; ++i)
+    {
+      if (!watch_fd (event_loop->epoll_fd, transport_fds[i],
+                     SOCKET_EVENT_SOURCE_TRANSPORT, error))
+        return FALSE;
+
+      event_loop->transport_fds[event_loop->n_transport_fds++] =
+        transport_fds[i];
+    }
+
+  return TRUE;
+}
+
+static gboolean
+init_socket_event_loop (SocketEventLoop  *event_loop,
+                        GrdSessionRdp    *session_rdp,
+                        HANDLE            channel_event,
+                        GError          **error)
+{
+  event_loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (event_loop->epoll_fd < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Failed to create epoll instance: %s", g_strerror (errno));
+      return FALSE;
+    }
+
+  if (!watch_event_handle (event_loop->epoll_fd, session_rdp->stop_event,
+                           SOCKET_EVENT_SOURCE_STOP, error))
+    return FALSE;
+  if (!watch_event_handle (event_loop->epoll_fd, channel_event,
+                           SOCKET_EVENT_SOURCE_CHANNEL, error))
+    return FALSE;
+  if (!watch_event_handle (event_loop->epoll_fd, session_rdp->dvc_init_event,
+                           SOCKET_EVENT_SOURCE_DVC_INIT, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+clear_socket_event_loop (SocketEventLoop *event_loop)
+{
+  g_clear_fd (&event_loop->epoll_fd, NULL);
+}
+
+static void
+maybe_init_dvcs (GrdSessionRdp  *session_rdp,
+                 RdpPeerContext *rdp_peer_context)
+{
+  GrdRdpDvcTelemetry *telemetry;
+  GrdRdpDvcGraphicsPipeline *graphics_pipeline;
+  GrdRdpDvcInput *input;
+  GrdRdpDvcAudioPlayback *audio_playback;
+  GrdRdpDvcDisplayControl *display_control;
+  GrdRdpDvcAudioInput *audio_input;
+  GrdRdpDvcCameraEnumerator *camera_enumerator;
+
+  g_mutex_lock (&rdp_peer_context->channel_mutex);
+  telemetry = rdp_peer_context->telemetry;
+  graphics_pipeline = rdp_peer_context->graphics_pipeline;
+  input = rdp_peer_context->input;
+  audio_playback = rdp_peer_context->audio_playback;
+  display_control = rdp_peer_context->display_control;
+  audio_input = rdp_peer_context->audio_input;
+  camera_enumerator = rdp_peer_context->camera_enumerator;
+
+  if (telemetry && !session_rdp->session_should_stop)
+    grd_rdp_dvc_maybe_init (GRD_RDP_DVC (telemetry));
+  if (graphics_pipeline && !session_rdp->session_should_stop)
+    grd_rdp_dvc_maybe_init (GRD_RDP_DVC (graphics_pipeline));
+  if (input && !session_rdp->session_should_stop)
+    grd_rdp_dvc_maybe_init (GRD_RDP_DVC (input));
+  if (audio_playback && !session_rdp->session_should_stop)
+    grd_rdp_dvc_maybe_init (GRD_RDP_DVC (audio_playback));
+  if (display_control && !session_rdp->session_should_stop)
+    grd_rdp_dvc_maybe_init (GRD_RDP_DVC (display_control));
+  if (audio_input && !session_rdp->session_should_stop)
+    grd_rdp_dvc_maybe_init (GRD_RDP_DVC (audio_input));
+  if (camera_enumerator && !session_rdp->session_should_stop)
+    grd_rdp_dvc_maybe_init (GRD_RDP_DVC (camera_enumerator));
+  g_mutex_unlock (&rdp_peer_context->channel_mutex);
+}
+
 gpointer
 socket_thread_func (gpointer data)
 {
   GrdSessionRdp *session_rdp = data;
   freerdp_peer *peer;
   RdpPeerContext *rdp_peer_context;
+  SocketEventLoop event_loop = { .epoll_fd = -1 };
   HANDLE vcm;
   HANDLE channel_event;
-  HANDLE events[32] = {};
-  uint32_t n_events;
-  uint32_t n_freerdp_handles;
+  HANDLE bw_measure_stop_event = NULL;
+  uint8_t last_drdynvc_state = DRDYNVC_STATE_NONE;
+  g_autoptr (GError) error = NULL;
 
   peer = session_rdp->peer;
   rdp_peer_context = (RdpPeerContext *) peer->context;
   vcm = rdp_peer_context->vcm;
   channel_event = WTSVirtualChannelManagerGetEventHandle (vcm);
 
+  if (!init_socket_event_loop (&event_loop, session_rdp, channel_event,
+                               &error))
+    {
+      g_warning ("[RDP] Failed to initialize socket event loop: %s",
+                 error->message);
+      clear_socket_event_loop (&event_loop);
+      handle_client_gone (session_rdp);
+      return NULL;
+    }
+
   while (TRUE)
     {
       GrdRdpNetworkAutodetection *network_autodetection =
         rdp_peer_context->network_autodetection;
+      struct epoll_event epoll_events[MAX_EPOLL_EVENTS];
+      gboolean transport_ready = FALSE;
+      gboolean channel_ready = FALSE;
+      gboolean dvc_init_pending = FALSE;
       gboolean pending_bw_measure_stop = FALSE;
-      HANDLE bw_measure_stop_event = NULL;
-
-      n_events = 0;
+      int n_epoll_events;
+      int i;
 
-      events[n_events++] = session_rdp->stop_event;
-      if (network_autodetection)
+      if (network_autodetection && !bw_measure_stop_event)
         {
           bw_measure_stop_event =
             grd_rdp_network_autodetection_get_bw_measure_stop_event_handle (network_autodetection);
-          events[n_events++] = bw_measure_stop_event;
+          if (!watch_event_handle (event_loop.epoll_fd, bw_measure_stop_event,
+                                   SOCKET_EVENT_SOURCE_BW_MEASURE_STOP,
+                                   &error))
+            {
+              g_warning ("[RDP] %s", error->message);
+              handle_client_gone (session_rdp);
+              break;
+            }
         }
 
-      events[n_events++] = channel_event;
+      if (!sync_transport_fds (&event_loop, peer, &error))
+        {
+          g_warning ("[RDP] %s", error->message);
+          handle_client_gone (session_rdp);
+          break;
+        }
 
-      n_freerdp_handles = peer->GetEventHandles (peer, &events[n_events],
-                                                 32 - n_events);
-      if (!n_freerdp_handles)
+      n_epoll_events = epoll_wait (event_loop.epoll_fd, epoll_events,
+                                   MAX_EPOLL_EVENTS, -1);
+      if (n_epoll_events < 0)
         {
-          g_warning ("Failed to get FreeRDP transport event handles");
+          if (errno == EINTR)
+            continue;
+
+          g_warning ("[RDP] Failed to wait for socket events: %s",
+                     g_strerror (errno));
           handle_client_gone (session_rdp);
           break;
         }
-      n_events += n_freerdp_handles;
 
-      WaitForMultipleObjects (n_events, events, FALSE, INFINITE);
+      for (i = 0; i < n_epoll_events; ++i)
+        {
+          switch ((SocketEventSource) epoll_events[i].data.u32)
+            {
+            case SOCKET_EVENT_SOURCE_STOP:
+              break;
+            case SOCKET_EVENT_SOURCE_BW_MEASURE_STOP:
+              pending_bw_measure_stop = TRUE;
+              break;
+            case SOCKET_EVENT_SOURCE_CHANNEL:
+              channel_ready = TRUE;
+              break;
+            case SOCKET_EVENT_SOURCE_DVC_INIT:
+              dvc_init_pending = TRUE;
+              break;
+            case SOCKET_EVENT_SOURCE_TRANSPORT:
+              transport_ready = TRUE;
+              break;
+            }
+        }
 
       if (session_rdp->session_should_stop)
         break;
 
-      if (!peer->CheckFileDescriptor (peer))
+      if (transport_ready && !peer->CheckFileDescriptor (peer))
         {
           g_message ("[RDP] Network or intentional disconnect, stopping session");
           handle_client_gone (session_rdp);
           break;
         }
 
+      if (session_rdp->peer_handover_pending)
+        {
+          session_rdp->peer_handover_idle_id =
+            g_idle_add (hand_over_peer_idle, session_rdp);
+          break;
+        }
+
+      if (dvc_init_pending)
+        ResetEvent (session_rdp->dvc_init_event);
+
       if (peer->connected &&
           WTSVirtualChannelManagerIsChannelJoined (vcm, DRDYNVC_SVC_CHANNEL_NAME))
         {
-          GrdRdpDvcTelemetry *telemetry;
-          GrdRdpDvcGraphicsPipeline *graphics_pipeline;
-          GrdRdpDvcInput *input;
-          GrdRdpDvcAudioPlayback *audio_playback;
-          GrdRdpDvcDisplayControl *display_control;
-          GrdRdpDvcAudioInput *audio_input;
-          GrdRdpDvcCameraEnumerator *camera_enumerator;
-
-          switch (WTSVirtualChannelManagerGetDrdynvcState (vcm))
+          uint8_t drdynvc_state;
+
+          drdynvc_state = WTSVirtualChannelManagerGetDrdynvcState (vcm);
+          switch (drdynvc_state)
             {
             case DRDYNVC_STATE_NONE:
               /*
@@ -1694,46 +2044,26 @@ socket_thread_func (gpointer data)
                * will be called, which initializes the drdynvc channel
                */
               SetEvent (channel_event);
+              channel_ready = TRUE;
               break;
             case DRDYNVC_STATE_READY:
-              g_mutex_lock (&rdp_peer_context->channel_mutex);
-              telemetry = rdp_peer_context->telemetry;
-              graphics_pipeline = rdp_peer_context->graphics_pipeline;
-              input = rdp_peer_context->input;
-              audio_playback = rdp_peer_context->audio_playback;
-              display_control = rdp_peer_context->display_control;
-              audio_input = rdp_peer_context->audio_input;
-              camera_enumerator = rdp_peer_context->camera_enumerator;
-
-              if (telemetry && !session_rdp->session_should_stop)
-                grd_rdp_dvc_maybe_init (GRD_RDP_DVC (telemetry));
-              if (graphics_pipeline && !session_rdp->session_should_stop)
-                grd_rdp_dvc_maybe_init (GRD_RDP_DVC (graphics_pipeline));
-              if (input && !session_rdp->session_should_stop)
-                grd_rdp_dvc_maybe_init (GRD_RDP_DVC (input));
-              if (audio_playback && !session_rdp->session_should_stop)
-                grd_rdp_dvc_maybe_init (GRD_RDP_DVC (audio_playback));
-              if (display_control && !session_rdp->session_should_stop)
-                grd_rdp_dvc_maybe_init (GRD_RDP_DVC (display_control));
-              if (audio_input && !session_rdp->session_should_stop)
-                grd_rdp_dvc_maybe_init (GRD_RDP_DVC (audio_input));
-              if (camera_enumerator && !session_rdp->session_should_stop)
-                grd_rdp_dvc_maybe_init (GRD_RDP_DVC (camera_enumerator));
-              g_mutex_unlock (&rdp_peer_context->channel_mutex);
+              /*
+               * DVCs only need to be looked at, when the drdynvc channel just
+               * became ready or when a DVC queued its (re-)initialization
+               */
+              if (last_drdynvc_state != DRDYNVC_STATE_READY || dvc_init_pending)
+                maybe_init_dvcs (session_rdp, rdp_peer_context);
+              break;
+            default:
               break;
             }
+          last_drdynvc_state = drdynvc_state;
 
           if (session_rdp->session_should_stop)
             break;
         }
 
-      if (bw_measure_stop_event)
-        {
-          pending_bw_measure_stop = WaitForSingleObject (bw_measure_stop_event,
-                                                         0) == WAIT_OBJECT_0;
-        }
-
-      if (WaitForSingleObject (channel_event, 0) == WAIT_OBJECT_0 &&
+      if (channel_ready &&
           !WTSVirtualChannelManagerCheckFileDescriptor (vcm))
         {
           g_message ("Unable to check VCM file descriptor, closing connection");
@@ -1745,6 +2075,8 @@ socket_thread_func (gpointer data)
         grd_rdp_network_autodetection_bw_measure_stop (network_autodetection);
     }
 
+  clear_socket_event_loop (&event_loop);
+
   return NULL;
 }
 
@@ -1765,6 +2097,7 @@ grd_session_rdp_new (GrdRdpServer      *rdp_server,
   g_autoptr (GrdSessionRdp) session_rdp = NULL;
   GrdContext *context;
   GrdSettings *settings;
+  int memory_budget_mib;
   char *username;
   char *password;
   g_autoptr (GError) error = NULL;
@@ -1789,6 +2122,12 @@ grd_session_rdp_new (GrdRdpServer      *rdp_server,
 
   session_rdp->server = rdp_server;
   session_rdp->connection = g_object_ref (connection);
+  session_rdp->logon_id = grd_rdp_server_acquire_logon_id (rdp_server);
+
+  g_set_object (&session_rdp->hwaccel_nvidia,
+                grd_rdp_server_get_hwaccel_nvidia (rdp_server));
+  g_set_object (&session_rdp->hwaccel_vulkan,
+                grd_rdp_server_get_hwaccel_vulkan (rdp_server));
 
   g_object_get (G_OBJECT (settings),
                 "rdp-screen-share-mode", &session_rdp->screen_share_mode,
@@ -1799,6 +2138,10 @@ grd_session_rdp_new (GrdRdpServer      *rdp_server,
                     G_CALLBACK (on_view_only_changed),
                     session_rdp);
 
+  memory_budget_mib = grd_settings_get_rdp_session_memory_budget (settings);
+  session_rdp->memory_budget =
+    grd_rdp_memory_budget_new ((uint64_t) memory_budget_mib * 1024 * 1024);
+
   session_rdp->renderer = grd_rdp_renderer_new (session_rdp);
   session_rdp->layout_manager = grd_rdp_layout_manager_new (session_rdp);
 
@@ -1845,35 +2188,10 @@ clear_rdp_peer (GrdSessionRdp *session_rdp)
 }
 
 static void
-grd_session_rdp_stop (GrdSession *session)
+clear_peer_channels (GrdSessionRdp *session_rdp)
 {
-  GrdSessionRdp *session_rdp = GRD_SESSION_RDP (session);
-  freerdp_peer *peer = session_rdp->peer;
-  RdpPeerContext *rdp_peer_context = (RdpPeerContext *) peer->context;
-
-  g_debug ("Stopping RDP session");
-
-  unset_rdp_peer_flag (session_rdp, RDP_PEER_ACTIVATED);
-  session_rdp->session_should_stop = TRUE;
-  SetEvent (session_rdp->stop_event);
-
-  if (!has_session_close_queued (session_rdp))
-    {
-      freerdp_set_error_info (peer->context->rdp,
-                              ERRINFO_RPC_INITIATED_DISCONNECT);
-    }
-  else if (session_rdp->rdp_error_info)
-    {
-      freerdp_set_error_info (peer->context->rdp, session_rdp->rdp_error_info);
-    }
-
-  if (rdp_peer_context->network_autodetection)
-    {
-      grd_rdp_network_autodetection_invoke_shutdown (
-        rdp_peer_context->network_autodetection);
-    }
-
-  grd_rdp_renderer_invoke_shutdown (session_rdp->renderer);
+  RdpPeerContext *rdp_peer_context =
+    (RdpPeerContext *) session_rdp->peer->context;
 
   g_mutex_lock (&rdp_peer_context->channel_mutex);
   g_clear_object (&rdp_peer_context->camera_enumerator);
@@ -1885,11 +2203,11 @@ grd_session_rdp_stop (GrdSession *session)
   g_clear_object (&rdp_peer_context->graphics_pipeline);
   g_clear_object (&rdp_peer_context->telemetry);
   g_mutex_unlock (&rdp_peer_context->channel_mutex);
+}
 
-  g_clear_pointer (&session_rdp->socket_thread, g_thread_join);
-  g_clear_handle_id (&session_rdp->notify_post_connected_source_id,
-                     g_source_remove);
-
+static void
+release_pressed_keys (GrdSessionRdp *session_rdp)
+{
   g_hash_table_foreach_remove (session_rdp->pressed_keys,
                                notify_keycode_released,
                                session_rdp);
@@ -1897,11 +2215,13 @@ grd_session_rdp_stop (GrdSession *session)
                                notify_keysym_released,
                                session_rdp);
   grd_rdp_event_queue_flush (session_rdp->rdp_event_queue);
+}
 
-  g_clear_object (&session_rdp->layout_manager);
-
-  g_clear_object (&session_rdp->cursor_renderer);
-  g_clear_object (&session_rdp->renderer);
+static void
+close_rdp_peer (GrdSessionRdp *session_rdp)
+{
+  freerdp_peer *peer = session_rdp->peer;
+  RdpPeerContext *rdp_peer_context = (RdpPeerContext *) peer->context;
 
   peer->Close (peer);
   g_clear_object (&session_rdp->connection);
@@ -1910,17 +2230,156 @@ grd_session_rdp_stop (GrdSession *session)
 
   peer->Disconnect (peer);
   clear_rdp_peer (session_rdp);
+}
+
+static void
+grd_session_rdp_stop (GrdSession *session)
+{
+  GrdSessionRdp *session_rdp = GRD_SESSION_RDP (session);
+  freerdp_peer *peer = session_rdp->peer;
+
+  g_debug ("Stopping RDP session");
+
+  grd_rdp_memory_budget_log_usage (session_rdp->memory_budget);
+
+  g_clear_handle_id (&session_rdp->reconnect_grace_period_source_id,
+                     g_source_remove);
+  if (session_rdp->is_suspended)
+    {
+      grd_rdp_server_remove_suspended_session (session_rdp->server,
+                                               session_rdp);
+      session_rdp->is_suspended = FALSE;
+    }
+
+  unset_rdp_peer_flag (session_rdp, RDP_PEER_ACTIVATED);
+  session_rdp->session_should_stop = TRUE;
+  SetEvent (session_rdp->stop_event);
+
+  if (peer)
+    {
+      RdpPeerContext *rdp_peer_context = (RdpPeerContext *) peer->context;
+
+      if (!has_session_close_queued (session_rdp))
+        {
+          freerdp_set_error_info (peer->context->rdp,
+                                  ERRINFO_RPC_INITIATED_DISCONNECT);
+        }
+      else if (session_rdp->rdp_error_info)
+        {
+          freerdp_set_error_info (peer->context->rdp,
+                                  session_rdp->rdp_error_info);
+        }
+
+      if (rdp_peer_context->network_autodetection)
+        {
+          grd_rdp_network_autodetection_invoke_shutdown (
+            rdp_peer_context->network_autodetection);
+        }
+    }
+
+  grd_rdp_renderer_invoke_shutdown (session_rdp->renderer);
+
+  if (peer)
+    clear_peer_channels (session_rdp);
+
+  g_clear_pointer (&session_rdp->socket_thread, g_thread_join);
+  g_clear_handle_id (&session_rdp->peer_handover_idle_id, g_source_remove);
+  g_clear_handle_id (&session_rdp->notify_post_connected_source_id,
+                     g_source_remove);
+
+  if (session_rdp->reconnect_target)
+    {
+      /* The client may retry reconnecting with the same cookie */
+      if (session_rdp->reconnect_target->is_suspended)
+        {
+          grd_rdp_server_add_suspended_session (session_rdp->server,
+                                                session_rdp->reconnect_target);
+        }
+      g_clear_object (&session_rdp->reconnect_target);
+    }
+
+  release_pressed_keys (session_rdp);
+
+  g_clear_object (&session_rdp->layout_manager);
+
+  g_clear_object (&session_rdp->cursor_renderer);
+  g_clear_object (&session_rdp->renderer);
+
+  if (peer)
+    close_rdp_peer (session_rdp);
 
   g_clear_handle_id (&session_rdp->close_session_idle_id, g_source_remove);
 }
 
 static gboolean
-close_session_idle (gpointer user_data)
+on_reconnect_grace_period_expired (gpointer user_data)
 {
   GrdSessionRdp *session_rdp = GRD_SESSION_RDP (user_data);
 
+  g_message ("[RDP] Client did not reconnect in time, stopping session");
+
+  session_rdp->reconnect_grace_period_source_id = 0;
   grd_session_stop (GRD_SESSION (session_rdp));
 
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+should_suspend_session (GrdSessionRdp *session_rdp)
+{
+  return session_rdp->peer &&
+         session_rdp->auto_reconnect_cookie_sent &&
+         !session_rdp->rdp_error_info &&
+         grd_rdp_layout_manager_can_suspend (session_rdp->layout_manager);
+}
+
+static void
+suspend_session (GrdSessionRdp *session_rdp)
+{
+  GrdContext *context = grd_session_get_context (GRD_SESSION (session_rdp));
+  GrdSettings *settings = grd_context_get_settings (context);
+  RdpPeerContext *rdp_peer_context =
+    (RdpPeerContext *) session_rdp->peer->context;
+  int grace_period;
+
+  grace_period = grd_settings_get_rdp_reconnect_grace_period (settings);
+  g_message ("[RDP] Keeping session for %i seconds to let the client "
+             "reconnect", grace_period);
+
+  if (rdp_peer_context->network_autodetection)
+    {
+      grd_rdp_network_autodetection_invoke_shutdown (
+        rdp_peer_context->network_autodetection);
+    }
+
+  grd_rdp_renderer_invoke_shutdown (session_rdp->renderer);
+  clear_peer_channels (session_rdp);
+
+  g_clear_pointer (&session_rdp->socket_thread, g_thread_join);
+
+  release_pressed_keys (session_rdp);
+
+  close_rdp_peer (session_rdp);
+  session_rdp->auto_reconnect_cookie_sent = FALSE;
+
+  session_rdp->is_suspended = TRUE;
+  session_rdp->reconnect_grace_period_source_id =
+    g_timeout_add_seconds (grace_period, on_reconnect_grace_period_expired,
+                           session_rdp);
+
+  grd_rdp_server_add_suspended_session (session_rdp->server, session_rdp);
+}
+
+static gboolean
+close_session_idle (gpointer user_data)
+{
+  GrdSessionRdp *session_rdp = GRD_SESSION_RDP (user_data);
+
+  if (should_suspend_session (session_rdp))
+    suspend_session (session_rdp);
+  else
+    grd_session_stop (GRD_SESSION (session_rdp));
+
   session_rdp->close_session_idle_id = 0;
 
   return G_SOURCE_REMOVE;
@@ -1932,7 +2391,7 @@ initialize_graphics_pipeline (GrdSessionRdp *session_rdp)
   rdpContext *rdp_context = session_rdp->peer->context;
   RdpPeerContext *rdp_peer_context = (RdpPeerContext *) rdp_context;
   GrdHwAccelNvidia *hwaccel_nvidia =
-    grd_rdp_server_get_hwaccel_nvidia (session_rdp->server);
+    grd_session_rdp_get_hwaccel_nvidia (session_rdp);
   GrdRdpDvcGraphicsPipeline *graphics_pipeline;
   GrdRdpDvcTelemetry *telemetry;
 
@@ -1996,7 +2455,8 @@ initialize_remaining_virtual_channels (GrdSessionRdp *session_rdp)
     {
       rdp_peer_context->audio_playback =
         grd_rdp_dvc_audio_playback_new (session_rdp, dvc_handler, vcm,
-                                        rdp_context);
+                                        rdp_context,
+                                        rdp_peer_context->network_autodetection);
     }
   if (freerdp_settings_get_bool (rdp_settings, FreeRDP_AudioCapture))
     {
@@ -2010,6 +2470,138 @@ initialize_remaining_virtual_channels (GrdSessionRdp *session_rdp)
                                        rdp_context);
 }
 
+static void
+maybe_send_auto_reconnect_cookie (GrdSessionRdp *session_rdp)
+{
+  GrdContext *context = grd_session_get_context (GRD_SESSION (session_rdp));
+  GrdSettings *settings = grd_context_get_settings (context);
+  rdpContext *rdp_context = session_rdp->peer->context;
+  rdpUpdate *rdp_update = rdp_context->update;
+  logon_info_ex logon_info_ex = {};
+
+  if (grd_settings_get_rdp_reconnect_grace_period (settings) == 0)
+    return;
+
+  /*
+   * In system and handover mode, reconnecting clients are routed via server
+   * redirection instead
+   */
+  switch (grd_context_get_runtime_mode (context))
+    {
+    case GRD_RUNTIME_MODE_HEADLESS:
+    case GRD_RUNTIME_MODE_SCREEN_SHARE:
+      break;
+    case GRD_RUNTIME_MODE_SYSTEM:
+    case GRD_RUNTIME_MODE_HANDOVER:
+      return;
+    }
+
+  if (session_rdp->screen_share_mode != GRD_RDP_SCREEN_SHARE_MODE_EXTEND)
+    return;
+
+  if (winpr_RAND (session_rdp->arc_random_bits, ARC_RANDOM_BITS_SIZE) == -1)
+    {
+      g_warning ("[RDP] Failed to generate auto-reconnect cookie");
+      return;
+    }
+
+  logon_info_ex.haveCookie = TRUE;
+  logon_info_ex.LogonId = session_rdp->logon_id;
+  memcpy (logon_info_ex.ArcRandomBits, session_rdp->arc_random_bits,
+          ARC_RANDOM_BITS_SIZE);
+
+  if (!rdp_update->SaveSessionInfo (rdp_context, INFO_TYPE_LOGON_EXTENDED_INF,
+                                    &logon_info_ex))
+    {
+      g_warning ("[RDP] Failed to send auto-reconnect cookie");
+      return;
+    }
+
+  session_rdp->auto_reconnect_cookie_sent = TRUE;
+}
+
+static void
+resume_session (GrdSessionRdp     *session_rdp,
+                freerdp_peer      *peer,
+                GSocketConnection *connection)
+{
+  RdpPeerContext *rdp_peer_context = (RdpPeerContext *) peer->context;
+
+  g_message ("[RDP] Client reconnected, resuming session");
+
+  g_assert (session_rdp->is_suspended);
+  g_assert (!session_rdp->peer);
+  g_assert (!session_rdp->socket_thread);
+
+  g_clear_handle_id (&session_rdp->reconnect_grace_period_source_id,
+                     g_source_remove);
+  session_rdp->is_suspended = FALSE;
+
+  session_rdp->peer = peer;
+  session_rdp->connection = connection;
+  rdp_peer_context->session_rdp = session_rdp;
+
+  session_rdp->rdp_error_info = 0;
+  session_rdp->pause_key_state = PAUSE_KEY_STATE_NONE;
+  session_rdp->session_should_stop = FALSE;
+  ResetEvent (session_rdp->stop_event);
+
+  grd_rdp_layout_manager_notify_peer_reattached (session_rdp->layout_manager);
+  grd_rdp_renderer_notify_graphics_pipeline_reset (session_rdp->renderer);
+  grd_rdp_cursor_renderer_notify_peer_reattached (session_rdp->cursor_renderer,
+                                                  peer->context);
+
+  initialize_graphics_pipeline (session_rdp);
+  initialize_remaining_virtual_channels (session_rdp);
+
+  if (rdp_peer_context->network_autodetection)
+    {
+      grd_rdp_network_autodetection_ensure_rtt_consumer (
+        rdp_peer_context->network_autodetection,
+        GRD_RDP_NW_AUTODETECT_RTT_CONSUMER_RDPGFX);
+    }
+
+  set_rdp_peer_flag (session_rdp, RDP_PEER_ACTIVATED);
+
+  grd_rdp_renderer_resume (session_rdp->renderer);
+
+  session_rdp->socket_thread = g_thread_new ("RDP socket thread",
+                                             socket_thread_func,
+                                             session_rdp);
+  grd_session_rdp_queue_dvc_initialization (session_rdp);
+
+  maybe_send_auto_reconnect_cookie (session_rdp);
+}
+
+static gboolean
+hand_over_peer_idle (gpointer user_data)
+{
+  GrdSessionRdp *session_rdp = GRD_SESSION_RDP (user_data);
+  g_autoptr (GrdSessionRdp) suspended_session = NULL;
+  freerdp_peer *peer;
+  GSocketConnection *connection;
+
+  session_rdp->peer_handover_idle_id = 0;
+  suspended_session = g_steal_pointer (&session_rdp->reconnect_target);
+
+  g_clear_pointer (&session_rdp->socket_thread, g_thread_join);
+
+  if (!suspended_session->is_suspended)
+    {
+      g_message ("[RDP] Suspended session is gone, closing connection");
+      grd_session_stop (GRD_SESSION (session_rdp));
+      return G_SOURCE_REMOVE;
+    }
+
+  peer = g_steal_pointer (&session_rdp->peer);
+  connection = g_steal_pointer (&session_rdp->connection);
+  resume_session (suspended_session, peer, connection);
+
+  grd_session_stop (GRD_SESSION (session_rdp));
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 on_remote_desktop_session_ready (GrdSession *session)
 {
@@ -2025,6 +2617,8 @@ on_remote_desktop_session_ready (GrdSession *session)
 
   initialize_graphics_pipeline (session_rdp);
   initialize_remaining_virtual_channels (session_rdp);
+
+  grd_session_rdp_queue_dvc_initialization (session_rdp);
 }
 
 static void
@@ -2043,6 +2637,8 @@ on_remote_desktop_session_started (GrdSession *session)
                                                    GRD_RDP_PHASE_SESSION_STARTED);
   grd_rdp_layout_manager_notify_session_started (session_rdp->layout_manager);
   grd_rdp_event_queue_flush_synchronization (session_rdp->rdp_event_queue);
+
+  maybe_send_auto_reconnect_cookie (session_rdp);
 }
 
 static void
@@ -2087,8 +2683,12 @@ grd_session_rdp_dispose (GObject *object)
   GrdSessionRdp *session_rdp = GRD_SESSION_RDP (object);
 
   g_assert (!session_rdp->notify_post_connected_source_id);
+  g_assert (!session_rdp->peer_handover_idle_id);
+  g_assert (!session_rdp->reconnect_grace_period_source_id);
   g_assert (!session_rdp->cursor_renderer);
 
+  g_clear_object (&session_rdp->reconnect_target);
+
   g_clear_object (&session_rdp->layout_manager);
   clear_rdp_peer (session_rdp);
 
@@ -2096,13 +2696,18 @@ grd_session_rdp_dispose (GObject *object)
 
   g_clear_object (&session_rdp->renderer);
 
+  g_clear_object (&session_rdp->hwaccel_vulkan);
+  g_clear_object (&session_rdp->hwaccel_nvidia);
+
   g_clear_object (&session_rdp->rdp_event_queue);
   g_clear_object (&session_rdp->session_metrics);
+  g_clear_object (&session_rdp->memory_budget);
 
   g_clear_pointer (&session_rdp->stream_table, g_hash_table_unref);
   g_clear_pointer (&session_rdp->pressed_unicode_keys, g_hash_table_unref);
   g_clear_pointer (&session_rdp->pressed_keys, g_hash_table_unref);
 
+  g_clear_pointer (&session_rdp->dvc_init_event, CloseHandle);
   g_clear_pointer (&session_rdp->stop_event, CloseHandle);
 
   G_OBJECT_CLASS (grd_session_rdp_parent_class)->dispose (object);
@@ -2124,6 +2729,7 @@ static void
 grd_session_rdp_init (GrdSessionRdp *session_rdp)
 {
   session_rdp->stop_event = CreateEvent (NULL, TRUE, FALSE, NULL);
+  session_rdp->dvc_init_event = CreateEvent (NULL, TRUE, FALSE, NULL);
 
   session_rdp->pressed_keys = g_hash_table_new (NULL, NULL);
   session_rdp->pressed_unicode_keys = g_hash_table_new (NULL, NULL);
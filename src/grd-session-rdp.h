@@ -62,9 +62,13 @@ GrdSessionRdp *grd_session_rdp_new (GrdRdpServer      *rdp_server,
 
 GrdRdpSessionMetrics *grd_session_rdp_get_session_metrics (GrdSessionRdp *session_rdp);
 
+GrdRdpMemoryBudget *grd_session_rdp_get_memory_budget (GrdSessionRdp *session_rdp);
+
 void grd_session_rdp_notify_error (GrdSessionRdp      *session_rdp,
                                    GrdSessionRdpError  error_info);
 
+void grd_session_rdp_queue_dvc_initialization (GrdSessionRdp *session_rdp);
+
 void grd_session_rdp_tear_down_channel (GrdSessionRdp *session_rdp,
                                         GrdRdpChannel  channel);
 
@@ -84,6 +88,10 @@ gboolean grd_session_rdp_send_server_redirection (GrdSessionRdp *session_rdp,
 
 GrdRdpServer *grd_session_rdp_get_server (GrdSessionRdp *session_rdp);
 
+GrdHwAccelNvidia *grd_session_rdp_get_hwaccel_nvidia (GrdSessionRdp *session_rdp);
+
+GrdHwAccelVulkan *grd_session_rdp_get_hwaccel_vulkan (GrdSessionRdp *session_rdp);
+
 GrdRdpRenderer *grd_session_rdp_get_renderer (GrdSessionRdp *session_rdp);
 
 GrdRdpCursorRenderer *grd_session_rdp_get_cursor_renderer (GrdSessionRdp *session_rdp);
@@ -95,3 +103,8 @@ GrdRdpDvcGraphicsPipeline *grd_session_rdp_get_graphics_pipeline (GrdSessionRdp
 GrdRdpScreenShareMode grd_session_rdp_get_screen_share_mode (GrdSessionRdp *session_rdp);
 
 GSocketConnection *grd_session_rdp_get_socket_connection (GrdSessionRdp *session_rdp);
+
+uint32_t grd_session_rdp_get_logon_id (GrdSessionRdp *session_rdp);
+
+gboolean grd_session_rdp_verify_auto_reconnect_cookie (GrdSessionRdp *session_rdp,
+                                                       const uint8_t *security_verifier);
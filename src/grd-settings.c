@@ -91,6 +91,15 @@ typedef struct _GrdSettingsPrivate
   } vnc;
 
   int max_parallel_connections;
+  int max_connections_per_peer;
+  int max_pending_connections_per_peer;
+  int max_connection_attempts_per_second;
+  int max_global_pending_connections;
+  int max_global_connection_attempts_per_second;
+  int rdp_listen_backlog;
+  int warm_display_pool_size;
+  int rdp_session_memory_budget_mib;
+  int rdp_reconnect_grace_period;
 } GrdSettingsPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GrdSettings, grd_settings, G_TYPE_OBJECT)
@@ -124,6 +133,159 @@ grd_settings_get_max_parallel_connections (GrdSettings *settings)
   return priv->max_parallel_connections;
 }
 
+void
+grd_settings_override_max_connections_per_peer (GrdSettings *settings,
+                                                int          max_connections_per_peer)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->max_connections_per_peer = max_connections_per_peer;
+}
+
+int
+grd_settings_get_max_connections_per_peer (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->max_connections_per_peer;
+}
+
+void
+grd_settings_override_max_pending_connections_per_peer (GrdSettings *settings,
+                                                        int          max_pending_connections)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->max_pending_connections_per_peer = max_pending_connections;
+}
+
+int
+grd_settings_get_max_pending_connections_per_peer (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->max_pending_connections_per_peer;
+}
+
+void
+grd_settings_override_max_connection_attempts_per_second (GrdSettings *settings,
+                                                          int          max_attempts_per_second)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->max_connection_attempts_per_second = max_attempts_per_second;
+}
+
+int
+grd_settings_get_max_connection_attempts_per_second (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->max_connection_attempts_per_second;
+}
+
+void
+grd_settings_override_max_global_pending_connections (GrdSettings *settings,
+                                                      int          max_pending_connections)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->max_global_pending_connections = max_pending_connections;
+}
+
+int
+grd_settings_get_max_global_pending_connections (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->max_global_pending_connections;
+}
+
+void
+grd_settings_override_max_global_connection_attempts_per_second (GrdSettings *settings,
+                                                                 int          max_attempts_per_second)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->max_global_connection_attempts_per_second = max_attempts_per_second;
+}
+
+int
+grd_settings_get_max_global_connection_attempts_per_second (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->max_global_connection_attempts_per_second;
+}
+
+void
+grd_settings_override_warm_display_pool_size (GrdSettings *settings,
+                                              int          warm_display_pool_size)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->warm_display_pool_size = warm_display_pool_size;
+}
+
+int
+grd_settings_get_warm_display_pool_size (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->warm_display_pool_size;
+}
+
+void
+grd_settings_override_rdp_listen_backlog (GrdSettings *settings,
+                                          int          backlog)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->rdp_listen_backlog = backlog;
+}
+
+int
+grd_settings_get_rdp_listen_backlog (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->rdp_listen_backlog;
+}
+
+void
+grd_settings_override_rdp_session_memory_budget (GrdSettings *settings,
+                                                 int          budget_mib)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->rdp_session_memory_budget_mib = budget_mib;
+}
+
+int
+grd_settings_get_rdp_session_memory_budget (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->rdp_session_memory_budget_mib;
+}
+
+void
+grd_settings_override_rdp_reconnect_grace_period (GrdSettings *settings,
+                                                  int          grace_period)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  priv->rdp_reconnect_grace_period = grace_period;
+}
+
+int
+grd_settings_get_rdp_reconnect_grace_period (GrdSettings *settings)
+{
+  GrdSettingsPrivate *priv = grd_settings_get_instance_private (settings);
+
+  return priv->rdp_reconnect_grace_period;
+}
+
 void
 grd_settings_override_rdp_port (GrdSettings *settings,
                                 int          port)
@@ -42,6 +42,51 @@ void grd_settings_override_max_parallel_connections (GrdSettings *settings,
 
 int grd_settings_get_max_parallel_connections (GrdSettings *settings);
 
+void grd_settings_override_max_connections_per_peer (GrdSettings *settings,
+                                                     int          max_connections_per_peer);
+
+int grd_settings_get_max_connections_per_peer (GrdSettings *settings);
+
+void grd_settings_override_max_pending_connections_per_peer (GrdSettings *settings,
+                                                             int          max_pending_connections);
+
+int grd_settings_get_max_pending_connections_per_peer (GrdSettings *settings);
+
+void grd_settings_override_max_connection_attempts_per_second (GrdSettings *settings,
+                                                               int          max_attempts_per_second);
+
+int grd_settings_get_max_connection_attempts_per_second (GrdSettings *settings);
+
+void grd_settings_override_max_global_pending_connections (GrdSettings *settings,
+                                                           int          max_pending_connections);
+
+int grd_settings_get_max_global_pending_connections (GrdSettings *settings);
+
+void grd_settings_override_max_global_connection_attempts_per_second (GrdSettings *settings,
+                                                                      int          max_attempts_per_second);
+
+int grd_settings_get_max_global_connection_attempts_per_second (GrdSettings *settings);
+
+void grd_settings_override_warm_display_pool_size (GrdSettings *settings,
+                                                    int          warm_display_pool_size);
+
+int grd_settings_get_warm_display_pool_size (GrdSettings *settings);
+
+void grd_settings_override_rdp_listen_backlog (GrdSettings *settings,
+                                              int          backlog);
+
+int grd_settings_get_rdp_listen_backlog (GrdSettings *settings);
+
+void grd_settings_override_rdp_session_memory_budget (GrdSettings *settings,
+                                                      int          budget_mib);
+
+int grd_settings_get_rdp_session_memory_budget (GrdSettings *settings);
+
+void grd_settings_override_rdp_reconnect_grace_period (GrdSettings *settings,
+                                                       int          grace_period);
+
+int grd_settings_get_rdp_reconnect_grace_period (GrdSettings *settings);
+
 void grd_settings_override_rdp_port (GrdSettings *settings,
                                      int          port);
 
@@ -23,30 +23,52 @@
 
 #include "grd-context.h"
 #include "grd-settings.h"
-#include "grd-utils.h"
 
-#define DEFAULT_MAX_CONNECTIONS_PER_PEER 5
-#define DEFAULT_MAX_PENDING_CONNECTIONS 5
-#define DEFAULT_MAX_ATTEMPTS_PER_SECOND 10
+#define PEER_PRUNE_INTERVAL_S 10
+
+enum
+{
+  STATS_CHANGED,
+
+  N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
 
 struct _GrdThrottlerLimits
 {
   int max_global_connections;
   int max_connections_per_peer;
   int max_pending_connections;
+  int max_global_pending_connections;
   int max_attempts_per_second;
+  int max_global_attempts_per_second;
 };
 
-#define PRUNE_TIME_CUTOFF_US (s2us (1))
+/*
+ * A bucket holds up to one second worth of tokens, i.e. as many tokens as
+ * attempts are allowed per second, and is refilled continuously
+ */
+typedef struct _GrdTokenBucket
+{
+  double tokens;
+  int64_t last_refill_us;
+} GrdTokenBucket;
+
+typedef struct _GrdDelayedConnection
+{
+  GSocketConnection *connection;
+  int64_t enqueue_time_us;
+} GrdDelayedConnection;
 
 typedef struct _GrdPeer
 {
   GrdThrottler *throttler;
   char *name;
   int active_connections;
-  GArray *connect_timestamps;
+  GrdTokenBucket attempts;
   GQueue *delayed_connections;
-  int64_t last_accept_us;
+  gboolean is_waiting;
 } GrdPeer;
 
 struct _GrdThrottler
@@ -56,13 +78,21 @@ struct _GrdThrottler
   GrdThrottlerLimits *limits;
 
   int active_connections;
+  GrdTokenBucket attempts;
 
   GrdThrottlerAllowCallback allow_callback;
   gpointer user_data;
 
   GHashTable *peers;
 
+  /* Peers with delayed connections, served in a round robin fashion */
+  GQueue *waiting_peers;
+  unsigned int n_delayed_connections;
+
+  GrdThrottlerStats stats;
+
   GSource *delayed_connections_source;
+  unsigned int prune_peers_source_id;
 };
 
 G_DEFINE_TYPE (GrdThrottler, grd_throttler, G_TYPE_OBJECT)
@@ -73,26 +103,66 @@ static void
 maybe_queue_timeout (GrdThrottler *throttler);
 
 static void
-prune_old_timestamps (GArray  *timestamps,
-                      int64_t  now_us)
+notify_stats_changed (GrdThrottler *throttler)
+{
+  g_signal_emit (throttler, signals[STATS_CHANGED], 0);
+}
+
+static void
+token_bucket_init (GrdTokenBucket *bucket,
+                   int             rate,
+                   int64_t         now_us)
 {
-  size_t i;
+  bucket->tokens = rate;
+  bucket->last_refill_us = now_us;
+}
 
-  if (!timestamps)
+static void
+token_bucket_refill (GrdTokenBucket *bucket,
+                     int             rate,
+                     int64_t         now_us)
+{
+  double new_tokens;
+
+  if (now_us <= bucket->last_refill_us)
     return;
 
-  /* Prune all timestamps older than 1 second, so we can determine how many
-   * connections that happened the last second by looking at how many timestamps
-   * we have.
-   */
-  for (i = 0; i < timestamps->len; i++)
-    {
-      int64_t ts_us = g_array_index (timestamps, int64_t, i);
+  new_tokens = (double) (now_us - bucket->last_refill_us) * rate /
+               G_USEC_PER_SEC;
+  bucket->tokens = MIN (bucket->tokens + new_tokens, rate);
+  bucket->last_refill_us = now_us;
+}
 
-      if (now_us - ts_us < PRUNE_TIME_CUTOFF_US)
-        break;
-    }
-  g_array_remove_range (timestamps, 0, i);
+static gboolean
+token_bucket_has_token (GrdTokenBucket *bucket)
+{
+  return bucket->tokens >= 1.0;
+}
+
+static gboolean
+token_bucket_is_full (GrdTokenBucket *bucket,
+                      int             rate)
+{
+  return bucket->tokens >= rate;
+}
+
+static void
+token_bucket_take_token (GrdTokenBucket *bucket)
+{
+  g_assert (token_bucket_has_token (bucket));
+
+  bucket->tokens -= 1.0;
+}
+
+static int64_t
+token_bucket_get_next_token_time_us (GrdTokenBucket *bucket,
+                                     int             rate)
+{
+  if (token_bucket_has_token (bucket))
+    return bucket->last_refill_us;
+
+  return bucket->last_refill_us +
+         (int64_t) ((1.0 - bucket->tokens) * G_USEC_PER_SEC / rate) + 1;
 }
 
 static void
@@ -100,13 +170,18 @@ maybe_dispose_peer (GrdThrottler   *throttler,
                     GrdPeer        *peer,
                     GHashTableIter *iter)
 {
+  GrdThrottlerLimits *limits = throttler->limits;
+
   if (peer->active_connections > 0)
     return;
 
-  if (peer->connect_timestamps && peer->connect_timestamps->len > 0)
+  if (peer->is_waiting || !g_queue_is_empty (peer->delayed_connections))
     return;
 
-  if (!g_queue_is_empty (peer->delayed_connections))
+  /* Keep the peer until it would start over with a full bucket anyway */
+  token_bucket_refill (&peer->attempts, limits->max_attempts_per_second,
+                       g_get_monotonic_time ());
+  if (!token_bucket_is_full (&peer->attempts, limits->max_attempts_per_second))
     return;
 
   if (iter)
@@ -115,22 +190,31 @@ maybe_dispose_peer (GrdThrottler   *throttler,
     g_hash_table_remove (throttler->peers, peer->name);
 }
 
+static gboolean
+prune_peers (gpointer user_data)
+{
+  GrdThrottler *throttler = GRD_THROTTLER (user_data);
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, throttler->peers);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    maybe_dispose_peer (throttler, value, &iter);
+
+  if (g_hash_table_size (throttler->peers) > 0)
+    return G_SOURCE_CONTINUE;
+
+  throttler->prune_peers_source_id = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 grd_throttler_register_connection (GrdThrottler *throttler,
                                    GrdPeer      *peer)
 {
-  int64_t now_us;
-
   peer->active_connections++;
   throttler->active_connections++;
-
-  if (!peer->connect_timestamps)
-    peer->connect_timestamps = g_array_new (FALSE, FALSE, sizeof (int64_t));
-
-  now_us = g_get_monotonic_time ();
-
-  prune_old_timestamps (peer->connect_timestamps, now_us);
-  g_array_append_val (peer->connect_timestamps, now_us);
 }
 
 static void
@@ -154,7 +238,12 @@ grd_throttler_deny_connection (GrdThrottler      *throttler,
                                GSocketConnection *connection)
 {
   g_debug ("[Throttler] Denying connection from %s", peer_name);
+
+  throttler->stats.n_denied_connections++;
+
   g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+
+  notify_stats_changed (throttler);
 }
 
 typedef struct _ConnectionData
@@ -194,6 +283,9 @@ grd_throttler_allow_connection (GrdThrottler      *throttler,
 
   g_debug ("[Throttler] Accepting connection from %s", peer->name);
 
+  token_bucket_take_token (&peer->attempts);
+  token_bucket_take_token (&throttler->attempts);
+
   connection_data = g_new0 (ConnectionData, 1);
   g_set_weak_pointer (&connection_data->throttler, throttler);
   connection_data->connection = connection;
@@ -201,8 +293,6 @@ grd_throttler_allow_connection (GrdThrottler      *throttler,
 
   throttler->allow_callback (throttler, connection, throttler->user_data);
 
-  peer->last_accept_us = g_get_monotonic_time ();
-
   g_object_set_qdata_full (G_OBJECT (connection), quark_remote_address,
                            connection_data,
                            (GDestroyNotify) connection_data_free);
@@ -225,24 +315,41 @@ static GSourceFuncs source_funcs =
 };
 
 static void
-prune_closed_connections (GQueue *queue)
+delayed_connection_free (GrdDelayedConnection *delayed_connection)
+{
+  g_object_unref (delayed_connection->connection);
+  g_free (delayed_connection);
+}
+
+static void
+prune_closed_connections (GrdThrottler *throttler,
+                          GrdPeer      *peer)
 {
+  GQueue *queue = peer->delayed_connections;
+  gboolean pruned_connections = FALSE;
   GList *l;
 
   l = queue->head;
   while (l)
     {
-      GSocketConnection *connection = G_SOCKET_CONNECTION (l->data);
+      GrdDelayedConnection *delayed_connection = l->data;
       GList *l_next = l->next;
 
-      if (g_io_stream_is_closed (G_IO_STREAM (connection)))
+      if (g_io_stream_is_closed (G_IO_STREAM (delayed_connection->connection)))
         {
           g_queue_delete_link (queue, l);
-          g_object_unref (connection);
+          delayed_connection_free (delayed_connection);
+
+          g_assert (throttler->n_delayed_connections > 0);
+          throttler->n_delayed_connections--;
+          pruned_connections = TRUE;
         }
 
       l = l_next;
     }
+
+  if (pruned_connections)
+    notify_stats_changed (throttler);
 }
 
 static gboolean
@@ -262,49 +369,88 @@ is_connection_limit_reached (GrdThrottler *throttler,
 
 static gboolean
 is_new_connection_allowed (GrdThrottler *throttler,
-                           GrdPeer      *peer)
+                           GrdPeer      *peer,
+                           int64_t       now_us)
 {
   GrdThrottlerLimits *limits = throttler->limits;
 
   if (is_connection_limit_reached (throttler, peer))
     return FALSE;
 
-  if (peer->connect_timestamps &&
-      peer->connect_timestamps->len >= limits->max_attempts_per_second)
-    return FALSE;
+  token_bucket_refill (&peer->attempts, limits->max_attempts_per_second,
+                       now_us);
+  token_bucket_refill (&throttler->attempts,
+                       limits->max_global_attempts_per_second, now_us);
+
+  return token_bucket_has_token (&peer->attempts) &&
+         token_bucket_has_token (&throttler->attempts);
+}
+
+static void
+allow_delayed_connection (GrdThrottler *throttler,
+                          GrdPeer      *peer,
+                          int64_t       now_us)
+{
+  GrdDelayedConnection *delayed_connection;
+  GSocketConnection *connection;
+  int64_t wait_time_us;
+
+  delayed_connection = g_queue_pop_head (peer->delayed_connections);
+  connection = g_steal_pointer (&delayed_connection->connection);
+
+  g_assert (throttler->n_delayed_connections > 0);
+  throttler->n_delayed_connections--;
+
+  wait_time_us = now_us - delayed_connection->enqueue_time_us;
+  throttler->stats.total_wait_time_us += wait_time_us;
+  throttler->stats.max_wait_time_us = MAX (throttler->stats.max_wait_time_us,
+                                           wait_time_us);
+  g_free (delayed_connection);
+
+  g_debug ("[Throttler] Connection from %s waited %" G_GINT64_FORMAT " ms, "
+           "%u connections remain queued",
+           peer->name, wait_time_us / 1000, throttler->n_delayed_connections);
+
+  grd_throttler_allow_connection (throttler, connection, peer);
+  g_object_unref (connection);
 
-  return TRUE;
+  notify_stats_changed (throttler);
 }
 
 static gboolean
 dispatch_delayed_connections (gpointer user_data)
 {
   GrdThrottler *throttler = GRD_THROTTLER (user_data);
-  GHashTableIter iter;
-  gpointer key, value;
+  unsigned int n_waiting_peers;
+  int64_t now_us;
+  unsigned int i;
 
-  g_hash_table_iter_init (&iter, throttler->peers);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  now_us = g_get_monotonic_time ();
+
+  /*
+   * Every waiting peer gets the chance to dispatch at most one connection per
+   * round, so that a peer with many queued connections does not starve
+   * others, when the global limits are reached
+   */
+  n_waiting_peers = g_queue_get_length (throttler->waiting_peers);
+  for (i = 0; i < n_waiting_peers; ++i)
     {
-      GrdPeer *peer = value;
-      GQueue *queue = peer->delayed_connections;
-      GSocketConnection *connection;
+      GrdPeer *peer = g_queue_pop_head (throttler->waiting_peers);
+
+      prune_closed_connections (throttler, peer);
 
-      prune_closed_connections (queue);
-      connection = g_queue_peek_head (queue);
+      if (!g_queue_is_empty (peer->delayed_connections) &&
+          is_new_connection_allowed (throttler, peer, now_us))
+        allow_delayed_connection (throttler, peer, now_us);
 
-      if (!connection)
+      if (g_queue_is_empty (peer->delayed_connections))
         {
-          maybe_dispose_peer (throttler, peer, &iter);
+          peer->is_waiting = FALSE;
+          maybe_dispose_peer (throttler, peer, NULL);
           continue;
         }
 
-      if (is_new_connection_allowed (throttler, peer))
-        {
-          g_queue_pop_head (queue);
-          grd_throttler_allow_connection (throttler, connection, peer);
-          g_object_unref (connection);
-        }
+      g_queue_push_tail (throttler->waiting_peers, peer);
     }
 
   maybe_queue_timeout (throttler);
@@ -330,36 +476,34 @@ static void
 maybe_queue_timeout (GrdThrottler *throttler)
 {
   GrdThrottlerLimits *limits = throttler->limits;
-  GHashTableIter iter;
-  gpointer key, value;
   int64_t next_timeout_us = INT64_MAX;
+  GList *l;
 
-  g_hash_table_iter_init (&iter, throttler->peers);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for (l = throttler->waiting_peers->head; l; l = l->next)
     {
-      GrdPeer *peer = value;
+      GrdPeer *peer = l->data;
 
+      /* Unregistering a connection queues a new timeout */
       if (is_connection_limit_reached (throttler, peer))
         continue;
 
-      if (g_queue_is_empty (peer->delayed_connections))
-        continue;
-
-      next_timeout_us = MIN (next_timeout_us,
-                             peer->last_accept_us +
-                             G_USEC_PER_SEC / limits->max_attempts_per_second);
+      next_timeout_us =
+        MIN (next_timeout_us,
+             token_bucket_get_next_token_time_us (&peer->attempts,
+                                                  limits->max_attempts_per_second));
     }
 
-
   if (next_timeout_us == INT64_MAX)
-    next_timeout_us = -1;
+    return;
 
-  if (next_timeout_us >= 0)
-    {
-      ensure_delayed_connections_source (throttler);
-      g_source_set_ready_time (throttler->delayed_connections_source,
-                               next_timeout_us);
-    }
+  next_timeout_us =
+    MAX (next_timeout_us,
+         token_bucket_get_next_token_time_us (&throttler->attempts,
+                                              limits->max_global_attempts_per_second));
+
+  ensure_delayed_connections_source (throttler);
+  g_source_set_ready_time (throttler->delayed_connections_source,
+                           next_timeout_us);
 }
 
 static void
@@ -369,16 +513,12 @@ maybe_delay_connection (GrdThrottler      *throttler,
                         int64_t            now_us)
 {
   GrdThrottlerLimits *limits = throttler->limits;
-  GQueue *delayed_connections;
+  GrdDelayedConnection *delayed_connection;
 
-  delayed_connections = peer->delayed_connections;
-  if (!delayed_connections)
-    {
-      delayed_connections = g_queue_new ();
-      peer->delayed_connections = delayed_connections;
-    }
-
-  if (g_queue_get_length (delayed_connections) > limits->max_pending_connections)
+  if (g_queue_get_length (peer->delayed_connections) >=
+      (unsigned int) limits->max_pending_connections ||
+      throttler->n_delayed_connections >=
+      (unsigned int) limits->max_global_pending_connections)
     {
       grd_throttler_deny_connection (throttler, peer->name, connection);
       return;
@@ -386,14 +526,34 @@ maybe_delay_connection (GrdThrottler      *throttler,
 
   g_debug ("[Throttler] Delaying connection from %s", peer->name);
 
-  g_queue_push_tail (delayed_connections, g_object_ref (connection));
+  delayed_connection = g_new0 (GrdDelayedConnection, 1);
+  delayed_connection->connection = g_object_ref (connection);
+  delayed_connection->enqueue_time_us = now_us;
+  g_queue_push_tail (peer->delayed_connections, delayed_connection);
+
+  throttler->n_delayed_connections++;
+  throttler->stats.n_delayed_connections++;
+  throttler->stats.max_queued_connections =
+    MAX (throttler->stats.max_queued_connections,
+         throttler->n_delayed_connections);
+
+  if (!peer->is_waiting)
+    {
+      peer->is_waiting = TRUE;
+      g_queue_push_tail (throttler->waiting_peers, peer);
+    }
+
   maybe_queue_timeout (throttler);
+
+  notify_stats_changed (throttler);
 }
 
 static GrdPeer *
 ensure_peer (GrdThrottler *throttler,
-             const char   *peer_name)
+             const char   *peer_name,
+             int64_t       now_us)
 {
+  GrdThrottlerLimits *limits = throttler->limits;
   GrdPeer *peer;
 
   peer = g_hash_table_lookup (throttler->peers, peer_name);
@@ -404,10 +564,17 @@ ensure_peer (GrdThrottler *throttler,
   peer->throttler = throttler;
   peer->name = g_strdup (peer_name);
   peer->delayed_connections = g_queue_new ();
+  token_bucket_init (&peer->attempts, limits->max_attempts_per_second, now_us);
 
   g_hash_table_insert (throttler->peers,
                        g_strdup (peer_name), peer);
 
+  if (!throttler->prune_peers_source_id)
+    {
+      throttler->prune_peers_source_id =
+        g_timeout_add_seconds (PEER_PRUNE_INTERVAL_S, prune_peers, throttler);
+    }
+
   return peer;
 }
 
@@ -436,14 +603,18 @@ grd_throttler_handle_connection (GrdThrottler      *throttler,
 
   g_debug ("[Throttler] New incoming connection from %s", peer_name);
 
-  peer = ensure_peer (throttler, peer_name);
+  now_us = g_get_monotonic_time ();
+  peer = ensure_peer (throttler, peer_name, now_us);
 
-  prune_closed_connections (peer->delayed_connections);
+  prune_closed_connections (throttler, peer);
 
-  now_us = g_get_monotonic_time ();
-  prune_old_timestamps (peer->connect_timestamps, now_us);
-  if (is_new_connection_allowed (throttler, peer) &&
-      g_queue_get_length (peer->delayed_connections) == 0)
+  /*
+   * Queued connections of the same peer go first. Queued connections of other
+   * peers only go first, when the global limits are reached, in which case
+   * the new connection is not allowed either.
+   */
+  if (g_queue_is_empty (peer->delayed_connections) &&
+      is_new_connection_allowed (throttler, peer, now_us))
     {
       grd_throttler_allow_connection (throttler, connection, peer);
       return;
@@ -452,6 +623,14 @@ grd_throttler_handle_connection (GrdThrottler      *throttler,
   maybe_delay_connection (throttler, connection, peer, now_us);
 }
 
+void
+grd_throttler_get_stats (GrdThrottler      *throttler,
+                         GrdThrottlerStats *stats)
+{
+  *stats = throttler->stats;
+  stats->queued_connections = throttler->n_delayed_connections;
+}
+
 void
 grd_throttler_limits_set_max_global_connections (GrdThrottlerLimits *limits,
                                                  int                 limit)
@@ -468,9 +647,16 @@ grd_throttler_limits_new (GrdContext *context)
   limits = g_new0 (GrdThrottlerLimits, 1);
   limits->max_global_connections =
     grd_settings_get_max_parallel_connections (settings);
-  limits->max_connections_per_peer = DEFAULT_MAX_CONNECTIONS_PER_PEER;
-  limits->max_pending_connections = DEFAULT_MAX_PENDING_CONNECTIONS;
-  limits->max_attempts_per_second = DEFAULT_MAX_ATTEMPTS_PER_SECOND;
+  limits->max_connections_per_peer =
+    grd_settings_get_max_connections_per_peer (settings);
+  limits->max_pending_connections =
+    grd_settings_get_max_pending_connections_per_peer (settings);
+  limits->max_global_pending_connections =
+    grd_settings_get_max_global_pending_connections (settings);
+  limits->max_attempts_per_second =
+    grd_settings_get_max_connection_attempts_per_second (settings);
+  limits->max_global_attempts_per_second =
+    grd_settings_get_max_global_connection_attempts_per_second (settings);
 
   return limits;
 }
@@ -483,12 +669,18 @@ grd_throttler_new (GrdThrottlerLimits        *limits,
   GrdThrottler *throttler;
 
   g_assert (limits);
+  g_assert (limits->max_attempts_per_second > 0);
+  g_assert (limits->max_global_attempts_per_second > 0);
 
   throttler = g_object_new (GRD_TYPE_THROTTLER, NULL);
   throttler->allow_callback = allow_callback;
   throttler->user_data = user_data;
   throttler->limits = limits;
 
+  token_bucket_init (&throttler->attempts,
+                     limits->max_global_attempts_per_second,
+                     g_get_monotonic_time ());
+
   return throttler;
 }
 
@@ -496,8 +688,10 @@ static void
 grd_peer_free (GrdPeer *peer)
 {
   if (peer->delayed_connections)
-    g_queue_free_full (peer->delayed_connections, g_object_unref);
-  g_clear_pointer (&peer->connect_timestamps, g_array_unref);
+    {
+      g_queue_free_full (peer->delayed_connections,
+                         (GDestroyNotify) delayed_connection_free);
+    }
   g_clear_pointer (&peer->name, g_free);
   g_free (peer);
 }
@@ -508,6 +702,8 @@ grd_throttler_finalize (GObject *object)
   GrdThrottler *throttler = GRD_THROTTLER(object);
 
   g_clear_pointer (&throttler->delayed_connections_source, g_source_destroy);
+  g_clear_handle_id (&throttler->prune_peers_source_id, g_source_remove);
+  g_clear_pointer (&throttler->waiting_peers, g_queue_free);
   g_clear_pointer (&throttler->peers, g_hash_table_unref);
   g_clear_pointer (&throttler->limits, g_free);
 
@@ -520,6 +716,7 @@ grd_throttler_init (GrdThrottler *throttler)
   throttler->peers =
     g_hash_table_new_full (g_str_hash, g_str_equal,
                            g_free, (GDestroyNotify) grd_peer_free);
+  throttler->waiting_peers = g_queue_new ();
 }
 
 static void
@@ -531,4 +728,11 @@ grd_throttler_class_init (GrdThrottlerClass *klass)
 
   quark_remote_address =
     g_quark_from_static_string ("grd-remote-address-string");
+
+  signals[STATS_CHANGED] = g_signal_new ("stats-changed",
+                                         G_TYPE_FROM_CLASS (klass),
+                                         G_SIGNAL_RUN_LAST,
+                                         0,
+                                         NULL, NULL, NULL,
+                                         G_TYPE_NONE, 0);
 }
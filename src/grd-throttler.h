@@ -22,11 +22,26 @@
 
 #include <gio/gio.h>
 #include <glib-object.h>
+#include <stdint.h>
 
 #include "grd-types.h"
 
 typedef struct _GrdThrottlerLimits GrdThrottlerLimits;
 
+typedef struct _GrdThrottlerStats
+{
+  /* Currently queued connections */
+  unsigned int queued_connections;
+  unsigned int max_queued_connections;
+
+  uint64_t n_delayed_connections;
+  uint64_t n_denied_connections;
+
+  /* Time delayed connections spent in the queue */
+  int64_t total_wait_time_us;
+  int64_t max_wait_time_us;
+} GrdThrottlerStats;
+
 #define GRD_TYPE_THROTTLER (grd_throttler_get_type())
 G_DECLARE_FINAL_TYPE (GrdThrottler, grd_throttler, GRD, THROTTLER, GObject)
 
@@ -38,6 +53,10 @@ void
 grd_throttler_handle_connection (GrdThrottler      *throttler,
                                  GSocketConnection *connection);
 
+void
+grd_throttler_get_stats (GrdThrottler      *throttler,
+                         GrdThrottlerStats *stats);
+
 void
 grd_throttler_limits_set_max_global_connections (GrdThrottlerLimits *limits,
                                                  int                 limit);
@@ -24,6 +24,7 @@
 
 #include <gio/gio.h>
 #include <stdio.h>
+#include <string.h>
 
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
 #include <tss2_esys.h>
@@ -508,12 +509,30 @@ grd_tpm_restore_secret (GrdTpm              *tpm,
   TPMS_CONTEXT secret_tpms_context;
   ESYS_TR loaded_secret_handle;
   TPM2B_SENSITIVE_DATA *unsealed_data;
+  char *secret;
 
   g_assert (tpm->policy_session);
 
   if (!decode_variant (variant, &secret_tpms_context, error))
     return NULL;
 
+  /*
+   * The policy session may have been used by a previous unseal operation,
+   * when the same TPM instance is used for multiple lookups
+   */
+  rc = Esys_PolicyRestart (tpm->esys_context,
+                           tpm->policy_session,
+                           ESYS_TR_NONE,
+                           ESYS_TR_NONE,
+                           ESYS_TR_NONE);
+  if (rc != TSS2_RC_SUCCESS)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Esys_PolicyRestart failed: %s",
+                   Tss2_RC_Decode (rc));
+      return NULL;
+    }
+
   rc = Esys_ContextLoad (tpm->esys_context, &secret_tpms_context,
                          &loaded_secret_handle);
   if (rc != TSS2_RC_SUCCESS)
@@ -529,7 +548,10 @@ grd_tpm_restore_secret (GrdTpm              *tpm,
                          pcr_digest,
                          NULL,
                          error))
-    return NULL;
+    {
+      Esys_FlushContext (tpm->esys_context, loaded_secret_handle);
+      return NULL;
+    }
 
   rc = Esys_Unseal (tpm->esys_context,
                     loaded_secret_handle,
@@ -537,6 +559,7 @@ grd_tpm_restore_secret (GrdTpm              *tpm,
                     ESYS_TR_NONE,
                     ESYS_TR_NONE,
                     &unsealed_data);
+  Esys_FlushContext (tpm->esys_context, loaded_secret_handle);
   if (rc != TSS2_RC_SUCCESS)
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -550,10 +573,16 @@ grd_tpm_restore_secret (GrdTpm              *tpm,
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                    "Secret not a zero terminated string");
+      explicit_bzero (unsealed_data->buffer, unsealed_data->size);
+      Esys_Free (unsealed_data);
       return NULL;
     }
 
-  return g_strdup ((char *) unsealed_data->buffer);
+  secret = g_strdup ((char *) unsealed_data->buffer);
+  explicit_bzero (unsealed_data->buffer, unsealed_data->size);
+  Esys_Free (unsealed_data);
+
+  return secret;
 }
 
 static const char *
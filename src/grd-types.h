@@ -59,6 +59,7 @@ typedef struct _GrdRdpDvcInput GrdRdpDvcInput;
 typedef struct _GrdRdpDvcTelemetry GrdRdpDvcTelemetry;
 typedef struct _GrdRdpEventQueue GrdRdpEventQueue;
 typedef struct _GrdRdpFrame GrdRdpFrame;
+typedef struct _GrdRdpFramePool GrdRdpFramePool;
 typedef struct _GrdRdpFrameStats GrdRdpFrameStats;
 typedef struct _GrdRdpGfxFrameController GrdRdpGfxFrameController;
 typedef struct _GrdRdpGfxFrameLog GrdRdpGfxFrameLog;
@@ -66,6 +67,7 @@ typedef struct _GrdRdpGfxFramerateLog GrdRdpGfxFramerateLog;
 typedef struct _GrdRdpGfxSurface GrdRdpGfxSurface;
 typedef struct _GrdRdpLayoutManager GrdRdpLayoutManager;
 typedef struct _GrdRdpLegacyBuffer GrdRdpLegacyBuffer;
+typedef struct _GrdRdpMemoryBudget GrdRdpMemoryBudget;
 typedef struct _GrdRdpNetworkAutodetection GrdRdpNetworkAutodetection;
 typedef struct _GrdRdpPwBuffer GrdRdpPwBuffer;
 typedef struct _GrdRdpRenderContext GrdRdpRenderContext;
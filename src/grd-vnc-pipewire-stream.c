@@ -31,6 +31,7 @@
 #include <sys/mman.h>
 
 #include "grd-context.h"
+#include "grd-damage-utils.h"
 #include "grd-drm-utils.h"
 #include "grd-egl-thread.h"
 #include "grd-pipewire-utils.h"
@@ -92,6 +93,17 @@ typedef struct
   int cursor_y;
 } VncPointer;
 
+typedef struct
+{
+  uint32_t hash;
+
+  int hotspot_x;
+  int hotspot_y;
+  int width;
+  int height;
+  uint8_t *bitmap;
+} VncCursorShape;
+
 struct _GrdVncPipeWireStream
 {
   GObject parent;
@@ -116,6 +128,9 @@ struct _GrdVncPipeWireStream
   VncPointer *pending_pointer;
   GSource *pending_pointer_source;
 
+  /* Shape of the last created cursor, only accessed in the process callback */
+  VncCursorShape cursor_shape;
+
   struct pw_stream *pipewire_stream;
   struct spa_hook pipewire_stream_listener;
 
@@ -685,6 +700,70 @@ render_mouse_pointer (gpointer user_data)
   return G_SOURCE_CONTINUE;
 }
 
+static void
+clear_cursor_shape (VncCursorShape *cursor_shape)
+{
+  g_clear_pointer (&cursor_shape->bitmap, g_free);
+}
+
+static gboolean
+is_current_cursor_shape (GrdVncPipeWireStream   *stream,
+                         struct spa_meta_cursor *spa_meta_cursor,
+                         struct spa_meta_bitmap *spa_meta_bitmap,
+                         uint8_t                *buf,
+                         uint32_t                hash)
+{
+  VncCursorShape *cursor_shape = &stream->cursor_shape;
+  int width = spa_meta_bitmap->size.width;
+  int height = spa_meta_bitmap->size.height;
+  int y;
+
+  if (!cursor_shape->bitmap ||
+      cursor_shape->hash != hash ||
+      cursor_shape->hotspot_x != spa_meta_cursor->hotspot.x ||
+      cursor_shape->hotspot_y != spa_meta_cursor->hotspot.y ||
+      cursor_shape->width != width ||
+      cursor_shape->height != height)
+    return FALSE;
+
+  for (y = 0; y < height; ++y)
+    {
+      if (memcmp (&cursor_shape->bitmap[y * width * 4],
+                  &buf[y * spa_meta_bitmap->stride], width * 4))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+update_cursor_shape (GrdVncPipeWireStream   *stream,
+                     struct spa_meta_cursor *spa_meta_cursor,
+                     struct spa_meta_bitmap *spa_meta_bitmap,
+                     uint8_t                *buf,
+                     uint32_t                hash)
+{
+  VncCursorShape *cursor_shape = &stream->cursor_shape;
+  int width = spa_meta_bitmap->size.width;
+  int height = spa_meta_bitmap->size.height;
+  int y;
+
+  clear_cursor_shape (cursor_shape);
+
+  cursor_shape->hash = hash;
+  cursor_shape->hotspot_x = spa_meta_cursor->hotspot.x;
+  cursor_shape->hotspot_y = spa_meta_cursor->hotspot.y;
+  cursor_shape->width = width;
+  cursor_shape->height = height;
+  cursor_shape->bitmap = g_malloc (width * height * 4);
+
+  for (y = 0; y < height; ++y)
+    {
+      memcpy (&cursor_shape->bitmap[y * width * 4],
+              &buf[y * spa_meta_bitmap->stride], width * 4);
+    }
+}
+
 static void
 process_mouse_pointer_bitmap (GrdVncPipeWireStream  *stream,
                               struct spa_buffer     *buffer,
@@ -713,8 +792,25 @@ process_mouse_pointer_bitmap (GrdVncPipeWireStream  *stream,
     {
       uint8_t *buf;
       rfbCursorPtr rfb_cursor;
+      uint32_t hash;
 
       buf = SPA_MEMBER (spa_meta_bitmap, spa_meta_bitmap->offset, uint8_t);
+      hash = grd_get_bitmap_hash (buf,
+                                  spa_meta_bitmap->size.width,
+                                  spa_meta_bitmap->size.height,
+                                  spa_meta_bitmap->stride, 4);
+
+      /*
+       * The last created cursor is either still pending or already set, so
+       * there is no need to convert and send the same shape again
+       */
+      if (is_current_cursor_shape (stream, spa_meta_cursor, spa_meta_bitmap,
+                                   buf, hash))
+        return;
+
+      update_cursor_shape (stream, spa_meta_cursor, spa_meta_bitmap,
+                           buf, hash);
+
       rfb_cursor = grd_vnc_create_cursor (spa_meta_bitmap->size.width,
                                           spa_meta_bitmap->size.height,
                                           spa_meta_bitmap->stride,
@@ -729,6 +825,8 @@ process_mouse_pointer_bitmap (GrdVncPipeWireStream  *stream,
     }
   else if (spa_meta_bitmap)
     {
+      clear_cursor_shape (&stream->cursor_shape);
+
       if (!(*vnc_pointer))
         *vnc_pointer = g_new0 (VncPointer, 1);
       (*vnc_pointer)->rfb_cursor = grd_vnc_create_empty_cursor (1, 1);
@@ -1062,6 +1160,11 @@ on_stream_process (void *user_data)
   if (vnc_pointer)
     {
       g_mutex_lock (&stream->pointer_mutex);
+      if (stream->pending_pointer && !vnc_pointer->rfb_cursor)
+        {
+          vnc_pointer->rfb_cursor =
+            g_steal_pointer (&stream->pending_pointer->rfb_cursor);
+        }
       g_clear_pointer (&stream->pending_pointer, vnc_pointer_free);
 
       stream->pending_pointer = vnc_pointer;
@@ -1268,6 +1371,7 @@ grd_vnc_pipewire_stream_finalize (GObject *object)
 
   g_clear_pointer (&stream->pending_pointer, vnc_pointer_free);
   g_clear_pointer (&stream->pending_frame, grd_vnc_frame_unref);
+  clear_cursor_shape (&stream->cursor_shape);
 
   g_mutex_clear (&stream->pointer_mutex);
   g_mutex_clear (&stream->frame_mutex);
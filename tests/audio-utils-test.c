@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "grd-audio-utils.h"
+
+#define N_CHANNELS 2
+#define N_FRAMES 1024
+
+#define N_BENCHMARK_FRAMES (48000 * 10)
+
+static void
+fill_samples (int16_t  *data,
+              uint32_t  n_samples)
+{
+  uint32_t i;
+
+  for (i = 0; i < n_samples; ++i)
+    data[i] = g_test_rand_int_range (INT16_MIN, INT16_MAX + 1);
+}
+
+static int16_t
+reference_alaw_to_s16 (uint8_t alaw_value)
+{
+  int16_t segment;
+  int16_t temp;
+
+  alaw_value ^= 0x55;
+
+  temp = (alaw_value & 0xF) << 4;
+  temp += 8;
+
+  segment = (alaw_value & 0x70) >> 4;
+
+  if (segment > 0)
+    temp += 0x100;
+  if (segment > 1)
+    temp <<= segment - 1;
+
+  return alaw_value > 127 ? temp : -temp;
+}
+
+static void
+test_apply_volume (void)
+{
+  int16_t data[N_FRAMES * N_CHANNELS];
+  int16_t original[N_FRAMES * N_CHANNELS];
+  float volumes[N_CHANNELS];
+  uint32_t i;
+
+  fill_samples (original, G_N_ELEMENTS (original));
+
+  volumes[0] = 1.0f;
+  volumes[1] = 1.0f;
+  memcpy (data, original, sizeof (data));
+  grd_audio_apply_volume_s16 (data, N_FRAMES, N_CHANNELS, volumes);
+  g_assert_cmpmem (data, sizeof (data), original, sizeof (original));
+
+  volumes[0] = 0.0f;
+  volumes[1] = 0.5f;
+  memcpy (data, original, sizeof (data));
+  grd_audio_apply_volume_s16 (data, N_FRAMES, N_CHANNELS, volumes);
+  for (i = 0; i < N_FRAMES; ++i)
+    {
+      g_assert_cmpint (data[2 * i], ==, 0);
+      g_assert_cmpint (ABS (data[2 * i + 1] - original[2 * i + 1] / 2), <=, 1);
+    }
+
+  volumes[0] = GRD_AUDIO_MAX_VOLUME;
+  volumes[1] = 100.0f;
+  memcpy (data, original, sizeof (data));
+  grd_audio_apply_volume_s16 (data, N_FRAMES, N_CHANNELS, volumes);
+  for (i = 0; i < N_FRAMES * N_CHANNELS; ++i)
+    {
+      int32_t expected;
+
+      expected = CLAMP (original[i] * 4, INT16_MIN, INT16_MAX);
+      g_assert_cmpint (data[i], ==, expected);
+    }
+}
+
+static void
+test_silence_detection (void)
+{
+  int16_t data[N_FRAMES * N_CHANNELS] = {};
+
+  g_assert_true (grd_audio_is_silent_s16 (data, G_N_ELEMENTS (data)));
+
+  data[G_N_ELEMENTS (data) - 1] = -1;
+  g_assert_false (grd_audio_is_silent_s16 (data, G_N_ELEMENTS (data)));
+  g_assert_true (grd_audio_is_silent_s16 (data, G_N_ELEMENTS (data) - 1));
+
+  data[0] = INT16_MIN;
+  g_assert_false (grd_audio_is_silent_s16 (data, 1));
+}
+
+static void
+test_alaw_decode (void)
+{
+  uint8_t src[256];
+  int16_t dst[256];
+  uint32_t i;
+
+  for (i = 0; i < G_N_ELEMENTS (src); ++i)
+    src[i] = i;
+
+  grd_audio_alaw_to_s16 (src, dst, G_N_ELEMENTS (src));
+
+  for (i = 0; i < G_N_ELEMENTS (src); ++i)
+    g_assert_cmpint (dst[i], ==, reference_alaw_to_s16 (src[i]));
+}
+
+static void
+test_benchmark (void)
+{
+  g_autofree int16_t *data = NULL;
+  g_autofree uint8_t *alaw_data = NULL;
+  g_autofree int16_t *decoded_data = NULL;
+  uint32_t n_samples = N_BENCHMARK_FRAMES * N_CHANNELS;
+  float volumes[N_CHANNELS] = {0.7f, 0.3f};
+  uint32_t i;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run in perf mode");
+      return;
+    }
+
+  data = g_new (int16_t, n_samples);
+  alaw_data = g_new (uint8_t, n_samples);
+  decoded_data = g_new (int16_t, n_samples);
+
+  fill_samples (data, n_samples);
+  for (i = 0; i < n_samples; ++i)
+    alaw_data[i] = g_test_rand_int_range (0, 256);
+
+  g_test_timer_start ();
+  grd_audio_apply_volume_s16 (data, N_BENCHMARK_FRAMES, N_CHANNELS, volumes);
+  g_test_minimized_result (g_test_timer_elapsed (),
+                           "Applied volume to %u frames in %f s",
+                           N_BENCHMARK_FRAMES, g_test_timer_last ());
+
+  memset (data, 0, n_samples * sizeof (int16_t));
+  g_test_timer_start ();
+  g_assert_true (grd_audio_is_silent_s16 (data, n_samples));
+  g_test_minimized_result (g_test_timer_elapsed (),
+                           "Checked %u samples for silence in %f s",
+                           n_samples, g_test_timer_last ());
+
+  g_test_timer_start ();
+  grd_audio_alaw_to_s16 (alaw_data, decoded_data, n_samples);
+  g_test_minimized_result (g_test_timer_elapsed (),
+                           "Decoded %u A-law samples in %f s",
+                           n_samples, g_test_timer_last ());
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/audio-utils/apply-volume",
+                   test_apply_volume);
+  g_test_add_func ("/audio-utils/silence-detection",
+                   test_silence_detection);
+  g_test_add_func ("/audio-utils/alaw-decode",
+                   test_alaw_decode);
+  g_test_add_func ("/audio-utils/benchmark",
+                   test_benchmark);
+
+  return g_test_run ();
+}
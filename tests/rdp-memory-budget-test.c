@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "grd-rdp-memory-budget.h"
+
+static void
+on_trim (GrdRdpMemoryBudget *memory_budget,
+         uint32_t           *n_trims)
+{
+  ++(*n_trims);
+}
+
+static void
+dispatch_pending_sources (void)
+{
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+}
+
+static void
+test_accounting (void)
+{
+  g_autoptr (GrdRdpMemoryBudget) memory_budget = NULL;
+
+  memory_budget = grd_rdp_memory_budget_new (0);
+
+  grd_rdp_memory_budget_account (memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_ENCODE_STREAMS,
+                                 4096);
+  grd_rdp_memory_budget_account (memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_AUDIO,
+                                 1024);
+  g_assert_cmpuint (grd_rdp_memory_budget_get_usage (memory_budget,
+                                                     GRD_RDP_MEMORY_CATEGORY_ENCODE_STREAMS),
+                    ==, 4096);
+  g_assert_cmpuint (grd_rdp_memory_budget_get_usage (memory_budget,
+                                                     GRD_RDP_MEMORY_CATEGORY_AUDIO),
+                    ==, 1024);
+  g_assert_cmpuint (grd_rdp_memory_budget_get_total_usage (memory_budget),
+                    ==, 5120);
+
+  grd_rdp_memory_budget_account (memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_ENCODE_STREAMS,
+                                 -4096);
+  g_assert_cmpuint (grd_rdp_memory_budget_get_usage (memory_budget,
+                                                     GRD_RDP_MEMORY_CATEGORY_ENCODE_STREAMS),
+                    ==, 0);
+  g_assert_cmpuint (grd_rdp_memory_budget_get_total_usage (memory_budget),
+                    ==, 1024);
+  g_assert_cmpuint (grd_rdp_memory_budget_get_peak_total_usage (memory_budget),
+                    ==, 5120);
+
+  /* Without a budget, usage alone never causes memory pressure */
+  grd_rdp_memory_budget_account (memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_BUFFER_POOLS,
+                                 G_MAXINT32);
+  g_assert_cmpuint (grd_rdp_memory_budget_get_peak_total_usage (memory_budget),
+                    ==, (uint64_t) G_MAXINT32 + 1024);
+  g_assert_false (grd_rdp_memory_budget_is_under_pressure (memory_budget));
+}
+
+static void
+test_over_budget (void)
+{
+  g_autoptr (GrdRdpMemoryBudget) memory_budget = NULL;
+  uint32_t n_trims = 0;
+
+  memory_budget = grd_rdp_memory_budget_new (8192);
+  g_signal_connect (memory_budget, "trim", G_CALLBACK (on_trim), &n_trims);
+
+  grd_rdp_memory_budget_account (memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_LOCAL_BUFFERS,
+                                 8192);
+  dispatch_pending_sources ();
+  g_assert_false (grd_rdp_memory_budget_is_under_pressure (memory_budget));
+  g_assert_cmpuint (n_trims, ==, 0);
+
+  grd_rdp_memory_budget_account (memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_CLIPBOARD,
+                                 1);
+  g_assert_true (grd_rdp_memory_budget_is_under_pressure (memory_budget));
+  dispatch_pending_sources ();
+  g_assert_cmpuint (n_trims, ==, 1);
+
+  /* Only crossing the budget requests a trim */
+  grd_rdp_memory_budget_account (memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_CLIPBOARD,
+                                 1);
+  dispatch_pending_sources ();
+  g_assert_cmpuint (n_trims, ==, 1);
+
+  grd_rdp_memory_budget_account (memory_budget,
+                                 GRD_RDP_MEMORY_CATEGORY_CLIPBOARD,
+                                 -2);
+  g_assert_false (grd_rdp_memory_budget_is_under_pressure (memory_budget));
+}
+
+static void
+test_memory_pressure (void)
+{
+  g_autoptr (GrdRdpMemoryBudget) memory_budget = NULL;
+  uint32_t n_trims = 0;
+
+  memory_budget = grd_rdp_memory_budget_new (0);
+  g_signal_connect (memory_budget, "trim", G_CALLBACK (on_trim), &n_trims);
+
+  g_assert_false (grd_rdp_memory_budget_is_under_pressure (memory_budget));
+
+  grd_rdp_memory_budget_notify_memory_pressure (memory_budget);
+  g_assert_true (grd_rdp_memory_budget_is_under_pressure (memory_budget));
+  dispatch_pending_sources ();
+  g_assert_cmpuint (n_trims, ==, 1);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/rdp-memory-budget/accounting",
+                   test_accounting);
+  g_test_add_func ("/rdp-memory-budget/over-budget",
+                   test_over_budget);
+  g_test_add_func ("/rdp-memory-budget/memory-pressure",
+                   test_memory_pressure);
+
+  return g_test_run ();
+}
@@ -23,10 +23,13 @@
 #include <gio/gio.h>
 #include <stdio.h>
 
+#include "grd-credentials-tpm.h"
 #include "grd-tpm.h"
 
 #define SECRET "secret value"
 
+#define N_BENCHMARK_LOOKUPS 20
+
 static GVariant *secret_variant;
 
 static void
@@ -154,6 +157,101 @@ test_tpm_read (void)
   g_assert_cmpstr (secret, ==, SECRET);
 }
 
+static GVariant *
+lookup_credentials (GrdCredentials *credentials)
+{
+  g_autoptr (GError) error = NULL;
+  GVariant *variant;
+
+  variant = grd_credentials_lookup (credentials, GRD_CREDENTIALS_TYPE_RDP,
+                                    &error);
+  if (!variant)
+    g_error ("Failed to look up credentials: %s", error->message);
+
+  return variant;
+}
+
+static void
+test_credentials_benchmark (void)
+{
+  g_autoptr (GrdTpm) tpm = NULL;
+  g_autoptr (GrdCredentialsTpm) credentials_tpm = NULL;
+  g_autoptr (GError) error = NULL;
+  GVariantBuilder builder;
+  g_autoptr (GVariant) expected = NULL;
+  unsigned int i;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run in perf mode");
+      return;
+    }
+
+  tpm = grd_tpm_new (GRD_TPM_MODE_NONE, &error);
+  if (!tpm)
+    g_error ("Failed to create TPM credentials manager: %s", error->message);
+
+  if (!check_compatibility (tpm))
+    {
+      g_test_skip ("TPM module not compatible");
+      return;
+    }
+
+  credentials_tpm = grd_credentials_tpm_new (&error);
+  if (!credentials_tpm)
+    g_error ("Failed to create TPM credentials: %s", error->message);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&builder, "{sv}", "username",
+                         g_variant_new_string ("user"));
+  g_variant_builder_add (&builder, "{sv}", "password",
+                         g_variant_new_string (SECRET));
+  expected = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  if (!grd_credentials_store (GRD_CREDENTIALS (credentials_tpm),
+                              GRD_CREDENTIALS_TYPE_RDP,
+                              expected,
+                              &error))
+    g_error ("Failed to store credentials: %s", error->message);
+
+  /* A new credentials object unseals the secret with a new TPM context */
+  g_test_timer_start ();
+  for (i = 0; i < N_BENCHMARK_LOOKUPS; ++i)
+    {
+      g_autoptr (GrdCredentials) credentials = NULL;
+      g_autoptr (GVariant) variant = NULL;
+
+      credentials = g_object_new (GRD_TYPE_CREDENTIALS_TPM, NULL);
+      variant = lookup_credentials (credentials);
+      g_assert_true (g_variant_equal (variant, expected));
+    }
+  g_test_minimized_result (g_test_timer_elapsed (),
+                           "Unsealed credentials %u times in %f s",
+                           N_BENCHMARK_LOOKUPS, g_test_timer_last ());
+
+  g_test_timer_start ();
+  for (i = 0; i < N_BENCHMARK_LOOKUPS; ++i)
+    {
+      g_autoptr (GVariant) variant = NULL;
+
+      variant = lookup_credentials (GRD_CREDENTIALS (credentials_tpm));
+      g_assert_true (g_variant_equal (variant, expected));
+    }
+  g_test_minimized_result (g_test_timer_elapsed (),
+                           "Looked up cached credentials %u times in %f s",
+                           N_BENCHMARK_LOOKUPS, g_test_timer_last ());
+
+  if (!grd_credentials_clear (GRD_CREDENTIALS (credentials_tpm),
+                              GRD_CREDENTIALS_TYPE_RDP,
+                              &error))
+    g_error ("Failed to clear credentials: %s", error->message);
+
+  g_assert_null (grd_credentials_lookup (GRD_CREDENTIALS (credentials_tpm),
+                                         GRD_CREDENTIALS_TYPE_RDP,
+                                         &error));
+  g_assert_no_error (error);
+}
+
 int
 main (int    argc,
       char **argv)
@@ -161,7 +259,7 @@ main (int    argc,
   g_autoptr (GFile) tpm_dev = NULL;
   g_autoptr (GFile) tpmrm_dev = NULL;
 
-  g_test_init (&argc, &argv, NULL);
+  g_test_init (&argc, &argv, G_TEST_OPTION_ISOLATE_DIRS, NULL);
 
   tpm_dev = g_file_new_for_path ("/dev/tpm0");
   tpmrm_dev = g_file_new_for_path ("/dev/tpmrm0");
@@ -178,6 +276,8 @@ main (int    argc,
                    test_tpm_write);
   g_test_add_func ("/tpm/read",
                    test_tpm_read);
+  g_test_add_func ("/tpm/credentials-benchmark",
+                   test_credentials_benchmark);
 
   return g_test_run ();
 }